@@ -47,9 +47,12 @@
 #include "dyn_dict_msg_id.h"
 #include "dyn_dnode_peer.h"
 #include "dyn_server.h"
+#include "dyn_task.h"
 #include "dyn_util.h"
 
 static rstatus_t msg_quorum_rsp_handler(struct context *ctx, struct msg *req, struct msg *rsp);
+static rstatus_t msg_hedged_rsp_handler(struct context *ctx, struct msg *req,
+                                        struct msg *rsp);
 static rstatus_t msg_each_quorum_rsp_handler(struct context *ctx, struct msg *req,
     struct msg *rsp);
 static msg_response_handler_t msg_get_rsp_handler(struct context *ctx, struct msg *req);
@@ -206,6 +209,11 @@ static void client_close(struct context *ctx, struct conn *conn) {
                req->is_error ? "error" : "completed", print_obj(req),
                req->mlen);
       req_put(req);
+    } else if (req->rsp_handler == msg_hedged_rsp_handler) {
+      // Both replicas still answer through the handler, which counts them
+      // down; the last one puts the request.
+      log_info("%s close, awaiting %u rsps for hedged %s", print_obj(conn),
+               req->awaiting_rsps, print_obj(req));
     } else {
       req->swallow = 1;
 
@@ -268,6 +276,7 @@ static rstatus_t client_handle_response(struct context *ctx, struct conn *conn,
       }
     }
   } else if (status == DN_OK) {
+    trace_hop(req, TRACE_quorum);
     g_pre_coalesce(req->selected_rsp);
     if (req_done(conn, req)) {
       status = conn_event_add_out(conn);
@@ -337,6 +346,10 @@ struct msg *req_recv_next(struct context *ctx, struct conn *conn, bool alloc) {
   req = req_get(conn);
   if (req != NULL) {
     conn->rmsg = req;
+    if (conn->type == CONN_CLIENT) {
+      struct server_pool *pool = conn->owner;
+      trace_sample(req, pool->trace_sample_rate);
+    }
   }
 
   // Record timetamps if repairs are enabled.
@@ -527,6 +540,31 @@ static void req_forward_stats(struct context *ctx, struct msg *req) {
     stats_server_incr(ctx, write_requests);
     stats_server_incr_by(ctx, write_request_bytes, req->mlen);
   }
+  stats_top_keys_sample(ctx, req);
+}
+
+/*
+ * Answer a read of a hot key from the read cache. Returns true if it did,
+ * the request then needs nothing more from the datastore.
+ */
+static bool req_read_cache_hit(struct context *ctx, struct conn *c_conn,
+                               struct msg *req) {
+  struct server_pool *pool = c_conn->owner;
+  struct msg *rsp;
+
+  if (read_cache_get(pool->read_cache, req, dn_usec_now(), &rsp) != DN_OK) {
+    stats_pool_incr(ctx, read_cache_misses);
+    return false;
+  }
+  stats_pool_incr(ctx, read_cache_hits);
+  stats_top_keys_sample(ctx, req);
+  stats_top_keys_add_rsp(ctx, req, rsp);
+
+  log_debug(LOG_VERB, "%s read cache hit %s", print_obj(c_conn),
+            print_obj(req));
+  rstatus_t status = conn_handle_response(ctx, c_conn, req->id, rsp);
+  IGNORE_RET_VAL(status);
+  return true;
 }
 
 rstatus_t req_forward_local_datastore(struct context *ctx, struct conn *c_conn,
@@ -534,10 +572,18 @@ rstatus_t req_forward_local_datastore(struct context *ctx, struct conn *c_conn,
                             dyn_error_t *dyn_error_code) {
   rstatus_t status;
   struct conn *s_conn;
+  struct server_pool *pool = c_conn->owner;
+  bool cacheable = pool->read_cache != NULL && read_cache_cacheable(req);
 
   ASSERT((c_conn->type == CONN_CLIENT) ||
          (c_conn->type == CONN_DNODE_PEER_CLIENT));
 
+  if (cacheable && ctx->dyn_state == NORMAL && req->expect_datastore_reply &&
+      !req->swallow && req_read_cache_hit(ctx, c_conn, req)) {
+    *dyn_error_code = 0;
+    return DN_OK;
+  }
+
   s_conn = get_datastore_conn(ctx, c_conn->owner, c_conn->sd);
   log_debug(LOG_VERB, "c_conn %p got server conn %p", c_conn, s_conn);
   if (s_conn == NULL) {
@@ -552,7 +598,7 @@ rstatus_t req_forward_local_datastore(struct context *ctx, struct conn *c_conn,
   if (ctx->dyn_state == NORMAL) {
     /* enqueue the message (request) into server inq */
     if (TAILQ_EMPTY(&s_conn->imsg_q)) {
-      status = conn_event_add_out(s_conn);
+      status = server_send_queued(ctx, s_conn);
 
       if (status != DN_OK) {
         *dyn_error_code = DYNOMITE_UNKNOWN_ERROR;
@@ -589,6 +635,10 @@ rstatus_t req_forward_local_datastore(struct context *ctx, struct conn *c_conn,
 
   conn_enqueue_inq(ctx, s_conn, req);
   req_forward_stats(ctx, req);
+  if (pool->read_cache != NULL && !cacheable) {
+    stats_pool_incr_by(ctx, read_cache_invalidations,
+                       read_cache_invalidate(pool->read_cache, req));
+  }
   if (g_data_store == DATA_REDIS) {
     req_redis_stats(ctx, req);
   }
@@ -647,9 +697,11 @@ rstatus_t req_forward_to_peer(struct context *ctx, struct conn *c_conn,
   struct server_pool *pool = c_conn->owner;
   ASSERT(pool != NULL);
 
-  // Figure out if the peer is in the same DC or rack.
+  // Figure out if the peer is in the same DC or rack. A DC_ONE read diverted
+  // to a replica on another rack is answered by it as by one on ours.
   same_dc = peer->is_same_dc;
-  same_rack = !(string_compare(&peer->rack, &pool->rack)) && same_dc;
+  same_rack = (!(string_compare(&peer->rack, &pool->rack)) && same_dc) ||
+              req->diverted;
   if (force_copy || !same_rack) {
     // Make a copy of the message if forced or if the peer is not on the same rack or DC.
     rack_msg = msg_get(c_conn, req->is_request, __FUNCTION__);
@@ -660,6 +712,9 @@ rstatus_t req_forward_to_peer(struct context *ctx, struct conn *c_conn,
       goto error;
     }
     msg_clone(req, orig_mbuf, rack_msg);
+    trace_fork(req, rack_msg, TRACE_LEG);
+    // Only the local rack sends the value of a digest read.
+    rack_msg->digest = req->digest_read && !same_rack;
   } else {
     rack_msg = req;
   }
@@ -717,9 +772,22 @@ void req_forward_all_racks_for_dc(struct context *ctx, struct conn *c_conn,
                                  struct msg *req, struct mbuf *orig_mbuf,
                                  uint8_t *key, uint32_t keylen,
                                  struct datacenter *dc) {
+  struct server_pool *pool = c_conn->owner;
   uint8_t rack_cnt = (uint8_t)array_n(&dc->racks);
   uint8_t rack_index;
 
+  // A single key read under DC_QUORUM may take digests from the other racks.
+  if (pool->quorum_digest_reads && req->is_read &&
+      req->consistency == DC_QUORUM && g_data_store == DATA_REDIS &&
+      !is_read_repairs_enabled() && req->frag_id == 0 && req->keys != NULL &&
+      array_n(req->keys) == 1 && rack_cnt > 1) {
+    req->digest_read = 1;
+    // kept to read a digest's value in full, should the digests not settle it
+    req->copy_mbuf = orig_mbuf;
+    req->copy_pos = orig_mbuf->pos;
+    stats_pool_incr(ctx, quorum_digest_reads);
+  }
+
   if (req->rspmgrs_inited == false) {
     if (req->consistency == DC_EACH_SAFE_QUORUM) {
       init_response_mgr_all_dcs(ctx, req, c_conn, dc);
@@ -875,6 +943,114 @@ static void req_forward_remote_dc(struct context *ctx, struct conn *c_conn,
   stats_pool_incr(ctx, remote_peer_dropped_requests);
 }
 
+/* A hedge costs this much credit, in hundredths of a hedge */
+#define HEDGE_COST 100
+
+/* Credit a thread saves up at most, so that hedges never come in a burst */
+#define HEDGE_MAX_CREDIT (10 * HEDGE_COST)
+
+/*
+ * Credit of this thread for hedged reads. Each read that may be hedged adds
+ * hedge_read_budget to it and each hedge sent takes HEDGE_COST, which keeps
+ * hedges to that percent of the reads.
+ */
+static __thread uint32_t hedge_credit;
+
+/*
+ * Send the hedge of a read that has had no response for as long as its
+ * replica usually takes, unless the read has been answered or the budget is
+ * spent meanwhile. Only then is the read copied for the other replica. From
+ * now on the read awaits both responses.
+ */
+static void req_send_hedge(void *arg) {
+  struct msg *req = arg;
+  struct node *peer = req->hedge_peer;
+  struct conn *c_conn = req->owner;
+  struct server_pool *pool = c_conn->owner;
+  struct context *ctx = pool->ctx;
+  struct conn *p_conn;
+  struct msg *hedge;
+  dyn_error_t dyn_error_code = DYNOMITE_OK;
+
+  req->hedge_task = NULL;
+
+  if (req->done || req->selected_rsp != NULL || req->swallow ||
+      c_conn->waiting_to_unref || hedge_credit < HEDGE_COST ||
+      peer->state != NORMAL) {
+    return;
+  }
+
+  hedge = msg_get(c_conn, req->is_request, __FUNCTION__);
+  if (hedge == NULL) {
+    return;
+  }
+  if (msg_clone_sent(req, req->copy_mbuf, req->copy_pos, hedge) != DN_OK) {
+    msg_put(hedge);
+    return;
+  }
+  hedge->swallow = 1;
+  hedge->is_hedge = 1;
+  trace_fork(req, hedge, TRACE_LEG);
+
+  p_conn = dnode_peer_get_conn(ctx, peer, c_conn->sd);
+  if (p_conn == NULL ||
+      dnode_peer_req_forward(ctx, c_conn, p_conn, hedge, NULL, 0,
+                             &dyn_error_code) != DN_OK) {
+    msg_put(hedge);
+    return;
+  }
+
+  log_info("%s %s hedged to rack '%.*s' as %s", print_obj(c_conn),
+           print_obj(req), peer->rack.len, peer->rack.data, print_obj(hedge));
+  hedge_credit -= HEDGE_COST;
+  req->awaiting_rsps = 2;
+  req->rsp_handler = msg_hedged_rsp_handler;
+  stats_pool_incr(ctx, hedged_reads);
+}
+
+/*
+ * Get a DC_ONE read ready to be hedged: send a copy of it to the token owner
+ * on another local rack if 'peer' has not answered within the
+ * hedge_read_percentile of its recent response times. The copy is taken from
+ * where the read starts now, as sending it moves the pos of its mbufs.
+ */
+static void req_prepare_hedge(struct context *ctx, struct conn *c_conn,
+                              struct msg *req, struct mbuf *orig_mbuf,
+                              struct node *peer, uint8_t *key,
+                              uint32_t keylen, struct datacenter *dc) {
+  struct server_pool *pool = c_conn->owner;
+  struct node *other;
+  usec_t delay;
+
+  hedge_credit = MIN(hedge_credit + pool->hedge_read_budget, HEDGE_MAX_CREDIT);
+  if (hedge_credit < HEDGE_COST) {
+    return;
+  }
+
+  // a read to a secured peer is encrypted in place, nothing to copy is left
+  if (!peer->is_local && peer->is_secure) {
+    return;
+  }
+
+  delay = replica_load_percentile(replica_load_of(pool, peer),
+                                  pool->hedge_read_percentile);
+  if (delay == 0) {
+    return;
+  }
+
+  other = dnode_peer_pool_other_replica(ctx, pool, dc, &peer->rack, key,
+                                        keylen);
+  if (other == NULL || other == peer || other->is_local ||
+      other->state != NORMAL) {
+    return;
+  }
+
+  req->copy_mbuf = orig_mbuf;
+  req->copy_pos = orig_mbuf->pos;
+  req->hedge_peer = other;
+  req->hedge_task = schedule_task_1(req_send_hedge, req, (delay + 999) / 1000);
+}
+
 static void req_forward_local_dc(struct context *ctx, struct conn *c_conn,
                                  struct msg *req, struct mbuf *orig_mbuf,
                                  uint8_t *key, uint32_t keylen,
@@ -892,6 +1068,29 @@ static void req_forward_local_dc(struct context *ctx, struct conn *c_conn,
     struct node *peer = dnode_peer_pool_server(ctx, c_conn->owner, rack, key,
                                                keylen, req->msg_routing);
 
+    // Or the one on another rack, if ours is expected to be much slower.
+    if (pool->adaptive_replica_selection && req->is_read &&
+        req->consistency == DC_ONE && req->msg_routing == ROUTING_NORMAL) {
+      usec_t gain;
+      struct node *replica = dnode_peer_pool_replica(ctx, pool, dc, peer, key,
+                                                     keylen, &gain);
+      if (replica != peer) {
+        log_info("%s %s diverted to rack '%.*s'", print_obj(c_conn),
+                 print_obj(req), replica->rack.len, replica->rack.data);
+        req->diverted = 1;
+        stats_pool_incr(ctx, replica_diverted_reads);
+        stats_pool_incr_by(ctx, replica_diverted_gain_usec, (int64_t)gain);
+        peer = replica;
+      }
+    }
+
+    // Be ready to ask another rack too, if the replica is slow to answer.
+    if (pool->hedge_read_percentile != 0 && req->is_read &&
+        req->consistency == DC_ONE && req->msg_routing == ROUTING_NORMAL &&
+        req->frag_id == 0 && peer != NULL) {
+      req_prepare_hedge(ctx, c_conn, req, orig_mbuf, peer, key, keylen, dc);
+    }
+
     dyn_error_t dyn_error_code = 0;
     // Forward the message to the peer.
     rstatus_t status = req_forward_to_peer(ctx, c_conn, req, peer, key, keylen,
@@ -1025,6 +1224,7 @@ rstatus_t rewrite_query_if_necessary(struct msg **req, struct context *ctx) {
   if (did_rewrite) {
     // If we successfully did a rewrite, we need to recycle the memory used by
     // the original request and point it to the 'new_req'.
+    trace_move(*req, new_req);
     msg_put(*req);
     *req = new_req;
     (*req)->orig_type = orig_msg_type;
@@ -1055,6 +1255,7 @@ static rstatus_t rewrite_query_with_timestamp_md(struct msg **req, struct contex
     // If we successfully did a rewrite, we neet to make sure that the 'new_req' is the
     // msg considered from here on, and record the original msg for later reference.
     new_req->orig_msg = *req;
+    trace_move(*req, new_req);
     *req = new_req;
     (*req)->orig_type = orig_msg_type;
   }
@@ -1080,7 +1281,7 @@ void req_recv_done(struct context *ctx, struct conn *conn, struct msg *req,
   ASSERT(conn->rmsg == req);
   ASSERT(nreq == NULL || nreq->is_request);
 
-  if (!req->is_read) stats_histo_add_payloadsize(ctx, req->mlen);
+  if (!req->is_read) stats_histo_add(ctx, payload_size, req->mlen);
 
   /* enqueue next message (request), if any */
   conn->rmsg = nreq;
@@ -1090,6 +1291,7 @@ void req_recv_done(struct context *ctx, struct conn *conn, struct msg *req,
   }
 
   req->stime_in_microsec = dn_usec_now();
+  trace_hop(req, TRACE_parse_done);
   struct msg_tqh frag_msgq;
   TAILQ_INIT(&frag_msgq);
 
@@ -1116,6 +1318,7 @@ void req_recv_done(struct context *ctx, struct conn *conn, struct msg *req,
     tmsg = TAILQ_NEXT(sub_msg, m_tqe);
 
     TAILQ_REMOVE(&frag_msgq, sub_msg, m_tqe);
+    trace_fork(req, sub_msg, TRACE_FRAGMENT);
     log_info("Forwarding split request %s", print_obj(sub_msg));
     req_forward(ctx, conn, sub_msg);
   }
@@ -1171,9 +1374,81 @@ static rstatus_t swallow_extra_rsp(struct msg *req, struct msg *rsp) {
   return DN_NOOPS;
 }
 
+/*
+ * Response handler of a hedged DC_ONE read, which awaits a response from
+ * each of its replicas. The first good one is selected, or the error if both
+ * fail, and the other is swallowed.
+ */
+static rstatus_t msg_hedged_rsp_handler(struct context *ctx, struct msg *req,
+                                        struct msg *rsp) {
+  uint32_t awaiting = req->awaiting_rsps;
+  struct conn *rsp_conn = rsp->owner;
+
+  if (req->selected_rsp != NULL || (rsp->is_error && awaiting > 1)) {
+    return swallow_extra_rsp(req, rsp);
+  }
+
+  if (!rsp->is_error && rsp_conn != NULL &&
+      rsp_conn->type == CONN_DNODE_PEER_SERVER &&
+      rsp_conn->owner == req->hedge_peer) {
+    stats_pool_incr(ctx, hedged_read_wins);
+  }
+  rstatus_t status = msg_local_one_rsp_handler(ctx, req, rsp);
+  req->awaiting_rsps = awaiting - 1;
+  return status;
+}
+
+/*
+ * Read in full the value of a digest read from a replica that sent a digest,
+ * when no response that carries a value has a quorum. The value takes the
+ * place of the digest once it comes in, and the read is settled then.
+ */
+static rstatus_t req_read_digest_value(struct context *ctx, struct msg *req) {
+  struct response_mgr *rspmgr = &req->rspmgr;
+  struct conn *c_conn = req->owner;
+  struct conn *p_conn;
+  struct keypos *kpos;
+  struct msg *full;
+  dyn_error_t dyn_error_code = DYNOMITE_OK;
+  int idx = rspmgr_full_read_index(rspmgr);
+
+  if (idx < 0 || req->copy_mbuf == NULL || c_conn->waiting_to_unref) {
+    return DN_ERROR;
+  }
+
+  full = msg_get(c_conn, req->is_request, __FUNCTION__);
+  if (full == NULL) {
+    return DN_ENOMEM;
+  }
+  if (msg_clone_sent(req, req->copy_mbuf, req->copy_pos, full) != DN_OK) {
+    msg_put(full);
+    return DN_ENOMEM;
+  }
+  // answered like the copies for the other racks, but with the value
+  full->swallow = 1;
+  trace_fork(req, full, TRACE_LEG);
+
+  kpos = array_get(req->keys, 0);
+  p_conn = dnode_peer_get_conn(ctx, rspmgr->digest_peers[idx], c_conn->sd);
+  if (p_conn == NULL ||
+      dnode_peer_req_forward(ctx, c_conn, p_conn, full, kpos->start,
+                             (uint32_t)(kpos->end - kpos->start),
+                             &dyn_error_code) != DN_OK) {
+    msg_put(full);
+    return DN_ERROR;
+  }
+
+  log_info("%s %s reads digest %d in full as %s", print_obj(c_conn),
+           print_obj(req), idx, print_obj(full));
+  rspmgr_await_full_read(rspmgr, (uint8_t)idx);
+  stats_pool_incr(ctx, quorum_digest_full_reads);
+  return DN_OK;
+}
+
 static rstatus_t msg_quorum_rsp_handler(struct context *ctx, struct msg *req,
     struct msg *rsp) {
   if (req->rspmgr.done) {
+    rspmgr_check_late_response(ctx, &req->rspmgr, rsp);
     rstatus_t swallow_status = swallow_extra_rsp(req, rsp);
     if (is_read_repairs_enabled()) {
       struct msg *cleanup_msg = NULL;
@@ -1188,6 +1463,9 @@ static rstatus_t msg_quorum_rsp_handler(struct context *ctx, struct msg *req,
   }
   rspmgr_submit_response(&req->rspmgr, rsp);
   if (!rspmgr_check_is_done(&req->rspmgr)) return DN_EAGAIN;
+  if (req->digest_read && req_read_digest_value(ctx, req) == DN_OK) {
+    return DN_EAGAIN;
+  }
   // rsp is absorbed by rspmgr. so we can use that variable
   rsp = rspmgr_get_response(ctx, &req->rspmgr);
   ASSERT(rsp);
@@ -1308,7 +1586,7 @@ static void req_client_enqueue_omsgq(struct context *ctx, struct conn *conn,
   ASSERT(conn->type == CONN_CLIENT);
 
   TAILQ_INSERT_TAIL(&conn->omsg_q, req, c_tqe);
-  histo_add(&ctx->stats->client_out_queue, TAILQ_COUNT(&conn->omsg_q));
+  stats_histo_add(ctx, client_out_queue, TAILQ_COUNT(&conn->omsg_q));
   log_debug(LOG_VERB, "%s enqueue outq %s", print_obj(conn), print_obj(req));
 }
 
@@ -1319,10 +1597,10 @@ static void req_client_dequeue_omsgq(struct context *ctx, struct conn *conn,
 
   if (req->stime_in_microsec) {
     usec_t latency = dn_usec_now() - req->stime_in_microsec;
-    stats_histo_add_latency(ctx, latency);
+    stats_histo_add(ctx, latency, latency);
   }
   TAILQ_REMOVE(&conn->omsg_q, req, c_tqe);
-  histo_add(&ctx->stats->client_out_queue, TAILQ_COUNT(&conn->omsg_q));
+  stats_histo_add(ctx, client_out_queue, TAILQ_COUNT(&conn->omsg_q));
   log_debug(LOG_VERB, "%s dequeue outq %s", print_obj(conn), print_obj(req));
 }
 
@@ -0,0 +1,216 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include "dyn_compress.h"
+#include "dyn_core.h"
+
+/*
+ * Preset dictionary shared by both ends of a connection, so that even a
+ * single short command finds back references. Deflate favours the end of the
+ * dictionary, where the most common strings go. Changing it breaks the
+ * payloads of older nodes, so it is tied to the dmsg version.
+ */
+static const char compress_dict[] =
+    "VALUE END\r\nSTORED\r\nNOT_FOUND\r\nDELETED\r\nget gets set add delete "
+    "SADD SREM SMEMBERS SISMEMBER ZADD ZREM ZRANGE ZSCORE ZRANGEBYSCORE "
+    "LPUSH RPUSH LPOP RPOP LRANGE LLEN INCR DECR INCRBY EXPIRE PEXPIRE "
+    "TTL EXISTS DEL MGET MSET SETEX HDEL HMSET HMGET HGETALL HINCRBY "
+    ":0\r\n:1\r\n$-1\r\n*0\r\n-ERR +OK\r\n"
+    "*2\r\n$3\r\nGET\r\n$"
+    "*4\r\n$4\r\nHSET\r\n$"
+    "*3\r\n$4\r\nHGET\r\n$"
+    "*3\r\n$3\r\nSET\r\n$";
+
+/*
+ * zlib streams of a peer connection. They are set up when first used, live
+ * as long as the connection and are reset for every payload, which is
+ * compressed on its own so that it can be opened in any order.
+ */
+struct dyn_zlib {
+  z_stream deflate;
+  z_stream inflate;
+  unsigned deflate_ready : 1;
+  unsigned inflate_ready : 1;
+};
+
+static struct dyn_zlib *zlib_get(struct conn *conn) {
+  if (conn->zlib == NULL) {
+    conn->zlib = dn_zalloc(sizeof(struct dyn_zlib));
+  }
+  return conn->zlib;
+}
+
+static z_stream *zlib_deflate(struct conn *conn) {
+  struct dyn_zlib *z = zlib_get(conn);
+
+  if (z == NULL) {
+    return NULL;
+  }
+
+  if (!z->deflate_ready) {
+    if (deflateInit2(&z->deflate, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      log_error("deflate setup failed on %s", print_obj(conn));
+      return NULL;
+    }
+    z->deflate_ready = 1;
+  } else if (deflateReset(&z->deflate) != Z_OK) {
+    return NULL;
+  }
+
+  if (deflateSetDictionary(&z->deflate, (const Bytef *)compress_dict,
+                           sizeof(compress_dict) - 1) != Z_OK) {
+    return NULL;
+  }
+
+  return &z->deflate;
+}
+
+static z_stream *zlib_inflate(struct conn *conn) {
+  struct dyn_zlib *z = zlib_get(conn);
+
+  if (z == NULL) {
+    return NULL;
+  }
+
+  if (!z->inflate_ready) {
+    if (inflateInit2(&z->inflate, -MAX_WBITS) != Z_OK) {
+      log_error("inflate setup failed on %s", print_obj(conn));
+      return NULL;
+    }
+    z->inflate_ready = 1;
+  } else if (inflateReset(&z->inflate) != Z_OK) {
+    return NULL;
+  }
+
+  if (inflateSetDictionary(&z->inflate, (const Bytef *)compress_dict,
+                           sizeof(compress_dict) - 1) != Z_OK) {
+    return NULL;
+  }
+
+  return &z->inflate;
+}
+
+/*
+ * Replace the payload of msg, from the read position of each of its mbufs
+ * on, with its compressed form, in one mbuf. Returns DN_OK if it did; the
+ * message is left as it was otherwise, when it is too short, does not shrink
+ * or on failure.
+ */
+rstatus_t dyn_compress_msg(struct conn *conn, struct msg *msg) {
+  struct mbuf *mbuf, *nbuf;
+  z_stream *zs;
+  uint32_t len = 0, hdr;
+  uLong bound;
+
+  STAILQ_FOREACH(mbuf, &msg->mhdr, next) { len += mbuf_length(mbuf); }
+  if (len < DYN_COMPRESS_MIN_SIZE || len > DMSG_MAX_WHOLE_PAYLOAD) {
+    return DN_NOOPS;
+  }
+
+  zs = zlib_deflate(conn);
+  if (zs == NULL) {
+    return DN_ERROR;
+  }
+
+  bound = deflateBound(zs, len);
+  nbuf = mbuf_get_whole(DYN_COMPRESS_HDR_LEN + bound);
+  if (nbuf == NULL) {
+    return DN_ENOMEM;
+  }
+
+  zs->next_out = nbuf->last + DYN_COMPRESS_HDR_LEN;
+  zs->avail_out = (uInt)bound;
+  STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+    zs->next_in = mbuf->pos;
+    zs->avail_in = mbuf_length(mbuf);
+    if (deflate(zs, Z_NO_FLUSH) == Z_STREAM_ERROR || zs->avail_in != 0) {
+      break;
+    }
+  }
+
+  if (mbuf != NULL || deflate(zs, Z_FINISH) != Z_STREAM_END ||
+      DYN_COMPRESS_HDR_LEN + zs->total_out >= len) {
+    mbuf_put(nbuf);
+    return DN_NOOPS;
+  }
+
+  hdr = htonl(len);
+  memcpy(nbuf->last, &hdr, sizeof(hdr));
+  nbuf->last += DYN_COMPRESS_HDR_LEN + zs->total_out;
+
+  while ((mbuf = STAILQ_FIRST(&msg->mhdr)) != NULL) {
+    mbuf_remove(&msg->mhdr, mbuf);
+    mbuf_put(mbuf);
+  }
+  mbuf_insert(&msg->mhdr, nbuf);
+
+  return DN_OK;
+}
+
+/*
+ * Inflate the compressed payload of len bytes at data into a new mbuf, which
+ * has room for at least 'room' more bytes after it. Fails if the payload is
+ * corrupt or does not have the length it claims.
+ */
+rstatus_t dyn_decompress(struct conn *conn, const uint8_t *data, size_t len,
+                         size_t room, struct mbuf **out) {
+  struct mbuf *nbuf;
+  z_stream *zs;
+  uint32_t hdr;
+
+  if (len < DYN_COMPRESS_HDR_LEN) {
+    return DN_ERROR;
+  }
+  memcpy(&hdr, data, sizeof(hdr));
+  hdr = ntohl(hdr);
+  if (hdr > DMSG_MAX_WHOLE_PAYLOAD) {
+    return DN_ERROR;
+  }
+
+  zs = zlib_inflate(conn);
+  if (zs == NULL) {
+    return DN_ERROR;
+  }
+
+  nbuf = mbuf_get_whole(hdr + room);
+  if (nbuf == NULL) {
+    return DN_ENOMEM;
+  }
+
+  zs->next_in = (Bytef *)data + DYN_COMPRESS_HDR_LEN;
+  zs->avail_in = (uInt)(len - DYN_COMPRESS_HDR_LEN);
+  zs->next_out = nbuf->last;
+  zs->avail_out = hdr;
+  if (inflate(zs, Z_FINISH) != Z_STREAM_END || zs->total_out != hdr ||
+      zs->avail_in != 0) {
+    mbuf_put(nbuf);
+    return DN_ERROR;
+  }
+  nbuf->last += hdr;
+
+  *out = nbuf;
+  return DN_OK;
+}
+
+/* Drop the zlib streams of a conn when it closes. */
+void dyn_compress_free(struct conn *conn) {
+  struct dyn_zlib *z = conn->zlib;
+
+  if (z == NULL) {
+    return;
+  }
+  if (z->deflate_ready) {
+    deflateEnd(&z->deflate);
+  }
+  if (z->inflate_ready) {
+    inflateEnd(&z->inflate);
+  }
+  dn_free(z);
+  conn->zlib = NULL;
+}
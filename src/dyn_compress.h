@@ -0,0 +1,29 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#ifndef DYN_COMPRESS_H_
+#define DYN_COMPRESS_H_
+
+#include "dyn_types.h"
+
+/*
+ * A compressed payload is the length of the original payload, in network
+ * byte order, followed by its raw deflate stream. Payloads shorter than
+ * DYN_COMPRESS_MIN_SIZE are sent as they are.
+ */
+#define DYN_COMPRESS_HDR_LEN 4
+#define DYN_COMPRESS_MIN_SIZE 64
+
+// Forward declarations
+struct conn;
+struct mbuf;
+struct msg;
+
+rstatus_t dyn_compress_msg(struct conn *conn, struct msg *msg);
+rstatus_t dyn_decompress(struct conn *conn, const uint8_t *data, size_t len,
+                         size_t room, struct mbuf **out);
+void dyn_compress_free(struct conn *conn);
+
+#endif /* DYN_COMPRESS_H_ */
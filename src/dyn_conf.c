@@ -67,6 +67,26 @@
 #define CONF_DEFAULT_DYN_CONNECTIONS 100
 #define CONF_DEFAULT_VNODE_TOKENS 1
 #define CONF_DEFAULT_GOS_INTERVAL 30000  // in millisec
+#define CONF_DEFAULT_WORKER_THREADS 1
+#define CONF_MAX_WORKER_THREADS 64
+#define CONF_DEFAULT_DATASTORE_BATCH_SIZE 64
+#define CONF_MAX_DATASTORE_BATCH_SIZE 1024
+#define CONF_DEFAULT_PEER_BATCH_SIZE 1
+#define CONF_MAX_PEER_BATCH_SIZE 1024
+#define CONF_DEFAULT_READ_CACHE_SIZE 0
+#define CONF_MAX_READ_CACHE_SIZE 65536
+#define CONF_DEFAULT_READ_CACHE_TTL 1000 /* in msec */
+#define CONF_DEFAULT_HOT_KEY_THRESHOLD 16
+#define CONF_DEFAULT_TOP_KEYS 0
+#define CONF_MAX_TOP_KEYS 1024
+#define CONF_DEFAULT_TOP_KEYS_SAMPLE_RATE 100 /* one request in 100 */
+#define CONF_DEFAULT_HISTOGRAM_PRECISION HISTO_DEFAULT_PRECISION
+#define CONF_MAX_HISTOGRAM_PRECISION HISTO_MAX_PRECISION
+#define CONF_DEFAULT_TRACE_SAMPLE_RATE 0 /* off */
+#define CONF_DEFAULT_HEDGE_READ_PERCENTILE 0 /* off */
+#define CONF_DEFAULT_HEDGE_READ_BUDGET 5 /* percent of reads */
+#define CONF_DEFAULT_PEER_CONCURRENCY_MAX 1024 /* requests in flight */
+#define CONF_MAX_PEER_CONCURRENCY_MAX 65536
 
 #define CONF_DEFAULT_MBUF_SIZE MBUF_SIZE
 #define CONF_DEFAULT_MBUF_MIN_SIZE MBUF_MIN_SIZE
@@ -81,9 +101,13 @@
 #define CONF_SECURE_OPTION_RACK "rack"
 #define CONF_SECURE_OPTION_ALL "all"
 
+#define CONF_SECURE_CIPHER_AES_CBC "aes-128-cbc"
+#define CONF_SECURE_CIPHER_AES_GCM "aes-256-gcm"
+
 #define CONF_DEFAULT_RACK "localrack"
 #define CONF_DEFAULT_DC "localdc"
 #define CONF_DEFAULT_SECURE_SERVER_OPTION CONF_SECURE_OPTION_NONE
+#define CONF_DEFAULT_SECURE_CIPHER CONF_SECURE_CIPHER_AES_CBC
 
 #define CONF_DEFAULT_SEED_PROVIDER "simple_provider"
 
@@ -215,6 +239,7 @@ static rstatus_t conf_pool_init(struct conf_pool *cp, struct string *name) {
   string_init(&cp->dyn_listen.pname);
   string_init(&cp->dyn_listen.name);
   string_init(&cp->secure_server_option);
+  string_init(&cp->secure_cipher);
   string_init(&cp->read_consistency);
   string_init(&cp->write_consistency);
   string_init(&cp->pem_key_file);
@@ -239,14 +264,29 @@ static rstatus_t conf_pool_init(struct conf_pool *cp, struct string *name) {
 
   cp->gos_interval = CONF_UNSET_NUM;
 
-  cp->conn_msg_rate = CONF_UNSET_NUM;
-
   array_null(&cp->dyn_seeds);
 
   cp->valid = 0;
   cp->enable_gossip = CONF_UNSET_BOOL;
   cp->mbuf_size = CONF_UNSET_NUM;
   cp->alloc_msgs_max = CONF_UNSET_NUM;
+  cp->worker_threads = CONF_UNSET_NUM;
+  cp->splice_threshold = CONF_UNSET_NUM;
+  cp->datastore_batch_size = CONF_UNSET_NUM;
+  cp->peer_batch_size = CONF_UNSET_NUM;
+  cp->remote_dc_compression = CONF_UNSET_BOOL;
+  cp->read_cache_size = CONF_UNSET_NUM;
+  cp->read_cache_ttl = CONF_UNSET_NUM;
+  cp->hot_key_threshold = CONF_UNSET_NUM;
+  cp->top_keys = CONF_UNSET_NUM;
+  cp->top_keys_sample_rate = CONF_UNSET_NUM;
+  cp->histogram_precision = CONF_UNSET_NUM;
+  cp->trace_sample_rate = CONF_UNSET_NUM;
+  cp->adaptive_replica_selection = CONF_UNSET_BOOL;
+  cp->hedge_read_percentile = CONF_UNSET_NUM;
+  cp->hedge_read_budget = CONF_UNSET_NUM;
+  cp->quorum_digest_reads = CONF_UNSET_BOOL;
+  cp->peer_concurrency_max = CONF_UNSET_NUM;
 
   status = string_duplicate(&cp->name, name);
   if (status != DN_OK) {
@@ -296,6 +336,7 @@ static void conf_pool_deinit(struct conf_pool *cp) {
   string_deinit(&cp->dyn_listen.pname);
   string_deinit(&cp->dyn_listen.name);
   string_deinit(&cp->secure_server_option);
+  string_deinit(&cp->secure_cipher);
   string_deinit(&cp->read_consistency);
   string_deinit(&cp->write_consistency);
   string_deinit(&cp->pem_key_file);
@@ -329,6 +370,13 @@ secure_server_option_t get_secure_server_option(struct string *option) {
   return SECURE_OPTION_NONE;
 }
 
+secure_cipher_t get_secure_cipher(struct string *cipher) {
+  if (dn_strcmp(cipher->data, CONF_SECURE_CIPHER_AES_GCM) == 0) {
+    return SECURE_CIPHER_AES_GCM;
+  }
+  return SECURE_CIPHER_AES_CBC;
+}
+
 /**
  * Output the entire configuration into the log file.
  * @param[in] cf Dynomite configuration.
@@ -388,11 +436,13 @@ static void conf_dump(struct conf *cf) {
   log_debug(LOG_VVERB, "  dyn_connections: %d", cp->dyn_connections);
 
   log_debug(LOG_VVERB, "  gos_interval: %lu", cp->gos_interval);
-  log_debug(LOG_VVERB, "  conn_msg_rate: %d", cp->conn_msg_rate);
 
   log_debug(LOG_VVERB, "  secure_server_option: \"%.*s\"",
             cp->secure_server_option.len, cp->secure_server_option.data);
 
+  log_debug(LOG_VVERB, "  secure_cipher: \"%.*s\"", cp->secure_cipher.len,
+            cp->secure_cipher.data);
+
   log_debug(LOG_VVERB, "  read_consistency: \"%.*s\"", cp->read_consistency.len,
             cp->read_consistency.data);
 
@@ -416,6 +466,27 @@ static void conf_dump(struct conf *cf) {
             cp->local_peer_connections);
   log_debug(LOG_VVERB, "  remote_peer_connections: %d",
             cp->remote_peer_connections);
+  log_debug(LOG_VVERB, "  worker_threads: %d", cp->worker_threads);
+  log_debug(LOG_VVERB, "  splice_threshold: %d", cp->splice_threshold);
+  log_debug(LOG_VVERB, "  datastore_batch_size: %d", cp->datastore_batch_size);
+  log_debug(LOG_VVERB, "  peer_batch_size: %d", cp->peer_batch_size);
+  log_debug(LOG_VVERB, "  remote_dc_compression: %s",
+            cp->remote_dc_compression ? "true" : "false");
+  log_debug(LOG_VVERB, "  read_cache_size: %d", cp->read_cache_size);
+  log_debug(LOG_VVERB, "  read_cache_ttl: %d", cp->read_cache_ttl);
+  log_debug(LOG_VVERB, "  hot_key_threshold: %d", cp->hot_key_threshold);
+  log_debug(LOG_VVERB, "  top_keys: %d", cp->top_keys);
+  log_debug(LOG_VVERB, "  top_keys_sample_rate: %d", cp->top_keys_sample_rate);
+  log_debug(LOG_VVERB, "  histogram_precision: %d", cp->histogram_precision);
+  log_debug(LOG_VVERB, "  trace_sample_rate: %d", cp->trace_sample_rate);
+  log_debug(LOG_VVERB, "  adaptive_replica_selection: %s",
+            cp->adaptive_replica_selection ? "true" : "false");
+  log_debug(LOG_VVERB, "  hedge_read_percentile: %d",
+            cp->hedge_read_percentile);
+  log_debug(LOG_VVERB, "  hedge_read_budget: %d", cp->hedge_read_budget);
+  log_debug(LOG_VVERB, "  quorum_digest_reads: %s",
+            cp->quorum_digest_reads ? "true" : "false");
+  log_debug(LOG_VVERB, "  peer_concurrency_max: %d", cp->peer_concurrency_max);
 }
 
 static rstatus_t conf_yaml_init(struct conf *cf) {
@@ -1149,6 +1220,9 @@ static struct command conf_commands[] = {
     {string("secure_server_option"), conf_set_string,
      offsetof(struct conf_pool, secure_server_option)},
 
+    {string("secure_cipher"), conf_set_string,
+     offsetof(struct conf_pool, secure_cipher)},
+
     {string("pem_key_file"), conf_set_string,
      offsetof(struct conf_pool, pem_key_file)},
 
@@ -1162,8 +1236,8 @@ static struct command conf_commands[] = {
 
     {string("env"), conf_set_string, offsetof(struct conf_pool, env)},
 
-    {string("conn_msg_rate"), conf_set_num,
-     offsetof(struct conf_pool, conn_msg_rate)},
+    {string("conn_msg_rate"), conf_set_deprecated,
+     offsetof(struct conf_pool, deprecated)},
 
     {string("read_consistency"), conf_set_string,
      offsetof(struct conf_pool, read_consistency)},
@@ -1196,6 +1270,57 @@ static struct command conf_commands[] = {
 
     {string("read_repairs_enabled"), conf_set_bool,
      offsetof(struct conf_pool, read_repairs_enabled)},
+
+    {string("worker_threads"), conf_set_num,
+     offsetof(struct conf_pool, worker_threads)},
+
+    {string("splice_threshold"), conf_set_num,
+     offsetof(struct conf_pool, splice_threshold)},
+
+    {string("datastore_batch_size"), conf_set_num,
+     offsetof(struct conf_pool, datastore_batch_size)},
+
+    {string("peer_batch_size"), conf_set_num,
+     offsetof(struct conf_pool, peer_batch_size)},
+
+    {string("remote_dc_compression"), conf_set_bool,
+     offsetof(struct conf_pool, remote_dc_compression)},
+
+    {string("read_cache_size"), conf_set_num,
+     offsetof(struct conf_pool, read_cache_size)},
+
+    {string("read_cache_ttl"), conf_set_num,
+     offsetof(struct conf_pool, read_cache_ttl)},
+
+    {string("hot_key_threshold"), conf_set_num,
+     offsetof(struct conf_pool, hot_key_threshold)},
+
+    {string("top_keys"), conf_set_num,
+     offsetof(struct conf_pool, top_keys)},
+
+    {string("top_keys_sample_rate"), conf_set_num,
+     offsetof(struct conf_pool, top_keys_sample_rate)},
+
+    {string("histogram_precision"), conf_set_num,
+     offsetof(struct conf_pool, histogram_precision)},
+
+    {string("trace_sample_rate"), conf_set_num,
+     offsetof(struct conf_pool, trace_sample_rate)},
+
+    {string("adaptive_replica_selection"), conf_set_bool,
+     offsetof(struct conf_pool, adaptive_replica_selection)},
+
+    {string("hedge_read_percentile"), conf_set_num,
+     offsetof(struct conf_pool, hedge_read_percentile)},
+
+    {string("hedge_read_budget"), conf_set_num,
+     offsetof(struct conf_pool, hedge_read_budget)},
+
+    {string("quorum_digest_reads"), conf_set_bool,
+     offsetof(struct conf_pool, quorum_digest_reads)},
+
+    {string("peer_concurrency_max"), conf_set_num,
+     offsetof(struct conf_pool, peer_concurrency_max)},
     null_command};
 
 static rstatus_t conf_handler(struct conf *cf, void *data) {
@@ -1894,10 +2019,6 @@ static rstatus_t conf_validate_pool(struct conf *cf, struct conf_pool *cp) {
     cp->gos_interval = CONF_DEFAULT_GOS_INTERVAL;
   }
 
-  if (cp->conn_msg_rate == CONF_UNSET_NUM) {
-    cp->conn_msg_rate = CONF_DEFAULT_CONN_MSG_RATE;
-  }
-
   if (cp->mbuf_size == CONF_UNSET_NUM) {
     log_debug(LOG_INFO, "setting mbuf_size to default value:%d",
               CONF_DEFAULT_MBUF_SIZE);
@@ -1968,6 +2089,13 @@ static rstatus_t conf_validate_pool(struct conf *cf, struct conf_pool *cp) {
               CONF_DEFAULT_SECURE_SERVER_OPTION);
   }
 
+  if (string_empty(&cp->secure_cipher)) {
+    string_copy_c(&cp->secure_cipher,
+                  (const uint8_t *)CONF_DEFAULT_SECURE_CIPHER);
+    log_debug(LOG_INFO, "setting secure_cipher to default value:%s",
+              CONF_DEFAULT_SECURE_CIPHER);
+  }
+
   if (string_empty(&cp->read_consistency)) {
     string_copy_c(&cp->read_consistency, (const uint8_t *)CONF_STR_DC_ONE);
     log_debug(LOG_INFO, "setting read_consistency to default value:%s",
@@ -2004,6 +2132,13 @@ static rstatus_t conf_validate_pool(struct conf *cf, struct conf_pool *cp) {
         "'datacenter' 'all'");
   }
 
+  if (dn_strcmp(cp->secure_cipher.data, CONF_SECURE_CIPHER_AES_CBC) &&
+      dn_strcmp(cp->secure_cipher.data, CONF_SECURE_CIPHER_AES_GCM)) {
+    log_error("conf: directive \"secure_cipher:\" must be one of '%s' '%s'",
+              CONF_SECURE_CIPHER_AES_CBC, CONF_SECURE_CIPHER_AES_GCM);
+    return DN_ERROR;
+  }
+
   if (!dn_strcasecmp(cp->read_consistency.data, CONF_STR_DC_ONE))
     g_read_consistency = DC_ONE;
   else if (!dn_strcasecmp(cp->read_consistency.data, CONF_STR_DC_SAFE_QUORUM))
@@ -2069,6 +2204,145 @@ static rstatus_t conf_validate_pool(struct conf *cf, struct conf_pool *cp) {
     cp->remote_peer_connections = CONF_DEFAULT_CONNECTIONS;
   }
 
+  if (cp->worker_threads == CONF_UNSET_NUM) {
+    cp->worker_threads = CONF_DEFAULT_WORKER_THREADS;
+  } else if (cp->worker_threads > CONF_MAX_WORKER_THREADS) {
+    log_error("conf: directive \"worker_threads:\" cannot be greater than %d",
+              CONF_MAX_WORKER_THREADS);
+    return DN_ERROR;
+  }
+
+  if (cp->worker_threads > 1) {
+    if (cp->enable_gossip) {
+      log_error("conf: directive \"worker_threads:\" > 1 requires static "
+                "topology, disable \"enable_gossip:\"");
+      return DN_ERROR;
+    }
+    if (cp->listen.info.family == AF_UNIX) {
+      log_error("conf: directive \"worker_threads:\" > 1 requires a TCP "
+                "\"listen:\" address");
+      return DN_ERROR;
+    }
+  }
+
+  if (cp->splice_threshold < 0 || cp->splice_threshold > MSG_PIPE_SIZE) {
+    log_error("conf: directive \"splice_threshold:\" must be between 0 and "
+              "%d", MSG_PIPE_SIZE);
+    return DN_ERROR;
+  }
+#ifndef DN_HAVE_SPLICE
+  if (cp->splice_threshold > 0) {
+    log_error("conf: directive \"splice_threshold:\" is not supported on "
+              "this platform");
+    return DN_ERROR;
+  }
+#endif
+
+  if (cp->datastore_batch_size == CONF_UNSET_NUM) {
+    cp->datastore_batch_size = CONF_DEFAULT_DATASTORE_BATCH_SIZE;
+  } else if (cp->datastore_batch_size > CONF_MAX_DATASTORE_BATCH_SIZE) {
+    log_error("conf: directive \"datastore_batch_size:\" cannot be greater "
+              "than %d", CONF_MAX_DATASTORE_BATCH_SIZE);
+    return DN_ERROR;
+  }
+
+  if (cp->peer_batch_size == CONF_UNSET_NUM) {
+    cp->peer_batch_size = CONF_DEFAULT_PEER_BATCH_SIZE;
+  } else if (cp->peer_batch_size > CONF_MAX_PEER_BATCH_SIZE) {
+    log_error("conf: directive \"peer_batch_size:\" cannot be greater "
+              "than %d", CONF_MAX_PEER_BATCH_SIZE);
+    return DN_ERROR;
+  }
+
+  if (cp->read_cache_size == CONF_UNSET_NUM) {
+    cp->read_cache_size = CONF_DEFAULT_READ_CACHE_SIZE;
+  } else if (cp->read_cache_size > CONF_MAX_READ_CACHE_SIZE) {
+    log_error("conf: directive \"read_cache_size:\" cannot be greater "
+              "than %d", CONF_MAX_READ_CACHE_SIZE);
+    return DN_ERROR;
+  } else if (cp->read_cache_size > 0 && cp->read_repairs_enabled) {
+    log_error("conf: directive \"read_cache_size:\" cannot be used with "
+              "\"read_repairs_enabled:\"");
+    return DN_ERROR;
+  } else if (cp->read_cache_size > 0 && cp->worker_threads > 1) {
+    // a write seen by one thread would not drop the entries of the others
+    log_error("conf: directive \"read_cache_size:\" cannot be used with "
+              "\"worker_threads:\" > 1");
+    return DN_ERROR;
+  }
+
+  if (cp->read_cache_ttl == CONF_UNSET_NUM) {
+    cp->read_cache_ttl = CONF_DEFAULT_READ_CACHE_TTL;
+  } else if (cp->read_cache_ttl <= 0) {
+    log_error("conf: directive \"read_cache_ttl:\" must be positive");
+    return DN_ERROR;
+  }
+
+  if (cp->hot_key_threshold == CONF_UNSET_NUM) {
+    cp->hot_key_threshold = CONF_DEFAULT_HOT_KEY_THRESHOLD;
+  } else if (cp->hot_key_threshold <= 0 ||
+             cp->hot_key_threshold > UINT16_MAX) {
+    log_error("conf: directive \"hot_key_threshold:\" must be between 1 "
+              "and %d", UINT16_MAX);
+    return DN_ERROR;
+  }
+
+  if (cp->top_keys == CONF_UNSET_NUM) {
+    cp->top_keys = CONF_DEFAULT_TOP_KEYS;
+  } else if (cp->top_keys < 0 || cp->top_keys > CONF_MAX_TOP_KEYS) {
+    log_error("conf: directive \"top_keys:\" must be between 0 and %d",
+              CONF_MAX_TOP_KEYS);
+    return DN_ERROR;
+  }
+
+  if (cp->top_keys_sample_rate == CONF_UNSET_NUM) {
+    cp->top_keys_sample_rate = CONF_DEFAULT_TOP_KEYS_SAMPLE_RATE;
+  } else if (cp->top_keys_sample_rate <= 0) {
+    log_error("conf: directive \"top_keys_sample_rate:\" must be positive");
+    return DN_ERROR;
+  }
+
+  if (cp->histogram_precision == CONF_UNSET_NUM) {
+    cp->histogram_precision = CONF_DEFAULT_HISTOGRAM_PRECISION;
+  } else if (cp->histogram_precision <= 0 ||
+             cp->histogram_precision > CONF_MAX_HISTOGRAM_PRECISION) {
+    log_error("conf: directive \"histogram_precision:\" must be between 1 "
+              "and %d", CONF_MAX_HISTOGRAM_PRECISION);
+    return DN_ERROR;
+  }
+
+  if (cp->trace_sample_rate == CONF_UNSET_NUM) {
+    cp->trace_sample_rate = CONF_DEFAULT_TRACE_SAMPLE_RATE;
+  } else if (cp->trace_sample_rate < 0) {
+    log_error("conf: directive \"trace_sample_rate:\" must be 0 or positive");
+    return DN_ERROR;
+  }
+
+  if (cp->hedge_read_percentile == CONF_UNSET_NUM) {
+    cp->hedge_read_percentile = CONF_DEFAULT_HEDGE_READ_PERCENTILE;
+  } else if (cp->hedge_read_percentile < 0 || cp->hedge_read_percentile > 99) {
+    log_error("conf: directive \"hedge_read_percentile:\" must be between 0 "
+              "and 99");
+    return DN_ERROR;
+  }
+
+  if (cp->hedge_read_budget == CONF_UNSET_NUM) {
+    cp->hedge_read_budget = CONF_DEFAULT_HEDGE_READ_BUDGET;
+  } else if (cp->hedge_read_budget < 0 || cp->hedge_read_budget > 100) {
+    log_error("conf: directive \"hedge_read_budget:\" must be between 0 "
+              "and 100");
+    return DN_ERROR;
+  }
+
+  if (cp->peer_concurrency_max == CONF_UNSET_NUM) {
+    cp->peer_concurrency_max = CONF_DEFAULT_PEER_CONCURRENCY_MAX;
+  } else if (cp->peer_concurrency_max < 0 ||
+             cp->peer_concurrency_max > CONF_MAX_PEER_CONCURRENCY_MAX) {
+    log_error("conf: directive \"peer_concurrency_max:\" must be between 0 "
+              "and %d", CONF_MAX_PEER_CONCURRENCY_MAX);
+    return DN_ERROR;
+  }
+
   status = conf_validate_server(cf, cp);
   if (status != DN_OK) {
     return status;
@@ -42,7 +42,6 @@
 
 #define CONF_DEFAULT_PEERS 200
 #define CONF_DEFAULT_ENV "aws"
-#define CONF_DEFAULT_CONN_MSG_RATE 50000  // conn msgs per sec
 
 #define CONF_STR_DC_ONE "dc_one"
 #define CONF_STR_DC_QUORUM "dc_quorum"
@@ -85,7 +84,8 @@ struct conf_pool {
   struct conf_listen listen; /* listen: */
   hash_type_t hash;          /* hash: */
   struct string hash_tag;    /* hash_tag: */
-  void *deprecated;          /* Deprecated: distribution, server_connections */
+  void *deprecated;          /* Deprecated: distribution, server_connections,
+                                conn_msg_rate */
   msec_t timeout;            /* timeout: */
   int backlog;               /* backlog: */
   int client_connections;    /* client_connections: */
@@ -110,6 +110,7 @@ struct conf_pool {
   /* none | datacenter | rack | all in order of increasing number of
    * connections. (default is datacenter) */
   struct string secure_server_option;
+  struct string secure_cipher; /* aes-128-cbc | aes-256-gcm */
   struct string read_consistency;
   struct string write_consistency;
   struct string pem_key_file;
@@ -119,7 +120,6 @@ struct conf_pool {
                              reconciliation */
   struct string dc;       /* this node's dc */
   struct string env;      /* AWS, Google, network, ... */
-  uint32_t conn_msg_rate; /* conn msg per sec */
   bool enable_gossip;     /* enable/disable gossip */
   size_t mbuf_size;       /* mbuf chunk size */
   size_t alloc_msgs_max;  /* allocated messages buffer size */
@@ -135,6 +135,24 @@ struct conf_pool {
 
   /* repairs enabled */
   bool read_repairs_enabled;
+
+  int worker_threads;         /* number of event loop threads */
+  int splice_threshold;       /* min bulk reply size to splice() to clients */
+  int datastore_batch_size;   /* max requests per datastore write */
+  int peer_batch_size;        /* max messages per dnode frame */
+  bool remote_dc_compression; /* compress payloads to remote dc peers */
+  int read_cache_size;        /* max read cache entries, 0 is off */
+  int read_cache_ttl;         /* read cache entry lifetime in msec */
+  int hot_key_threshold;      /* recent reads that make a key hot */
+  int top_keys;               /* hot and big keys to report, 0 is off */
+  int top_keys_sample_rate;   /* sample one request in this many */
+  int histogram_precision;    /* log2 of histogram buckets per power of 2 */
+  int trace_sample_rate;      /* trace one request in this many, 0 is off */
+  bool adaptive_replica_selection; /* DC_ONE reads may go to other racks */
+  int hedge_read_percentile;  /* replica latency percentile to hedge at */
+  int hedge_read_budget;      /* percent of reads that may be hedged */
+  bool quorum_digest_reads;   /* other racks send digests of quorum reads */
+  int peer_concurrency_max;   /* most requests in flight to a peer, 0 is off */
 };
 
 struct conf {
@@ -163,6 +181,7 @@ void conf_destroy(struct conf *cf);
 rstatus_t conf_datastore_transform(struct datastore *s, struct conf_pool *cp,
                                    struct conf_server *cs);
 secure_server_option_t get_secure_server_option(struct string *option);
+secure_cipher_t get_secure_cipher(struct string *cipher);
 bool is_secure(secure_server_option_t option, struct string *this_dc,
                struct string *this_rack, struct string *that_dc,
                struct string *that_rack);
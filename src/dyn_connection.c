@@ -20,6 +20,8 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+
 #include "dyn_connection_internal.h"
 #include "dyn_core.h"
 #include "event/dyn_event.h"
@@ -439,3 +441,108 @@ ssize_t conn_sendv_data(struct conn *conn, struct array *sendv, size_t nsend) {
 
   return DN_ERROR;
 }
+
+/*
+ * Moves up to 'size' bytes from the connection's socket into the pipe 'fd'
+ * without copying them through user space.
+ */
+ssize_t conn_splice_recv(struct conn *conn, int fd, size_t size) {
+#ifdef DN_HAVE_SPLICE
+  ssize_t n;
+
+  ASSERT(size > 0);
+  ASSERT(conn->recv_ready);
+
+  for (;;) {
+    n = splice(conn->sd, NULL, fd, NULL, size,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    log_debug(LOG_VERB, "%s splice recv %zd of %zu", print_obj(conn), n, size);
+
+    if (n > 0) {
+      /* a short count may mean a full pipe rather than a drained socket, so
+       * leave recv_ready alone and let the next call tell them apart */
+      conn->recv_bytes += (size_t)n;
+      return n;
+    }
+
+    if (n == 0) {
+      conn->recv_ready = 0;
+      conn->eof = 1;
+      log_debug(LOG_NOTICE, "%s recv eof rb %zu sb %zu", print_obj(conn),
+                conn->recv_bytes, conn->send_bytes);
+      return n;
+    }
+
+    if (errno == EINTR) {
+      log_debug(LOG_VERB, "%s splice recv not ready - eintr", print_obj(conn));
+      continue;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // Either the socket is drained or the pipe is full.
+      conn->recv_ready = 0;
+      log_debug(LOG_VERB, "%s splice recv not ready - eagain", print_obj(conn));
+      return DN_EAGAIN;
+    } else {
+      conn->recv_ready = 0;
+      conn->err = errno;
+      log_error("%s splice recv failed: %s", print_obj(conn), strerror(errno));
+      return DN_ERROR;
+    }
+  }
+
+  NOT_REACHED();
+#endif
+
+  return DN_ERROR;
+}
+
+/*
+ * Moves up to 'size' bytes from the pipe 'fd' to the connection's socket.
+ */
+ssize_t conn_splice_send(struct conn *conn, int fd, size_t size) {
+#ifdef DN_HAVE_SPLICE
+  ssize_t n;
+
+  ASSERT(size > 0);
+  ASSERT(conn->send_ready);
+
+  for (;;) {
+    n = splice(fd, NULL, conn->sd, NULL, size,
+               SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+
+    log_debug(LOG_VERB, "splice on sd %d %zd of %zu", conn->sd, n, size);
+
+    if (n > 0) {
+      if (n < (ssize_t)size) {
+        conn->send_ready = 0;
+      }
+      conn->send_bytes += (size_t)n;
+      return n;
+    }
+
+    if (n == 0) {
+      log_warn("splice on sd %d returned zero", conn->sd);
+      conn->send_ready = 0;
+      return 0;
+    }
+
+    if (errno == EINTR) {
+      log_debug(LOG_VERB, "splice on sd %d not ready - eintr", conn->sd);
+      continue;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      conn->send_ready = 0;
+      log_debug(LOG_VERB, "splice on sd %d not ready - eagain", conn->sd);
+      return DN_EAGAIN;
+    } else {
+      conn->send_ready = 0;
+      conn->err = errno;
+      log_error("splice on sd %d failed: %s", conn->sd, strerror(errno));
+      return DN_ERROR;
+    }
+  }
+
+  NOT_REACHED();
+#endif
+
+  return DN_ERROR;
+}
@@ -102,6 +102,7 @@ struct conn {
   object_t object;
   TAILQ_ENTRY(conn) conn_tqe;  /* link in server_pool / server / free q */
   TAILQ_ENTRY(conn) ready_tqe; /* link in ready connection q */
+  TAILQ_ENTRY(conn) batch_tqe; /* link in batch connection q */
   void *owner;                 /* connection owner - server_pool / server */
   struct conn_pool *conn_pool;
 
@@ -127,6 +128,7 @@ struct conn {
   unsigned recv_ready : 1;  /* recv ready? */
   unsigned send_active : 1; /* send active? */
   unsigned send_ready : 1;  /* send ready? */
+  unsigned batched : 1;     /* in batch connection q? */
 
   unsigned connecting : 1;       /* connecting? */
   unsigned connected : 1;        /* connected? */
@@ -136,11 +138,22 @@ struct conn {
   unsigned dyn_mode : 1;         /* is a dyn connection? */
   unsigned dnode_secured : 1;    /* is a secured connection? */
   unsigned crypto_key_sent : 1;  /* crypto state */
+  unsigned dmsg_binary : 1;      /* peer reads binary dmsg headers? */
+  unsigned dmsg_compress : 1;    /* peer inflates compressed payloads? */
+  unsigned dmsg_trace : 1;       /* peer reads trace ids? */
+  unsigned dmsg_digest : 1;      /* peer answers reads with digests? */
   unsigned char aes_key[50];  // aes_key[34];              /* a place holder for
                               // AES key */
+  struct aes_gcm *aes_gcm;    /* AES-GCM contexts keyed with aes_key */
+  struct dyn_zlib *zlib;      /* zlib streams for compressed payloads */
+  uint8_t *dmsg_frame;        /* header of the dnode frame being written */
+  uint64_t dmsg_frame_id;     /* id of the dnode frame being read */
+  uint32_t dmsg_frame_left;   /* messages left in the frame being read */
+  uint8_t dmsg_frame_type;    /* ... their type */
+  uint8_t dmsg_frame_flags;   /* ... flags */
+  uint8_t dmsg_frame_same_dc; /* ... and same_dc */
+  usec_t batch_usec;          /* when put in the batch connection q */
   unsigned same_dc : 1;  /* bit to indicate whether a peer conn is same DC */
-  uint32_t avail_tokens; /* used to throttle the traffics */
-  uint32_t last_sent;    /* ts in sec used to determine the last sent time */
   // uint32_t           non_bytes_send;        /* #times or epoll triggers that
   // we are not able to send any bytes */
   consistency_t read_consistency;
@@ -209,6 +222,8 @@ rstatus_t conn_connect(struct context *ctx, struct conn *conn);
 
 ssize_t conn_recv_data(struct conn *conn, void *buf, size_t size);
 ssize_t conn_sendv_data(struct conn *conn, struct array *sendv, size_t nsend);
+ssize_t conn_splice_recv(struct conn *conn, int fd, size_t size);
+ssize_t conn_splice_send(struct conn *conn, int fd, size_t size);
 void conn_init(void);
 void conn_deinit(void);
 
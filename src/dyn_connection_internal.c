@@ -18,14 +18,14 @@
  */
 
 #include "dyn_connection_internal.h"
+#include "dyn_conf.h"
 #include "dyn_connection_pool.h"
 #include "dyn_core.h"
-#include "dyn_setting.h"
 #include "dyn_util.h"
 #include "event/dyn_event.h"
 
-static uint32_t nfree_connq;       /* # free conn q */
-static struct conn_tqh free_connq; /* free conn q */
+static __thread uint32_t nfree_connq;       /* # free conn q */
+static __thread struct conn_tqh free_connq; /* free conn q */
 
 inline char *_conn_get_type_string(struct conn *conn) {
   switch (conn->type) {
@@ -80,8 +80,8 @@ struct conn *_conn_get(void) {
   struct conn *conn;
 
   // Generate a new key for each connection
-  unsigned char *aes_key = generate_aes_key();
-  if (aes_key == NULL) {
+  unsigned char aes_key[AES_KEYLEN + 1];
+  if (generate_aes_key(aes_key) != DN_OK) {
     return NULL;
   }
 
@@ -132,6 +132,7 @@ struct conn *_conn_get(void) {
   conn->recv_ready = 0;
   conn->send_active = 0;
   conn->send_ready = 0;
+  conn->batched = 0;
 
   conn->connecting = 0;
   conn->connected = 0;
@@ -143,10 +144,14 @@ struct conn *_conn_get(void) {
   conn->dyn_mode = 0;
   conn->dnode_secured = 0;
   conn->crypto_key_sent = 0;
+  conn->dmsg_binary = 0;
+  conn->dmsg_compress = 0;
+  conn->dmsg_trace = 0;
+  conn->dmsg_digest = 0;
+  conn->dmsg_frame = NULL;
+  conn->dmsg_frame_left = 0;
 
   conn->same_dc = 1;
-  conn->avail_tokens = msgs_per_sec();
-  conn->last_sent = 0;
   // conn->non_bytes_send = 0;
   conn_set_read_consistency(conn, g_read_consistency);
   conn_set_write_consistency(conn, g_write_consistency);
@@ -179,6 +184,8 @@ static void _conn_free(struct conn *conn) {
 }
 
 void _conn_put(struct conn *conn) {
+  dyn_aes_gcm_free(conn);
+  dyn_compress_free(conn);
   nfree_connq++;
   TAILQ_INSERT_HEAD(&free_connq, conn, conn_tqe);
   if (conn->conn_pool) conn_pool_notify_conn_close(conn->conn_pool, conn);
@@ -213,6 +220,13 @@ rstatus_t _conn_reuse(struct conn *p) {
     case AF_INET:
     case AF_INET6:
       status = dn_set_reuseaddr(p->sd);
+      if (status == DN_OK && p->type == CONN_PROXY) {
+        /* every worker thread listens on the client port */
+        struct server_pool *pool = p->owner;
+        if (pool->conf_pool->worker_threads > 1) {
+          status = dn_set_reuseport(p->sd);
+        }
+      }
       break;
 
     case AF_UNIX:
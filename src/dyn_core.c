@@ -31,6 +31,7 @@
 #include "dyn_proxy.h"
 #include "dyn_server.h"
 #include "dyn_task.h"
+#include "dyn_worker.h"
 #include "event/dyn_event.h"
 
 uint32_t admin_opt = 0;
@@ -167,6 +168,7 @@ static rstatus_t core_stats_create(struct context *ctx) {
     log_error("Failed to create stats!!!");
     return DN_ERROR;
   }
+  ctx->stats_counters = stats_thread_counters(ctx->stats, 0);
 
   return DN_OK;
 }
@@ -212,9 +214,11 @@ static rstatus_t core_ctx_create(struct instance *nci) {
   ctx->instance = nci;
   ctx->cf = NULL;
   ctx->stats = NULL;
+  ctx->stats_counters = NULL;
   ctx->evb = NULL;
   ctx->dyn_state = INIT;
   ctx->admin_opt = admin_opt;
+  ctx->worker_id = 0;
 
   /* parse and create configuration */
   ctx->cf = conf_create(nci->conf_filename);
@@ -337,6 +341,16 @@ rstatus_t core_start(struct instance *nci) {
     msg_init(sp->alloc_msgs_max);
   }
 
+  status = trace_init();
+  if (status != DN_OK) {
+    goto error;
+  }
+
+  status = worker_start(ctx);
+  if (status != DN_OK) {
+    goto error;
+  }
+
   return DN_OK;
 
 error:
@@ -379,6 +393,7 @@ void core_stop(struct context *ctx) {
   msg_deinit();
   dmsg_deinit();
   mbuf_deinit();
+  trace_deinit();
   core_ctx_destroy(ctx);
 }
 
@@ -440,21 +455,20 @@ static void core_error(struct context *ctx, struct conn *conn) {
 }
 
 static void core_timeout(struct context *ctx) {
+  msec_t now = dn_msec_now();
+
   for (;;) {
     struct msg *req;
     struct conn *conn;
-    msec_t now, then;
 
-    req = msg_tmo_min();
+    req = msg_tmo_expired(now);
     if (req == NULL) {
-      ctx->timeout = ctx->max_timeout;
-      return;
+      break;
     }
 
     /* skip over req that are in-error or done */
 
     if (req->is_error || req->done) {
-      msg_tmo_delete(req);
       continue;
     }
 
@@ -463,20 +477,10 @@ static void core_timeout(struct context *ctx) {
      * out server
      */
 
-    conn = req->tmo_rbe.data;
-    then = req->tmo_rbe.key;
-
-    now = dn_msec_now();
-    if (now < then) {
-      msec_t delta = (msec_t)(then - now);
-      ctx->timeout = MIN(delta, ctx->max_timeout);
-      return;
-    }
+    conn = req->tmo_twe.rbnode.data;
 
     log_warn("%s on %s timedout, timeout was %d", print_obj(req),
-             print_obj(conn), req->tmo_rbe.timeout);
-
-    msg_tmo_delete(req);
+             print_obj(conn), req->tmo_twe.rbnode.timeout);
 
     if (conn->dyn_mode) {
       if (conn->type == CONN_DNODE_PEER_SERVER) {  // outgoing peer requests
@@ -484,6 +488,8 @@ static void core_timeout(struct context *ctx) {
           stats_pool_incr(ctx, peer_timedout_requests);
         else
           stats_pool_incr(ctx, remote_peer_timedout_requests);
+        peer_limit_cut(ctx, conn->owner, ctx->pool.peer_concurrency_max,
+                       req->request_send_time);
       }
     } else {
       if (conn->type == CONN_SERVER) {  // storage server requests
@@ -495,6 +501,46 @@ static void core_timeout(struct context *ctx) {
 
     core_close(ctx, conn);
   }
+
+  ctx->timeout = MIN(msg_tmo_next(now), ctx->max_timeout);
+}
+
+/*
+ * Writes the requests forwarded to each datastore connection since the last
+ * flush, one writev() per connection. Requests that do not fit in a batch, or
+ * in the socket, are sent when the connection is reported writable.
+ */
+void core_batch_flush(struct context *ctx) {
+  struct server_pool *sp = &ctx->pool;
+  struct conn *conn;
+
+  while ((conn = TAILQ_FIRST(&sp->batch_conn_q)) != NULL) {
+    rstatus_t status;
+    uint32_t nmax = sp->datastore_batch_size;
+
+    server_batch_del(ctx, conn);
+
+    if (conn->type == CONN_DNODE_PEER_SERVER) {
+      // one dnode frame per write
+      nmax = sp->peer_batch_size;
+      stats_histo_add(ctx, peer_batch_wait, dn_usec_now() - conn->batch_usec);
+    }
+
+    status = msg_send_batch(ctx, conn, nmax, SERVER_BATCH_BYTES);
+    if (status != DN_OK || conn->err) {
+      log_info("%s batch send failed: %s", print_obj(conn), strerror(errno));
+      core_close(ctx, conn);
+      continue;
+    }
+
+    if (!TAILQ_EMPTY(&conn->imsg_q)) {
+      status = conn_event_add_out(conn);
+      if (status != DN_OK) {
+        conn->err = errno;
+        core_close(ctx, conn);
+      }
+    }
+  }
 }
 
 rstatus_t core_core(void *arg, uint32_t events) {
@@ -641,12 +687,19 @@ static rstatus_t core_process_messages(void) {
  */
 rstatus_t core_loop(struct context *ctx) {
   int nsd;
+  bool is_main = (ctx->worker_id == 0);
 
-  core_process_messages();
+  // Gossip messages and stats aggregation are handled by the main thread only.
+  if (is_main) {
+    core_process_messages();
+  } else {
+    worker_sync_state(ctx);
+  }
 
   core_timeout(ctx);
   execute_expired_tasks(0);
   ctx->timeout = MIN(ctx->timeout, time_to_next_task());
+  core_batch_flush(ctx);
   nsd = event_wait(ctx->evb, (int)ctx->timeout);
   if (nsd < 0) {
     return nsd;
@@ -664,7 +717,9 @@ rstatus_t core_loop(struct context *ctx) {
           TAILQ_REMOVE(&sp->ready_conn_q, conn, ready_tqe);
       }
   }*/
-  stats_swap(ctx->stats);
+  if (is_main) {
+    stats_sample_free_queues(ctx->stats);
+  }
 
   return DN_OK;
 }
@@ -25,6 +25,7 @@
 
 #include "dyn_array.h"
 #include "dyn_cbuf.h"
+#include "dyn_compress.h"
 #include "dyn_connection.h"
 #include "dyn_connection_pool.h"
 #include "dyn_crypto.h"
@@ -34,8 +35,8 @@
 #include "dyn_message.h"
 #include "dyn_queue.h"
 #include "dyn_rbtree.h"
+#include "dyn_read_cache.h"
 #include "dyn_ring_queue.h"
-#include "dyn_setting.h"
 #include "dyn_stats.h"
 #include "dyn_string.h"
 #include "dyn_types.h"
@@ -137,6 +138,7 @@ struct rack {
   uint32_t
       nserver_continuum; /* # servers - live and dead on continuum (const) */
   struct array continuums;
+  struct token_table *table; /* flat copy of continuums, NULL if unusable */
 };
 
 struct datacenter {
@@ -154,6 +156,40 @@ struct endpoint {
   struct sockaddr *addr; /* socket address (ref in conf_server) */
 };
 
+/* Log-linear buckets of replica_load, 4 per power of 2 up to 2^25 usec */
+#define REPLICA_LOAD_PRECISION 2
+#define REPLICA_LOAD_MAX_USEC ((1ULL << 25) - 1)
+#define REPLICA_LOAD_NBUCKETS \
+  ((25 - REPLICA_LOAD_PRECISION + 1) << REPLICA_LOAD_PRECISION)
+
+/*
+ * Load of a replica as seen from this node, which picks the replica a DC_ONE
+ * read goes to under adaptive_replica_selection and when to hedge it.
+ */
+struct replica_load {
+  usec_t latency_us;    /* EWMA of its response times, 0 until one is in */
+  usec_t updated_us;    /* when the last response time was taken in */
+  uint32_t outstanding; /* requests queued to it or awaiting a response */
+  uint32_t count;       /* response times in buckets */
+  uint32_t buckets[REPLICA_LOAD_NBUCKETS]; /* recent response times */
+};
+
+/*
+ * Requests a peer in another datacenter may have in flight, adapted to its
+ * response times: the limit grows while they hold near the fastest seen and
+ * is cut by a tenth when they climb, the sign of requests queueing up on the
+ * peer.
+ */
+struct peer_limit {
+  uint32_t limit;    /* requests it may have in flight, 0 until the first */
+  uint32_t inflight; /* requests sent or picked to be sent, not yet answered */
+  uint32_t grown;    /* responses since the limit last grew */
+  usec_t rtt_us;     /* baseline response time, 0 until one is in */
+  usec_t cut_us;     /* when the limit was last cut */
+  bool slow_start;   /* grow by one a response, until the first cut */
+  bool blocked;      /* a connection stopped sending on the limit */
+};
+
 struct datastore {
   struct object obj;
   uint32_t idx;              /* server index */
@@ -166,6 +202,7 @@ struct datastore {
 
   msec_t next_retry_ms;   /* next retry time in msec */
   uint32_t failure_count; /* # consecutive failures */
+  struct replica_load load; /* as the replica of the local node */
 };
 
 /** \struct node
@@ -191,6 +228,8 @@ struct node {
   unsigned processed : 1; /* flag to indicate whether this has been processed */
   unsigned is_secure : 1; /* is the connection to the server secure? */
   dyn_state_t state;      /* state of the server - used mainly in peers  */
+  struct replica_load load; /* of a remote peer, see the datastore for ours */
+  struct peer_limit limit;  /* requests it may have in flight */
 };
 
 /** \struct server_pool
@@ -210,6 +249,7 @@ struct server_pool {
   struct conn *p_conn;          /* proxy connection (listener) */
   struct conn_tqh c_conn_q;     /* client connection q */
   struct conn_tqh ready_conn_q; /* ready connection q */
+  struct conn_tqh batch_conn_q; /* datastore conns with requests to batch */
 
   struct datastore *datastore; /* underlying datastore */
   struct array datacenters;    /* racks info  */
@@ -248,6 +288,7 @@ struct server_pool {
   /* none | datacenter | rack | all in order of increasing number of
    * connections. (default is datacenter) */
   secure_server_option_t secure_server_option;
+  secure_cipher_t secure_cipher; /* cipher of requests to secured peers */
   struct string pem_key_file;
   struct string recon_key_file; /* file with Key encryption in reconciliation */
   struct string
@@ -258,6 +299,20 @@ struct server_pool {
   bool enable_gossip;             /* enable/disable gossip */
   size_t mbuf_size;               /* mbuf chunk size */
   size_t alloc_msgs_max;          /* allocated messages buffer size */
+  uint32_t splice_threshold;      /* min bulk reply size to splice(), 0 off */
+  uint32_t datastore_batch_size;  /* max requests per datastore write */
+  uint32_t peer_batch_size;       /* max messages per dnode frame */
+  bool remote_dc_compression;     /* compress payloads to remote dc peers */
+  struct read_cache *read_cache;  /* hot key read cache, NULL if off */
+  uint32_t top_keys;              /* hot and big keys to report, 0 is off */
+  uint32_t top_keys_sample_rate;  /* sample one request in this many */
+  uint32_t histogram_precision;   /* log2 of histogram buckets per power of 2 */
+  uint32_t trace_sample_rate;     /* trace one request in this many, 0 is off */
+  bool adaptive_replica_selection; /* DC_ONE reads may go to other racks */
+  uint32_t hedge_read_percentile; /* replica latency percentile to hedge at */
+  uint32_t hedge_read_budget;     /* percent of reads that may be hedged */
+  bool quorum_digest_reads;       /* other racks send digests of quorum reads */
+  uint32_t peer_concurrency_max;  /* cap on a peer's requests in flight, or 0 */
 };
 
 /** \struct context
@@ -272,6 +327,7 @@ struct context {
   struct instance *instance; /* back pointer to instance */
   struct conf *cf;           /* configuration */
   struct stats *stats;       /* stats */
+  struct stats_counters *stats_counters; /* stats counters of this thread */
   struct entropy *entropy;   /* reconciliation connection */
   struct server_pool pool;   /* server_pool[] */
   struct event_base *evb;    /* event base */
@@ -280,12 +336,14 @@ struct context {
   dyn_state_t dyn_state;     /* state of the node.  Don't need volatile as
                                 it is ok to eventually get its new value */
   uint32_t admin_opt;        /* admin mode */
+  uint32_t worker_id;        /* event loop thread, 0 is the main thread */
 };
 
 rstatus_t core_start(struct instance *nci);
 void core_stop(struct context *ctx);
 rstatus_t core_core(void *arg, uint32_t events);
 rstatus_t core_loop(struct context *ctx);
+void core_batch_flush(struct context *ctx);
 void core_debug(struct context *ctx);
 void core_set_local_state(struct context *ctx, dyn_state_t state);
 char *print_server_pool(const struct object *obj);
@@ -0,0 +1,139 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+/*
+ * Measures the checksum quorum reads take of each response, over responses
+ * of 1KB to 1MB. Compares the table crc32 responses used to be checksummed
+ * with against crc32c, from its table and from the crc32 instructions.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dyn_types.h"
+#include "dyn_util.h"
+#include "hashkit/dyn_hashkit.h"
+
+#define CRC_BENCH_BYTES (256U * 1024 * 1024)
+#define CRC_BENCH_MAX_SIZE (1024U * 1024)
+
+static struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"bytes", required_argument, NULL, 'n'},
+    {NULL, 0, NULL, 0}};
+
+static char short_options[] = "hn:";
+
+static void print_usage(void) {
+  printf("Usage: dynomite-crc-bench [-h] [-n bytes]\n");
+  printf("Time the response checksums of quorum reads, crc32 against crc32c,\n");
+  printf("for responses of 1KB to 1MB.\n\n");
+  printf("Options:\n");
+  printf("  -h, --help             : this help\n");
+  printf("  -n, --bytes=N          : bytes checksummed per run (default: %u)\n\n",
+         CRC_BENCH_BYTES);
+}
+
+static uint64_t crc_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t crc_bench_crc32(const uint8_t *buf, size_t len) {
+  return crc32_sz((const char *)buf, len, 0);
+}
+
+static uint32_t crc_bench_crc32c_sw(const uint8_t *buf, size_t len) {
+  return crc32c_sw(buf, len, 0);
+}
+
+static uint32_t crc_bench_crc32c(const uint8_t *buf, size_t len) {
+  return crc32c(buf, len, 0);
+}
+
+/*
+ * Checksums 'nbyte' bytes as responses of 'size' bytes, and returns the time
+ * per response in ns. Responses start at varying offsets, the way they sit in
+ * mbufs.
+ */
+static double crc_bench_run(uint32_t (*fn)(const uint8_t *, size_t),
+                            const uint8_t *buf, size_t size, size_t nbyte,
+                            uint32_t *sink) {
+  size_t i, n = nbyte / size;
+  uint64_t start;
+
+  if (n == 0) {
+    n = 1;
+  }
+  start = crc_now_ns();
+  for (i = 0; i < n; i++) {
+    *sink ^= fn(buf + (i & 7), size);
+  }
+  return (double)(crc_now_ns() - start) / (double)n;
+}
+
+int main(int argc, char **argv) {
+  static const size_t sizes[] = {1024,       4 * 1024,   16 * 1024,
+                                 64 * 1024,  256 * 1024, 1024 * 1024};
+  size_t nbyte = CRC_BENCH_BYTES;
+  uint32_t sink = 0;
+  uint8_t *buf;
+  size_t i;
+  int c;
+
+  for (;;) {
+    c = getopt_long(argc, argv, short_options, long_options, NULL);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+      case 'n':
+        nbyte = (size_t)atol(optarg);
+        if (nbyte == 0) {
+          print_usage();
+          return 1;
+        }
+        break;
+
+      case 'h':
+      default:
+        print_usage();
+        return c == 'h' ? 0 : 1;
+    }
+  }
+
+  buf = malloc(CRC_BENCH_MAX_SIZE + 8);
+  if (buf == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  srandom(1);
+  for (i = 0; i < CRC_BENCH_MAX_SIZE + 8; i++) {
+    buf[i] = (uint8_t)random();
+  }
+
+  printf("crc32c instructions: %s\n", crc32c_hw_available() ? "yes" : "no");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    double crc32_ns, sw_ns, hw_ns;
+
+    crc32_ns = crc_bench_run(crc_bench_crc32, buf, sizes[i], nbyte, &sink);
+    sw_ns = crc_bench_run(crc_bench_crc32c_sw, buf, sizes[i], nbyte, &sink);
+    hw_ns = crc_bench_run(crc_bench_crc32c, buf, sizes[i], nbyte, &sink);
+
+    printf("%5zuKB: crc32 %10.0f ns (%5.2f GB/s), crc32c table %10.0f ns "
+           "(%5.2f GB/s), crc32c %10.0f ns (%5.2f GB/s)\n",
+           sizes[i] / 1024, crc32_ns, (double)sizes[i] / crc32_ns, sw_ns,
+           (double)sizes[i] / sw_ns, hw_ns, (double)sizes[i] / hw_ns);
+  }
+
+  free(buf);
+  return sink == 0x5a5a5a5a ? 2 : 0;
+}
@@ -19,10 +19,9 @@ static const EVP_CIPHER *aes_cipher;
 static RSA *rsa;
 static int rsa_size = 0;
 
-static unsigned char aes_key[AES_KEYLEN + 1];
-
-static EVP_CIPHER_CTX *aes_encrypt_ctx;
-static EVP_CIPHER_CTX *aes_decrypt_ctx;
+/* Cipher contexts are not shareable, so every event loop thread owns a pair. */
+static __thread EVP_CIPHER_CTX *aes_encrypt_ctx;
+static __thread EVP_CIPHER_CTX *aes_decrypt_ctx;
 
 /**
  * Read the PEM key file.
@@ -115,10 +114,10 @@ static rstatus_t load_private_rsa_key(struct server_pool *sp) {
 }
 
 /**
- * Initialize AES.
+ * Create the calling thread's AES encrypt and decrypt contexts.
  * @return rstatus_t Return status code.
  */
-static rstatus_t aes_init(void) {
+static rstatus_t aes_ctx_init(void) {
 // Initialize contexts
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
   aes_encrypt_ctx = (EVP_CIPHER_CTX *)malloc(sizeof(EVP_CIPHER_CTX));
@@ -145,12 +144,21 @@ static rstatus_t aes_init(void) {
   // EVP_CIPHER_CTX_set_padding(aes_decrypt_ctx, RSA_PKCS1_PADDING);
   EVP_CIPHER_CTX_set_padding(aes_decrypt_ctx, RSA_NO_PADDING);
 
+  return DN_OK;
+}
+
+/**
+ * Initialize AES.
+ * @return rstatus_t Return status code.
+ */
+static rstatus_t aes_init(void) {
+  THROW_STATUS(aes_ctx_init());
+
   // Init AES
   aes_cipher = EVP_aes_128_cbc();
 
-  if (RAND_bytes(aes_key, AES_KEYLEN) == 0) {
-    return DN_ERROR;
-  }
+  unsigned char aes_key[AES_KEYLEN + 1];
+  THROW_STATUS(generate_aes_key(aes_key));
 
   return DN_OK;
 }
@@ -174,6 +182,20 @@ rstatus_t crypto_init(struct server_pool *sp) {
   return DN_OK;
 }
 
+/**
+ * Initialize the calling worker thread's AES cipher contexts. The key and
+ * the RSA private key loaded by crypto_init() are shared.
+ * @param[in] sp Server pool.
+ * @return rstatus_t Return status code.
+ */
+rstatus_t crypto_thread_init(struct server_pool *sp) {
+  if (sp->secure_server_option == SECURE_OPTION_NONE) {
+    return DN_OK;
+  }
+
+  return aes_ctx_init();
+}
+
 rstatus_t crypto_deinit(void) {
   if (aes_encrypt_ctx != NULL) {
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
@@ -467,6 +489,143 @@ rstatus_t dyn_aes_encrypt_msg(struct msg *msg, unsigned char *arg_aes_key,
   return DN_OK;
 }
 
+/*
+ * AES-256-GCM state of a secured peer connection. Both cipher contexts are
+ * keyed with the connection's AES key when first used and live as long as the
+ * connection, so sealing or opening a message only sets its nonce. A nonce is
+ * the salt followed by the number of messages sealed so far; the top bit of
+ * the salt differs between the two ends of a connection, which share the key.
+ */
+struct aes_gcm {
+  EVP_CIPHER_CTX *encrypt_ctx;
+  EVP_CIPHER_CTX *decrypt_ctx;
+  uint8_t salt[4];
+  uint64_t seq;
+};
+
+static void aes_gcm_destroy(struct aes_gcm *gcm) {
+  if (gcm->encrypt_ctx != NULL) {
+    EVP_CIPHER_CTX_free(gcm->encrypt_ctx);
+  }
+  if (gcm->decrypt_ctx != NULL) {
+    EVP_CIPHER_CTX_free(gcm->decrypt_ctx);
+  }
+  dn_free(gcm);
+}
+
+static struct aes_gcm *aes_gcm_get(struct conn *conn) {
+  struct aes_gcm *gcm = conn->aes_gcm;
+
+  if (gcm != NULL) {
+    return gcm;
+  }
+
+  gcm = dn_zalloc(sizeof(*gcm));
+  if (gcm == NULL) {
+    return NULL;
+  }
+
+  gcm->encrypt_ctx = EVP_CIPHER_CTX_new();
+  gcm->decrypt_ctx = EVP_CIPHER_CTX_new();
+  if (gcm->encrypt_ctx == NULL || gcm->decrypt_ctx == NULL ||
+      !EVP_EncryptInit_ex(gcm->encrypt_ctx, EVP_aes_256_gcm(), NULL,
+                          conn->aes_key, NULL) ||
+      !EVP_DecryptInit_ex(gcm->decrypt_ctx, EVP_aes_256_gcm(), NULL,
+                          conn->aes_key, NULL) ||
+      RAND_bytes(gcm->salt, sizeof(gcm->salt)) != 1) {
+    log_error("AES-GCM setup failed on %s", print_obj(conn));
+    aes_gcm_destroy(gcm);
+    return NULL;
+  }
+
+  if (conn->type == CONN_DNODE_PEER_CLIENT) {
+    gcm->salt[0] |= 0x80;
+  } else {
+    gcm->salt[0] &= 0x7f;
+  }
+
+  conn->aes_gcm = gcm;
+  return gcm;
+}
+
+/*
+ *  AES-GCM encrypt a msg with one or more buffers in place, as one sealed
+ *  message, and write its nonce and tag to gcm_data
+ */
+rstatus_t dyn_aes_gcm_encrypt_msg(struct conn *conn, struct msg *msg,
+                                  uint8_t *gcm_data, size_t *outlen) {
+  struct aes_gcm *gcm = aes_gcm_get(conn);
+  struct mbuf *mbuf;
+  size_t count = 0;
+  unsigned i;
+  int len;
+
+  if (gcm == NULL) {
+    return DN_ENOMEM;
+  }
+
+  memcpy(gcm_data, gcm->salt, sizeof(gcm->salt));
+  for (i = 0; i < 8; i++) {
+    gcm_data[sizeof(gcm->salt) + i] = (uint8_t)(gcm->seq >> (56 - 8 * i));
+  }
+  gcm->seq++;
+
+  if (!EVP_EncryptInit_ex(gcm->encrypt_ctx, NULL, NULL, NULL, gcm_data)) {
+    return DN_ERROR;
+  }
+
+  STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+    if (mbuf_length(mbuf) != 0 &&
+        !EVP_EncryptUpdate(gcm->encrypt_ctx, mbuf->pos, &len, mbuf->pos,
+                           (int)mbuf_length(mbuf))) {
+      return DN_ERROR;
+    }
+    count += mbuf_length(mbuf);
+  }
+
+  if (!EVP_EncryptFinal_ex(gcm->encrypt_ctx, gcm_data + AES_GCM_IV_LEN, &len) ||
+      !EVP_CIPHER_CTX_ctrl(gcm->encrypt_ctx, EVP_CTRL_GCM_GET_TAG,
+                           AES_GCM_TAG_LEN, gcm_data + AES_GCM_IV_LEN)) {
+    return DN_ERROR;
+  }
+
+  *outlen = count;
+  return DN_OK;
+}
+
+/*
+ *  AES-GCM decrypt len bytes in place. Fails if they do not match the nonce
+ *  and tag in gcm_data.
+ */
+rstatus_t dyn_aes_gcm_decrypt(struct conn *conn, uint8_t *data, size_t len,
+                              const uint8_t *gcm_data) {
+  struct aes_gcm *gcm = aes_gcm_get(conn);
+  int outlen;
+
+  if (gcm == NULL) {
+    return DN_ENOMEM;
+  }
+
+  if (!EVP_DecryptInit_ex(gcm->decrypt_ctx, NULL, NULL, NULL, gcm_data) ||
+      !EVP_DecryptUpdate(gcm->decrypt_ctx, data, &outlen, data, (int)len) ||
+      !EVP_CIPHER_CTX_ctrl(gcm->decrypt_ctx, EVP_CTRL_GCM_SET_TAG,
+                           AES_GCM_TAG_LEN,
+                           (void *)(gcm_data + AES_GCM_IV_LEN)) ||
+      EVP_DecryptFinal_ex(gcm->decrypt_ctx, data + outlen, &outlen) <= 0) {
+    return DN_ERROR;
+  }
+
+  return DN_OK;
+}
+
+/* Drop the AES-GCM state of a conn, when it closes or its key changes. */
+void dyn_aes_gcm_free(struct conn *conn) {
+  if (conn->aes_gcm != NULL) {
+    aes_gcm_destroy(conn->aes_gcm);
+    conn->aes_gcm = NULL;
+  }
+}
+
 rstatus_t aes_decrypt(unsigned char *enc_msg, size_t enc_msg_len,
                       unsigned char **dec_msg, unsigned char *arg_aes_key) {
   size_t dec_len = 0;
@@ -505,13 +664,17 @@ rstatus_t aes_decrypt(unsigned char *enc_msg, size_t enc_msg_len,
   return (int)dec_len;
 }
 
-unsigned char *generate_aes_key(void) {
+/*
+ * Fill 'aes_key', of AES_KEYLEN + 1 bytes, with a random key and a NUL. The
+ * caller owns the buffer, as connections get their keys on several threads.
+ */
+rstatus_t generate_aes_key(unsigned char *aes_key) {
   if (RAND_bytes(aes_key, AES_KEYLEN) == 0) {
-    return NULL;
+    return DN_ERROR;
   }
   aes_key[AES_KEYLEN] = '\0';
 
-  return aes_key;
+  return DN_OK;
 }
 
 int dyn_rsa_size(void) { return rsa_size; }
@@ -23,12 +23,21 @@
 
 #define AES_KEYLEN 32
 
+/* Nonce and tag of a peer message sealed with AES-256-GCM, carried in the
+ * data field of its dnode header. */
+#define AES_GCM_IV_LEN 12
+#define AES_GCM_TAG_LEN 16
+#define AES_GCM_DATA_LEN (AES_GCM_IV_LEN + AES_GCM_TAG_LEN)
+
 // Forward declarations
+struct aes_gcm;
+struct conn;
 struct mbuf;
 struct msg;
 struct server_pool;
 
 rstatus_t crypto_init(struct server_pool *sp);
+rstatus_t crypto_thread_init(struct server_pool *sp);
 rstatus_t crypto_deinit(void);
 
 char *base64_encode(const unsigned char *message, const size_t length);
@@ -46,7 +55,13 @@ rstatus_t dyn_aes_decrypt(unsigned char *encMsg, size_t encMsgLen,
 
 rstatus_t dyn_aes_encrypt_msg(struct msg *msg, unsigned char *aes_key,
                               size_t *outlen);
-unsigned char *generate_aes_key(void);
+rstatus_t generate_aes_key(unsigned char *aes_key);
+
+rstatus_t dyn_aes_gcm_encrypt_msg(struct conn *conn, struct msg *msg,
+                                  uint8_t *gcm_data, size_t *outlen);
+rstatus_t dyn_aes_gcm_decrypt(struct conn *conn, uint8_t *data, size_t len,
+                              const uint8_t *gcm_data);
+void dyn_aes_gcm_free(struct conn *conn);
 
 int dyn_rsa_size(void);
 
@@ -219,6 +219,9 @@ static rstatus_t dnode_client_handle_response(struct context *ctx, struct conn *
   ASSERT_LOG(!req->selected_rsp, "req %lu:%lu has selected_rsp set", req->id,
              req->parent_id);
   status = msg_handle_response(ctx, req, rsp);
+  if (status == DN_OK) {
+    trace_hop(req, TRACE_quorum);
+  }
   if (conn->waiting_to_unref) {
     dictDelete(conn->outstanding_msgs_dict, &reqid);
     log_info("Putting %s", print_obj(req));
@@ -333,6 +336,7 @@ static void dnode_req_recv_done(struct context *ctx, struct conn *conn,
   }
 
   log_debug(LOG_VERB, "received req %d:%d", req->id, req->parent_id);
+  trace_hop(req, TRACE_parse_done);
   dnode_req_forward(ctx, conn, req);
 }
 
@@ -344,7 +348,7 @@ static void dnode_req_client_enqueue_omsgq(struct context *ctx,
   log_debug(LOG_VERB, "conn %p enqueue outq %p", conn, req);
   TAILQ_INSERT_TAIL(&conn->omsg_q, req, c_tqe);
 
-  histo_add(&ctx->stats->dnode_client_out_queue, TAILQ_COUNT(&conn->omsg_q));
+  stats_histo_add(ctx, dnode_client_out_queue, TAILQ_COUNT(&conn->omsg_q));
   stats_pool_incr(ctx, dnode_client_out_queue);
   stats_pool_incr_by(ctx, dnode_client_out_queue_bytes, req->mlen);
 }
@@ -357,12 +361,44 @@ static void dnode_req_client_dequeue_omsgq(struct context *ctx,
   TAILQ_REMOVE(&conn->omsg_q, req, c_tqe);
   log_debug(LOG_VERB, "conn %p dequeue outq %p", conn, req);
 
-  histo_add(&ctx->stats->dnode_client_out_queue, TAILQ_COUNT(&conn->omsg_q));
+  stats_histo_add(ctx, dnode_client_out_queue, TAILQ_COUNT(&conn->omsg_q));
   stats_pool_decr(ctx, dnode_client_out_queue);
   stats_pool_decr_by(ctx, dnode_client_out_queue_bytes, req->mlen);
 }
 
 /* dnode sends a response back to a peer  */
+/* What a response carries when its header holds the digest of the value */
+static const struct string digest_rsp = string("+DIGEST\r\n");
+
+/*
+ * Replace the value in the response to a quorum read with its digest, which
+ * the coordinator compares with the value the local rack sent it. A response
+ * no longer than what replaces it is left as it is.
+ */
+static bool dnode_rsp_digest(struct msg *rsp, uint32_t *digest) {
+  struct mbuf *mbuf;
+
+  if (msg_length(rsp) <= digest_rsp.len + DMSG_DIGEST_LEN) {
+    return false;
+  }
+  mbuf = mbuf_get();
+  if (mbuf == NULL) {
+    return false;
+  }
+
+  *digest = msg_payload_crc32(rsp);
+  while (!STAILQ_EMPTY(&rsp->mhdr)) {
+    struct mbuf *b = STAILQ_FIRST(&rsp->mhdr);
+    mbuf_remove(&rsp->mhdr, b);
+    mbuf_put(b);
+  }
+  mbuf_write_string(mbuf, &digest_rsp);
+  mbuf_insert(&rsp->mhdr, mbuf);
+  rsp->mlen = mbuf_length(mbuf);
+  rsp->crc_done = 0;
+  return true;
+}
+
 static struct msg *dnode_rsp_send_next(struct context *ctx, struct conn *conn) {
   rstatus_t status;
 
@@ -427,12 +463,16 @@ static struct msg *dnode_rsp_send_next(struct context *ctx, struct conn *conn) {
       return rsp;
     }
 
-    struct mbuf *header_buf = mbuf_get();
+    struct mbuf *header_buf = mbuf_get_sized(DMSG_HEADER_MAX_SIZE);
     if (header_buf == NULL) {
       loga("Unable to obtain an mbuf for header!");
       return NULL;  // need to address error here properly
     }
     dmsg_type_t msg_type = DMSG_RES;
+    bool compressed = false;
+    uint32_t digest = 0;
+    bool digested = (req->dmsg->flags & DMSG_FLAG_DIGEST) && !rsp->is_error &&
+                    dnode_rsp_digest(rsp, &digest);
     // TODOs: need to set the outcoming conn to be secured too if the incoming
     // conn is secured
     if (req->owner->dnode_secured || conn->dnode_secured) {
@@ -444,7 +484,24 @@ static struct msg *dnode_rsp_send_next(struct context *ctx, struct conn *conn) {
           loga("AES encryption key: %s\n", (char *)encoded_aes_key);
       }
 
-      if (ENCRYPTION) {
+      if (ENCRYPTION && (req->dmsg->flags & DMSG_FLAG_AES_GCM)) {
+        // answer in the cipher the request came in
+        uint8_t gcm_data[AES_GCM_DATA_LEN];
+        size_t encrypted_bytes;
+
+        // compressed before it is sealed
+        compressed = dmsg_compress(ctx, conn, rsp);
+        status = dyn_aes_gcm_encrypt_msg(conn, rsp, gcm_data, &encrypted_bytes);
+        if (status != DN_OK) {
+          loga("AES-GCM encryption failed on %s", print_obj(conn));
+          mbuf_put(header_buf);
+          rsp_put(rsp);
+          return NULL;
+        }
+
+        dmsg_write_gcm(header_buf, msg_id, msg_type, conn,
+                       (uint32_t)encrypted_bytes, gcm_data);
+      } else if (ENCRYPTION) {
         size_t encrypted_bytes;
         status = dyn_aes_encrypt_msg(rsp, conn->aes_key, &encrypted_bytes);
         if (status != DN_OK) {
@@ -473,9 +530,16 @@ static struct msg *dnode_rsp_send_next(struct context *ctx, struct conn *conn) {
     } else {
       // write dnode header
       log_debug(LOG_VERB, "sending dnode response with msg_id %u", msg_id);
+      compressed = dmsg_compress(ctx, conn, rsp);
       dmsg_write(header_buf, msg_id, msg_type, conn, msg_length(rsp));
     }
 
+    if (compressed) {
+      dmsg_set_compressed(header_buf);
+    }
+    if (digested) {
+      dmsg_set_digest(header_buf, digest);
+    }
     rsp->dnode_header_prepended = 1;
     mbuf_insert_head(&rsp->mhdr, header_buf);
 
@@ -512,6 +576,7 @@ static void dnode_rsp_send_done(struct context *ctx, struct conn *conn,
 
   /* dequeue request from client outq */
   conn_dequeue_outq(ctx, conn, req);
+  trace_hop(req, TRACE_client_send);
 
   req_put(req);
 }
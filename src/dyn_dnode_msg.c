@@ -3,6 +3,7 @@
  * storages. Copyright (C) 2014 Netflix, Inc.
  */
 
+#include <arpa/inet.h>
 #include <ctype.h>
 
 #include "dyn_dnode_msg.h"
@@ -12,19 +13,144 @@
 #include "dyn_server.h"
 #include "proto/dyn_proto.h"
 
-static uint8_t version = VERSION_10;
+static uint8_t version = VERSION_14;
 
-static uint64_t dmsg_id;           /* message id counter */
-static struct dmsg_tqh free_dmsgq; /* free msg q */
+static __thread uint64_t dmsg_id;           /* message id counter */
+static __thread struct dmsg_tqh free_dmsgq; /* free msg q */
 
 static const struct string MAGIC_STR = string("   $2014$ ");
 static const struct string CRLF_STR = string(CRLF);
 
-static unsigned char aes_encrypted_buf[130];
-static unsigned char aes_decrypted_buf[34];
+static __thread unsigned char aes_encrypted_buf[130];
+static __thread unsigned char aes_decrypted_buf[34];
 
 static rstatus_t dmsg_to_gossip(struct ring_msg *rmsg);
 
+/*
+ * Asks for more of a binary header, and moves one cut off near the end of an
+ * mbuf to one it fits in.
+ */
+static bool dyn_parse_bin_again(struct msg *r, struct mbuf *b) {
+  if (r->pos != b->start &&
+      (size_t)(b->end - r->pos) < sizeof(struct dmsg_bin_header) +
+                                      DMSG_HEADER_MAX_SIZE) {
+    r->result = MSG_PARSE_REPAIR;
+  } else {
+    r->result = MSG_PARSE_AGAIN;
+  }
+  return false;
+}
+
+/* Moves past a binary header to the payload, once its data is in at 'data'. */
+static void dyn_parse_bin_data(struct msg *r, struct dmsg *dmsg,
+                               struct mbuf *b, uint8_t *data) {
+  uint8_t *p = data + dmsg->mlen;
+
+  dmsg->data = data;
+  r->mlen -= (uint32_t)(p - r->pos);
+  r->pos = p;
+  b->pos = p;
+  dmsg->payload = p;
+  r->dyn_parse_state = DYN_DONE;
+}
+
+/*
+ * Parses a binary header at r->pos, once it and its data have arrived in the
+ * last mbuf. A header that opens a frame leaves what its messages share on
+ * the connection.
+ */
+static bool dyn_parse_bin_header(struct msg *r, struct dmsg *dmsg,
+                                 struct mbuf *b) {
+  struct conn *conn = r->owner;
+  struct dmsg_bin_header hdr;
+  size_t avail = (size_t)(b->last - r->pos);
+  uint32_t min_mlen = 0;
+
+  if (avail < sizeof(hdr)) {
+    return dyn_parse_bin_again(r, b);
+  }
+
+  memcpy(&hdr, r->pos, sizeof(hdr));
+  dmsg->mlen = ntohl(hdr.mlen);
+  if (hdr.flags & DMSG_FLAG_TRACED) {
+    min_mlen += DMSG_TRACE_ID_LEN;
+  }
+  if ((hdr.flags & DMSG_FLAG_DIGEST) && hdr.type == DMSG_RES) {
+    min_mlen += DMSG_DIGEST_LEN;
+  }
+  if (hdr.magic[1] != DMSG_BIN_MAGIC1 || dmsg->mlen > DMSG_HEADER_MAX_SIZE ||
+      dmsg->mlen < min_mlen) {
+    log_error("bad binary dmsg header with %u bytes of data on %s", dmsg->mlen,
+              print_obj(conn));
+    r->result = MSG_PARSE_ERROR;
+    errno = EINVAL;
+    return false;
+  }
+
+  if (avail < sizeof(hdr) + dmsg->mlen) {
+    return dyn_parse_bin_again(r, b);
+  }
+
+  dmsg->id = ((uint64_t)ntohl(hdr.id_hi) << 32) | ntohl(hdr.id_lo);
+  dmsg->type = hdr.type;
+  dmsg->flags = hdr.flags & (0xF | DMSG_FLAG_DIGEST) & ~DMSG_FLAG_BATCH;
+  dmsg->version = hdr.version;
+  dmsg->same_dc = hdr.same_dc;
+  dmsg->plen = ntohl(hdr.plen);
+
+  if (hdr.flags & DMSG_FLAG_BATCH) {
+    conn->dmsg_frame_id = dmsg->id;
+    conn->dmsg_frame_left = ntohs(hdr.batch);
+    conn->dmsg_frame_type = hdr.type;
+    conn->dmsg_frame_flags = dmsg->flags;
+    conn->dmsg_frame_same_dc = hdr.same_dc;
+  }
+
+  dyn_parse_bin_data(r, dmsg, b, r->pos + sizeof(hdr));
+
+  if (hdr.flags & DMSG_FLAG_TRACED) {
+    uint32_t trace_id[2];
+
+    dmsg->mlen -= DMSG_TRACE_ID_LEN;
+    memcpy(trace_id, dmsg->data + dmsg->mlen, sizeof(trace_id));
+    dmsg->trace_id = ((uint64_t)ntohl(trace_id[0]) << 32) | ntohl(trace_id[1]);
+  }
+  if ((hdr.flags & DMSG_FLAG_DIGEST) && hdr.type == DMSG_RES) {
+    uint32_t digest;
+
+    dmsg->mlen -= DMSG_DIGEST_LEN;
+    memcpy(&digest, dmsg->data + dmsg->mlen, sizeof(digest));
+    dmsg->digest = ntohl(digest);
+  }
+  return true;
+}
+
+/* Parses the sub header of the next message in a frame. */
+static bool dyn_parse_bin_sub_header(struct msg *r, struct dmsg *dmsg,
+                                     struct mbuf *b) {
+  struct conn *conn = r->owner;
+  struct dmsg_bin_sub_header sub;
+  size_t avail = (size_t)(b->last - r->pos);
+
+  dmsg->mlen = (conn->dmsg_frame_flags & DMSG_FLAG_AES_GCM) ? AES_GCM_DATA_LEN
+                                                            : 0;
+  if (avail < sizeof(sub) + dmsg->mlen) {
+    return dyn_parse_bin_again(r, b);
+  }
+
+  memcpy(&sub, r->pos, sizeof(sub));
+  dmsg->id = conn->dmsg_frame_id + ntohl(sub.id_delta);
+  dmsg->type = conn->dmsg_frame_type;
+  dmsg->flags = conn->dmsg_frame_flags;
+  dmsg->version = VERSION_11;
+  dmsg->same_dc = conn->dmsg_frame_same_dc;
+  dmsg->plen = ntohl(sub.plen);
+  conn->dmsg_frame_left--;
+
+  dyn_parse_bin_data(r, dmsg, b, r->pos + sizeof(sub));
+  return true;
+}
+
 static bool dyn_parse_core(struct msg *r) {
   struct dmsg *dmsg;
   struct mbuf *b;
@@ -51,6 +177,22 @@ static bool dyn_parse_core(struct msg *r) {
     dmsg->owner = r;
   }
 
+  if (r->owner->dmsg_frame_left != 0) {
+    if (!dyn_parse_bin_sub_header(r, dmsg, b)) {
+      return false;
+    }
+    p = r->pos;
+    goto done;
+  }
+
+  if (r->pos < b->last && *r->pos == DMSG_BIN_MAGIC0) {
+    if (!dyn_parse_bin_header(r, dmsg, b)) {
+      return false;
+    }
+    p = r->pos;
+    goto done;
+  }
+
   token = NULL;
 
   for (p = r->pos; p < b->last; p++) {
@@ -356,6 +498,22 @@ split:
 done:
   r->pos = p;
   dmsg->source_address = r->owner->addr;
+  if (dmsg->version >= VERSION_11) {
+    r->owner->dmsg_binary = 1;
+  }
+  if (dmsg->version >= VERSION_12) {
+    r->owner->dmsg_compress = 1;
+  }
+  if (dmsg->version >= VERSION_13) {
+    r->owner->dmsg_trace = 1;
+  }
+  if (dmsg->version >= VERSION_14) {
+    r->owner->dmsg_digest = 1;
+  }
+  if (dmsg->trace_id != 0 && r->is_request) {
+    trace_start(r, dmsg->trace_id, TRACE_PEER);
+    trace_hop(r, TRACE_peer_recv);
+  }
   log_debug(LOG_DEBUG,
             "MSG ID: %d, type: %d, secured %d, version %d, "
             "same_dc %d, datalen %u, payload len: %u",
@@ -401,6 +559,146 @@ error:
   return false;
 }
 
+/*
+ * Opens a payload sealed with AES-GCM and/or compressed, once all of it is in
+ * mbuf 'b': it is decrypted in place if it matches its tag, and inflated into
+ * a new mbuf that takes the place of 'b', together with whatever followed the
+ * payload.
+ */
+rstatus_t dmsg_open_payload(struct context *ctx, struct msg *r,
+                            struct mbuf *b) {
+  struct dmsg *dmsg = r->dmsg;
+  struct conn *conn = r->owner;
+  uint8_t *end = dmsg->payload + dmsg->whole_len;
+  struct mbuf *nbuf;
+  rstatus_t status;
+
+  if ((dmsg->flags & DMSG_FLAG_AES_GCM) &&
+      dyn_aes_gcm_decrypt(conn, dmsg->payload, dmsg->whole_len,
+                          dmsg->gcm_data) != DN_OK) {
+    log_error("AES-GCM payload of %u bytes from %s failed to authenticate",
+              dmsg->whole_len, print_obj(conn));
+    return DN_ERROR;
+  }
+
+  if (dmsg->flags & DMSG_FLAG_COMPRESSED) {
+    usec_t start = dn_usec_now();
+
+    status = dyn_decompress(conn, dmsg->payload, dmsg->whole_len,
+                            (size_t)(b->last - end), &nbuf);
+    stats_pool_incr_by(ctx, peer_decompress_usec,
+                       (int64_t)(dn_usec_now() - start));
+    if (status != DN_OK) {
+      log_error("compressed payload of %u bytes from %s is corrupt",
+                dmsg->whole_len, print_obj(conn));
+      return status;
+    }
+
+    mbuf_copy(nbuf, end, (size_t)(b->last - end));
+    r->mlen = r->mlen - (uint32_t)(b->last - dmsg->payload) +
+              mbuf_length(nbuf);
+    mbuf_insert(&r->mhdr, nbuf);
+    mbuf_remove(&r->mhdr, b);
+    mbuf_put(b);
+    b = nbuf;
+    r->pos = b->pos;
+  }
+
+  b->flags |= MBUF_FLAGS_READ_FLIP;
+  return DN_OK;
+}
+
+/*
+ * Picks up an AES-GCM or compressed payload once its header is parsed. The
+ * payload is opened when all of it has arrived, in one mbuf, and is handed to
+ * the datastore parser only then. Returns true if it can be parsed now;
+ * otherwise msg_recv_chain() reads and opens the rest.
+ */
+static bool dyn_parse_whole(struct msg *r, struct context *ctx) {
+  struct dmsg *dmsg = r->dmsg;
+  struct conn *conn = r->owner;
+  struct mbuf *b = STAILQ_LAST(&r->mhdr, mbuf, next);
+  struct mbuf *nbuf;
+  uint32_t avail;
+  rstatus_t status;
+
+  r->dyn_parse_state = DYN_POST_DONE;
+
+  if (dmsg->plen > DMSG_MAX_WHOLE_PAYLOAD) {
+    log_error("bad dmsg header with %u bytes of payload on %s", dmsg->plen,
+              print_obj(conn));
+    goto error;
+  }
+
+  if (dmsg->flags & DMSG_FLAG_AES_GCM) {
+    conn->dnode_secured = 1;
+    conn->crypto_key_sent = 1;
+
+    // the nonce and tag, after an RSA encrypted AES key if there is a new one
+    if (dmsg->mlen != AES_GCM_DATA_LEN &&
+        dmsg->mlen != (uint32_t)dyn_rsa_size() + AES_GCM_DATA_LEN) {
+      log_error("bad AES-GCM header with %u bytes of data on %s", dmsg->mlen,
+                print_obj(conn));
+      goto error;
+    }
+
+    if (dmsg->mlen > AES_GCM_DATA_LEN) {
+      // a new AES key, before the nonce and tag
+      if (dyn_rsa_decrypt(dmsg->data, aes_decrypted_buf) != AES_KEYLEN) {
+        log_error("unable to decrypt the AES key from %s", print_obj(conn));
+        goto error;
+      }
+      memcpy(conn->aes_key, aes_decrypted_buf, AES_KEYLEN);
+      dyn_aes_gcm_free(conn);
+    }
+
+    memcpy(dmsg->gcm_data, dmsg->data + dmsg->mlen - AES_GCM_DATA_LEN,
+           AES_GCM_DATA_LEN);
+  }
+
+  dmsg->payload = b->pos;
+  dmsg->whole_len = dmsg->plen;
+
+  avail = (uint32_t)(b->last - b->pos);
+  if (avail >= dmsg->plen) {
+    status = dmsg_open_payload(ctx, r, b);
+    if (status == DN_ENOMEM) {
+      r->result = MSG_OOM_ERROR;
+      return false;
+    } else if (status != DN_OK) {
+      goto error;
+    }
+    dmsg->plen = 0;
+    return true;
+  }
+
+  if ((uint32_t)(b->end - b->pos) < dmsg->plen) {
+    // move what has arrived to an mbuf that holds the whole payload
+    nbuf = mbuf_get_whole(dmsg->plen);
+    if (nbuf == NULL) {
+      r->result = MSG_OOM_ERROR;
+      return false;
+    }
+
+    mbuf_copy(nbuf, b->pos, avail);
+    mbuf_insert(&r->mhdr, nbuf);
+    mbuf_remove(&r->mhdr, b);
+    mbuf_put(b);
+    b = nbuf;
+    r->pos = b->pos;
+  }
+
+  dmsg->payload = b->pos;
+  dmsg->plen -= avail;
+  r->result = MSG_PARSE_AGAIN;
+  return false;
+
+error:
+  r->result = MSG_PARSE_ERROR;
+  errno = EINVAL;
+  return false;
+}
+
 static void data_store_parse_req(struct msg *r, struct context *ctx) {
   if (g_data_store == DATA_REDIS) {
     return redis_parse_req(r, ctx);
@@ -430,6 +728,14 @@ void dyn_parse_req(struct msg *r, struct context *ctx) {
       return;
     }
 
+    if (r->dyn_parse_state == DYN_DONE &&
+        (dmsg->flags & (DMSG_FLAG_AES_GCM | DMSG_FLAG_COMPRESSED))) {
+      if (dyn_parse_whole(r, ctx)) {
+        data_store_parse_req(r, ctx);
+      }
+      return;
+    }
+
     if (r->dyn_parse_state == DYN_DONE && dmsg->flags == 1) {
       dmsg->owner->owner->dnode_secured = 1;
       r->owner->crypto_key_sent = 1;
@@ -543,6 +849,14 @@ void dyn_parse_rsp(struct msg *r, struct context *ctx) {
       return;
     }
 
+    if (r->dyn_parse_state == DYN_DONE &&
+        (dmsg->flags & (DMSG_FLAG_AES_GCM | DMSG_FLAG_COMPRESSED))) {
+      if (dyn_parse_whole(r, ctx)) {
+        data_store_parse_rsp(r, ctx);
+      }
+      return;
+    }
+
     if (r->dyn_parse_state == DYN_DONE && dmsg->flags == 1) {
       dmsg->owner->owner->dnode_secured = 1;
       r->owner->crypto_key_sent = 1;
@@ -680,12 +994,215 @@ done:
   dmsg->owner = NULL;
   dmsg->flags = 0;
   dmsg->same_dc = 1;
+  dmsg->trace_id = 0;
+  dmsg->digest = 0;
 
   return dmsg;
 }
 
 rstatus_t dmsg_write(struct mbuf *mbuf, uint64_t msg_id, uint8_t type,
                      struct conn *conn, uint32_t payload_len) {
+  return dmsg_write_gcm(mbuf, msg_id, type, conn, payload_len, NULL);
+}
+
+/*
+ * Writes the binary header of a message, for a peer that reads them, along
+ * with the data the ASCII header would carry.
+ */
+static rstatus_t dmsg_write_bin(struct mbuf *mbuf, uint64_t msg_id,
+                                uint8_t type, struct conn *conn,
+                                uint32_t payload_len,
+                                const uint8_t *gcm_data) {
+  struct dmsg_bin_header hdr;
+  bool send_key = (conn->dnode_secured || gcm_data != NULL) &&
+                  !conn->crypto_key_sent;
+  uint32_t mlen = 0;
+
+  if (send_key) {
+    mlen += (uint32_t)dyn_rsa_size();
+  }
+  if (gcm_data != NULL) {
+    mlen += AES_GCM_DATA_LEN;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic[0] = DMSG_BIN_MAGIC0;
+  hdr.magic[1] = DMSG_BIN_MAGIC1;
+  hdr.version = version;
+  hdr.type = type;
+  if (conn->dnode_secured) {
+    hdr.flags |= DMSG_FLAG_SECURED;
+  }
+  if (gcm_data != NULL) {
+    hdr.flags |= DMSG_FLAG_SECURED | DMSG_FLAG_AES_GCM;
+  }
+  hdr.same_dc = conn->same_dc ? 1 : 0;
+  hdr.id_hi = htonl((uint32_t)(msg_id >> 32));
+  hdr.id_lo = htonl((uint32_t)msg_id);
+  hdr.mlen = htonl(mlen);
+  hdr.plen = htonl(payload_len);
+  mbuf_write_bytes(mbuf, (unsigned char *)&hdr, sizeof(hdr));
+
+  if (send_key) {
+    dyn_rsa_encrypt(conn->aes_key, aes_encrypted_buf);
+    mbuf_write_bytes(mbuf, aes_encrypted_buf, dyn_rsa_size());
+    conn->crypto_key_sent = 1;
+  }
+  if (gcm_data != NULL) {
+    mbuf_write_bytes(mbuf, (unsigned char *)gcm_data, AES_GCM_DATA_LEN);
+  }
+
+  return DN_OK;
+}
+
+/*
+ * Called for each message that goes out in one write to a peer, in order. The
+ * binary header of the message is turned into a sub header of the frame
+ * opened by an earlier message, if they share type and flags, and the frame
+ * header counts it; otherwise the message opens a frame for the next ones.
+ * Headers are rewritten in place, in their own mbuf, before any of them is
+ * sent. conn->dmsg_frame is reset before and after each write.
+ */
+void dmsg_frame_add(struct conn *conn, struct msg *msg, uint32_t nmax) {
+  struct mbuf *mbuf = STAILQ_FIRST(&msg->mhdr);
+  struct dmsg_bin_header hdr, frame;
+  struct dmsg_bin_sub_header sub;
+  uint32_t glen;
+  uint64_t id, frame_id;
+  uint16_t n;
+
+  // only a header that is whole, not sent yet and carries no AES key
+  if (mbuf == NULL || mbuf->pos != mbuf->start ||
+      mbuf_length(mbuf) < sizeof(hdr) || *mbuf->pos != DMSG_BIN_MAGIC0) {
+    conn->dmsg_frame = NULL;
+    return;
+  }
+  memcpy(&hdr, mbuf->pos, sizeof(hdr));
+  glen = (hdr.flags & DMSG_FLAG_AES_GCM) ? AES_GCM_DATA_LEN : 0;
+  if ((hdr.flags & DMSG_FLAG_BATCH) || ntohl(hdr.mlen) != glen ||
+      mbuf_length(mbuf) != sizeof(hdr) + glen ||
+      ((hdr.flags & DMSG_FLAG_SECURED) && glen == 0)) {
+    conn->dmsg_frame = NULL;
+    return;
+  }
+  id = ((uint64_t)ntohl(hdr.id_hi) << 32) | ntohl(hdr.id_lo);
+
+  if (conn->dmsg_frame != NULL) {
+    memcpy(&frame, conn->dmsg_frame, sizeof(frame));
+    frame_id = ((uint64_t)ntohl(frame.id_hi) << 32) | ntohl(frame.id_lo);
+    n = ntohs(frame.batch);
+
+    if (frame.type == hdr.type && frame.same_dc == hdr.same_dc &&
+        (frame.flags & ~DMSG_FLAG_BATCH) == hdr.flags && id >= frame_id &&
+        id - frame_id <= UINT32_MAX && n + 1U < nmax) {
+      sub.id_delta = htonl((uint32_t)(id - frame_id));
+      sub.plen = hdr.plen;
+      mbuf->pos += sizeof(hdr) - sizeof(sub);
+      memcpy(mbuf->pos, &sub, sizeof(sub));
+
+      frame.flags |= DMSG_FLAG_BATCH;
+      frame.batch = htons((uint16_t)(n + 1));
+      memcpy(conn->dmsg_frame, &frame, sizeof(frame));
+      return;
+    }
+  }
+
+  conn->dmsg_frame = mbuf->pos;
+}
+
+/*
+ * Compress the payload of a message to a peer in a remote DC, if that is on,
+ * the peer inflates payloads and the payload shrinks. If it did, the binary
+ * header written for the message must be flagged with dmsg_set_compressed().
+ */
+bool dmsg_compress(struct context *ctx, struct conn *conn, struct msg *msg) {
+  struct mbuf *mbuf;
+  usec_t start;
+  uint32_t len = 0, clen;
+
+  if (!ctx->pool.remote_dc_compression || conn->same_dc ||
+      !conn->dmsg_binary || !conn->dmsg_compress) {
+    return false;
+  }
+
+  start = dn_usec_now();
+  STAILQ_FOREACH(mbuf, &msg->mhdr, next) { len += mbuf_length(mbuf); }
+  if (dyn_compress_msg(conn, msg) != DN_OK) {
+    return false;
+  }
+  clen = mbuf_length(STAILQ_FIRST(&msg->mhdr));
+
+  stats_pool_incr_by(ctx, peer_compress_in_bytes, len);
+  stats_pool_incr_by(ctx, peer_compress_out_bytes, clen);
+  stats_pool_incr_by(ctx, peer_compress_usec,
+                     (int64_t)(dn_usec_now() - start));
+  stats_histo_add(ctx, peer_compress_ratio, len * 100ULL / clen);
+  return true;
+}
+
+void dmsg_set_compressed(struct mbuf *mbuf) {
+  ASSERT(*mbuf->pos == DMSG_BIN_MAGIC0);
+  mbuf->pos[offsetof(struct dmsg_bin_header, flags)] |= DMSG_FLAG_COMPRESSED;
+}
+
+/*
+ * Append the id of a traced request to the data of the binary header just
+ * written to 'mbuf', for a peer that reads trace ids. A traced header does
+ * not go into a frame, whose messages share one header.
+ */
+void dmsg_set_trace(struct mbuf *mbuf, uint64_t trace_id) {
+  struct dmsg_bin_header hdr;
+  uint32_t id[2];
+
+  ASSERT(*mbuf->pos == DMSG_BIN_MAGIC0);
+  memcpy(&hdr, mbuf->pos, sizeof(hdr));
+  hdr.flags |= DMSG_FLAG_TRACED;
+  hdr.mlen = htonl(ntohl(hdr.mlen) + DMSG_TRACE_ID_LEN);
+  memcpy(mbuf->pos, &hdr, sizeof(hdr));
+
+  id[0] = htonl((uint32_t)(trace_id >> 32));
+  id[1] = htonl((uint32_t)trace_id);
+  mbuf_write_bytes(mbuf, (unsigned char *)id, sizeof(id));
+}
+
+/*
+ * Ask, in the binary header just written to 'mbuf', for the digest of the
+ * value a quorum read gets rather than the value itself.
+ */
+void dmsg_set_digest_read(struct mbuf *mbuf) {
+  ASSERT(*mbuf->pos == DMSG_BIN_MAGIC0);
+  mbuf->pos[offsetof(struct dmsg_bin_header, flags)] |= DMSG_FLAG_DIGEST;
+}
+
+/*
+ * Append the digest a response stands for to the data of the binary header
+ * just written to 'mbuf'. The header does not go into a frame.
+ */
+void dmsg_set_digest(struct mbuf *mbuf, uint32_t digest) {
+  struct dmsg_bin_header hdr;
+
+  ASSERT(*mbuf->pos == DMSG_BIN_MAGIC0);
+  memcpy(&hdr, mbuf->pos, sizeof(hdr));
+  hdr.flags |= DMSG_FLAG_DIGEST;
+  hdr.mlen = htonl(ntohl(hdr.mlen) + DMSG_DIGEST_LEN);
+  memcpy(mbuf->pos, &hdr, sizeof(hdr));
+
+  digest = htonl(digest);
+  mbuf_write_bytes(mbuf, (unsigned char *)&digest, sizeof(digest));
+}
+
+/*
+ * Write the header of a message whose payload was sealed with AES-GCM, if
+ * gcm_data is set. Its nonce and tag follow the encrypted AES key, if any, in
+ * the data field.
+ */
+rstatus_t dmsg_write_gcm(struct mbuf *mbuf, uint64_t msg_id, uint8_t type,
+                         struct conn *conn, uint32_t payload_len,
+                         const uint8_t *gcm_data) {
+  if (conn->dmsg_binary) {
+    return dmsg_write_bin(mbuf, msg_id, type, conn, payload_len, gcm_data);
+  }
+
   mbuf_write_string(mbuf, &MAGIC_STR);
   mbuf_write_uint64(mbuf, msg_id);
 
@@ -699,7 +1216,10 @@ rstatus_t dmsg_write(struct mbuf *mbuf, uint64_t msg_id, uint8_t type,
   uint8_t flags = 0;
 
   if (conn->dnode_secured) {
-    flags |= 0x1;
+    flags |= DMSG_FLAG_SECURED;
+  }
+  if (gcm_data != NULL) {
+    flags |= DMSG_FLAG_SECURED | DMSG_FLAG_AES_GCM;
   }
   mbuf_write_uint8(mbuf, flags);
 
@@ -721,7 +1241,21 @@ rstatus_t dmsg_write(struct mbuf *mbuf, uint64_t msg_id, uint8_t type,
   // write aes key
   unsigned char *aes_key = conn->aes_key;
 
-  if (conn->dnode_secured && !conn->crypto_key_sent) {
+  if (gcm_data != NULL) {
+    uint32_t len = AES_GCM_DATA_LEN;
+
+    if (!conn->crypto_key_sent) {
+      len += (uint32_t)dyn_rsa_size();
+    }
+    mbuf_write_uint32(mbuf, len);
+    mbuf_write_char(mbuf, ' ');
+    if (!conn->crypto_key_sent) {
+      dyn_rsa_encrypt(aes_key, aes_encrypted_buf);
+      mbuf_write_bytes(mbuf, aes_encrypted_buf, dyn_rsa_size());
+      conn->crypto_key_sent = 1;
+    }
+    mbuf_write_bytes(mbuf, (unsigned char *)gcm_data, AES_GCM_DATA_LEN);
+  } else if (conn->dnode_secured && !conn->crypto_key_sent) {
     mbuf_write_uint32(mbuf, (uint32_t)dyn_rsa_size());
     // payload
     mbuf_write_char(mbuf, ' ');
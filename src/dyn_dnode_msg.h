@@ -8,10 +8,81 @@
 
 #include <stdbool.h>
 
+#include "dyn_crypto.h"
 #include "dyn_queue.h"
 #include "dyn_types.h"
 
-typedef enum dmsg_version { VERSION_10 = 1 } dmsg_version_t;
+/*
+ * VERSION_11 nodes read both header formats. Every connection starts out with
+ * the ASCII one and moves to the binary one once the other side shows, in a
+ * header it sent, that it runs VERSION_11 or later. Payloads to a remote DC
+ * are compressed only once the other side shows it runs VERSION_12,
+ * trace ids are sent only once it shows it runs VERSION_13, and digests of
+ * quorum reads are asked for only once it shows it runs VERSION_14.
+ */
+typedef enum dmsg_version {
+  VERSION_10 = 1,
+  VERSION_11 = 2, /* binary header */
+  VERSION_12 = 3, /* compressed payloads */
+  VERSION_13 = 4, /* trace ids */
+  VERSION_14 = 5  /* quorum read digests */
+} dmsg_version_t;
+
+/* Upper bound of a header written by dmsg_write(), including the RSA
+ * encrypted AES key sent on the first message of a secured connection and
+ * the nonce and tag of an AES-GCM payload. */
+#define DMSG_HEADER_MAX_SIZE 256
+
+/*
+ * Fixed-size binary header, in network byte order. It is followed by mlen
+ * bytes of data (the encrypted AES key, the AES-GCM nonce and tag, the 4 byte
+ * digest of a response with DMSG_FLAG_DIGEST and, with DMSG_FLAG_TRACED, the
+ * 8 byte trace id, each only if there is one) and then plen bytes of payload.
+ *
+ * With DMSG_FLAG_BATCH the header opens a frame: 'batch' more messages of the
+ * same type and flags follow its payload, each with only a sub header, the
+ * nonce and tag if the frame is sealed with AES-GCM, and its payload.
+ */
+#define DMSG_BIN_MAGIC0 0xd7
+#define DMSG_BIN_MAGIC1 0x14
+
+struct dmsg_bin_header {
+  uint8_t magic[2];
+  uint8_t version;
+  uint8_t type;
+  uint8_t flags;
+  uint8_t same_dc;
+  uint16_t batch;
+  uint32_t id_hi;
+  uint32_t id_lo;
+  uint32_t mlen;
+  uint32_t plen;
+};
+
+struct dmsg_bin_sub_header {
+  uint32_t id_delta; /* from the id of the frame header */
+  uint32_t plen;
+};
+
+/* dmsg flags */
+#define DMSG_FLAG_SECURED 0x1    /* payload is encrypted */
+#define DMSG_FLAG_COMPRESSED 0x2 /* payload is compressed (binary only) */
+#define DMSG_FLAG_AES_GCM 0x4    /* ... with AES-256-GCM rather than AES-CBC */
+#define DMSG_FLAG_BATCH 0x8      /* more messages follow in this frame */
+#define DMSG_FLAG_TRACED 0x10    /* data ends with a trace id (binary only) */
+#define DMSG_FLAG_DIGEST 0x20    /* request: answer with a digest of the value,
+                                    response: this is one (binary only) */
+
+/* Length of a trace id in the data of a binary header */
+#define DMSG_TRACE_ID_LEN 8
+
+/* Length of the digest of a response in the data of a binary header */
+#define DMSG_DIGEST_LEN 4
+
+/* Largest AES-GCM or compressed payload, which is received into one buffer
+ * to be checked or inflated before it is parsed, and largest payload it
+ * inflates to. */
+#define DMSG_MAX_WHOLE_PAYLOAD (512U * 1024 * 1024)
 
 typedef enum {
   DYN_START = 0,
@@ -73,6 +144,12 @@ struct dmsg {
 
   uint32_t plen;    /* payload length */
   uint8_t *payload; /* pointer to payload */
+
+  uint32_t whole_len;                 /* length of an AES-GCM or compressed
+                                         payload */
+  uint8_t gcm_data[AES_GCM_DATA_LEN]; /* nonce and tag of an AES-GCM one */
+  uint64_t trace_id;                  /* id of a traced request, else 0 */
+  uint32_t digest; /* crc32c of the value a DMSG_FLAG_DIGEST response stands for */
 };
 
 TAILQ_HEAD(dmsg_tqh, dmsg);
@@ -89,9 +166,20 @@ bool dmsg_empty(struct dmsg *msg);
 struct dmsg *dmsg_get(void);
 rstatus_t dmsg_write(struct mbuf *mbuf, uint64_t msg_id, uint8_t type,
                      struct conn *conn, uint32_t payload_len);
+rstatus_t dmsg_write_gcm(struct mbuf *mbuf, uint64_t msg_id, uint8_t type,
+                         struct conn *conn, uint32_t payload_len,
+                         const uint8_t *gcm_data);
+rstatus_t dmsg_open_payload(struct context *ctx, struct msg *r,
+                            struct mbuf *b);
+bool dmsg_compress(struct context *ctx, struct conn *conn, struct msg *msg);
+void dmsg_set_compressed(struct mbuf *mbuf);
+void dmsg_set_trace(struct mbuf *mbuf, uint64_t trace_id);
+void dmsg_set_digest_read(struct mbuf *mbuf);
+void dmsg_set_digest(struct mbuf *mbuf, uint32_t digest);
 
 rstatus_t dmsg_write_mbuf(struct mbuf *mbuf, uint64_t msg_id, uint8_t type,
                           struct conn *conn, uint32_t plen);
 bool dmsg_process(struct context *ctx, struct conn *conn, struct dmsg *dmsg);
+void dmsg_frame_add(struct conn *conn, struct msg *msg, uint32_t nmax);
 
 #endif
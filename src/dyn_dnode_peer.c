@@ -280,7 +280,8 @@ static struct conn *dnode_peer_conn(struct node *peer, int tag) {
 static void dnode_peer_ack_err(struct context *ctx, struct conn *conn,
                                struct msg *req) {
   if ((req->swallow && !req->expect_datastore_reply) ||  // no reply
-      (req->swallow && (req->consistency == DC_ONE)) ||  // dc one
+      (req->swallow && (req->consistency == DC_ONE) &&
+       !req->is_hedge) ||  // dc one, a hedge still answers its read
       (req->swallow &&
        ((req->consistency == DC_QUORUM) ||
         (req->consistency == DC_SAFE_QUORUM))  // remote dc request
@@ -377,6 +378,7 @@ static void dnode_peer_close(struct context *ctx, struct conn *conn) {
   ASSERT(conn->type == CONN_DNODE_PEER_SERVER);
   struct node *peer = conn->owner;
 
+  server_batch_del(ctx, conn);
   dnode_peer_close_stats(ctx, conn);
 
   if (conn->sd < 0) {
@@ -786,7 +788,7 @@ uint32_t dnode_peer_idx_for_key_on_rack(struct server_pool *pool,
                                         uint32_t keylen) {
   struct dyn_token token;
   pool->key_hash(key, keylen, &token);
-  return vnode_dispatch(&rack->continuums, rack->ncontinuum, &token);
+  return vnode_dispatch_rack(rack, &token);
 }
 
 static struct node *dnode_peer_for_key_on_rack(struct server_pool *pool,
@@ -846,6 +848,290 @@ struct node *dnode_peer_pool_server(struct context *ctx,
   return peer;
 }
 
+/* Weight, as a power of 2, of the newest response time in replica_load */
+#define REPLICA_LOAD_EWMA_SHIFT 3
+
+/* A replica with no response in this long is probed with the next read */
+#define REPLICA_LOAD_STALE_USEC 1000000ULL
+
+/* Outstanding requests beyond which a replica scores no worse */
+#define REPLICA_LOAD_MAX_OUTSTANDING 1024
+
+/* Response times in the buckets of replica_load before they are halved */
+#define REPLICA_LOAD_WINDOW 512
+
+/* Response times a replica needs in its buckets to have a percentile */
+#define REPLICA_LOAD_MIN_SAMPLES 32
+
+static __thread uint32_t replica_rand; /* xorshift state, 0 until seeded */
+
+/*
+ * Take the response time of a request into the load of its replica. Once the
+ * buckets hold REPLICA_LOAD_WINDOW response times, all of them are halved, so
+ * that the older ones weigh less and less in the percentiles.
+ */
+void replica_load_add(struct replica_load *load, usec_t latency_us) {
+  uint32_t i;
+
+  if (load->count >= REPLICA_LOAD_WINDOW) {
+    load->count = 0;
+    for (i = 0; i < REPLICA_LOAD_NBUCKETS; i++) {
+      load->buckets[i] >>= 1;
+      load->count += load->buckets[i];
+    }
+  }
+  load->buckets[histo_index(REPLICA_LOAD_PRECISION,
+                            MIN(latency_us, REPLICA_LOAD_MAX_USEC))]++;
+  load->count++;
+
+  if (load->latency_us == 0) {
+    load->latency_us = latency_us != 0 ? latency_us : 1;
+  } else if (latency_us >= load->latency_us) {
+    load->latency_us +=
+        (latency_us - load->latency_us) >> REPLICA_LOAD_EWMA_SHIFT;
+  } else {
+    load->latency_us -=
+        (load->latency_us - latency_us) >> REPLICA_LOAD_EWMA_SHIFT;
+  }
+  load->updated_us = dn_usec_now();
+}
+
+/*
+ * Response time at or below which the given percent of the recent ones of a
+ * replica fall, as the largest value of its bucket. 0 if there are too few.
+ */
+usec_t replica_load_percentile(const struct replica_load *load,
+                               uint32_t percentile) {
+  uint32_t target, seen = 0, i;
+
+  if (load->count < REPLICA_LOAD_MIN_SAMPLES) {
+    return 0;
+  }
+
+  target = (uint32_t)(((uint64_t)load->count * MIN(percentile, 100) + 99) / 100);
+  target = MAX(target, 1);
+  for (i = 0; i < REPLICA_LOAD_NBUCKETS; i++) {
+    seen += load->buckets[i];
+    if (seen >= target) {
+      return histo_bucket_high(REPLICA_LOAD_PRECISION, i);
+    }
+  }
+  return REPLICA_LOAD_MAX_USEC;
+}
+
+struct replica_load *replica_load_of(struct server_pool *pool,
+                                     struct node *peer) {
+  return peer->is_local ? &pool->datastore->load : &peer->load;
+}
+
+/* Requests a peer may have in flight before its response times are known */
+#define PEER_LIMIT_START 32
+
+/* Fewest requests a peer is left to have in flight */
+#define PEER_LIMIT_MIN 4
+
+/* Times the baseline response time a peer is taken to be queueing at */
+#define PEER_LIMIT_TOLERANCE 2
+
+/* Weight, as a power of 2, with which the baseline rises to a slower time */
+#define PEER_LIMIT_BASELINE_SHIFT 10
+
+/*
+ * Requests the peer may have in flight under a 'max' of them, 0 when they are
+ * not limited. As conn_msg_rate was, the limit is only for peers in other
+ * datacenters. A peer starts at PEER_LIMIT_START, and in slow start.
+ */
+uint32_t peer_limit_of(struct node *peer, uint32_t max) {
+  struct peer_limit *pl = &peer->limit;
+
+  if (max == 0 || peer->is_same_dc) {
+    return 0;
+  }
+  if (pl->limit == 0) {
+    pl->limit = MIN(PEER_LIMIT_START, max);
+    pl->slow_start = true;
+  }
+  return MIN(pl->limit, max);
+}
+
+/*
+ * Cut the limit of a peer by a tenth, for a request sent at 'sent_us' that
+ * took too long. Requests that were already in flight at the last cut do not
+ * cut it again: their response times say nothing of the limit since.
+ */
+void peer_limit_cut(struct context *ctx, struct node *peer, uint32_t max,
+                    usec_t sent_us) {
+  struct peer_limit *pl = &peer->limit;
+
+  if (peer_limit_of(peer, max) == 0 || sent_us <= pl->cut_us) {
+    return;
+  }
+  pl->limit = MAX(PEER_LIMIT_MIN, MIN(pl->limit, max) * 9 / 10);
+  pl->grown = 0;
+  pl->slow_start = false;
+  pl->cut_us = dn_usec_now();
+  if (ctx != NULL) {
+    stats_pool_incr(ctx, peer_limit_backoffs);
+  }
+}
+
+/*
+ * Take the response time of a request sent at 'sent_us' into the limit of its
+ * peer, once replica_load_add() took it into the load. The limit is cut when
+ * the EWMA of the response times climbs past PEER_LIMIT_TOLERANCE times the
+ * baseline, the fastest seen lately. Otherwise it grows, as long as the peer
+ * has enough requests in flight for the limit to matter: by one a response in
+ * slow start, and after that by one a limit's worth of responses.
+ */
+void peer_limit_sample(struct context *ctx, struct node *peer, uint32_t max,
+                       usec_t rtt_us, usec_t sent_us) {
+  struct peer_limit *pl = &peer->limit;
+
+  if (peer_limit_of(peer, max) == 0) {
+    return;
+  }
+
+  rtt_us = MAX(rtt_us, 1);
+  if (pl->rtt_us == 0 || rtt_us < pl->rtt_us) {
+    pl->rtt_us = rtt_us;
+  } else {
+    pl->rtt_us += (rtt_us - pl->rtt_us) >> PEER_LIMIT_BASELINE_SHIFT;
+  }
+
+  if (peer->load.latency_us > PEER_LIMIT_TOLERANCE * pl->rtt_us) {
+    peer_limit_cut(ctx, peer, max, sent_us);
+    return;
+  }
+
+  if (pl->inflight * 2 < pl->limit) {
+    return;
+  }
+  if (pl->slow_start) {
+    pl->limit++;
+  } else if (++pl->grown >= pl->limit) {
+    pl->limit++;
+    pl->grown = 0;
+  }
+  pl->limit = MIN(pl->limit, max);
+}
+
+/* Let the connections to a peer that stopped on its limit send again. */
+static void peer_limit_wake(struct context *ctx, struct node *peer) {
+  struct server_pool *sp = &ctx->pool;
+  uint8_t max_connections, i;
+  struct conn *conn;
+
+  max_connections = peer->is_same_dc ? sp->max_local_peer_connections
+                                     : sp->max_remote_peer_connections;
+  for (i = 0; i < max_connections; i++) {
+    conn = conn_pool_get(peer->conn_pool, i);
+    if (conn != NULL && !TAILQ_EMPTY(&conn->imsg_q)) {
+      IGNORE_RET_VAL(conn_event_add_out(conn));
+    }
+  }
+}
+
+/*
+ * How long a replica is expected to take with a read, as in C3: its response
+ * time times the cube of one plus the requests it already has, so that a
+ * replica which builds up a queue is soon avoided even while the responses
+ * it still sends are fast.
+ */
+static uint64_t replica_load_score(const struct replica_load *load) {
+  uint64_t q = 1 + MIN(load->outstanding, REPLICA_LOAD_MAX_OUTSTANDING);
+  return load->latency_us * q * q * q;
+}
+
+/*
+ * The token owner of a key on a rack of 'dc' other than 'skip', picked at
+ * random. NULL if there is no other rack.
+ */
+struct node *dnode_peer_pool_other_replica(struct context *ctx,
+                                           struct server_pool *pool,
+                                           struct datacenter *dc,
+                                           struct string *skip, uint8_t *key,
+                                           uint32_t keylen) {
+  struct rack *rack = NULL;
+  uint32_t rack_cnt = array_n(&dc->racks), idx, i;
+
+  if (rack_cnt < 2) {
+    return NULL;
+  }
+
+  if (replica_rand == 0) {
+    replica_rand = (uint32_t)random() | 1;
+  }
+  replica_rand ^= replica_rand << 13;
+  replica_rand ^= replica_rand >> 17;
+  replica_rand ^= replica_rand << 5;
+
+  /* the n-th of the racks other than the skipped one */
+  idx = replica_rand % (rack_cnt - 1);
+  for (i = 0; i < rack_cnt; i++) {
+    struct rack *r = array_get(&dc->racks, i);
+    if (string_compare(r->name, skip) == 0) {
+      continue;
+    }
+    if (idx-- == 0) {
+      rack = r;
+      break;
+    }
+  }
+  if (rack == NULL) {
+    return NULL;
+  }
+
+  return dnode_peer_pool_server(ctx, pool, rack, key, keylen, ROUTING_NORMAL);
+}
+
+/*
+ * Pick the replica a DC_ONE read goes to with adaptive_replica_selection.
+ * Two choices are compared: the token owner on the local rack, which the
+ * read goes to otherwise, and the token owner on another rack of the local
+ * DC picked at random. The read goes to the other one only if that scores
+ * less than half of what the owner does, and never to a peer that is not up
+ * or has no response time yet. An owner which has had nothing to answer for
+ * a while gets the read, to find out whether it got faster. Sets '*gain' to
+ * the response time a read sent elsewhere is expected to save.
+ */
+struct node *dnode_peer_pool_replica(struct context *ctx,
+                                     struct server_pool *pool,
+                                     struct datacenter *dc, struct node *owner,
+                                     uint8_t *key, uint32_t keylen,
+                                     usec_t *gain) {
+  struct replica_load *owner_load, *other_load;
+  struct node *other;
+
+  *gain = 0;
+  if (owner == NULL || array_n(&dc->racks) < 2) {
+    return owner;
+  }
+
+  owner_load = replica_load_of(pool, owner);
+  if (owner_load->latency_us == 0 ||
+      (owner_load->outstanding == 0 &&
+       dn_usec_now() - owner_load->updated_us > REPLICA_LOAD_STALE_USEC)) {
+    return owner;
+  }
+
+  other = dnode_peer_pool_other_replica(ctx, pool, dc, &pool->rack, key,
+                                        keylen);
+  if (other == NULL || other == owner ||
+      (!other->is_local && other->state != NORMAL)) {
+    return owner;
+  }
+  other_load = replica_load_of(pool, other);
+  if (other_load->latency_us == 0 ||
+      2 * replica_load_score(other_load) >= replica_load_score(owner_load)) {
+    return owner;
+  }
+
+  if (owner_load->latency_us > other_load->latency_us) {
+    *gain = owner_load->latency_us - other_load->latency_us;
+  }
+  return other;
+}
+
 struct conn *dnode_peer_get_conn(struct context *ctx, struct node *peer,
                                  int tag) {
   ASSERT(!peer->is_local);
@@ -959,9 +1245,10 @@ static void dnode_rsp_forward_match(struct context *ctx, struct conn *peer_conn,
   c_conn = req->owner;
 
   /* if client consistency is dc_one forward the response from only the
-     local node. Since dyn_dnode_peer is always a remote node, drop the rsp */
+     local node. Since dyn_dnode_peer is always a remote node, drop the rsp.
+     A hedge goes to its read, whose handler swallows the slower response. */
   if (req->consistency == DC_ONE) {
-    if (req->swallow) {
+    if (req->swallow && !req->is_hedge) {
       dnode_rsp_swallow(ctx, peer_conn, req, rsp);
       return;
     }
@@ -1039,15 +1326,23 @@ static void dnode_rsp_forward(struct context *ctx, struct conn *peer_conn,
     c_conn = req->owner;
 
     if (req->request_send_time) {
-      struct stats *st = ctx->stats;
+      struct node *peer = peer_conn->owner;
       uint64_t delay = dn_usec_now() - req->request_send_time;
+      replica_load_add(&peer->load, delay);
+      peer_limit_sample(ctx, peer, ctx->pool.peer_concurrency_max, delay,
+                        req->request_send_time);
       if (!peer_conn->same_dc)
-        histo_add(&st->cross_region_latency_histo, delay);
+        stats_histo_add(ctx, cross_region_latency, delay);
       else
-        histo_add(&st->cross_zone_latency_histo, delay);
+        stats_histo_add(ctx, cross_zone_latency, delay);
+      stats_family_add(ctx,
+                       peer_conn->same_dc ? STATS_PATH_cross_zone
+                                          : STATS_PATH_cross_region,
+                       req, rsp->mlen, delay);
     }
 
     if (req->id == rsp->dmsg->id) {
+      trace_hop(req, TRACE_reply);
       dnode_rsp_forward_match(ctx, peer_conn, rsp);
       return;
     }
@@ -1069,7 +1364,7 @@ static void dnode_rsp_forward(struct context *ctx, struct conn *peer_conn,
     }
 
     if (req->consistency == DC_ONE) {
-      if (req->swallow) {
+      if (req->swallow && !req->is_hedge) {
         // swallow the request and move on the next one
         dnode_rsp_swallow(ctx, peer_conn, req, NULL);
         continue;
@@ -1225,38 +1520,46 @@ TAILQ_FIRST(&p_conn->omsg_q))) { status = conn_event_add_out(p_conn); if (status
 }
 
 */
+/*
+ * Send the next request to the peer unless that would take it over its limit
+ * of requests in flight. A request counts against the limit from the time it
+ * is picked until it is answered or dropped, so that the rest of a chain in
+ * the middle of being sent still goes. A connection that stops on the limit
+ * stops waiting to send, until a response brings the peer back under it.
+ */
 static struct msg *dnode_req_send_next(struct context *ctx, struct conn *conn) {
-  rstatus_t status;
+  struct node *peer = conn->owner;
+  struct peer_limit *pl = &peer->limit;
+  struct msg *req;
+  uint32_t limit;
 
   ASSERT(conn->type == CONN_DNODE_PEER_SERVER);
 
-  // TODO: Not the right way to use time_t directly. FIXME
-  uint32_t now = (uint32_t)time(NULL);
-  // throttling the sending traffics here
-  if (!conn->same_dc) {
-    if (conn->last_sent != 0) {
-      uint32_t elapsed_time = now - conn->last_sent;
-      uint32_t earned_tokens = elapsed_time * msgs_per_sec();
-      conn->avail_tokens = (conn->avail_tokens + earned_tokens) < msgs_per_sec()
-                               ? conn->avail_tokens + earned_tokens
-                               : msgs_per_sec();
-    }
-
-    conn->last_sent = now;
-    if (conn->avail_tokens > 0) {
-      conn->avail_tokens--;
-      return req_send_next(ctx, conn);
-    }
+  limit = peer_limit_of(peer, ctx->pool.peer_concurrency_max);
+  if (limit == 0) {
+    return req_send_next(ctx, conn);
+  }
 
-    // requeue
-    status = conn_event_add_out(conn);
-    IGNORE_RET_VAL(status);
+  if (conn->connecting) {
+    dnode_peer_connected(ctx, conn);
+  }
 
+  req = conn->smsg != NULL ? TAILQ_NEXT(conn->smsg, s_tqe)
+                           : TAILQ_FIRST(&conn->imsg_q);
+  if (req != NULL && !req->in_flight && pl->inflight >= limit) {
+    pl->blocked = true;
+    if (conn_event_del_out(conn) != DN_OK) {
+      conn->err = errno;
+    }
     return NULL;
   }
 
-  conn->last_sent = now;
-  return req_send_next(ctx, conn);
+  req = req_send_next(ctx, conn);
+  if (req != NULL && !req->in_flight) {
+    req->in_flight = 1;
+    pl->inflight++;
+  }
+  return req;
 }
 
 static void dnode_req_peer_enqueue_imsgq(struct context *ctx, struct conn *conn,
@@ -1264,20 +1567,26 @@ static void dnode_req_peer_enqueue_imsgq(struct context *ctx, struct conn *conn,
   ASSERT(req->is_request);
   ASSERT(conn->type == CONN_DNODE_PEER_SERVER);
   req->request_inqueue_enqueue_time_us = dn_usec_now();
+  if (req->trace != NULL) {
+    struct node *peer = conn->owner;
+    trace_hop(req, TRACE_enqueue);
+    trace_target(req, &peer->name, peer->endpoint.port);
+  }
 
   if (req->expect_datastore_reply) {
     msg_tmo_insert(req, conn);
   }
   TAILQ_INSERT_TAIL(&conn->imsg_q, req, s_tqe);
+  ((struct node *)conn->owner)->load.outstanding++;
   log_debug(LOG_VERB, "conn %p enqueue inq %d:%d", conn, req->id,
             req->parent_id);
 
   if (conn->same_dc) {
-    histo_add(&ctx->stats->peer_in_queue, TAILQ_COUNT(&conn->imsg_q));
+    stats_histo_add(ctx, peer_in_queue, TAILQ_COUNT(&conn->imsg_q));
     stats_pool_incr(ctx, peer_in_queue);
     stats_pool_incr_by(ctx, peer_in_queue_bytes, req->mlen);
   } else {
-    histo_add(&ctx->stats->remote_peer_in_queue, TAILQ_COUNT(&conn->imsg_q));
+    stats_histo_add(ctx, remote_peer_in_queue, TAILQ_COUNT(&conn->imsg_q));
     stats_pool_incr(ctx, remote_peer_in_queue);
     stats_pool_incr_by(ctx, remote_peer_in_queue_bytes, req->mlen);
   }
@@ -1292,20 +1601,25 @@ static void dnode_req_peer_dequeue_imsgq(struct context *ctx, struct conn *conn,
   if (req->request_inqueue_enqueue_time_us) {
     delay_us = dn_usec_now() - req->request_inqueue_enqueue_time_us;
     if (conn->same_dc)
-      histo_add(&ctx->stats->cross_zone_queue_wait_time_histo, delay_us);
+      stats_histo_add(ctx, cross_zone_queue_wait_time, delay_us);
     else
-      histo_add(&ctx->stats->cross_region_queue_wait_time_histo, delay_us);
+      stats_histo_add(ctx, cross_region_queue_wait_time, delay_us);
   }
   TAILQ_REMOVE(&conn->imsg_q, req, s_tqe);
+  ((struct node *)conn->owner)->load.outstanding--;
+  if (req->in_flight) {
+    req->in_flight = 0;
+    ((struct node *)conn->owner)->limit.inflight--;
+  }
   log_debug(LOG_VERB, "conn %p dequeue inq %d:%d", conn, req->id,
             req->parent_id);
 
   if (conn->same_dc) {
-    histo_add(&ctx->stats->peer_in_queue, TAILQ_COUNT(&conn->imsg_q));
+    stats_histo_add(ctx, peer_in_queue, TAILQ_COUNT(&conn->imsg_q));
     stats_pool_decr(ctx, peer_in_queue);
     stats_pool_decr_by(ctx, peer_in_queue_bytes, req->mlen);
   } else {
-    histo_add(&ctx->stats->remote_peer_in_queue, TAILQ_COUNT(&conn->imsg_q));
+    stats_histo_add(ctx, remote_peer_in_queue, TAILQ_COUNT(&conn->imsg_q));
     stats_pool_decr(ctx, remote_peer_in_queue);
     stats_pool_decr_by(ctx, remote_peer_in_queue_bytes, req->mlen);
   }
@@ -1317,15 +1631,20 @@ static void dnode_req_peer_enqueue_omsgq(struct context *ctx, struct conn *conn,
   ASSERT(conn->type == CONN_DNODE_PEER_SERVER);
 
   TAILQ_INSERT_TAIL(&conn->omsg_q, req, s_tqe);
+  ((struct node *)conn->owner)->load.outstanding++;
+  if (!req->in_flight) {
+    req->in_flight = 1;
+    ((struct node *)conn->owner)->limit.inflight++;
+  }
   log_debug(LOG_VERB, "conn %p enqueue outq %d:%d", conn, req->id,
             req->parent_id);
 
   if (conn->same_dc) {
-    histo_add(&ctx->stats->peer_out_queue, TAILQ_COUNT(&conn->omsg_q));
+    stats_histo_add(ctx, peer_out_queue, TAILQ_COUNT(&conn->omsg_q));
     stats_pool_incr(ctx, peer_out_queue);
     stats_pool_incr_by(ctx, peer_out_queue_bytes, req->mlen);
   } else {
-    histo_add(&ctx->stats->remote_peer_out_queue, TAILQ_COUNT(&conn->omsg_q));
+    stats_histo_add(ctx, remote_peer_out_queue, TAILQ_COUNT(&conn->omsg_q));
     stats_pool_incr(ctx, remote_peer_out_queue);
     stats_pool_incr_by(ctx, remote_peer_out_queue_bytes, req->mlen);
   }
@@ -1336,17 +1655,30 @@ static void dnode_req_peer_dequeue_omsgq(struct context *ctx, struct conn *conn,
   ASSERT(req->is_request);
   ASSERT(conn->type == CONN_DNODE_PEER_SERVER);
 
+  struct node *peer = conn->owner;
+
   msg_tmo_delete(req);
 
   TAILQ_REMOVE(&conn->omsg_q, req, s_tqe);
+  peer->load.outstanding--;
+  if (req->in_flight) {
+    req->in_flight = 0;
+    peer->limit.inflight--;
+    if (peer->limit.blocked &&
+        peer->limit.inflight <
+            peer_limit_of(peer, ctx->pool.peer_concurrency_max)) {
+      peer->limit.blocked = false;
+      peer_limit_wake(ctx, peer);
+    }
+  }
   log_debug(LOG_VVERB, "conn %p dequeue outq %p", conn, req);
 
   if (conn->same_dc) {
-    histo_add(&ctx->stats->peer_out_queue, TAILQ_COUNT(&conn->omsg_q));
+    stats_histo_add(ctx, peer_out_queue, TAILQ_COUNT(&conn->omsg_q));
     stats_pool_decr(ctx, peer_out_queue);
     stats_pool_decr_by(ctx, peer_out_queue_bytes, req->mlen);
   } else {
-    histo_add(&ctx->stats->remote_peer_out_queue, TAILQ_COUNT(&conn->omsg_q));
+    stats_histo_add(ctx, remote_peer_out_queue, TAILQ_COUNT(&conn->omsg_q));
     stats_pool_decr(ctx, remote_peer_out_queue);
     stats_pool_decr_by(ctx, remote_peer_out_queue_bytes, req->mlen);
   }
@@ -14,8 +14,10 @@
 
 // Forward declarations
 struct context;
+struct datacenter;
 struct msg;
 struct rack;
+struct replica_load;
 
 msec_t dnode_peer_timeout(struct msg *msg, struct conn *conn);
 rstatus_t dnode_initialize_peers(struct context *ctx);
@@ -26,6 +28,26 @@ struct node *dnode_peer_pool_server(struct context *ctx,
                                     struct server_pool *pool, struct rack *rack,
                                     uint8_t *key, uint32_t keylen,
                                     msg_routing_t msg_routing);
+struct node *dnode_peer_pool_replica(struct context *ctx,
+                                     struct server_pool *pool,
+                                     struct datacenter *dc, struct node *owner,
+                                     uint8_t *key, uint32_t keylen,
+                                     usec_t *gain);
+struct node *dnode_peer_pool_other_replica(struct context *ctx,
+                                           struct server_pool *pool,
+                                           struct datacenter *dc,
+                                           struct string *skip, uint8_t *key,
+                                           uint32_t keylen);
+void replica_load_add(struct replica_load *load, usec_t latency_us);
+usec_t replica_load_percentile(const struct replica_load *load,
+                               uint32_t percentile);
+struct replica_load *replica_load_of(struct server_pool *pool,
+                                     struct node *peer);
+uint32_t peer_limit_of(struct node *peer, uint32_t max);
+void peer_limit_cut(struct context *ctx, struct node *peer, uint32_t max,
+                    usec_t sent_us);
+void peer_limit_sample(struct context *ctx, struct node *peer, uint32_t max,
+                       usec_t rtt_us, usec_t sent_us);
 struct conn *dnode_peer_get_conn(struct context *ctx, struct node *server,
                                  int tag);
 rstatus_t dnode_peer_pool_preconnect(struct context *ctx);
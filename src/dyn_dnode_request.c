@@ -9,7 +9,7 @@
 #include "dyn_server.h"
 
 // static struct string client_request_dyn_msg = string("Client_request");
-static uint64_t peer_msg_id = 0;
+static __thread uint64_t peer_msg_id = 0;
 
 static void dnode_req_forward_error(struct context *ctx, struct conn *conn,
                                     struct msg *req) {
@@ -63,15 +63,33 @@ rstatus_t dnode_peer_req_forward(struct context *ctx, struct conn *c_conn,
   ASSERT((c_conn->type == CONN_CLIENT) ||
          (c_conn->type == CONN_DNODE_PEER_CLIENT));
 
-  /* enqueue the message (request) into peer inq */
-  status = conn_event_add_out(p_conn);
-  if (status != DN_OK) {
-    *dyn_error_code = DYNOMITE_UNKNOWN_ERROR;
-    p_conn->err = errno;
+  /*
+   * shed the request rather than queue it behind a limit's worth of others
+   * that wait for the peer to have room for them
+   */
+  uint32_t limit = peer_limit_of(server, ctx->pool.peer_concurrency_max);
+  if (limit != 0 &&
+      server->load.outstanding >= server->limit.inflight + limit) {
+    stats_pool_incr(ctx, peer_shed_requests);
+    *dyn_error_code = PEER_OVERLOADED;
     return DN_ERROR;
   }
 
-  struct mbuf *header_buf = mbuf_get();
+  /* enqueue the message (request) into peer inq */
+  if (p_conn->connected && p_conn->dmsg_binary &&
+      ctx->pool.peer_batch_size > 1) {
+    // framed with the other requests to this peer at the end of the iteration
+    server_batch_add(ctx, p_conn);
+  } else {
+    status = conn_event_add_out(p_conn);
+    if (status != DN_OK) {
+      *dyn_error_code = DYNOMITE_UNKNOWN_ERROR;
+      p_conn->err = errno;
+      return DN_ERROR;
+    }
+  }
+
+  struct mbuf *header_buf = mbuf_get_sized(DMSG_HEADER_MAX_SIZE);
   if (header_buf == NULL) {
     loga("Unable to obtain an mbuf for dnode msg's header!");
     *dyn_error_code = DYNOMITE_OK;
@@ -81,6 +99,7 @@ rstatus_t dnode_peer_req_forward(struct context *ctx, struct conn *c_conn,
   struct server_pool *pool = c_conn->owner;
   dmsg_type_t msg_type = (string_compare(&pool->dc, &server->dc) != 0) ?
       DMSG_REQ_FORWARD : DMSG_REQ;
+  bool compressed = false;
 
   if (req->msg_routing == ROUTING_ALL_NODES_ALL_RACKS_ALL_DCS) {
     // If the routing type is 'ROUTING_ALL_NODES_ALL_RACKS_ALL_DCS', the server that
@@ -105,7 +124,23 @@ rstatus_t dnode_peer_req_forward(struct context *ctx, struct conn *c_conn,
     }
 
     // write dnode header
-    if (ENCRYPTION) {
+    if (ENCRYPTION && pool->secure_cipher == SECURE_CIPHER_AES_GCM) {
+      uint8_t gcm_data[AES_GCM_DATA_LEN];
+      size_t encrypted_bytes;
+
+      // compressed before it is sealed
+      compressed = dmsg_compress(ctx, p_conn, req);
+      status = dyn_aes_gcm_encrypt_msg(p_conn, req, gcm_data, &encrypted_bytes);
+      if (status != DN_OK) {
+        loga("AES-GCM encryption failed on %s", print_obj(p_conn));
+        *dyn_error_code = status;
+        mbuf_put(header_buf);
+        return status;
+      }
+
+      dmsg_write_gcm(header_buf, req->id, msg_type, p_conn,
+                     (uint32_t)encrypted_bytes, gcm_data);
+    } else if (ENCRYPTION) {
       size_t encrypted_bytes;
       status = dyn_aes_encrypt_msg(req, p_conn->aes_key, &encrypted_bytes);
       if (status != DN_OK) {
@@ -129,9 +164,20 @@ rstatus_t dnode_peer_req_forward(struct context *ctx, struct conn *c_conn,
 
   } else {
     // write dnode header
+    compressed = dmsg_compress(ctx, p_conn, req);
     dmsg_write(header_buf, req->id, msg_type, p_conn, msg_length(req));
   }
 
+  if (compressed) {
+    dmsg_set_compressed(header_buf);
+  }
+  if (req->trace != NULL && p_conn->dmsg_trace) {
+    dmsg_set_trace(header_buf, req->trace->id);
+  }
+  if (req->digest && p_conn->dmsg_digest && !p_conn->dnode_secured) {
+    // the digest would go out in the clear in the header
+    dmsg_set_digest_read(header_buf);
+  }
   mbuf_insert_head(&req->mhdr, header_buf);
 
   if (log_loggable(LOG_VVERB)) {
@@ -8,60 +8,106 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "dyn_conf.h"
 #include "dyn_core.h"
 #include "dyn_histogram.h"
 
-/* a port from this java code:
- * https://github.com/apache/cassandra/blob/cassandra-1.2/src/java/org/apache/cassandra/utils/EstimatedHistogram.java
- *
- * Will try to use https://github.com/HdrHistogram/HdrHistogram_c  later
+/*
+ * Same bucket layout as HdrHistogram (https://github.com/HdrHistogram), with
+ * binary precision. A value whose highest set bit is m, for m > precision,
+ * keeps the precision bits below it and drops the m - precision bits after
+ * them: shift = m - precision is then both the number of dropped bits and
+ * the group of 2^precision buckets the value goes to. OR-ing in 2^precision
+ * makes smaller values fall in group 0 with no shift, so they are exact and
+ * the index is computed without a branch.
  */
 
-static uint64_t bucket_offsets[BUCKET_SIZE];
+static inline uint32_t histo_shift(uint32_t precision, uint64_t val) {
+  return (uint32_t)(63 - __builtin_clzll(val | (1ULL << precision))) -
+         precision;
+}
+
+uint32_t histo_index(uint32_t precision, uint64_t val) {
+  uint32_t shift = histo_shift(precision, val);
+
+  return (shift << precision) + (uint32_t)(val >> shift);
+}
+
+static uint32_t histo_bucket_shift(uint32_t precision, uint32_t index) {
+  uint32_t group = index >> precision;
+
+  return group > 1 ? group - 1 : 0;
+}
+
+/* smallest value that goes to the bucket */
+uint64_t histo_bucket_low(uint32_t precision, uint32_t index) {
+  uint32_t shift = histo_bucket_shift(precision, index);
+
+  return (uint64_t)(index - (shift << precision)) << shift;
+}
+
+/* largest value that goes to the bucket */
+uint64_t histo_bucket_high(uint32_t precision, uint32_t index) {
+  uint32_t shift = histo_bucket_shift(precision, index);
+
+  return histo_bucket_low(precision, index) + ((1ULL << shift) - 1);
+}
+
+/* the groups for shifts 0 to 63 - precision, and group 0 */
+static uint32_t histo_nbuckets(uint32_t precision) {
+  ASSERT(precision > 0 && precision <= HISTO_MAX_PRECISION);
+
+  return (65 - precision) << precision;
+}
+
+rstatus_t histo_init(volatile struct histogram *histo, uint32_t precision) {
+  uint64_t *buckets;
+  uint32_t nbuckets;
 
-rstatus_t histo_init(volatile struct histogram *histo) {
   if (histo == NULL) {
     return DN_ERROR;
   }
 
-  uint64_t *buckets = histo->buckets;
-  uint64_t last = 1;
-  bucket_offsets[0] = last;
-  int i;
-  for (i = 1; i < BUCKET_SIZE; i++) {
-    uint64_t next = (uint64_t)floor((double)last * 1.2);
-    if (next == last) next++;
-
-    bucket_offsets[i] = next;
-    last = next;
+  nbuckets = histo_nbuckets(precision);
+  buckets = dn_zalloc(3 * sizeof(*buckets) * nbuckets);
+  if (buckets == NULL) {
+    return DN_ENOMEM;
   }
 
-  for (i = 0; i < BUCKET_SIZE; i++) {
-    buckets[i] = 0;
-  }
+  histo->precision = precision;
+  histo->nbuckets = nbuckets;
+  histo->buckets = buckets;
+  histo->last = buckets + nbuckets;
+  histo->window = buckets + 2 * nbuckets;
+  histo->sum = 0;
+  histo->last_sum = 0;
 
-  histo->mean = 0;
-  histo->val_95th = 0;
-  histo->val_999th = 0;
-  histo->val_99th = 0;
-  histo->val_max = 0;
+  return histo_reset(histo);
+}
 
-  return DN_OK;
+void histo_deinit(volatile struct histogram *histo) {
+  if (histo->buckets != NULL) {
+    dn_free(histo->buckets);
+    histo->buckets = NULL;
+  }
 }
 
+/*
+ * Start a new window. Only the stats thread calls it, and the buckets
+ * gathered from the recorders are left alone.
+ */
 rstatus_t histo_reset(volatile struct histogram *histo) {
   if (histo == NULL) {
     return DN_ERROR;
   }
 
-  uint64_t *buckets = histo->buckets;
-  int i;
-  for (i = 0; i < BUCKET_SIZE; i++) {
-    buckets[i] = 0;
-  }
+  memset(histo->window, 0, sizeof(*histo->window) * histo->nbuckets);
+  histo->count = 0;
+  histo->window_sum = 0;
+  histo->max = 0;
 
   histo->mean = 0;
   histo->val_95th = 0;
@@ -72,195 +118,141 @@ rstatus_t histo_reset(volatile struct histogram *histo) {
   return DN_OK;
 }
 
-static uint64_t count(struct histogram *histo) {
-  if (histo == NULL) {
-    return 0;
+rstatus_t histo_recorder_init(struct histo_recorder *rec, uint32_t precision) {
+  rec->buckets = dn_zalloc(sizeof(*rec->buckets) * histo_nbuckets(precision));
+  if (rec->buckets == NULL) {
+    return DN_ENOMEM;
   }
+  rec->precision = precision;
+  rec->sum = 0;
+  rec->max = 0;
 
-  uint64_t *buckets = histo->buckets;
-  uint64_t sum = 0L;
-  int i;
-  for (i = 0; i < BUCKET_SIZE; i++) sum += buckets[i];
-  return sum;
+  return DN_OK;
 }
 
-void histo_add(volatile struct histogram *histo, uint64_t val) {
-  if (histo == NULL) {
-    return;
-  }
-
-  uint64_t *buckets = histo->buckets;
-  int left_index, right_index, middle_index, index = 0;
-
-  left_index = 0;
-  right_index = BUCKET_SIZE - 1;
-
-  while (left_index < right_index) {
-    middle_index = left_index + (right_index - left_index) / 2;
-
-    if (val == bucket_offsets[middle_index]) {
-      index = middle_index;
-      break;
-    } else if (val < bucket_offsets[middle_index]) {
-      right_index = middle_index;
-    } else {
-      left_index = middle_index;
-    }
-
-    if (left_index == right_index - 1) {
-      index = left_index;
-      break;
-    }
+void histo_recorder_deinit(struct histo_recorder *rec) {
+  if (rec->buckets != NULL) {
+    dn_free(rec->buckets);
+    rec->buckets = NULL;
   }
-
-  if (left_index == right_index - 1) index = left_index;
-
-  buckets[index]++;
-
-  // store max value
-  histo->val_max = (histo->val_max > val) ? histo->val_max : val;
-}
-
-/*uint64_t histo_get_bucket(struct histogram *histo, int bucket)
-{
-        if (histo == NULL) {
-                return -1;
-        }
-
-        uint64_t *buckets = histo->buckets;
-        if (bucket < BUCKET_SIZE)
-                return buckets[bucket];
-
-        return 0;
 }
 
+/* Record a value. Only the thread that owns the recorder calls it. */
+void histo_add(struct histo_recorder *rec, uint64_t val) {
+  uint64_t *bucket, max;
 
-void histo_get_buckets(struct histogram *histo, uint64_t* my_buckets)
-{
-        if (histo == NULL) {
-                return;
-        }
+  if (rec == NULL || rec->buckets == NULL) {
+    return;
+  }
 
-        uint64_t *buckets = histo->buckets;
-        int i;
-        for(i=0; i<BUCKET_SIZE; i++) {
-                my_buckets[i] = buckets[i];
-        }
+  bucket = &rec->buckets[histo_index(rec->precision, val)];
+  __atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&rec->sum, rec->sum + val, __ATOMIC_RELAXED);
 
+  /* the stats thread takes max away meanwhile, so it needs a CAS */
+  max = __atomic_load_n(&rec->max, __ATOMIC_RELAXED);
+  while (val > max &&
+         !__atomic_compare_exchange_n(&rec->max, &max, val, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
 }
 
-
-uint64_t histo_percentile(struct histogram *histo, double percentile)
-{
-        if (histo == NULL) {
-                return -1;
-        }
-
-        uint64_t *buckets = histo->buckets;
-
-        if (percentile < 0 && percentile > 1.0) {
-                return 0;
-        }
-
-        int last_bucket = BUCKET_SIZE - 1;
-        if (buckets[last_bucket] > 0) {
-                log_error("histogram overflowed!");
-                return -1;
-        }
-
-        uint64_t pcount = floor(count(histo) * percentile);
-        if (pcount == 0)
-                return 0;
-
-        uint64_t elements = 0;
-        int i;
-        for (i = 0; i < last_bucket; i++)
-        {
-                elements += buckets[i];
-                if (elements >= pcount)
-                        return bucket_offsets[i];
-        }
-
-        return 0;
+/*
+ * Gather 'nrec' recorders, 'stride' bytes apart, into the buckets and sum of
+ * the histogram, and take their max. Only the stats thread calls it, before
+ * histo_compute().
+ */
+void histo_merge(volatile struct histogram *histo, struct histo_recorder *rec,
+                 uint32_t nrec, size_t stride) {
+  uint64_t *buckets = histo->buckets;
+  uint64_t sum = 0, max;
+  uint32_t i, r;
+
+  memset(buckets, 0, sizeof(*buckets) * histo->nbuckets);
+  for (r = 0; r < nrec; r++) {
+    if (rec->buckets != NULL) {
+      ASSERT(rec->precision == histo->precision);
+      for (i = 0; i < histo->nbuckets; i++) {
+        buckets[i] += __atomic_load_n(&rec->buckets[i], __ATOMIC_RELAXED);
+      }
+      sum += __atomic_load_n(&rec->sum, __ATOMIC_RELAXED);
+      max = __atomic_exchange_n(&rec->max, 0, __ATOMIC_RELAXED);
+      histo->max = MAX(histo->max, max);
+    }
+    rec = (struct histo_recorder *)((uint8_t *)rec + stride);
+  }
+  histo->sum = sum;
 }
 
+/*
+ * Value at or below which the given percent of the window falls, as the
+ * largest value of its bucket.
+ */
+uint64_t histo_percentile(volatile struct histogram *histo, double percentile) {
+  uint64_t *window = histo->window;
+  uint64_t target, elements = 0;
+  uint32_t i;
 
-uint64_t histo_mean(struct histogram *histo)
-{
-        if (histo == NULL) {
-                return -1;
-        }
-
-        uint64_t *buckets = histo->buckets;
-
-        int last_bucket = BUCKET_SIZE - 1;
-        if (buckets[last_bucket] > 0) {
-                log_error("histogram overflowed!");
-                return -1;
-        }
-
-        uint64_t elements = 0;
-        uint64_t sum = 0;
-        int i;
-        for (i = 0; i < last_bucket; i++)
-        {
-                elements += buckets[i];
-                sum += buckets[i] * bucket_offsets[i];
-        }
-
-        return  ceil((double) sum / elements);
-}
+  if (histo->count == 0) {
+    return 0;
+  }
 
+  percentile = MAX(0.0, MIN(percentile, 100.0));
+  target = (uint64_t)ceil((double)histo->count * percentile / 100.0);
+  target = MAX(target, 1);
 
-uint64_t histo_max(struct histogram *histo)
-{
-        if (histo == NULL) {
-                return -1;
-        }
+  for (i = 0; i < histo->nbuckets; i++) {
+    elements += window[i];
+    if (elements >= target) {
+      return MIN(histo_bucket_high(histo->precision, i), histo->val_max);
+    }
+  }
 
-        return histo->val_max;
+  return histo->val_max;
 }
-*/
 
+/*
+ * Merge the interval since the previous call into the window and compute
+ * the mean and percentiles of the window. Only the stats thread calls it.
+ */
 void histo_compute(volatile struct histogram *histo) {
+  uint64_t *buckets, *last, *window;
+  uint64_t sum, count = 0;
+  uint32_t i;
+
   if (histo == NULL) {
     return;
   }
 
-  uint64_t *buckets = histo->buckets;
-
-  int last_bucket = BUCKET_SIZE - 1;
-  if (buckets[last_bucket] > 0) {
-    log_error("histogram overflowed!");
-    return;
+  buckets = histo->buckets;
+  last = histo->last;
+  window = histo->window;
+  for (i = 0; i < histo->nbuckets; i++) {
+    uint64_t val = buckets[i];
+    window[i] += val - last[i];
+    last[i] = val;
+    count += window[i];
   }
 
-  uint64_t p95_count = (uint64_t)floor((double)count(histo) * 0.95);
-  uint64_t p99_count = (uint64_t)floor((double)count(histo) * 0.99);
-  uint64_t p999_count = (uint64_t)floor((double)count(histo) * 0.999);
-
-  uint64_t val_95th = 0;
-  uint64_t val_99th = 0;
-  uint64_t val_999th = 0;
+  sum = histo->sum;
+  histo->window_sum += sum - histo->last_sum;
+  histo->last_sum = sum;
+  histo->count = count;
 
-  uint64_t elements = 0;
-  uint64_t sum = 0;
-  int i;
-  for (i = 0; i < last_bucket; i++) {
-    elements += buckets[i];
-    if (elements >= p95_count && val_95th == 0) val_95th = bucket_offsets[i];
-
-    if (elements >= p99_count && val_99th == 0) val_99th = bucket_offsets[i];
-
-    if (elements >= p999_count && val_999th == 0) val_999th = bucket_offsets[i];
-
-    sum += buckets[i] * bucket_offsets[i];
+  /* the window may hold a value recorded before the last reset of max */
+  for (i = histo->nbuckets; i > 0 && count != 0; i--) {
+    if (window[i - 1] != 0) {
+      histo->val_max =
+          MAX(histo->max, histo_bucket_low(histo->precision, i - 1));
+      break;
+    }
   }
 
-  if (elements != 0)
-    histo->mean = (uint64_t)ceil((double)sum / (double)elements);
+  if (count != 0) {
+    histo->mean = (uint64_t)ceil((double)histo->window_sum / (double)count);
+  }
 
-  histo->val_95th = val_95th;
-  histo->val_99th = val_99th;
-  histo->val_999th = val_999th;
+  histo->val_95th = histo_percentile(histo, 95.0);
+  histo->val_99th = histo_percentile(histo, 99.0);
+  histo->val_999th = histo_percentile(histo, 99.9);
 }
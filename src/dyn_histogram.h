@@ -8,10 +8,34 @@
 #ifndef DYN_HISTOGRAM_H_
 #define DYN_HISTOGRAM_H_
 
-#define BUCKET_SIZE 94
+#include "dyn_types.h"
 
+/* sub-bucket bits: values are kept within 1/2^precision of their size */
+#define HISTO_DEFAULT_PRECISION 5
+#define HISTO_MAX_PRECISION 8
+
+/*
+ * Log-linear histogram: every power of two is split into 2^precision buckets
+ * of equal width, and values below 2^(precision + 1) get a bucket each.
+ *
+ * Each event loop records into a histo_recorder of its own. The stats thread
+ * gathers the recorders into buckets, sum and max with histo_merge(), merges
+ * what was recorded since its last histo_compute() into the window, from
+ * which the percentiles are taken, and clears only the window on a reset.
+ */
 struct histogram {
-  uint64_t buckets[BUCKET_SIZE];
+  uint32_t precision; /* log2 of the buckets per power of two */
+  uint32_t nbuckets;  /* buckets in each array */
+  uint64_t *buckets;  /* values recorded since init, by all recorders */
+  uint64_t sum;       /* sum of the values recorded since init */
+  uint64_t max;       /* largest value recorded since the last reset */
+
+  uint64_t *last;     /* buckets at the previous histo_compute() */
+  uint64_t last_sum;  /* sum at the previous histo_compute() */
+  uint64_t *window;   /* values recorded since the last reset */
+  uint64_t count;     /* values in the window */
+  uint64_t window_sum; /* sum of the values in the window */
+
   uint64_t mean;
   uint64_t val_95th;
   uint64_t val_99th;
@@ -19,14 +43,30 @@ struct histogram {
   uint64_t val_max;
 };
 
-rstatus_t histo_init(volatile struct histogram *histo);
+/*
+ * Values one thread recorded into a histogram. Only that thread writes the
+ * buckets and the sum, so recording takes no lock and no atomic add; the
+ * stats thread reads them, and takes max, with atomic operations.
+ */
+struct histo_recorder {
+  uint32_t precision; /* as the histogram's */
+  uint64_t *buckets;  /* values recorded since init */
+  uint64_t sum;       /* sum of the values recorded since init */
+  uint64_t max;       /* largest value since histo_merge() last took it */
+};
+
+rstatus_t histo_init(volatile struct histogram *histo, uint32_t precision);
+void histo_deinit(volatile struct histogram *histo);
 rstatus_t histo_reset(volatile struct histogram *histo);
-void histo_add(volatile struct histogram *histo, uint64_t val);
-uint64_t histo_get_bucket(volatile struct histogram *histo, int bucket);
-void histo_get_buckets(volatile struct histogram *histo, uint64_t *my_buckets);
-uint64_t histo_percentile(volatile struct histogram *histo, double percentile);
-uint64_t histo_mean(volatile struct histogram *histo);
-uint64_t histo_max(volatile struct histogram *histo);
+void histo_merge(volatile struct histogram *histo, struct histo_recorder *rec,
+                 uint32_t nrec, size_t stride);
 void histo_compute(volatile struct histogram *histo);
+rstatus_t histo_recorder_init(struct histo_recorder *rec, uint32_t precision);
+void histo_recorder_deinit(struct histo_recorder *rec);
+void histo_add(struct histo_recorder *rec, uint64_t val);
+uint64_t histo_percentile(volatile struct histogram *histo, double percentile);
+uint32_t histo_index(uint32_t precision, uint64_t val);
+uint64_t histo_bucket_low(uint32_t precision, uint32_t index);
+uint64_t histo_bucket_high(uint32_t precision, uint32_t index);
 
 #endif /* DYN_HISTOGRAM_H_ */
@@ -22,41 +22,104 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "dyn_core.h"
 
-static uint64_t nfree_mbufq;   /* # free mbuf */
-static struct mhdr free_mbufq; /* free mbuf q */
-
-static size_t mbuf_chunk_size; /* mbuf chunk size - header + data (const) */
-static size_t
-    mbuf_offset; /* mbuf offset in chunk (const) - include the extra space*/
+/*
+ * mbufs come in a few size classes (MBUF_MIN_SIZE, MBUF_SMALL_SIZE and the
+ * configured mbuf_size, which is the default class returned by mbuf_get()).
+ * Chunks are carved out of large slabs that are mmap-ed and, where
+ * available, backed by transparent huge pages; they are never handed back to
+ * malloc. Each event loop thread keeps its own per-class cache of free
+ * chunks, so mbuf_get()/mbuf_put() are a list push/pop with no locking and
+ * no allocation on the hot path. The data pages of cached chunks can be
+ * returned to the OS with mbuf_trim().
+ */
+struct mbuf_class {
+  size_t chunk_size; /* mbuf chunk size - header + data (const) */
+  size_t offset;     /* mbuf offset in chunk (const) - include the extra space*/
+};
+
+struct mbuf_cache {
+  uint64_t nfree;   /* # free mbuf */
+  struct mhdr free; /* free mbuf q */
+};
+
+struct mbuf_slab {
+  uint8_t *base;          /* slab start, MBUF_SLAB_SIZE aligned */
+  struct mbuf_slab *next; /* next slab owned by this thread */
+};
+
+static struct mbuf_class mbuf_classes[MBUF_MAX_CLASSES];
+static uint8_t mbuf_nclass;  /* # size classes (const) */
+static uint8_t mbuf_dclass;  /* default size class (const) */
+static size_t mbuf_pagesize; /* system page size (const) */
 static uint64_t mbuf_alloc_count = 0;
 
-uint64_t mbuf_alloc_get_count(void) { return mbuf_alloc_count; }
+static __thread struct mbuf_cache mbuf_caches[MBUF_MAX_CLASSES];
+static __thread struct mbuf_slab *mbuf_slabs;
 
-static struct mbuf *_mbuf_get(void) {
-  struct mbuf *mbuf;
-  uint8_t *buf;
+uint64_t mbuf_alloc_get_count(void) {
+  return __atomic_load_n(&mbuf_alloc_count, __ATOMIC_RELAXED);
+}
 
-  // loga("_mbuf_get, nfree_mbufq = %d", nfree_mbufq);
+/*
+ * Map a new MBUF_SLAB_SIZE aligned slab so that the kernel can back it with
+ * huge pages.
+ */
+static uint8_t *mbuf_slab_map(void) {
+  size_t size = 2 * MBUF_SLAB_SIZE;
+  uint8_t *raw = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    log_error("mmap of %zu bytes for mbuf slab failed: %s", size,
+              strerror(errno));
+    return NULL;
+  }
 
-  if (!STAILQ_EMPTY(&free_mbufq)) {
-    ASSERT(nfree_mbufq > 0);
+  uint8_t *base = (uint8_t *)DN_ALIGN_PTR(raw, MBUF_SLAB_SIZE);
+  if (base > raw) {
+    munmap(raw, (size_t)(base - raw));
+  }
+  uint8_t *tail = base + MBUF_SLAB_SIZE;
+  if (tail < raw + size) {
+    munmap(tail, (size_t)(raw + size - tail));
+  }
 
-    mbuf = STAILQ_FIRST(&free_mbufq);
-    nfree_mbufq--;
-    STAILQ_REMOVE_HEAD(&free_mbufq, next);
+#ifdef MADV_HUGEPAGE
+  madvise(base, MBUF_SLAB_SIZE, MADV_HUGEPAGE);
+#endif
 
-    ASSERT(mbuf->magic == MBUF_MAGIC);
-    goto done;
+  return base;
+}
+
+/*
+ * Carve a fresh slab into chunks of the given size class and push them all
+ * onto the calling thread's cache.
+ */
+static rstatus_t mbuf_slab_grow(uint8_t cid) {
+  struct mbuf_class *mc = &mbuf_classes[cid];
+  struct mbuf_cache *cache = &mbuf_caches[cid];
+  struct mbuf_slab *slab;
+  size_t nchunk, i;
+
+  slab = dn_alloc(sizeof(*slab));
+  if (slab == NULL) {
+    return DN_ENOMEM;
   }
 
-  buf = dn_alloc(mbuf_chunk_size);
-  if (buf == NULL) {
-    return NULL;
+  slab->base = mbuf_slab_map();
+  if (slab->base == NULL) {
+    dn_free(slab);
+    return DN_ENOMEM;
   }
-  mbuf_alloc_count++;
+  slab->next = mbuf_slabs;
+  mbuf_slabs = slab;
+
+  nchunk = MBUF_SLAB_SIZE / mc->chunk_size;
+  ASSERT(nchunk > 0);
 
   /*
    * mbuf header is at the tail end of the mbuf. This enables us to catch
@@ -79,31 +142,62 @@ static struct mbuf *_mbuf_get(void) {
    *                       mbuf->last (one byte past valid byte)
    *
    */
-  mbuf = (struct mbuf *)(buf + mbuf_offset);
-  mbuf->magic = MBUF_MAGIC;
-  mbuf->chunk_size = mbuf_chunk_size;
+  for (i = 0; i < nchunk; i++) {
+    uint8_t *buf = slab->base + i * mc->chunk_size;
+    struct mbuf *mbuf = (struct mbuf *)(buf + mc->offset);
+    mbuf->magic = MBUF_MAGIC;
+    mbuf->chunk_size = (uint32_t)mc->chunk_size;
+    mbuf->cid = cid;
+    mbuf->flags = 0;
+    STAILQ_INSERT_HEAD(&cache->free, mbuf, next);
+    cache->nfree++;
+  }
+
+  __atomic_add_fetch(&mbuf_alloc_count, nchunk, __ATOMIC_RELAXED);
+  log_debug(LOG_INFO, "mbuf slab %p with %zu chunks of %zu bytes", slab->base,
+            nchunk, mc->chunk_size);
+
+  return DN_OK;
+}
+
+static struct mbuf *_mbuf_get(uint8_t cid) {
+  struct mbuf_cache *cache = &mbuf_caches[cid];
+  struct mbuf *mbuf;
+
+  if (STAILQ_EMPTY(&cache->free)) {
+    if (mbuf_slab_grow(cid) != DN_OK) {
+      return NULL;
+    }
+  }
+
+  ASSERT(cache->nfree > 0);
+
+  mbuf = STAILQ_FIRST(&cache->free);
+  cache->nfree--;
+  STAILQ_REMOVE_HEAD(&cache->free, next);
+
+  ASSERT(mbuf->magic == MBUF_MAGIC);
 
-done:
   STAILQ_NEXT(mbuf, next) = NULL;
   return mbuf;
 }
 
-struct mbuf *mbuf_get(void) {
+static struct mbuf *mbuf_get_class(uint8_t cid) {
+  struct mbuf_class *mc = &mbuf_classes[cid];
   struct mbuf *mbuf;
   uint8_t *buf;
 
-  mbuf = _mbuf_get();
+  mbuf = _mbuf_get(cid);
   if (mbuf == NULL) {
     loga("mbuf is Null");
     return NULL;
   }
 
-  buf = (uint8_t *)mbuf - mbuf_offset;
+  buf = (uint8_t *)mbuf - mc->offset;
   mbuf->start = buf;
-  mbuf->end = buf + mbuf_offset - MBUF_ESIZE;
-  mbuf->end_extra = buf + mbuf_offset;
+  mbuf->end = buf + mc->offset - MBUF_ESIZE;
+  mbuf->end_extra = buf + mc->offset;
 
-  // ASSERT(mbuf->end - mbuf->start == (int)mbuf_offset);
   ASSERT(mbuf->start < mbuf->end);
 
   mbuf->pos = mbuf->start;
@@ -116,19 +210,80 @@ struct mbuf *mbuf_get(void) {
   return mbuf;
 }
 
-static void mbuf_free(struct mbuf *mbuf) {
-  uint8_t *buf;
+struct mbuf *mbuf_get(void) { return mbuf_get_class(mbuf_dclass); }
 
-  log_debug(LOG_VVERB, "put mbuf %p len %d", mbuf, mbuf->last - mbuf->pos);
+/*
+ * Get an mbuf from the smallest size class that can hold size bytes. Use
+ * this only for buffers whose final size is known up front (headers, error
+ * replies); anything that may grow must come from mbuf_get().
+ */
+struct mbuf *mbuf_get_sized(size_t size) {
+  uint8_t cid;
 
-  ASSERT(STAILQ_NEXT(mbuf, next) == NULL);
-  ASSERT(mbuf->magic == MBUF_MAGIC);
+  for (cid = 0; cid < mbuf_dclass; cid++) {
+    if (size < mbuf_classes[cid].offset - MBUF_ESIZE) {
+      break;
+    }
+  }
 
-  buf = (uint8_t *)mbuf - mbuf_offset;
-  dn_free(buf);
+  return mbuf_get_class(cid);
+}
+
+/*
+ * Get an mbuf that holds 'size' bytes in one piece: a cached one if they fit
+ * in the largest class, one allocated for them otherwise.
+ */
+struct mbuf *mbuf_get_whole(size_t size) {
+  if (size <= mbuf_data_size() - MBUF_ESIZE) {
+    return mbuf_get_sized(size);
+  }
+  return mbuf_alloc(size + MBUF_ESIZE);
 }
 
-uint64_t mbuf_free_queue_size(void) { return nfree_mbufq; }
+uint64_t mbuf_free_queue_size(void) {
+  uint64_t nfree = 0;
+  uint8_t cid;
+
+  for (cid = 0; cid < mbuf_nclass; cid++) {
+    nfree += mbuf_caches[cid].nfree;
+  }
+
+  return nfree;
+}
+
+/*
+ * Give the data pages of every cached free mbuf back to the OS. The chunk
+ * header at the tail stays resident, so the mbuf remains on its free list
+ * and the pages are faulted back in (zeroed) on next use.
+ */
+void mbuf_trim(void) {
+  uint64_t ntrim = 0;
+  uint8_t cid;
+
+  for (cid = 0; cid < mbuf_nclass; cid++) {
+    struct mbuf_class *mc = &mbuf_classes[cid];
+    struct mbuf *mbuf;
+
+    STAILQ_FOREACH(mbuf, &mbuf_caches[cid].free, next) {
+      if (mbuf->flags & MBUF_FLAGS_TRIMMED) {
+        continue;
+      }
+      mbuf->flags |= MBUF_FLAGS_TRIMMED;
+
+      uint8_t *buf = (uint8_t *)mbuf - mc->offset;
+      uint8_t *first = (uint8_t *)DN_ALIGN_PTR(buf, mbuf_pagesize);
+      uint8_t *last = (uint8_t *)((uintptr_t)mbuf & ~(mbuf_pagesize - 1));
+      if (last <= first) {
+        continue;
+      }
+      if (madvise(first, (size_t)(last - first), MADV_DONTNEED) == 0) {
+        ntrim++;
+      }
+    }
+  }
+
+  log_debug(LOG_NOTICE, "trimmed %" PRIu64 " free mbufs", ntrim);
+}
 
 void mbuf_dump(struct mbuf *mbuf) {
   uint8_t *p, *q;
@@ -147,8 +302,16 @@ void mbuf_put(struct mbuf *mbuf) {
   ASSERT(STAILQ_NEXT(mbuf, next) == NULL);
   ASSERT(mbuf->magic == MBUF_MAGIC);
 
-  nfree_mbufq++;
-  STAILQ_INSERT_HEAD(&free_mbufq, mbuf, next);
+  if (mbuf->cid == MBUF_CLASS_NONE) {
+    mbuf_dealloc(mbuf);
+    return;
+  }
+
+  ASSERT(mbuf->cid < mbuf_nclass);
+
+  struct mbuf_cache *cache = &mbuf_caches[mbuf->cid];
+  cache->nfree++;
+  STAILQ_INSERT_HEAD(&cache->free, mbuf, next);
 }
 
 /*
@@ -184,7 +347,7 @@ uint32_t mbuf_remaining_space(struct mbuf *mbuf) {
  * Return the maximum available space size for data in any mbuf. Mbuf cannot
  * contain more than 2^32 bytes (4G).
  */
-size_t mbuf_data_size(void) { return mbuf_offset; }
+size_t mbuf_data_size(void) { return mbuf_classes[mbuf_dclass].offset; }
 
 /*
  * Insert mbuf at the tail of the mhdr Q
@@ -283,29 +446,64 @@ struct mbuf *mbuf_split(struct mhdr *h, uint8_t *pos, func_mbuf_copy_t cb,
   return nbuf;
 }
 
+static void mbuf_class_add(size_t size) {
+  struct mbuf_class *mc = &mbuf_classes[mbuf_nclass++];
+
+  mc->chunk_size = size + MBUF_ESIZE;
+  mc->offset = mc->chunk_size - MBUF_HSIZE;
+
+  log_debug(LOG_DEBUG, "mbuf class %d hsize %d chunk size %zu offset %zu",
+            mbuf_nclass - 1, MBUF_HSIZE, mc->chunk_size, mc->offset);
+}
+
 /**
  * Initialize memory buffers to store network packets/socket buffers.
  * @param[in,out] mbuf_size
  */
 void mbuf_init(size_t mbuf_size) {
-  nfree_mbufq = 0;
-  STAILQ_INIT(&free_mbufq);
+  mbuf_pagesize = (size_t)sysconf(_SC_PAGESIZE);
 
-  mbuf_chunk_size = mbuf_size + MBUF_ESIZE;
-  mbuf_offset = mbuf_chunk_size - MBUF_HSIZE;
+  mbuf_nclass = 0;
+  if (MBUF_MIN_SIZE < mbuf_size) {
+    mbuf_class_add(MBUF_MIN_SIZE);
+  }
+  if (MBUF_SMALL_SIZE < mbuf_size) {
+    mbuf_class_add(MBUF_SMALL_SIZE);
+  }
+  mbuf_dclass = mbuf_nclass;
+  mbuf_class_add(mbuf_size);
 
-  log_debug(LOG_DEBUG, "mbuf hsize %d chunk size %zu offset %zu length %zu",
-            MBUF_HSIZE, mbuf_chunk_size, mbuf_offset, mbuf_offset);
+  mbuf_thread_init();
+}
+
+/*
+ * Initialize the calling thread's mbuf caches. mbuf_init() must already
+ * have been called once to set up the size classes.
+ */
+void mbuf_thread_init(void) {
+  uint8_t cid;
+
+  for (cid = 0; cid < MBUF_MAX_CLASSES; cid++) {
+    mbuf_caches[cid].nfree = 0;
+    STAILQ_INIT(&mbuf_caches[cid].free);
+  }
+  mbuf_slabs = NULL;
 }
 
 void mbuf_deinit(void) {
-  while (!STAILQ_EMPTY(&free_mbufq)) {
-    struct mbuf *mbuf = STAILQ_FIRST(&free_mbufq);
-    mbuf_remove(&free_mbufq, mbuf);
-    mbuf_free(mbuf);
-    nfree_mbufq--;
+  uint8_t cid;
+
+  for (cid = 0; cid < MBUF_MAX_CLASSES; cid++) {
+    mbuf_caches[cid].nfree = 0;
+    STAILQ_INIT(&mbuf_caches[cid].free);
+  }
+
+  while (mbuf_slabs != NULL) {
+    struct mbuf_slab *slab = mbuf_slabs;
+    mbuf_slabs = slab->next;
+    munmap(slab->base, MBUF_SLAB_SIZE);
+    dn_free(slab);
   }
-  ASSERT(nfree_mbufq == 0);
 }
 
 void mbuf_write_char(struct mbuf *mbuf, char ch) {
@@ -369,6 +567,8 @@ struct mbuf *mbuf_alloc(const size_t size) {
   struct mbuf *mbuf = (struct mbuf *)(buf + size);
   mbuf->magic = MBUF_MAGIC;
   mbuf->chunk_size = mbuf_chunk_size;
+  mbuf->cid = MBUF_CLASS_NONE;
+  mbuf->flags = 0;
 
   STAILQ_NEXT(mbuf, next) = NULL;
 
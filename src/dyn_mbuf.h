@@ -42,6 +42,7 @@ struct mbuf {
   uint8_t *end_extra;      /*end of the buffer - including the extra region */
   uint32_t flags;          /* flags: readflip, just_decrypted etc */
   uint32_t chunk_size;
+  uint8_t cid;             /* size class, MBUF_CLASS_NONE for mbuf_alloc */
 };
 
 STAILQ_HEAD(mhdr, mbuf);
@@ -50,12 +51,18 @@ STAILQ_HEAD(mhdr, mbuf);
 #define MBUF_MIN_SIZE 512
 #define MBUF_MAX_SIZE 512000
 #define MBUF_SIZE 16384
+#define MBUF_SMALL_SIZE 4096
+#define MBUF_MAX_CLASSES 3
+#define MBUF_CLASS_NONE 0xff
+#define MBUF_SLAB_SIZE (2 * 1024 * 1024)
 #define MBUF_HSIZE sizeof(struct mbuf)
 #define MBUF_ESIZE 16
 
 // FLAGS
 #define MBUF_FLAGS_READ_FLIP 0x00000001
 #define MBUF_FLAGS_JUST_DECRYPTED 0x00000002
+#define MBUF_FLAGS_TRIMMED 0x00000004
+#define MBUF_FLAGS_PIPE 0x00000008 /* msg's piped value goes before this mbuf */
 
 static inline bool mbuf_empty(struct mbuf *mbuf) {
   return mbuf->pos == mbuf->last ? true : false;
@@ -66,8 +73,12 @@ static inline bool mbuf_full(struct mbuf *mbuf) {
 }
 
 void mbuf_init(size_t mbuf_chunk_size);
+void mbuf_thread_init(void);
 void mbuf_deinit(void);
 struct mbuf *mbuf_get(void);
+struct mbuf *mbuf_get_sized(size_t size);
+struct mbuf *mbuf_get_whole(size_t size);
+void mbuf_trim(void);
 void mbuf_put(struct mbuf *mbuf);
 uint64_t mbuf_alloc_get_count(void);
 uint64_t mbuf_free_queue_size(void);
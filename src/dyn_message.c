@@ -28,6 +28,7 @@
 #include "dyn_core.h"
 #include "dyn_dnode_peer.h"
 #include "dyn_server.h"
+#include "dyn_task.h"
 #include "hashkit/dyn_hashkit.h"
 #include "proto/dyn_proto.h"
 
@@ -143,11 +144,16 @@
  * So generally request->selected_rsp & response->peer is valid. Eventually it
  * will be good to have different structures for request and response.
  */
-static uint64_t msg_id;          /* message id counter */
-static uint64_t frag_id;         /* fragment id counter */
-static struct msg_tqh free_msgq; /* free msg q */
-static struct rbtree tmo_rbt;    /* timeout rbtree */
-static struct rbnode tmo_rbs;    /* timeout rbtree sentinel */
+/*
+ * Message ids, the free msg q and the timeout wheel are owned by the event
+ * loop thread that uses them; see dyn_worker.c.
+ */
+static __thread uint64_t msg_id;          /* message id counter */
+static __thread uint64_t frag_id;         /* fragment id counter */
+static __thread struct msg_tqh free_msgq; /* free msg q */
+static __thread struct timewheel tmo_tw;  /* timeout wheel */
+static __thread int msg_pipes[MSG_PIPE_CACHE][2]; /* idle splice pipes */
+static __thread uint32_t msg_npipe;               /* # idle splice pipes */
 static size_t alloc_msgs_max; /* maximum number of allowed allocated messages */
 uint8_t g_timeout_factor = 1;
 
@@ -226,29 +232,36 @@ static inline rstatus_t msg_cant_handle_response(struct msg *req,
   return DN_ENO_IMPL;
 }
 
-static struct msg *msg_from_rbe(struct rbnode *node) {
+static struct msg *msg_from_twe(struct tw_node *node) {
   struct msg *req;
   int offset;
 
-  offset = offsetof(struct msg, tmo_rbe);
+  offset = offsetof(struct msg, tmo_twe);
   req = (struct msg *)((char *)node - offset);
 
   return req;
 }
 
-struct msg *msg_tmo_min(void) {
-  struct rbnode *node;
+/*
+ * Removes and returns a request whose timeout expired at or before 'now', or
+ * NULL if there is none.
+ */
+struct msg *msg_tmo_expired(msec_t now) {
+  struct tw_node *node;
 
-  node = rbtree_min(&tmo_rbt);
+  node = timewheel_expire(&tmo_tw, now);
   if (node == NULL) {
     return NULL;
   }
 
-  return msg_from_rbe(node);
+  return msg_from_twe(node);
 }
 
+/* Returns the msec until msg_tmo_expired() may return a request. */
+msec_t msg_tmo_next(msec_t now) { return timewheel_next(&tmo_tw, now); }
+
 void msg_tmo_insert(struct msg *req, struct conn *conn) {
-  struct rbnode *node;
+  struct tw_node *node;
   msec_t timeout;
 
   // ASSERT(req->is_request);
@@ -261,42 +274,57 @@ void msg_tmo_insert(struct msg *req, struct conn *conn) {
   }
   timeout = timeout * g_timeout_factor;
 
-  node = &req->tmo_rbe;
-  node->timeout = timeout;
-  node->key = dn_msec_now() + timeout;
-  node->data = conn;
+  node = &req->tmo_twe;
+  node->rbnode.timeout = timeout;
+  node->rbnode.data = conn;
 
-  rbtree_insert(&tmo_rbt, node);
+  timewheel_insert(&tmo_tw, node, dn_msec_now() + timeout);
 
   if (log_loggable(LOG_VERB)) {
     log_debug(LOG_VERB,
               "insert req %" PRIu64
-              " into tmo rbt with expiry of "
+              " into tmo wheel with expiry of "
               "%d msec",
               req->id, timeout);
   }
 }
 
 void msg_tmo_delete(struct msg *req) {
-  struct rbnode *node;
+  struct tw_node *node;
 
-  node = &req->tmo_rbe;
+  node = &req->tmo_twe;
 
   /* already deleted */
 
-  if (node->data == NULL) {
+  if (!timewheel_queued(node)) {
     return;
   }
 
-  rbtree_delete(&tmo_rbt, node);
+  timewheel_delete(&tmo_tw, node);
 
   if (log_loggable(LOG_VERB)) {
-    log_debug(LOG_VERB, "delete req %" PRIu64 " from tmo rbt", req->id);
+    log_debug(LOG_VERB, "delete req %" PRIu64 " from tmo wheel", req->id);
   }
 }
 
 static size_t alloc_msg_count = 0;
 
+/*
+ * Running out of messages means this thread just absorbed a burst and very
+ * likely sits on a large cache of free mbufs. Give their pages back to the OS,
+ * at most once per MSG_TRIM_INTERVAL_MS.
+ */
+static void msg_memory_pressure(void) {
+  static __thread msec_t last_trim_ms = 0;
+  msec_t now_ms = dn_msec_now();
+
+  if (now_ms - last_trim_ms < MSG_TRIM_INTERVAL_MS) {
+    return;
+  }
+  last_trim_ms = now_ms;
+  mbuf_trim();
+}
+
 static struct msg *_msg_get(struct conn *conn, bool request,
                             const char *const caller) {
   struct msg *msg;
@@ -311,19 +339,20 @@ static struct msg *_msg_get(struct conn *conn, bool request,
 
   // protect our server in the slow network and high traffics.
   // we drop client requests but still honor our peer requests
-  if (alloc_msg_count >= alloc_msgs_max) {
-    log_debug(LOG_WARN, "allocated #msgs %lu hit max allowable limit",
-              alloc_msg_count);
+  size_t count = __atomic_load_n(&alloc_msg_count, __ATOMIC_RELAXED);
+  if (count >= alloc_msgs_max) {
+    log_debug(LOG_WARN, "allocated #msgs %lu hit max allowable limit", count);
+    msg_memory_pressure();
     return NULL;
   }
 
-  alloc_msg_count++;
+  count = __atomic_add_fetch(&alloc_msg_count, 1, __ATOMIC_RELAXED);
 
-  if (alloc_msg_count % 1000 == 0)
-    log_warn("alloc_msg_count: %lu caller: %s %s", alloc_msg_count, caller,
+  if (count % 1000 == 0)
+    log_warn("alloc_msg_count: %lu caller: %s %s", count, caller,
              print_obj(conn));
   else
-    log_info("alloc_msg_count: %lu caller: %s %s", alloc_msg_count, caller,
+    log_info("alloc_msg_count: %lu caller: %s %s", count, caller,
              print_obj(conn));
 
   msg = dn_alloc(sizeof(*msg));
@@ -346,13 +375,22 @@ done:
   msg->stime_in_microsec = 0ULL;
   msg->request_send_time = 0L;
   msg->request_inqueue_enqueue_time_us = 0L;
+  msg->trace = NULL;
+  msg->copy_mbuf = NULL;
+  msg->copy_pos = NULL;
+  msg->hedge_peer = NULL;
+  msg->hedge_task = NULL;
   msg->awaiting_rsps = 0;
   msg->selected_rsp = NULL;
 
-  rbtree_node_init(&msg->tmo_rbe);
+  timewheel_node_init(&msg->tmo_twe);
 
   STAILQ_INIT(&msg->mhdr);
   msg->mlen = 0;
+  msg->pipe_fd[0] = -1;
+  msg->pipe_fd[1] = -1;
+  msg->pipe_len = 0;
+  msg->pipe_remain = 0;
 
   msg->state = 0;
   msg->pos = NULL;
@@ -391,6 +429,9 @@ done:
   msg->rntokens = 0;
   msg->nkeys = 0;
   msg->rlen = 0;
+  msg->bulk_rlen = 0;
+  msg->crc = 0;
+  msg->crc_pos = NULL;
   msg->integer = 0;
 
   msg->error_code = 0;
@@ -404,6 +445,15 @@ done:
   msg->swallow = 0;
   msg->dnode_header_prepended = 0;
   msg->rsp_sent = 0;
+  msg->spliced = 0;
+  msg->read_cache_fill = 0;
+  msg->top_keys_sampled = 0;
+  msg->diverted = 0;
+  msg->is_hedge = 0;
+  msg->digest_read = 0;
+  msg->digest = 0;
+  msg->crc_done = 0;
+  msg->in_flight = 0;
 
   // dynomite
   msg->is_read = 1;
@@ -438,7 +488,9 @@ done:
   return msg;
 }
 
-size_t msg_alloc_msgs() { return alloc_msg_count; }
+size_t msg_alloc_msgs() {
+  return __atomic_load_n(&alloc_msg_count, __ATOMIC_RELAXED);
+}
 
 size_t msg_free_queue_size(void) { return TAILQ_COUNT(&free_msgq); }
 
@@ -494,8 +546,13 @@ struct msg *msg_get(struct conn *conn, bool request, const char *const caller) {
   return msg;
 }
 
-rstatus_t msg_clone(struct msg *src, struct mbuf *mbuf_start,
-                    struct msg *target) {
+/*
+ * Copy 'src' from the mbuf 'mbuf_start' on into 'target'. If 'pos' is given
+ * the data starts there in 'mbuf_start' and at the start of the mbufs after
+ * it, rather than at their pos, which sending moves to their last.
+ */
+static rstatus_t msg_clone_at(struct msg *src, struct mbuf *mbuf_start,
+                              uint8_t *pos, struct msg *target) {
   target->parent_id = src->id;
   target->owner = src->owner;
   target->is_request = src->is_request;
@@ -524,14 +581,30 @@ rstatus_t msg_clone(struct msg *src, struct mbuf *mbuf_start,
       return DN_ENOMEM;
     }
 
-    uint32_t len = mbuf_length(mbuf);
-    mbuf_copy(nbuf, mbuf->pos, len);
+    uint8_t *start = pos == NULL ? mbuf->pos
+                                 : mbuf == mbuf_start ? pos : mbuf->start;
+    uint32_t len = (uint32_t)(mbuf->last - start);
+    mbuf_copy(nbuf, start, len);
     mbuf_insert(&target->mhdr, nbuf);
   }
 
   return DN_OK;
 }
 
+rstatus_t msg_clone(struct msg *src, struct mbuf *mbuf_start,
+                    struct msg *target) {
+  return msg_clone_at(src, mbuf_start, NULL, target);
+}
+
+/*
+ * Copy a request that may have been sent since 'pos' was its start in
+ * 'mbuf_start'. It must not have been encrypted or compressed in place.
+ */
+rstatus_t msg_clone_sent(struct msg *src, struct mbuf *mbuf_start,
+                         uint8_t *pos, struct msg *target) {
+  return msg_clone_at(src, mbuf_start, pos, target);
+}
+
 struct msg *msg_get_error(struct conn *conn, dyn_error_t dyn_error_code,
                           err_t error_code) {
   struct msg *rsp;
@@ -606,6 +679,50 @@ struct msg *msg_get_rsp_integer(struct conn *conn) {
   return rsp;
 }
 
+static rstatus_t msg_pipe_get(struct msg *msg) {
+  ASSERT(msg->pipe_fd[0] < 0);
+
+  if (msg_npipe != 0) {
+    msg_npipe--;
+    msg->pipe_fd[0] = msg_pipes[msg_npipe][0];
+    msg->pipe_fd[1] = msg_pipes[msg_npipe][1];
+    return DN_OK;
+  }
+
+  if (dn_pipe(msg->pipe_fd, MSG_PIPE_SIZE) < 0) {
+    log_warn("pipe for splice failed: %s", strerror(errno));
+    msg->pipe_fd[0] = -1;
+    msg->pipe_fd[1] = -1;
+    return DN_ERROR;
+  }
+
+  return DN_OK;
+}
+
+/*
+ * Releases the message's pipe. Empty pipes are kept for reuse; a pipe that
+ * still holds part of a value (the peer went away) is closed.
+ */
+static void msg_pipe_put(struct msg *msg) {
+  if (msg->pipe_fd[0] < 0) {
+    return;
+  }
+
+  if (msg->pipe_len == 0 && msg_npipe < MSG_PIPE_CACHE) {
+    msg_pipes[msg_npipe][0] = msg->pipe_fd[0];
+    msg_pipes[msg_npipe][1] = msg->pipe_fd[1];
+    msg_npipe++;
+  } else {
+    close(msg->pipe_fd[0]);
+    close(msg->pipe_fd[1]);
+  }
+
+  msg->pipe_fd[0] = -1;
+  msg->pipe_fd[1] = -1;
+  msg->pipe_len = 0;
+  msg->pipe_remain = 0;
+}
+
 static void msg_free(struct msg *msg) {
   ASSERT(STAILQ_EMPTY(&msg->mhdr));
 
@@ -629,6 +746,13 @@ void msg_put(struct msg *msg) {
     return;
   }
 
+  trace_finish(msg);
+
+  if (msg->hedge_task != NULL) {
+    cancel_task(msg->hedge_task);
+    msg->hedge_task = NULL;
+  }
+
   struct dmsg *dmsg = msg->dmsg;
   if (dmsg != NULL) {
     dmsg_put(dmsg);
@@ -641,6 +765,8 @@ void msg_put(struct msg *msg) {
     mbuf_put(mbuf);
   }
 
+  msg_pipe_put(msg);
+
   if (msg->frag_seq) {
     dn_free(msg->frag_seq);
     msg->frag_seq = NULL;
@@ -741,12 +867,20 @@ void msg_dump(int level, struct msg *msg) {
  */
 void msg_init(size_t msgs_max) {
   log_debug(LOG_DEBUG, "msg size %d", sizeof(struct msg));
+  alloc_msgs_max = msgs_max;
+  msg_thread_init();
+}
+
+/*
+ * Initialize the calling thread's msg id counters, free msg q and timeout
+ * wheel.
+ */
+void msg_thread_init(void) {
   msg_id = 0;
   frag_id = 0;
-  alloc_msgs_max = msgs_max;
+  msg_npipe = 0;
   TAILQ_INIT(&free_msgq);
-  rbtree_init(&tmo_rbt, &tmo_rbs);
-
+  timewheel_init(&tmo_tw, dn_msec_now());
 }
 
 void msg_deinit(void) {
@@ -758,6 +892,12 @@ void msg_deinit(void) {
     msg_free(msg);
   }
   ASSERT(TAILQ_COUNT(&free_msgq) == 0);
+
+  while (msg_npipe != 0) {
+    msg_npipe--;
+    close(msg_pipes[msg_npipe][0]);
+    close(msg_pipes[msg_npipe][1]);
+  }
 }
 
 struct string *msg_type_string(msg_type_t type) {
@@ -852,8 +992,17 @@ uint8_t *msg_get_arg_copy(struct msg *msg, int idx, uint32_t *arglen) {
   return copied_arg;
 }
 
+/*
+ * The crc32c of the payload of a response, which quorum reads compare. The
+ * redis parser works it out as it goes, so a response it parsed is not read
+ * again; other responses are checksummed here.
+ */
 uint32_t msg_payload_crc32(struct msg *rsp) {
   ASSERT(rsp != NULL);
+  if (rsp->crc_done) {
+    return rsp->crc;
+  }
+
   // take a continuous buffer crc
   uint32_t crc = 0;
   struct mbuf *mbuf;
@@ -883,7 +1032,7 @@ uint32_t msg_payload_crc32(struct msg *rsp) {
       }
     }
 
-    crc = crc32_sz((char *)start, (size_t)(end - start), crc);
+    crc = crc32c(start, (size_t)(end - start), crc);
   }
   return crc;
 }
@@ -1088,6 +1237,123 @@ static rstatus_t msg_parse(struct context *ctx, struct conn *conn,
   return conn->err != 0 ? DN_ERROR : status;
 }
 
+/*
+ * Switches a response to pipe mode once the parser has read the header of a
+ * large bulk reply: the rest of the value is spliced from the datastore socket
+ * into a pipe and later from the pipe to the client socket, never touching an
+ * mbuf. Only responses that go back unchanged to a single client qualify;
+ * anything that is inspected, merged or re-framed keeps using mbufs.
+ */
+static void msg_splice_start(struct context *ctx, struct conn *conn,
+                             struct msg *rsp) {
+  uint32_t threshold = ctx->pool.splice_threshold;
+  struct msg *req;
+
+  ASSERT(rsp->bulk_rlen != 0);
+
+  if (conn->type != CONN_SERVER || threshold == 0 ||
+      rsp->bulk_rlen < threshold || rsp->bulk_rlen > MSG_PIPE_SIZE ||
+      rsp->spliced) {
+    return;
+  }
+
+  req = TAILQ_FIRST(&conn->omsg_q);
+  if (req == NULL || req->owner == NULL || req->owner->type != CONN_CLIENT ||
+      req->swallow || req->frag_id != 0 ||
+      req->rsp_handler != msg_local_one_rsp_handler) {
+    return;
+  }
+
+  if (msg_pipe_get(rsp) != DN_OK) {
+    return;
+  }
+
+  rsp->spliced = 1;
+  rsp->pipe_remain = rsp->bulk_rlen;
+  rsp->bulk_rlen = 0;
+}
+
+/*
+ * The pipe filled up before the whole value arrived. Moves what it holds into
+ * mbufs and lets the parser read the rest of the value the usual way.
+ */
+static rstatus_t msg_pipe_drain(struct conn *conn, struct msg *msg) {
+  struct mbuf *mbuf;
+  size_t size;
+  ssize_t n;
+
+  log_debug(LOG_INFO, "%s pipe full after %u bytes, %u to go",
+            print_obj(conn), msg->pipe_len, msg->pipe_remain);
+
+  while (msg->pipe_len != 0) {
+    mbuf = STAILQ_LAST(&msg->mhdr, mbuf, next);
+    if (mbuf == NULL || mbuf_full(mbuf)) {
+      mbuf = mbuf_get();
+      if (mbuf == NULL) {
+        return DN_ENOMEM;
+      }
+      mbuf_insert(&msg->mhdr, mbuf);
+    }
+
+    size = MIN(mbuf_remaining_space(mbuf), msg->pipe_len);
+    n = dn_read(msg->pipe_fd[0], mbuf->last, size);
+    if (n <= 0) {
+      log_error("%s read from pipe failed: %s", print_obj(conn),
+                n < 0 ? strerror(errno) : "eof");
+      return DN_ERROR;
+    }
+    mbuf->last += n;
+    msg->pipe_len -= (uint32_t)n;
+  }
+
+  mbuf = STAILQ_LAST(&msg->mhdr, mbuf, next);
+  msg->pos = mbuf->last;
+  msg->rlen = msg->pipe_remain;
+  msg_pipe_put(msg);
+
+  /* the socket still has data */
+  conn->recv_ready = 1;
+
+  return DN_OK;
+}
+
+static rstatus_t msg_recv_pipe(struct context *ctx, struct conn *conn,
+                               struct msg *msg) {
+  struct mbuf *mbuf;
+  ssize_t n;
+
+  n = conn_splice_recv(conn, msg->pipe_fd[1], msg->pipe_remain);
+  if (n < 0) {
+    if (n == DN_EAGAIN) {
+      if (dn_get_nread(conn->sd) > 0) {
+        return msg_pipe_drain(conn, msg);
+      }
+      return DN_OK;
+    }
+    return DN_ERROR;
+  }
+
+  msg->pipe_remain -= (uint32_t)n;
+  msg->pipe_len += (uint32_t)n;
+  msg->mlen += (uint32_t)n;
+  if (msg->pipe_remain != 0) {
+    return DN_OK;
+  }
+
+  /* the value is in the pipe; the trailing CRLF and whatever follows it go
+   * into a fresh mbuf that is sent after the pipe */
+  mbuf = mbuf_get();
+  if (mbuf == NULL) {
+    return DN_ENOMEM;
+  }
+  mbuf->flags |= MBUF_FLAGS_PIPE;
+  mbuf_insert(&msg->mhdr, mbuf);
+  msg->pos = mbuf->pos;
+  msg->rlen = 0;
+
+  return DN_OK;
+}
+
 static rstatus_t msg_recv_chain(struct context *ctx, struct conn *conn,
                                 struct msg *msg) {
   rstatus_t status;
@@ -1095,9 +1361,15 @@ static rstatus_t msg_recv_chain(struct context *ctx, struct conn *conn,
   struct mbuf *mbuf;
   size_t msize;
   ssize_t n;
-  bool encryption_detected = (msg->dyn_parse_state == DYN_DONE ||
-                              msg->dyn_parse_state == DYN_POST_DONE) &&
-                             (msg->dmsg->flags & 0x1);
+  bool dmsg_parsed = msg->dyn_parse_state == DYN_DONE ||
+                     msg->dyn_parse_state == DYN_POST_DONE;
+  bool encryption_detected = dmsg_parsed && (msg->dmsg->flags & 0x1);
+  bool whole = dmsg_parsed && (msg->dmsg->flags & (DMSG_FLAG_AES_GCM |
+                                                   DMSG_FLAG_COMPRESSED));
+
+  if (msg->pipe_remain != 0) {
+    return msg_recv_pipe(ctx, conn, msg);
+  }
 
   mbuf = STAILQ_LAST(&msg->mhdr, mbuf, next);
   /* This logic is unncessarily complicated. Ideally a connection should read
@@ -1121,17 +1393,20 @@ static rstatus_t msg_recv_chain(struct context *ctx, struct conn *conn,
    * entire payload first and then decrypt it. Its slightly slow but worth the
    * simplicity
    *
+   * AES-GCM and compressed payloads avoid all this: dyn_parse_whole() gives
+   * the payload one mbuf that holds all of it, and it is opened once it is in.
+   *
    * Create a new buffer if:
    * 1) mbuf is NULL
-   * 2) unencrypted case and mbuf is full
-   * 3) encrypted case and
+   * 2) unencrypted, AES-GCM or compressed case and mbuf is full
+   * 3) AES-CBC case and
    *      a) mbuf is full till end_extra
    *      b) mbuf is full till mbuf->end (mbuf_full) and we just decrypted that
    * buffer.
    */
-  if (mbuf == NULL || ((!encryption_detected) && mbuf_full(mbuf)) ||
-      (encryption_detected && mbuf->last == mbuf->end_extra) ||
-      (encryption_detected && mbuf_full(mbuf) &&
+  if (mbuf == NULL || ((!encryption_detected || whole) && mbuf_full(mbuf)) ||
+      (encryption_detected && !whole && mbuf->last == mbuf->end_extra) ||
+      (encryption_detected && !whole && mbuf_full(mbuf) &&
        (mbuf->flags & MBUF_FLAGS_JUST_DECRYPTED))) {
     mbuf = mbuf_get();
     if (mbuf == NULL) {
@@ -1144,7 +1419,9 @@ static rstatus_t msg_recv_chain(struct context *ctx, struct conn *conn,
 
   ASSERT(mbuf->end_extra - mbuf->last > 0);
 
-  if (!encryption_detected) {
+  if (whole) {
+    msize = MIN(msg->dmsg->plen, mbuf_remaining_space(mbuf));
+  } else if (!encryption_detected) {
     msize = mbuf_remaining_space(mbuf);
   } else {
     msize = (size_t)MIN(msg->dmsg->plen, mbuf->end_extra - mbuf->last);
@@ -1166,11 +1443,26 @@ static rstatus_t msg_recv_chain(struct context *ctx, struct conn *conn,
   }
 
   ASSERT((mbuf->last + n) <= mbuf->end_extra);
+  if (msg->mlen == 0 && n != 0) {
+    /* sampled before any of it was read */
+    trace_hop(msg, TRACE_client_recv);
+  }
   mbuf->last += n;
   msg->mlen += (uint32_t)n;
 
-  // Only used in encryption case
-  if (encryption_detected) {
+  if (whole) {
+    msg->dmsg->plen -= (uint32_t)n;
+    if (n != 0 && msg->dmsg->plen == 0) {
+      status = dmsg_open_payload(ctx, msg, mbuf);
+      if (status != DN_OK) {
+        if (status == DN_ERROR) {
+          conn->err = EINVAL;
+        }
+        return status;
+      }
+    }
+  } else if (encryption_detected) {
+    // Only used in AES-CBC case
     if ((n >= msg->dmsg->plen && n != 0) || mbuf->end_extra == mbuf->last) {
       // log_debug(LOG_VERB, "About to decrypt this mbuf as it is full or
       // eligible!");
@@ -1232,6 +1524,10 @@ static rstatus_t msg_recv_chain(struct context *ctx, struct conn *conn,
       return status;
     }
 
+    if (msg->result == MSG_PARSE_AGAIN && msg->bulk_rlen != 0) {
+      msg_splice_start(ctx, conn, msg);
+    }
+
     /* get next message to parse */
     nmsg = conn_recv_next(ctx, conn, false);
     if (nmsg == NULL || nmsg == msg) {
@@ -1268,10 +1564,17 @@ rstatus_t msg_recv(struct context *ctx, struct conn *conn) {
   return DN_OK;
 }
 
+/*
+ * Sends 'msg' and the messages queued after it in one writev(), adding
+ * messages until there are 'nmax' of them or 'nbyte' bytes or the iovec is
+ * full.
+ */
 static rstatus_t msg_send_chain(struct context *ctx, struct conn *conn,
-                                struct msg *msg) {
+                                struct msg *msg, uint32_t nmax, size_t nbyte) {
   struct msg_tqh send_msgq;            /* send msg q */
+  uint32_t nqueued = 0;                /* # msgs in send_msgq */
   struct msg *nmsg;                    /* next msg */
+  struct msg *pmsg = NULL;             /* msg waiting on its pipe */
   struct mbuf *mbuf, *nbuf;            /* current and next mbuf */
   size_t mlen;                         /* current mbuf data length */
   struct iovec *ciov, iov[DN_IOV_MAX]; /* current iovec */
@@ -1279,6 +1582,7 @@ static rstatus_t msg_send_chain(struct context *ctx, struct conn *conn,
   size_t nsend, nsent;                 /* bytes to send; bytes sent */
   size_t limit;                        /* bytes to send limit */
   ssize_t n = 0;                       /* bytes sent by sendv */
+  bool frame;                          /* pack dnode messages in frames? */
 
   if (log_loggable(LOG_VVERB)) {
     loga("About to dump out the content of msg");
@@ -1299,14 +1603,28 @@ static rstatus_t msg_send_chain(struct context *ctx, struct conn *conn,
    */
   limit = SSIZE_MAX;
 
+  frame = conn->dyn_mode && conn->dmsg_binary && ctx->pool.peer_batch_size > 1;
+  conn->dmsg_frame = NULL;
+
   for (;;) {
     ASSERT(conn->smsg == msg);
 
     TAILQ_INSERT_TAIL(&send_msgq, msg, m_tqe);
+    nqueued++;
+
+    if (frame) {
+      dmsg_frame_add(conn, msg, ctx->pool.peer_batch_size);
+    }
 
     STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
       if (!(array_n(&sendv) < DN_IOV_MAX) && (nsend < limit)) break;
 
+      if ((mbuf->flags & MBUF_FLAGS_PIPE) && msg->pipe_len != 0) {
+        /* the piped value has to go out before this mbuf */
+        pmsg = msg;
+        break;
+      }
+
       if (mbuf_empty(mbuf)) {
         continue;
       }
@@ -1323,7 +1641,8 @@ static rstatus_t msg_send_chain(struct context *ctx, struct conn *conn,
       nsend += mlen;
     }
 
-    if (array_n(&sendv) >= DN_IOV_MAX || nsend >= limit) {
+    if (pmsg != NULL || array_n(&sendv) >= DN_IOV_MAX || nsend >= limit ||
+        nqueued >= nmax || nsend >= nbyte) {
       break;
     }
 
@@ -1334,11 +1653,29 @@ static rstatus_t msg_send_chain(struct context *ctx, struct conn *conn,
   }
 
   conn->smsg = NULL;
+  conn->dmsg_frame = NULL;
 
   if (nsend != 0) n = conn_sendv_data(conn, &sendv, nsend);
 
   nsent = n > 0 ? (size_t)n : 0;
 
+  if (nsent != 0 && conn->type == CONN_SERVER) {
+    stats_histo_add(ctx, datastore_batch, nqueued);
+  } else if (nsent != 0 && frame) {
+    stats_histo_add(ctx, peer_batch, nqueued);
+  }
+
+  /* everything ahead of the piped value is out, now move the value */
+  if (pmsg != NULL && nsent == nsend && conn->send_ready) {
+    ssize_t m = conn_splice_send(conn, pmsg->pipe_fd[0], pmsg->pipe_len);
+    if (m > 0) {
+      pmsg->pipe_len -= (uint32_t)m;
+      n = (ssize_t)nsent + m;
+    } else if (m != DN_EAGAIN || nsend == 0) {
+      n = m;
+    }
+  }
+
   /* postprocess - process sent messages in send_msgq */
   TAILQ_FOREACH_SAFE(msg, &send_msgq, m_tqe, nmsg) {
     TAILQ_REMOVE(&send_msgq, msg, m_tqe);
@@ -1354,6 +1691,10 @@ static rstatus_t msg_send_chain(struct context *ctx, struct conn *conn,
     for (mbuf = STAILQ_FIRST(&msg->mhdr); mbuf != NULL; mbuf = nbuf) {
       nbuf = STAILQ_NEXT(mbuf, next);
 
+      if ((mbuf->flags & MBUF_FLAGS_PIPE) && msg->pipe_len != 0) {
+        break;
+      }
+
       if (mbuf_empty(mbuf)) {
         continue;
       }
@@ -1401,7 +1742,7 @@ rstatus_t msg_send(struct context *ctx, struct conn *conn) {
       return DN_OK;
     }
 
-    status = msg_send_chain(ctx, conn, msg);
+    status = msg_send_chain(ctx, conn, msg, UINT32_MAX, SIZE_MAX);
     if (status != DN_OK) {
       return status;
     }
@@ -1417,6 +1758,27 @@ rstatus_t msg_send(struct context *ctx, struct conn *conn) {
   return DN_OK;
 }
 
+/*
+ * Writes the requests queued on a datastore or peer connection with a single
+ * writev(), taking at most 'nmax' of them and stopping once 'nbyte' bytes are
+ * queued. Unlike msg_send() this does not need the connection to have been
+ * reported writable; whatever does not fit is left in the connection's inq.
+ */
+rstatus_t msg_send_batch(struct context *ctx, struct conn *conn, uint32_t nmax,
+                         size_t nbyte) {
+  struct msg *msg;
+
+  ASSERT(conn->type == CONN_SERVER || conn->type == CONN_DNODE_PEER_SERVER);
+
+  conn->send_ready = 1;
+  msg = conn_send_next(ctx, conn);
+  if (msg == NULL) {
+    return DN_OK;
+  }
+
+  return msg_send_chain(ctx, conn, msg, nmax, nbyte);
+}
+
 struct mbuf *msg_ensure_mbuf(struct msg *msg, size_t len) {
   struct mbuf *mbuf;
 
@@ -31,6 +31,8 @@
 #include "dyn_queue.h"
 #include "dyn_rbtree.h"
 #include "dyn_response_mgr.h"
+#include "dyn_timewheel.h"
+#include "dyn_trace.h"
 #include "dyn_types.h"
 
 #define ALLOC_MSGS 200000
@@ -39,6 +41,11 @@
 
 #define MAX_ALLOWABLE_PROCESSED_MSGS 500
 
+#define MSG_TRIM_INTERVAL_MS 1000 /* min interval between mbuf trims */
+
+#define MSG_PIPE_SIZE (1024 * 1024) /* pipe buffer for spliced bulk replies */
+#define MSG_PIPE_CACHE 16           /* idle pipes kept per event loop */
+
 #define MSG_TYPE_CODEC(ACTION)                                                 \
   ACTION(UNKNOWN)                                                              \
   ACTION(REQ_MC_GET) /* memcache retrieval requests */                         \
@@ -294,6 +301,7 @@ typedef enum dyn_error {
   BAD_FORMAT,
   DYNOMITE_NO_QUORUM_ACHIEVED,
   DYNOMITE_SCRIPT_SPANS_NODES,
+  PEER_OVERLOADED,
 } dyn_error_t;
 
 static inline char *dn_strerror(dyn_error_t err) {
@@ -318,6 +326,8 @@ static inline char *dn_strerror(dyn_error_t err) {
       return "Failed to achieve Quorum";
     case DYNOMITE_SCRIPT_SPANS_NODES:
       return "Keys in the script cannot span multiple nodes";
+    case PEER_OVERLOADED:
+      return "Peer Node has too many requests queued";
     default:
       return strerror(err);
   }
@@ -333,6 +343,7 @@ static inline char *dyn_error_source(dyn_error_t err) {
     case PEER_CONNECTION_REFUSE:
     case PEER_HOST_DOWN:
     case PEER_HOST_NOT_CONNECTED:
+    case PEER_OVERLOADED:
       return "Peer:";
     case STORAGE_CONNECTION_REFUSE:
       return "Storage:";
@@ -460,14 +471,25 @@ struct msg {
                                              or remote region or cross rack */
   usec_t request_send_time; /* when message was sent: either to the data store
                                or remote region or cross rack */
+  struct trace_span *trace; /* hops of a traced request, NULL if not traced */
+  struct mbuf *copy_mbuf;   /* first mbuf of a read to copy once it is sent */
+  uint8_t *copy_pos;        /* where the read starts in copy_mbuf */
+  struct node *hedge_peer;  /* replica the hedge goes to */
+  struct task *hedge_task;  /* sends the hedge, NULL once it ran */
   uint32_t awaiting_rsps;
   struct msg *selected_rsp;
 
-  struct rbnode tmo_rbe; /* entry in rbtree */
+  struct tw_node tmo_twe; /* entry in timeout wheel */
 
   struct mhdr mhdr; /* message mbuf header */
   uint32_t mlen;    /* message length */
 
+  /* A large bulk reply value can bypass the mbufs and wait in a pipe instead;
+   * it goes on the wire before the mbuf flagged MBUF_FLAGS_PIPE. */
+  int pipe_fd[2];       /* pipe holding the value, -1 if none */
+  uint32_t pipe_len;    /* bytes of the value in the pipe */
+  uint32_t pipe_remain; /* bytes of the value still to splice into the pipe */
+
   int state;      /* current parser state */
   uint8_t *pos;   /* parser position marker */
   uint8_t *token; /* token marker */
@@ -491,6 +513,9 @@ struct msg {
   uint32_t nkeys;      /* # keys in script (redis EVAL/EVALSHA) */
   uint32_t rntokens;      /* running # tokens used by parsing fsa (redis) */
   uint32_t rlen;       /* running length in parsing fsa (redis) */
+  uint32_t bulk_rlen;  /* bulk reply bytes beyond the parsed mbuf (redis) */
+  uint32_t crc;        /* crc32c of the reply parsed so far (redis) */
+  uint8_t *crc_pos;    /* end of the bytes in crc, in the last mbuf (redis) */
   uint32_t integer;    /* integer reply value (redis) */
 
   struct msg *frag_owner; /* owner of fragment message */
@@ -517,6 +542,15 @@ struct msg {
    * destination */
   unsigned dnode_header_prepended : 1;
   unsigned rsp_sent : 1; /* is a response sent for this request?*/
+  unsigned spliced : 1;  /* did the value go through a pipe? */
+  unsigned read_cache_fill : 1; /* fill the read cache with the response? */
+  unsigned top_keys_sampled : 1; /* counted towards the hot keys? */
+  unsigned diverted : 1; /* DC_ONE read sent to a replica on another rack? */
+  unsigned is_hedge : 1; /* copy of a slow DC_ONE read for another replica? */
+  unsigned digest_read : 1; /* quorum read that other racks send digests for? */
+  unsigned digest : 1;      /* copy that asks its peer for a digest? */
+  unsigned crc_done : 1;    /* does crc cover the whole reply? */
+  unsigned in_flight : 1;   /* counted against its peer's concurrency limit? */
   uint64_t timestamp;   // Timestamp of request. Used only if 'read_repiars' is enabled.
 
   // Some 'msg's are not possible to rewrite.
@@ -566,13 +600,17 @@ static inline rstatus_t msg_handle_response(struct context *ctx, struct msg *req
 
 size_t msg_free_queue_size(void);
 
-struct msg *msg_tmo_min(void);
+struct msg *msg_tmo_expired(msec_t now);
+msec_t msg_tmo_next(msec_t now);
 void msg_tmo_insert(struct msg *msg, struct conn *conn);
 void msg_tmo_delete(struct msg *msg);
 
 void msg_init(size_t alloc_msgs_max);
+void msg_thread_init(void);
 rstatus_t msg_clone(struct msg *src, struct mbuf *mbuf_start,
                     struct msg *target);
+rstatus_t msg_clone_sent(struct msg *src, struct mbuf *mbuf_start,
+                         uint8_t *pos, struct msg *target);
 void msg_deinit(void);
 struct string *msg_type_string(msg_type_t type);
 struct msg *msg_get(struct conn *conn, bool request, const char *const caller);
@@ -584,6 +622,8 @@ void msg_dump(int level, struct msg *msg);
 bool msg_empty(struct msg *msg);
 rstatus_t msg_recv(struct context *ctx, struct conn *conn);
 rstatus_t msg_send(struct context *ctx, struct conn *conn);
+rstatus_t msg_send_batch(struct context *ctx, struct conn *conn, uint32_t nmax,
+                         size_t nbyte);
 uint64_t msg_gen_frag_id(void);
 size_t msg_alloc_msgs(void);
 uint32_t msg_payload_crc32(struct msg *msg);
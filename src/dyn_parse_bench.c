@@ -0,0 +1,371 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+/*
+ * Runs redis_parse_req() and redis_parse_rsp() over pipelined batches of
+ * typical command and reply mixes, or over a captured stream of RESP requests
+ * or replies, and reports the time per message and the bytes parsed per
+ * second. Messages are parsed from one contiguous buffer, the way most of a
+ * pipelined read is parsed from its mbuf.
+ */
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dyn_core.h"
+#include "proto/dyn_proto.h"
+
+#define PARSE_BENCH_BYTES (64U * 1024 * 1024)
+#define PARSE_BENCH_BATCH (1024U * 1024)
+
+struct parse_buf {
+  uint8_t *data;
+  size_t len;
+  size_t size;
+};
+
+struct parse_mix {
+  const char *name;
+  bool request;
+  void (*gen)(struct parse_buf *pb, uint32_t i);
+};
+
+static struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"bytes", required_argument, NULL, 'n'},
+    {"file", required_argument, NULL, 'f'},
+    {"replies", no_argument, NULL, 'r'},
+    {NULL, 0, NULL, 0}};
+
+static char short_options[] = "hn:f:r";
+
+static char value[4096];
+
+static void print_usage(void) {
+  printf("Usage: dynomite-parse-bench [-hr] [-n bytes] [-f file]\n");
+  printf("Time the redis request and reply parsers over command mixes, or\n");
+  printf("over a file of captured RESP requests or replies.\n\n");
+  printf("Options:\n");
+  printf("  -h, --help             : this help\n");
+  printf("  -n, --bytes=N          : bytes parsed per mix (default: %u)\n",
+         PARSE_BENCH_BYTES);
+  printf("  -f, --file=S           : parse the RESP stream in this file\n");
+  printf("  -r, --replies          : the file holds replies, not requests\n\n");
+}
+
+static uint64_t parse_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void parse_append(struct parse_buf *pb, const void *data, size_t len) {
+  if (pb->len + len > pb->size) {
+    return;
+  }
+  memcpy(pb->data + pb->len, data, len);
+  pb->len += len;
+}
+
+static void parse_appendf(struct parse_buf *pb, const char *fmt, ...) {
+  char line[64];
+  va_list args;
+  int n;
+
+  va_start(args, fmt);
+  n = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  parse_append(pb, line, (size_t)n);
+}
+
+static void parse_append_bulk(struct parse_buf *pb, const char *s, size_t len) {
+  parse_appendf(pb, "$%zu\r\n", len);
+  parse_append(pb, s, len);
+  parse_append(pb, CRLF, CRLF_LEN);
+}
+
+static void parse_append_key(struct parse_buf *pb, uint32_t i) {
+  char key[32];
+  int n = snprintf(key, sizeof(key), "user:%08u", i % 1000000);
+
+  parse_append_bulk(pb, key, (size_t)n);
+}
+
+/* 80% GET, 20% SET of 100 byte values */
+static void gen_get_set(struct parse_buf *pb, uint32_t i) {
+  if (i % 5 != 0) {
+    parse_append(pb, "*2\r\n$3\r\nGET\r\n", 13);
+    parse_append_key(pb, i);
+  } else {
+    parse_append(pb, "*3\r\n$3\r\nSET\r\n", 13);
+    parse_append_key(pb, i);
+    parse_append_bulk(pb, value, 100);
+  }
+}
+
+static void gen_hash(struct parse_buf *pb, uint32_t i) {
+  switch (i % 3) {
+    case 0:
+      parse_append(pb, "*3\r\n$4\r\nHGET\r\n", 14);
+      parse_append_key(pb, i);
+      parse_append_bulk(pb, "field", 5);
+      break;
+    case 1:
+      parse_append(pb, "*4\r\n$4\r\nHSET\r\n", 14);
+      parse_append_key(pb, i);
+      parse_append_bulk(pb, "field", 5);
+      parse_append_bulk(pb, value, 32);
+      break;
+    default:
+      parse_append(pb, "*4\r\n$7\r\nHINCRBY\r\n", 17);
+      parse_append_key(pb, i);
+      parse_append_bulk(pb, "visits", 6);
+      parse_append_bulk(pb, "1", 1);
+      break;
+  }
+}
+
+static void gen_mget(struct parse_buf *pb, uint32_t i) {
+  uint32_t k;
+
+  parse_append(pb, "*11\r\n$4\r\nMGET\r\n", 15);
+  for (k = 0; k < 10; k++) {
+    parse_append_key(pb, i * 10 + k);
+  }
+}
+
+static void gen_set_4k(struct parse_buf *pb, uint32_t i) {
+  parse_append(pb, "*3\r\n$3\r\nSET\r\n", 13);
+  parse_append_key(pb, i);
+  parse_append_bulk(pb, value, sizeof(value));
+}
+
+static void gen_status_int(struct parse_buf *pb, uint32_t i) {
+  if (i % 2 == 0) {
+    parse_append(pb, "+OK\r\n", 5);
+  } else {
+    parse_appendf(pb, ":%u\r\n", i);
+  }
+}
+
+/* GET replies, one in ten a miss */
+static void gen_bulk(struct parse_buf *pb, uint32_t i) {
+  if (i % 10 == 0) {
+    parse_append(pb, "$-1\r\n", 5);
+  } else {
+    parse_append_bulk(pb, value, 100);
+  }
+}
+
+static void gen_multibulk(struct parse_buf *pb, uint32_t i) {
+  uint32_t k;
+
+  parse_append(pb, "*10\r\n", 5);
+  for (k = 0; k < 10; k++) {
+    parse_append_bulk(pb, value, 20);
+  }
+}
+
+static const struct parse_mix mixes[] = {
+    {"get/set requests", true, gen_get_set},
+    {"hash requests", true, gen_hash},
+    {"mget requests", true, gen_mget},
+    {"4k set requests", true, gen_set_4k},
+    {"status/int replies", false, gen_status_int},
+    {"bulk replies", false, gen_bulk},
+    {"multibulk replies", false, gen_multibulk},
+};
+
+/* Clears what the parser leaves behind so the msg can take the next one. */
+static void parse_msg_reset(struct msg *r) {
+  r->type = MSG_UNKNOWN;
+  r->state = 0;
+  r->token = NULL;
+  r->ntokens = 0;
+  r->rntokens = 0;
+  r->nkeys = 0;
+  r->rlen = 0;
+  r->integer = 0;
+  r->is_read = 1;
+  r->is_error = 0;
+  array_reset(r->keys);
+  array_reset(r->args);
+}
+
+/*
+ * Parses the batch 'nround' times. Returns the ns per message, or -1 if a
+ * message fails to parse.
+ */
+static double parse_batch(struct context *ctx, struct parse_buf *pb,
+                          bool request, uint32_t nround, uint32_t *nmsg) {
+  struct mbuf mbuf;
+  struct msg r;
+  uint64_t start, elapsed, n = 0;
+  uint32_t round;
+
+  memset(&r, 0, sizeof(r));
+  r.is_request = request ? 1 : 0;
+  r.latest_parsed_mbuf_idx = -1;
+  r.keys = array_create(1, sizeof(struct keypos));
+  r.args = array_create(1, sizeof(struct argpos));
+  if (r.keys == NULL || r.args == NULL) {
+    return -1;
+  }
+
+  memset(&mbuf, 0, sizeof(mbuf));
+  mbuf.magic = MBUF_MAGIC;
+  mbuf.start = mbuf.pos = pb->data;
+  mbuf.last = mbuf.end = mbuf.end_extra = pb->data + pb->len;
+  STAILQ_INIT(&r.mhdr);
+  STAILQ_INSERT_TAIL(&r.mhdr, &mbuf, next);
+
+  start = parse_now_ns();
+  for (round = 0; round < nround; round++) {
+    r.pos = mbuf.pos;
+    while (r.pos < mbuf.last) {
+      parse_msg_reset(&r);
+      if (request) {
+        redis_parse_req(&r, ctx);
+      } else {
+        redis_parse_rsp(&r, ctx);
+      }
+      if (r.result != MSG_PARSE_OK) {
+        fprintf(stderr, "message at offset %ld parsed with result %d\n",
+                (long)(r.pos - mbuf.pos), r.result);
+        return -1;
+      }
+      n++;
+    }
+  }
+  elapsed = parse_now_ns() - start;
+
+  array_destroy(r.keys);
+  array_destroy(r.args);
+  *nmsg = (uint32_t)(n / nround);
+  return n == 0 ? -1 : (double)elapsed / (double)n;
+}
+
+static int parse_report(struct context *ctx, const char *name,
+                        struct parse_buf *pb, bool request, size_t nbyte) {
+  uint32_t nround = (uint32_t)MAX(1, nbyte / MAX(pb->len, 1));
+  uint32_t nmsg;
+  double ns;
+
+  ns = parse_batch(ctx, pb, request, nround, &nmsg);
+  if (ns < 0) {
+    fprintf(stderr, "%s failed to parse\n", name);
+    return -1;
+  }
+
+  printf("%-20s %7u msgs, %6.1f bytes/msg: %7.2f ns/msg, %7.1f MB/s\n", name,
+         nmsg, (double)pb->len / nmsg, ns,
+         (double)pb->len / nmsg / ns * 1000.0);
+  return 0;
+}
+
+static int parse_file(struct context *ctx, const char *filename, bool request,
+                      size_t nbyte) {
+  struct parse_buf pb;
+  FILE *fp;
+  long size;
+  int status;
+
+  fp = fopen(filename, "rb");
+  if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) <= 0) {
+    fprintf(stderr, "cannot read '%s'\n", filename);
+    return 1;
+  }
+  rewind(fp);
+
+  pb.size = pb.len = (size_t)size;
+  pb.data = dn_alloc(pb.size);
+  if (pb.data == NULL || fread(pb.data, 1, pb.len, fp) != pb.len) {
+    fprintf(stderr, "cannot read '%s'\n", filename);
+    return 1;
+  }
+  fclose(fp);
+
+  status = parse_report(ctx, filename, &pb, request, nbyte);
+  dn_free(pb.data);
+  return status == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  static struct context ctx;
+  struct parse_buf pb;
+  size_t nbyte = PARSE_BENCH_BYTES;
+  char *filename = NULL;
+  bool replies = false;
+  uint32_t i, j;
+  int c;
+
+  for (;;) {
+    c = getopt_long(argc, argv, short_options, long_options, NULL);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+      case 'n':
+        nbyte = (size_t)atol(optarg);
+        if (nbyte == 0) {
+          print_usage();
+          return 1;
+        }
+        break;
+
+      case 'f':
+        filename = optarg;
+        break;
+
+      case 'r':
+        replies = true;
+        break;
+
+      case 'h':
+      default:
+        print_usage();
+        return c == 'h' ? 0 : 1;
+    }
+  }
+
+  mbuf_init(MBUF_SIZE);
+  string_init(&ctx.pool.hash_tag);
+
+  if (filename != NULL) {
+    return parse_file(&ctx, filename, !replies, nbyte);
+  }
+
+  for (i = 0; i < sizeof(value); i++) {
+    value[i] = (char)('a' + i % 26);
+  }
+
+  pb.size = PARSE_BENCH_BATCH;
+  pb.data = dn_alloc(pb.size);
+  if (pb.data == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  for (i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++) {
+    /* stop a message short of the end so none is cut off */
+    pb.len = 0;
+    for (j = 0; pb.len + 2 * sizeof(value) < pb.size; j++) {
+      mixes[i].gen(&pb, j);
+    }
+
+    if (parse_report(&ctx, mixes[i].name, &pb, mixes[i].request, nbyte) != 0) {
+      return 1;
+    }
+  }
+
+  dn_free(pb.data);
+  return 0;
+}
@@ -0,0 +1,445 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#include "dyn_read_cache.h"
+#include "dyn_core.h"
+
+/*
+ * Read cache for hot keys.
+ *
+ * Reads that would go to the local datastore are counted per key in a
+ * count-min sketch. Once a key is hot, the next read of it leaves a pending
+ * entry that the response of the datastore fills, and later reads are
+ * answered from the entry until it expires. Every write that goes to the
+ * local datastore, whether from a client or from a peer, drops the entries
+ * of its keys, including pending ones, so that a response that raced with a
+ * write is never kept.
+ *
+ * An entry is identified by the request type, the key and the bytes after
+ * the key, such as the field of an HGET. It holds one mbuf with the key and
+ * those bytes at its start and the response from mbuf->pos on. The cache is
+ * not shared between event loop threads, so conf_validate_pool() does not
+ * allow it with more than one.
+ */
+
+struct read_cache_entry {
+  TAILQ_ENTRY(read_cache_entry) tqe; /* link in lru or free q */
+  struct read_cache_entry *next;     /* next entry in the bucket */
+  uint32_t hash;                     /* hash of the key */
+  msg_type_t type;                   /* request type */
+  msg_type_t rsp_type;               /* response type */
+  uint32_t keylen;                   /* key length */
+  uint32_t taillen;                  /* length of the bytes after the key */
+  msgid_t fill_id;                   /* request to fill it, 0 once filled */
+  usec_t expire_at;                  /* expiry time in usec */
+  struct mbuf *mbuf;                 /* key, tail and response */
+};
+
+TAILQ_HEAD(read_cache_tqh, read_cache_entry);
+
+struct read_cache {
+  struct read_cache_entry *entries;  /* all the entries */
+  struct read_cache_entry **buckets; /* entries by key hash */
+  uint32_t nbuckets;                 /* # buckets, a power of two */
+  struct read_cache_tqh lru_q;       /* entries in use, most recent first */
+  struct read_cache_tqh free_q;      /* entries not in use */
+  uint32_t nentries;                 /* # entries in use */
+  usec_t ttl;                        /* entry lifetime in usec */
+  uint32_t hot_threshold;            /* estimated reads that make a key hot */
+  uint32_t cms_reads;                /* reads counted since the last aging */
+  uint16_t cms[READ_CACHE_CMS_DEPTH][READ_CACHE_CMS_WIDTH];
+};
+
+struct read_cache *read_cache_create(uint32_t max_entries, msec_t ttl,
+                                     uint32_t hot_threshold) {
+  struct read_cache *cache;
+  uint32_t i;
+
+  ASSERT(max_entries > 0);
+
+  cache = dn_zalloc(sizeof(*cache));
+  if (cache == NULL) {
+    return NULL;
+  }
+
+  cache->nbuckets = 1;
+  while (cache->nbuckets < max_entries) {
+    cache->nbuckets <<= 1;
+  }
+  cache->entries = dn_zalloc(sizeof(struct read_cache_entry) * max_entries);
+  cache->buckets = dn_zalloc(sizeof(struct read_cache_entry *) *
+                             cache->nbuckets);
+  if (cache->entries == NULL || cache->buckets == NULL) {
+    read_cache_destroy(cache);
+    return NULL;
+  }
+
+  TAILQ_INIT(&cache->lru_q);
+  TAILQ_INIT(&cache->free_q);
+  for (i = 0; i < max_entries; i++) {
+    TAILQ_INSERT_TAIL(&cache->free_q, &cache->entries[i], tqe);
+  }
+  cache->ttl = ttl * 1000ULL;
+  cache->hot_threshold = hot_threshold;
+
+  return cache;
+}
+
+void read_cache_destroy(struct read_cache *cache) {
+  struct read_cache_entry *e;
+
+  if (cache == NULL) {
+    return;
+  }
+
+  TAILQ_FOREACH(e, &cache->lru_q, tqe) { mbuf_put(e->mbuf); }
+  dn_free(cache->entries);
+  dn_free(cache->buckets);
+  dn_free(cache);
+}
+
+/* Reads answered the same way as long as their key does not change. */
+bool read_cache_cacheable(struct msg *req) {
+  if (!req->is_read || req->frag_id != 0 || array_n(req->keys) != 1) {
+    return false;
+  }
+
+  switch (req->type) {
+    case MSG_REQ_MC_GET:
+    case MSG_REQ_MC_GETS:
+    case MSG_REQ_REDIS_EXISTS:
+    case MSG_REQ_REDIS_GET:
+    case MSG_REQ_REDIS_GETBIT:
+    case MSG_REQ_REDIS_GETRANGE:
+    case MSG_REQ_REDIS_STRLEN:
+    case MSG_REQ_REDIS_HEXISTS:
+    case MSG_REQ_REDIS_HGET:
+    case MSG_REQ_REDIS_HGETALL:
+    case MSG_REQ_REDIS_HKEYS:
+    case MSG_REQ_REDIS_HLEN:
+    case MSG_REQ_REDIS_HMGET:
+    case MSG_REQ_REDIS_HSTRLEN:
+    case MSG_REQ_REDIS_HVALS:
+    case MSG_REQ_REDIS_LINDEX:
+    case MSG_REQ_REDIS_LLEN:
+    case MSG_REQ_REDIS_LRANGE:
+    case MSG_REQ_REDIS_SCARD:
+    case MSG_REQ_REDIS_SISMEMBER:
+    case MSG_REQ_REDIS_SMEMBERS:
+    case MSG_REQ_REDIS_ZCARD:
+    case MSG_REQ_REDIS_ZCOUNT:
+    case MSG_REQ_REDIS_ZRANGE:
+    case MSG_REQ_REDIS_ZRANGEBYSCORE:
+    case MSG_REQ_REDIS_ZRANK:
+    case MSG_REQ_REDIS_ZREVRANGE:
+    case MSG_REQ_REDIS_ZREVRANGEBYSCORE:
+    case MSG_REQ_REDIS_ZREVRANK:
+    case MSG_REQ_REDIS_ZSCORE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*
+ * Find the key of a request and the bytes that follow it up to the end of
+ * the request. Both must be in its last mbuf.
+ */
+static bool read_cache_key(struct msg *req, uint8_t **key, uint32_t *keylen,
+                           uint8_t **tail, uint32_t *taillen) {
+  struct keypos *kpos = array_get(req->keys, 0);
+  struct mbuf *mbuf = STAILQ_LAST(&req->mhdr, mbuf, next);
+
+  if (mbuf == NULL || kpos->start < mbuf->start || kpos->end > mbuf->last ||
+      mbuf->last - kpos->end > READ_CACHE_MAX_TAIL) {
+    return false;
+  }
+
+  *key = kpos->start;
+  *keylen = (uint32_t)(kpos->end - kpos->start);
+  *tail = kpos->end;
+  *taillen = (uint32_t)(mbuf->last - kpos->end);
+  return true;
+}
+
+static uint32_t read_cache_hash(uint8_t *key, uint32_t keylen) {
+  return dictGenHashFunction(key, keylen);
+}
+
+/*
+ * Count a read of the key with the given hash and return the estimated
+ * number of its recent reads. Only the smallest counters are bumped, which
+ * keeps the keys that share them from looking hotter than they are.
+ */
+static uint32_t read_cache_count(struct read_cache *cache, uint32_t hash) {
+  uint32_t idx[READ_CACHE_CMS_DEPTH];
+  uint32_t step = ((hash >> 16) | (hash << 16)) | 1;
+  uint16_t min = UINT16_MAX;
+  uint32_t i, j;
+
+  for (i = 0; i < READ_CACHE_CMS_DEPTH; i++) {
+    idx[i] = (hash + i * step) & (READ_CACHE_CMS_WIDTH - 1);
+    min = MIN(min, cache->cms[i][idx[i]]);
+  }
+  if (min < UINT16_MAX) {
+    for (i = 0; i < READ_CACHE_CMS_DEPTH; i++) {
+      if (cache->cms[i][idx[i]] == min) {
+        cache->cms[i][idx[i]]++;
+      }
+    }
+  }
+
+  if (++cache->cms_reads >= READ_CACHE_CMS_WIDTH * READ_CACHE_CMS_AGING) {
+    for (i = 0; i < READ_CACHE_CMS_DEPTH; i++) {
+      for (j = 0; j < READ_CACHE_CMS_WIDTH; j++) {
+        cache->cms[i][j] >>= 1;
+      }
+    }
+    cache->cms_reads = 0;
+  }
+
+  return (uint32_t)min + 1;
+}
+
+static struct read_cache_entry **read_cache_bucket(struct read_cache *cache,
+                                                   uint32_t hash) {
+  return &cache->buckets[hash & (cache->nbuckets - 1)];
+}
+
+static bool read_cache_match_key(struct read_cache_entry *e, uint32_t hash,
+                                 uint8_t *key, uint32_t keylen) {
+  return e->hash == hash && e->keylen == keylen &&
+         memcmp(e->mbuf->start, key, keylen) == 0;
+}
+
+static struct read_cache_entry *read_cache_find(struct read_cache *cache,
+                                                uint32_t hash, msg_type_t type,
+                                                uint8_t *key, uint32_t keylen,
+                                                uint8_t *tail,
+                                                uint32_t taillen) {
+  struct read_cache_entry *e;
+
+  for (e = *read_cache_bucket(cache, hash); e != NULL; e = e->next) {
+    if (e->type == type && e->taillen == taillen &&
+        read_cache_match_key(e, hash, key, keylen) &&
+        memcmp(e->mbuf->start + keylen, tail, taillen) == 0) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void read_cache_remove(struct read_cache *cache,
+                              struct read_cache_entry *e) {
+  struct read_cache_entry **p = read_cache_bucket(cache, e->hash);
+
+  while (*p != e) {
+    p = &(*p)->next;
+  }
+  *p = e->next;
+
+  TAILQ_REMOVE(&cache->lru_q, e, tqe);
+  TAILQ_INSERT_HEAD(&cache->free_q, e, tqe);
+  mbuf_put(e->mbuf);
+  e->mbuf = NULL;
+  cache->nentries--;
+}
+
+/* Add a pending entry, evicting the least recently used one if need be. */
+static struct read_cache_entry *read_cache_add(struct read_cache *cache,
+                                               uint32_t hash, msg_type_t type,
+                                               uint8_t *key, uint32_t keylen,
+                                               uint8_t *tail,
+                                               uint32_t taillen) {
+  struct read_cache_entry *e, **bucket;
+  struct mbuf *mbuf;
+
+  if (keylen + taillen >= mbuf_data_size()) {
+    return NULL;
+  }
+
+  mbuf = mbuf_get();
+  if (mbuf == NULL) {
+    return NULL;
+  }
+
+  if (TAILQ_EMPTY(&cache->free_q)) {
+    read_cache_remove(cache, TAILQ_LAST(&cache->lru_q, read_cache_tqh));
+  }
+  e = TAILQ_FIRST(&cache->free_q);
+  TAILQ_REMOVE(&cache->free_q, e, tqe);
+  TAILQ_INSERT_HEAD(&cache->lru_q, e, tqe);
+  bucket = read_cache_bucket(cache, hash);
+  e->next = *bucket;
+  *bucket = e;
+  cache->nentries++;
+
+  mbuf_copy(mbuf, key, keylen);
+  mbuf_copy(mbuf, tail, taillen);
+  mbuf->pos = mbuf->last;
+  e->mbuf = mbuf;
+  e->hash = hash;
+  e->type = type;
+  e->keylen = keylen;
+  e->taillen = taillen;
+
+  return e;
+}
+
+/*
+ * Look up a cacheable read. On a hit, *rsp is set to a copy of the cached
+ * response and DN_OK is returned. On a miss, the read of a hot key is
+ * marked to fill the cache with its response, and DN_NOOPS is returned.
+ */
+rstatus_t read_cache_get(struct read_cache *cache, struct msg *req,
+                         usec_t now, struct msg **rsp) {
+  struct read_cache_entry *e;
+  struct msg *msg;
+  uint8_t *key, *tail;
+  uint32_t keylen, taillen, hash;
+  bool hot;
+
+  if (!read_cache_key(req, &key, &keylen, &tail, &taillen)) {
+    return DN_NOOPS;
+  }
+
+  hash = read_cache_hash(key, keylen);
+  hot = read_cache_count(cache, hash) >= cache->hot_threshold;
+
+  e = read_cache_find(cache, hash, req->type, key, keylen, tail, taillen);
+  if (e != NULL && e->expire_at <= now) {
+    read_cache_remove(cache, e);
+    e = NULL;
+  }
+
+  if (e != NULL) {
+    if (e->fill_id != 0) {
+      /* the datastore has yet to answer the read that fills it */
+      return DN_NOOPS;
+    }
+
+    msg = msg_get(req->owner, false, __FUNCTION__);
+    if (msg == NULL) {
+      return DN_ENOMEM;
+    }
+    if (msg_append(msg, e->mbuf->pos, mbuf_length(e->mbuf)) != DN_OK) {
+      rsp_put(msg);
+      return DN_ENOMEM;
+    }
+    msg->type = e->rsp_type;
+
+    TAILQ_REMOVE(&cache->lru_q, e, tqe);
+    TAILQ_INSERT_HEAD(&cache->lru_q, e, tqe);
+    *rsp = msg;
+    return DN_OK;
+  }
+
+  if (hot) {
+    e = read_cache_add(cache, hash, req->type, key, keylen, tail, taillen);
+    if (e != NULL) {
+      e->fill_id = req->id;
+      e->expire_at = now + cache->ttl;
+      req->read_cache_fill = 1;
+    }
+  }
+
+  return DN_NOOPS;
+}
+
+/*
+ * Fill the pending entry of req with its response. Returns false if the
+ * entry is gone, or the response is an error or does not fit.
+ */
+bool read_cache_fill(struct read_cache *cache, struct msg *req,
+                     struct msg *rsp, usec_t now) {
+  struct read_cache_entry *e;
+  struct mbuf *mbuf;
+  uint8_t *key, *tail;
+  uint32_t keylen, taillen, hash;
+
+  if (!read_cache_key(req, &key, &keylen, &tail, &taillen)) {
+    return false;
+  }
+
+  hash = read_cache_hash(key, keylen);
+  e = read_cache_find(cache, hash, req->type, key, keylen, tail, taillen);
+  if (e == NULL || e->fill_id != req->id) {
+    return false;
+  }
+
+  if (rsp->is_error || rsp->spliced) {
+    goto drop;
+  }
+
+  STAILQ_FOREACH(mbuf, &rsp->mhdr, next) {
+    if (mbuf_length(mbuf) > mbuf_remaining_space(e->mbuf)) {
+      goto drop;
+    }
+    mbuf_copy(e->mbuf, mbuf->pos, mbuf_length(mbuf));
+  }
+
+  e->fill_id = 0;
+  e->rsp_type = rsp->type;
+  e->expire_at = now + cache->ttl;
+  return true;
+
+drop:
+  read_cache_remove(cache, e);
+  return false;
+}
+
+/*
+ * Drop the entries of the keys a write changes. Writes that change keys
+ * they do not name as keys clear the whole cache. Returns the number of
+ * entries dropped.
+ */
+uint32_t read_cache_invalidate(struct read_cache *cache, struct msg *req) {
+  struct read_cache_entry *e, *next;
+  struct keypos *kpos;
+  uint32_t i, keylen, hash, n = 0;
+
+  switch (req->type) {
+    case MSG_REQ_REDIS_GEORADIUS:
+    case MSG_REQ_REDIS_GEORADIUSBYMEMBER:
+    case MSG_REQ_REDIS_RPOPLPUSH:
+    case MSG_REQ_REDIS_SLAVEOF:
+    case MSG_REQ_REDIS_SMOVE:
+    case MSG_REQ_REDIS_SORT:
+      while ((e = TAILQ_FIRST(&cache->lru_q)) != NULL) {
+        read_cache_remove(cache, e);
+        n++;
+      }
+      return n;
+    case MSG_REQ_REDIS_SUNIONSTORE:
+    case MSG_REQ_REDIS_ZINTERSTORE:
+    case MSG_REQ_REDIS_ZUNIONSTORE:
+      // flagged as reads, but they write their destination
+      break;
+    default:
+      if (req->is_read) {
+        return 0;
+      }
+      break;
+  }
+
+  for (i = 0; i < array_n(req->keys); i++) {
+    kpos = array_get(req->keys, i);
+    keylen = (uint32_t)(kpos->end - kpos->start);
+    hash = read_cache_hash(kpos->start, keylen);
+    for (e = *read_cache_bucket(cache, hash); e != NULL; e = next) {
+      next = e->next;
+      if (read_cache_match_key(e, hash, kpos->start, keylen)) {
+        read_cache_remove(cache, e);
+        n++;
+      }
+    }
+  }
+
+  return n;
+}
+
+uint32_t read_cache_entries(struct read_cache *cache) {
+  return cache->nentries;
+}
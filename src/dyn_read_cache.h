@@ -0,0 +1,40 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#ifndef DYN_READ_CACHE_H_
+#define DYN_READ_CACHE_H_
+
+#include <stdbool.h>
+
+#include "dyn_types.h"
+
+/*
+ * A count-min sketch of READ_CACHE_CMS_DEPTH rows finds the hot keys. Its
+ * counters are halved every READ_CACHE_CMS_WIDTH * READ_CACHE_CMS_AGING
+ * reads, so a key is hot when it takes a fair share of the recent ones.
+ */
+#define READ_CACHE_CMS_DEPTH 4
+#define READ_CACHE_CMS_WIDTH 4096
+#define READ_CACHE_CMS_AGING 4
+
+/* Longest request tail, after the key, a cached read may have */
+#define READ_CACHE_MAX_TAIL 256
+
+// Forward declarations
+struct msg;
+struct read_cache;
+
+struct read_cache *read_cache_create(uint32_t max_entries, msec_t ttl,
+                                     uint32_t hot_threshold);
+void read_cache_destroy(struct read_cache *cache);
+bool read_cache_cacheable(struct msg *req);
+rstatus_t read_cache_get(struct read_cache *cache, struct msg *req,
+                         usec_t now, struct msg **rsp);
+bool read_cache_fill(struct read_cache *cache, struct msg *req,
+                     struct msg *rsp, usec_t now);
+uint32_t read_cache_invalidate(struct read_cache *cache, struct msg *req);
+uint32_t read_cache_entries(struct read_cache *cache);
+
+#endif /* DYN_READ_CACHE_H_ */
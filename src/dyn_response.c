@@ -171,6 +171,7 @@ void rsp_send_done(struct context *ctx, struct conn *conn, struct msg *rsp) {
   ASSERT(!rsp->is_request && req->is_request);
   ASSERT(req->selected_rsp == rsp);
   req->rsp_sent = 1;
+  trace_hop(req, TRACE_client_send);
 
   /* dequeue request from client outq */
   conn_dequeue_outq(ctx, conn, req);
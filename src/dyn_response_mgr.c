@@ -110,20 +110,35 @@ void init_response_mgr(struct msg *req, struct response_mgr *rspmgr,
   req->rspmgrs_inited = true;
 }
 
+/*
+ * Index of a good response that a quorum of them agree on, or -1. Since a
+ * digest cannot be returned, one of the responses that agree must carry the
+ * value itself.
+ */
+static int rspmgr_quorum_response(struct response_mgr *rspmgr) {
+  uint8_t i, j;
+
+  if (rspmgr->good_responses < rspmgr->quorum_responses) return -1;
+  if (rspmgr->quorum_responses == 1) {
+    for (i = 0; i < rspmgr->good_responses; i++) {
+      if (!rspmgr->digests[i]) return i;
+    }
+    return -1;
+  }
+
+  // with at most 3 replicas, a quorum is any two that agree
+  for (i = 0; i < rspmgr->good_responses; i++) {
+    for (j = (uint8_t)(i + 1); j < rspmgr->good_responses; j++) {
+      if (rspmgr->checksums[i] != rspmgr->checksums[j]) continue;
+      if (!rspmgr->digests[i]) return i;
+      if (!rspmgr->digests[j]) return j;
+    }
+  }
+  return -1;
+}
+
 static bool rspmgr_is_quorum_achieved(struct response_mgr *rspmgr) {
-  if (rspmgr->quorum_responses == 1 &&
-      rspmgr->good_responses == rspmgr->quorum_responses)
-    return true;
-  if (rspmgr->good_responses < rspmgr->quorum_responses) return false;
-
-  uint32_t chk0, chk1, chk2;
-  chk0 = rspmgr->checksums[0];
-  chk1 = rspmgr->checksums[1];
-  if (chk0 == chk1) return true;
-  if (rspmgr->good_responses < 3) return false;
-  chk2 = rspmgr->checksums[2];
-  if ((chk1 == chk2) || (chk0 == chk2)) return true;
-  return false;
+  return rspmgr_quorum_response(rspmgr) >= 0;
 }
 
 // Wait for all responses before responding
@@ -144,6 +159,8 @@ rspmgr_check_is_done(struct response_mgr *rspmgr)
 bool rspmgr_check_is_done(struct response_mgr *rspmgr) {
   uint8_t pending_responses = (uint8_t)(
       rspmgr->max_responses - rspmgr->good_responses - rspmgr->error_responses);
+  // the value of a digest is still being read, all others are in
+  if (rspmgr->full_read_pending) return false;
   // do the required calculation and tell if we are done here
   if (rspmgr->good_responses >= rspmgr->quorum_responses) {
     // We received enough good responses but do their checksum match?
@@ -238,6 +255,31 @@ bool perform_repairs_if_necessary(struct context *ctx, struct response_mgr *rspm
   return false;
 }
 
+/*
+ * Pick the response of a digest read whose responses do not agree, even
+ * once a digest was read in full. As under DC_QUORUM otherwise, the first
+ * value is returned, but only a response that carries one will do: if all
+ * of them are digests, there is no quorum.
+ */
+static struct msg *rspmgr_reconcile_digests(struct context *ctx,
+                                            struct response_mgr *rspmgr) {
+  uint8_t i;
+
+  stats_pool_incr(ctx, quorum_digest_mismatches);
+  for (i = 0; i < rspmgr->good_responses; i++) {
+    if (!rspmgr->digests[i]) return rspmgr->responses[i];
+  }
+
+  log_info("req %lu got only digests, returning error", rspmgr->msg->id);
+  struct msg *rsp = msg_get_error(NULL, DYNOMITE_NO_QUORUM_ACHIEVED, 0);
+  if (rspmgr->err_rsp) {
+    rsp_put(rspmgr->err_rsp);
+  }
+  rspmgr->err_rsp = rsp;
+  rspmgr->error_responses++;
+  return rsp;
+}
+
 struct msg *rspmgr_get_response(struct context *ctx, struct response_mgr *rspmgr) {
   // no quorum possible
   if (rspmgr->good_responses < rspmgr->quorum_responses) {
@@ -263,17 +305,11 @@ struct msg *rspmgr_get_response(struct context *ctx, struct response_mgr *rspmgr
   }
 
   // If we did not perform any repairs. we fall back to checksum matching.
-  uint32_t chk0, chk1, chk2;
-  chk0 = rspmgr->checksums[0];
-  chk1 = rspmgr->checksums[1];
-  if (chk0 == chk1) {
-    return rspmgr->responses[0];
-  } else if (rspmgr->good_responses == 3) {
-    chk2 = rspmgr->checksums[2];
-    if (chk1 == chk2)
-      return rspmgr->responses[1];
-    else if (chk0 == chk2)
-      return rspmgr->responses[0];
+  int idx = rspmgr_quorum_response(rspmgr);
+  if (idx >= 0) {
+    rspmgr->agreed = true;
+    rspmgr->agreed_checksum = rspmgr->checksums[idx];
+    return rspmgr->responses[idx];
   }
   rspmgr_incr_non_quorum_responses_stats(rspmgr);
   if (log_loggable(LOG_DEBUG)) {
@@ -290,9 +326,67 @@ struct msg *rspmgr_get_response(struct context *ctx, struct response_mgr *rspmgr
       msg_dump(LOG_VVERB, rspmgr->responses[2]);
     }
   }
+  if (rspmgr->msg->digest_read) {
+    return rspmgr_reconcile_digests(ctx, rspmgr);
+  }
   return g_reconcile_responses(rspmgr);
 }
 
+/*
+ * Index of the digest whose value a digest read should read in full, or -1.
+ * That is when enough responses came in but none that carries a value has a
+ * quorum: the local rack failed or disagrees with the others. With at most
+ * three replicas, two digests that agree are read the same from either.
+ * Only one digest is ever read in full.
+ */
+int rspmgr_full_read_index(struct response_mgr *rspmgr) {
+  uint8_t i;
+
+  if (!rspmgr->msg->digest_read || rspmgr->full_read_sent ||
+      rspmgr->good_responses < rspmgr->quorum_responses ||
+      rspmgr_quorum_response(rspmgr) >= 0) {
+    return -1;
+  }
+
+  for (i = 0; i < rspmgr->good_responses; i++) {
+    if (rspmgr->digests[i] && rspmgr->digest_peers[i] != NULL) return i;
+  }
+  return -1;
+}
+
+/*
+ * The value of the digest at 'idx' is being read in full. All the other
+ * responses are in, so the next one is that value, or the error in its place.
+ */
+void rspmgr_await_full_read(struct response_mgr *rspmgr, uint8_t idx) {
+  rspmgr->full_read_sent = true;
+  rspmgr->full_read_pending = true;
+  rspmgr->full_read_idx = idx;
+  rspmgr->done = false;
+  rspmgr->msg->awaiting_rsps++;
+}
+
+/*
+ * Compare a response that comes in once a quorum agreed on the value of a
+ * digest read with that value, counting it if it differs. By then the client
+ * has its response, so this costs it nothing.
+ */
+void rspmgr_check_late_response(struct context *ctx,
+                                struct response_mgr *rspmgr, struct msg *rsp) {
+  uint32_t checksum;
+
+  if (!rspmgr->msg->digest_read || !rspmgr->agreed || rsp->is_error) return;
+
+  checksum = (rsp->dmsg != NULL && (rsp->dmsg->flags & DMSG_FLAG_DIGEST))
+                 ? rsp->dmsg->digest
+                 : msg_payload_crc32(rsp);
+  if (checksum != rspmgr->agreed_checksum) {
+    log_warn("req %lu late %s differs from the quorum", rspmgr->msg->id,
+             print_obj(rsp));
+    stats_pool_incr(ctx, quorum_digest_mismatches);
+  }
+}
+
 void rspmgr_free_other_responses(struct response_mgr *rspmgr,
                                  struct msg *dont_free) {
   int i;
@@ -309,6 +403,26 @@ void rspmgr_free_other_responses(struct response_mgr *rspmgr,
 rstatus_t rspmgr_submit_response(struct response_mgr *rspmgr, struct msg *rsp) {
   log_info("req %d submitting response %d awaiting_rsps %d", rspmgr->msg->id,
            rsp->id, rspmgr->msg->awaiting_rsps);
+  if (rspmgr->full_read_pending) {
+    uint8_t idx = rspmgr->full_read_idx;
+
+    // the value read in full replaces its digest; if it failed, the digest
+    // stays and the read is settled on what came in before
+    rspmgr->full_read_pending = false;
+    if (rsp->is_error || (rsp->dmsg != NULL &&
+                          (rsp->dmsg->flags & DMSG_FLAG_DIGEST))) {
+      log_info("req %lu full read failed with %s", rspmgr->msg->id,
+               print_obj(rsp));
+      rsp_put(rsp);
+    } else {
+      rsp_put(rspmgr->responses[idx]);
+      rspmgr->responses[idx] = rsp;
+      rspmgr->digests[idx] = false;
+      rspmgr->checksums[idx] = msg_payload_crc32(rsp);
+    }
+    msg_decr_awaiting_rsps(rspmgr->msg);
+    return DN_OK;
+  }
   if (rsp->is_error) {
     log_debug(LOG_VERB, "Received error response %d:%d for req %d:%d", rsp->id,
               rsp->parent_id, rspmgr->msg->id, rspmgr->msg->parent_id);
@@ -318,9 +432,19 @@ rstatus_t rspmgr_submit_response(struct response_mgr *rspmgr, struct msg *rsp) {
     else
       rsp_put(rsp);
   } else {
-    rspmgr->checksums[rspmgr->good_responses] = msg_payload_crc32(rsp);
-    log_debug(LOG_VERB, "Good response %d:%d checksum %u", rsp->id,
-              rsp->parent_id, rspmgr->checksums[rspmgr->good_responses]);
+    // a digest stands for the value the replica has, by its checksum
+    bool digest = rsp->dmsg != NULL && (rsp->dmsg->flags & DMSG_FLAG_DIGEST);
+    rspmgr->digests[rspmgr->good_responses] = digest;
+    rspmgr->digest_peers[rspmgr->good_responses] =
+        (digest && rsp->owner != NULL &&
+         rsp->owner->type == CONN_DNODE_PEER_SERVER)
+            ? rsp->owner->owner
+            : NULL;
+    rspmgr->checksums[rspmgr->good_responses] =
+        digest ? rsp->dmsg->digest : msg_payload_crc32(rsp);
+    log_debug(LOG_VERB, "Good %s %d:%d checksum %u",
+              digest ? "digest" : "response", rsp->id, rsp->parent_id,
+              rspmgr->checksums[rspmgr->good_responses]);
     rspmgr->responses[rspmgr->good_responses++] = rsp;
   }
   msg_decr_awaiting_rsps(rspmgr->msg);
@@ -11,6 +11,21 @@ struct response_mgr {
      here. But we have only 3 ASGs */
   struct msg *responses[MAX_REPLICAS_PER_DC];
   uint32_t checksums[MAX_REPLICAS_PER_DC];
+  // Which responses are digests that stand for a value, under
+  // quorum_digest_reads. A digest is compared but never returned.
+  bool digests[MAX_REPLICAS_PER_DC];
+  // Replica each digest came from.
+  struct node *digest_peers[MAX_REPLICAS_PER_DC];
+  // Whether the value of one digest was read in full, because the responses
+  // of a digest read agreed on no value, and whether that read is still out.
+  // Its response takes the place of the digest at full_read_idx.
+  bool full_read_sent;
+  bool full_read_pending;
+  uint8_t full_read_idx;
+  // Whether a quorum agreed on the response returned, and its checksum, to
+  // compare the responses that come in later with.
+  bool agreed;
+  uint32_t agreed_checksum;
   // Number of non-error responses received. (nil) is not an error.
   uint8_t good_responses;
   // Maximum number of responses possible.
@@ -41,6 +56,10 @@ struct msg *rspmgr_get_response(struct context *ctx, struct response_mgr *rspmgr
 void rspmgr_free_response(struct response_mgr *rspmgr, struct msg *dont_free);
 void rspmgr_free_other_responses(struct response_mgr *rspmgr,
                                  struct msg *dont_free);
+int rspmgr_full_read_index(struct response_mgr *rspmgr);
+void rspmgr_await_full_read(struct response_mgr *rspmgr, uint8_t idx);
+void rspmgr_check_late_response(struct context *ctx,
+                                struct response_mgr *rspmgr, struct msg *rsp);
 rstatus_t msg_local_one_rsp_handler(struct context *ctx, struct msg *req, struct msg *rsp);
 rstatus_t rspmgr_clone_responses(struct response_mgr *src,
                                  struct array *responses);
@@ -29,6 +29,7 @@
 #include "dyn_server.h"
 #include "dyn_token.h"
 #include "dyn_util.h"
+#include "dyn_vnode.h"
 
 static char *_print_datastore(const struct object *obj) {
   ASSERT(obj->type == OBJ_DATASTORE);
@@ -209,12 +210,56 @@ static void server_ack_err(struct context *ctx, struct conn *conn,
   if (req->swallow) req_put(req);
 }
 
+/*
+ * Queues a datastore or peer connection that has requests waiting, so that
+ * all the requests forwarded to it in this event loop iteration, from any
+ * number of client connections, go out in one write (see core_batch_flush())
+ * instead of waiting for the connection to be reported writable.
+ */
+void server_batch_add(struct context *ctx, struct conn *conn) {
+  ASSERT(conn->type == CONN_SERVER || conn->type == CONN_DNODE_PEER_SERVER);
+
+  if (!conn->batched) {
+    TAILQ_INSERT_TAIL(&ctx->pool.batch_conn_q, conn, batch_tqe);
+    conn->batched = 1;
+    if (conn->type == CONN_DNODE_PEER_SERVER) {
+      conn->batch_usec = dn_usec_now();
+    }
+  }
+}
+
+void server_batch_del(struct context *ctx, struct conn *conn) {
+  if (conn->batched) {
+    TAILQ_REMOVE(&ctx->pool.batch_conn_q, conn, batch_tqe);
+    conn->batched = 0;
+  }
+}
+
+/*
+ * Arranges for the requests just queued on an idle datastore connection to go
+ * out: batched with the others of this event loop iteration when
+ * datastore_batch_size allows it, else once the connection is reported
+ * writable.
+ */
+rstatus_t server_send_queued(struct context *ctx, struct conn *conn) {
+  ASSERT(conn->type == CONN_SERVER);
+
+  if (conn->connected && ctx->pool.datastore_batch_size > 1) {
+    server_batch_add(ctx, conn);
+    return DN_OK;
+  }
+
+  return conn_event_add_out(conn);
+}
+
 static void server_close(struct context *ctx, struct conn *conn) {
   struct msg *req, *nmsg; /* current and next message */
 
   ASSERT(conn->type == CONN_SERVER);
   struct datastore *datastore = conn->owner;
 
+  server_batch_del(ctx, conn);
+
   if (ctx->stats) {
     server_close_stats(ctx, datastore, conn->err, conn->eof, conn->connected);
   }
@@ -391,6 +436,7 @@ rstatus_t server_pool_init(struct server_pool *sp, struct conf_pool *cp,
   sp->p_conn = NULL;
   TAILQ_INIT(&sp->c_conn_q);
   TAILQ_INIT(&sp->ready_conn_q);
+  TAILQ_INIT(&sp->batch_conn_q);
 
   array_null(&sp->datacenters);
   /* sp->ncontinuum = 0; */
@@ -457,9 +503,31 @@ rstatus_t server_pool_init(struct server_pool *sp, struct conf_pool *cp,
   sp->stats_interval = cp->stats_interval;
   sp->mbuf_size = cp->mbuf_size;
   sp->alloc_msgs_max = cp->alloc_msgs_max;
+  sp->splice_threshold = (uint32_t)cp->splice_threshold;
+  sp->datastore_batch_size = (uint32_t)cp->datastore_batch_size;
+  sp->peer_batch_size = (uint32_t)cp->peer_batch_size;
+  sp->remote_dc_compression = cp->remote_dc_compression;
+  sp->top_keys = (uint32_t)cp->top_keys;
+  sp->top_keys_sample_rate = (uint32_t)cp->top_keys_sample_rate;
+  sp->histogram_precision = (uint32_t)cp->histogram_precision;
+  sp->trace_sample_rate = (uint32_t)cp->trace_sample_rate;
+  sp->adaptive_replica_selection = cp->adaptive_replica_selection;
+  sp->hedge_read_percentile = (uint32_t)cp->hedge_read_percentile;
+  sp->hedge_read_budget = (uint32_t)cp->hedge_read_budget;
+  sp->quorum_digest_reads = cp->quorum_digest_reads;
+  sp->peer_concurrency_max = (uint32_t)cp->peer_concurrency_max;
+  if (cp->read_cache_size > 0) {
+    sp->read_cache = read_cache_create((uint32_t)cp->read_cache_size,
+                                       (msec_t)cp->read_cache_ttl,
+                                       (uint32_t)cp->hot_key_threshold);
+    if (sp->read_cache == NULL) {
+      return DN_ENOMEM;
+    }
+  }
 
   sp->secure_server_option =
       get_secure_server_option(&cp->secure_server_option);
+  sp->secure_cipher = get_secure_cipher(&cp->secure_cipher);
   sp->pem_key_file = cp->pem_key_file;
   sp->recon_key_file = cp->recon_key_file;
   sp->recon_iv_file = cp->recon_iv_file;
@@ -471,8 +539,6 @@ rstatus_t server_pool_init(struct server_pool *sp, struct conf_pool *cp,
   /* gossip */
   sp->g_interval = cp->gos_interval;
 
-  set_msgs_per_sec(cp->conn_msg_rate);
-
   log_debug(LOG_VERB, "transform to pool '%.*s'", sp->name.len, sp->name.data);
 
   sp->ctx = ctx;
@@ -496,6 +562,8 @@ void server_pool_deinit(struct server_pool *sp) {
   server_deinit(sp->datastore);
   dn_free(sp->datastore);
   sp->datastore = NULL;
+  read_cache_destroy(sp->read_cache);
+  sp->read_cache = NULL;
   log_debug(LOG_DEBUG, "deinit pool '%.*s'", sp->name.len, sp->name.data);
 }
 
@@ -514,6 +582,7 @@ static rstatus_t rack_init(struct rack *rack) {
   THROW_STATUS(array_init(&rack->continuums, 1, sizeof(struct continuum)));
   rack->ncontinuum = 0;
   rack->nserver_continuum = 0;
+  rack->table = NULL;
   rack->name = dn_alloc(sizeof(struct string));
   string_init(rack->name);
 
@@ -524,6 +593,7 @@ static rstatus_t rack_init(struct rack *rack) {
 }
 
 static rstatus_t rack_deinit(struct rack *rack) {
+  vnode_rack_deinit(rack);
   array_deinit(&rack->continuums);
 
   return DN_OK;
@@ -777,10 +847,13 @@ static void server_rsp_forward(struct context *ctx, struct conn *s_conn,
   req = TAILQ_FIRST(&s_conn->omsg_q);
   ASSERT(req->is_request);
   if (req->request_send_time) {
-    struct stats *st = ctx->stats;
+    struct datastore *datastore = s_conn->owner;
     uint64_t delay = dn_usec_now() - req->request_send_time;
-    histo_add(&st->server_latency_histo, delay);
+    stats_histo_add(ctx, server_latency, delay);
+    replica_load_add(&datastore->load, delay);
+    stats_family_add(ctx, STATS_PATH_local, req, rsp->mlen, delay);
   }
+  trace_hop(req, TRACE_reply);
   conn_dequeue_outq(ctx, s_conn, req);
 
   c_conn = req->owner;
@@ -791,6 +864,13 @@ static void server_rsp_forward(struct context *ctx, struct conn *s_conn,
          (c_conn->type == CONN_DNODE_PEER_CLIENT));
 
   server_rsp_forward_stats(ctx, rsp);
+  stats_top_keys_add_rsp(ctx, req, rsp);
+  if (req->read_cache_fill) {
+    struct server_pool *pool = c_conn->owner;
+    if (read_cache_fill(pool->read_cache, req, rsp, dn_usec_now())) {
+      stats_pool_incr(ctx, read_cache_fills);
+    }
+  }
   // handler owns the response now
   status = conn_handle_response(ctx, c_conn, req->id, rsp);
   IGNORE_RET_VAL(status);
@@ -881,6 +961,7 @@ void req_send_done(struct context *ctx, struct conn *conn, struct msg *req) {
   /* dequeue the message (request) from server inq */
   conn_dequeue_inq(ctx, conn, req);
   req->request_send_time = dn_usec_now();
+  trace_hop(req, TRACE_send);
 
   /*
    * expect_datastore_reply request instructs the server to send response. So,
@@ -899,6 +980,11 @@ static void req_server_enqueue_imsgq(struct context *ctx, struct conn *conn,
   ASSERT(req->is_request);
   ASSERT(conn->type == CONN_SERVER);
   req->request_inqueue_enqueue_time_us = dn_usec_now();
+  if (req->trace != NULL) {
+    struct datastore *datastore = conn->owner;
+    trace_hop(req, TRACE_enqueue);
+    trace_target(req, &datastore->name, datastore->endpoint.port);
+  }
 
   /*
    * timeout clock starts ticking the instant the message is enqueued into
@@ -913,10 +999,11 @@ static void req_server_enqueue_imsgq(struct context *ctx, struct conn *conn,
   }
 
   TAILQ_INSERT_TAIL(&conn->imsg_q, req, s_tqe);
+  ((struct datastore *)conn->owner)->load.outstanding++;
   log_debug(LOG_VERB, "conn %p enqueue inq %d:%d", conn, req->id,
             req->parent_id);
 
-  histo_add(&ctx->stats->server_in_queue, TAILQ_COUNT(&conn->imsg_q));
+  stats_histo_add(ctx, server_in_queue, TAILQ_COUNT(&conn->imsg_q));
   stats_server_incr(ctx, in_queue);
   stats_server_incr_by(ctx, in_queue_bytes, req->mlen);
 }
@@ -927,12 +1014,13 @@ static void req_server_dequeue_imsgq(struct context *ctx, struct conn *conn,
   ASSERT(conn->type == CONN_SERVER);
 
   TAILQ_REMOVE(&conn->imsg_q, req, s_tqe);
+  ((struct datastore *)conn->owner)->load.outstanding--;
   log_debug(LOG_VERB, "conn %p dequeue inq %d:%d", conn, req->id,
             req->parent_id);
   usec_t delay = dn_usec_now() - req->request_inqueue_enqueue_time_us;
-  histo_add(&ctx->stats->server_queue_wait_time_histo, delay);
+  stats_histo_add(ctx, server_queue_wait_time, delay);
 
-  histo_add(&ctx->stats->server_in_queue, TAILQ_COUNT(&conn->imsg_q));
+  stats_histo_add(ctx, server_in_queue, TAILQ_COUNT(&conn->imsg_q));
   stats_server_decr(ctx, in_queue);
   stats_server_decr_by(ctx, in_queue_bytes, req->mlen);
 }
@@ -943,10 +1031,11 @@ static void req_server_enqueue_omsgq(struct context *ctx, struct conn *conn,
   ASSERT(conn->type == CONN_SERVER);
 
   TAILQ_INSERT_TAIL(&conn->omsg_q, req, s_tqe);
+  ((struct datastore *)conn->owner)->load.outstanding++;
   log_debug(LOG_VERB, "conn %p enqueue outq %d:%d", conn, req->id,
             req->parent_id);
 
-  histo_add(&ctx->stats->server_out_queue, TAILQ_COUNT(&conn->omsg_q));
+  stats_histo_add(ctx, server_out_queue, TAILQ_COUNT(&conn->omsg_q));
   stats_server_incr(ctx, out_queue);
   stats_server_incr_by(ctx, out_queue_bytes, req->mlen);
 }
@@ -959,10 +1048,11 @@ static void req_server_dequeue_omsgq(struct context *ctx, struct conn *conn,
   msg_tmo_delete(req);
 
   TAILQ_REMOVE(&conn->omsg_q, req, s_tqe);
+  ((struct datastore *)conn->owner)->load.outstanding--;
   log_debug(LOG_VERB, "conn %p dequeue outq %d:%d", conn, req->id,
             req->parent_id);
 
-  histo_add(&ctx->stats->server_out_queue, TAILQ_COUNT(&conn->omsg_q));
+  stats_histo_add(ctx, server_out_queue, TAILQ_COUNT(&conn->omsg_q));
   stats_server_decr(ctx, out_queue);
   stats_server_decr_by(ctx, out_queue_bytes, req->mlen);
 }
@@ -26,6 +26,12 @@
 #include "dyn_dict.h"
 #include "dyn_types.h"
 
+/*
+ * A batched write to a datastore connection stops adding requests once it
+ * holds this many bytes; see server_batch_add().
+ */
+#define SERVER_BATCH_BYTES (256 * 1024)
+
 // Forward declarations
 struct conf_pool;
 struct context;
@@ -93,5 +99,8 @@ rstatus_t server_pool_init(struct server_pool *server_pool,
                            struct conf_pool *conf_pool, struct context *ctx);
 void server_pool_deinit(struct server_pool *server_pool);
 void init_server_conn(struct conn *conn);
+void server_batch_add(struct context *ctx, struct conn *conn);
+void server_batch_del(struct context *ctx, struct conn *conn);
+rstatus_t server_send_queued(struct context *ctx, struct conn *conn);
 
 #endif
@@ -1,26 +0,0 @@
-/*
- * Dynomite - A thin, distributed replication layer for multi non-distributed
- * storages. Copyright (C) 2014 Netflix, Inc. Licensed under the Apache License,
- * Version 2.0 (the "License"); you may not use this file except in compliance
- * with the License. You may obtain a copy of the License at
- *
- * http://www.apache.org/licenses/LICENSE-2.0
- *
- * Unless required by applicable law or agreed to in writing, software
- * distributed under the License is distributed on an "AS IS" BASIS,
- * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
- * See the License for the specific language governing permissions and
- * limitations under the License.
- */
-
-#include "dyn_conf.h"
-#include "dyn_core.h"
-
-static uint32_t conn_msg_rate = CONF_DEFAULT_CONN_MSG_RATE;  // conn msgs per
-                                                             // sec
-
-uint32_t msgs_per_sec(void) { return conn_msg_rate; }
-
-void set_msgs_per_sec(uint32_t tokens_per_sec) {
-  conn_msg_rate = tokens_per_sec;
-}
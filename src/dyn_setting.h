@@ -1,22 +0,0 @@
-/*
- * Dynomite - A thin, distributed replication layer for multi non-distributed
- * storages. Copyright (C) 2014 Netflix, Inc. Licensed under the Apache License,
- * Version 2.0 (the "License"); you may not use this file except in compliance
- * with the License. You may obtain a copy of the License at
- *
- * http://www.apache.org/licenses/LICENSE-2.0
- *
- * Unless required by applicable law or agreed to in writing, software
- * distributed under the License is distributed on an "AS IS" BASIS,
- * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
- * See the License for the specific language governing permissions and
- * limitations under the License.
- */
-
-#ifndef _DYN_SETTING_H_
-#define _DYN_SETTING_H_
-
-uint32_t msgs_per_sec(void);
-void set_msgs_per_sec(uint32_t tokens_per_sec);
-
-#endif
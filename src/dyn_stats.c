@@ -25,6 +25,7 @@
 #include <unistd.h>
 
 #include <ctype.h>
+#include <stdarg.h>
 #include <netinet/in.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
@@ -38,6 +39,7 @@
 #include "dyn_node_snitch.h"
 #include "dyn_ring_queue.h"
 #include "dyn_server.h"
+#include "dyn_topk.h"
 
 struct stats_desc {
   char *name; /* stats name */
@@ -60,10 +62,109 @@ static struct stats_desc stats_server_desc[] = {
     STATS_SERVER_CODEC(DEFINE_ACTION)};
 #undef DEFINE_ACTION
 
+/* histograms by the name they have on the histograms and metrics endpoints */
+#define DEFINE_ACTION(_name, _field, _desc) \
+  {#_name, offsetof(struct stats, _field), _desc},
+static const struct {
+  const char *name;
+  size_t offset;
+  const char *desc;
+} stats_histos[] = {STATS_HISTO_CODEC(DEFINE_ACTION)};
+#undef DEFINE_ACTION
+
+/* percentiles of every histogram on the histograms endpoint */
+static const struct {
+  const char *name;
+  double percentile;
+} stats_histo_percentiles[] = {
+    {"p50", 50.0},   {"p90", 90.0},     {"p95", 95.0},
+    {"p99", 99.0},   {"p99.9", 99.9},   {"p99.99", 99.99},
+};
+
+#define DEFINE_ACTION(_name) #_name,
+static const char *stats_family_names[] = {STATS_FAMILY_CODEC(DEFINE_ACTION)};
+static const char *stats_path_names[] = {STATS_PATH_CODEC(DEFINE_ACTION)};
+#undef DEFINE_ACTION
+
+/* command family of each msg_type_t, see stats_families_init() */
+static uint8_t stats_families[MSG_SENTINEL];
+
+static volatile struct histogram *stats_histo(struct stats *st, uint32_t i) {
+  return (volatile struct histogram *)((uint8_t *)st + stats_histos[i].offset);
+}
+
+static stats_family_t stats_family_of(msg_type_t type) {
+  switch (type) {
+    case MSG_REQ_REDIS_KEYS:
+    case MSG_REQ_REDIS_UNLINK:
+      return STATS_FAMILY_keys;
+    case MSG_REQ_REDIS_INFO:
+    case MSG_REQ_REDIS_PING:
+    case MSG_REQ_REDIS_QUIT:
+    case MSG_REQ_REDIS_SLAVEOF:
+    case MSG_REQ_REDIS_CONFIG:
+      return STATS_FAMILY_server;
+    case MSG_REQ_REDIS_EVAL:
+    case MSG_REQ_REDIS_EVALSHA:
+    case MSG_REQ_REDIS_SCRIPT:
+    case MSG_REQ_REDIS_SCRIPT_LOAD:
+    case MSG_REQ_REDIS_SCRIPT_EXISTS:
+    case MSG_REQ_REDIS_SCRIPT_FLUSH:
+    case MSG_REQ_REDIS_SCRIPT_KILL:
+      return STATS_FAMILY_script;
+    case MSG_REQ_REDIS_PFADD:
+    case MSG_REQ_REDIS_PFCOUNT:
+      return STATS_FAMILY_hyperloglog;
+    default:
+      break;
+  }
+
+  /* the request types of each family are listed together in msg_type_t */
+  if (type >= MSG_REQ_MC_GET && type <= MSG_REQ_MC_QUIT) {
+    return STATS_FAMILY_memcache;
+  } else if (type >= MSG_REQ_REDIS_DEL && type <= MSG_REQ_REDIS_TYPE) {
+    return STATS_FAMILY_keys;
+  } else if (type >= MSG_REQ_REDIS_APPEND && type <= MSG_REQ_REDIS_STRLEN) {
+    return STATS_FAMILY_string;
+  } else if (type >= MSG_REQ_REDIS_HDEL && type <= MSG_REQ_REDIS_HSTRLEN) {
+    return STATS_FAMILY_hash;
+  } else if (type >= MSG_REQ_REDIS_LINDEX && type <= MSG_REQ_REDIS_RPUSHX) {
+    return STATS_FAMILY_list;
+  } else if (type >= MSG_REQ_REDIS_SADD && type <= MSG_REQ_REDIS_SSCAN) {
+    return STATS_FAMILY_set;
+  } else if (type >= MSG_REQ_REDIS_ZADD && type <= MSG_REQ_REDIS_ZSCAN) {
+    return STATS_FAMILY_zset;
+  } else if (type >= MSG_REQ_REDIS_GEOADD &&
+             type <= MSG_REQ_REDIS_GEORADIUSBYMEMBER) {
+    return STATS_FAMILY_geo;
+  } else if (type >= MSG_REQ_REDIS_JSONSET &&
+             type <= MSG_REQ_REDIS_JSONOBJLEN) {
+    return STATS_FAMILY_json;
+  }
+  return STATS_FAMILY_other;
+}
+
+static void stats_families_init(void) {
+  uint32_t type;
+
+  for (type = 0; type < MSG_SENTINEL; type++) {
+    stats_families[type] = (uint8_t)stats_family_of((msg_type_t)type);
+  }
+}
+
+/* the i-th of the family_latency histograms, path by path */
+static volatile struct histogram *stats_family_histo(struct stats *st,
+                                                     uint32_t i) {
+  return &st->family_latency[i / STATS_NFAMILY][i % STATS_NFAMILY];
+}
+
 #define MAX_HTTP_HEADER_SIZE 1024
 static struct string header_str = string(
     "HTTP/1.1 200 OK \nContent-Type: application/json; charset=utf-8 "
     "\nContent-Length:");
+static struct string metrics_header_str = string(
+    "HTTP/1.1 200 OK \nContent-Type: application/openmetrics-text; "
+    "version=1.0.0; charset=utf-8 \nContent-Length:");
 // static struct string endline = string("\r\n");
 static struct string ok = string("OK\r\n");
 static struct string err_resp = string("ERR");
@@ -112,19 +213,6 @@ static void stats_metric_init(struct stats_metric *stm) {
   }
 }
 
-static void stats_metric_reset(struct array *stats_metric) {
-  uint32_t i, nmetric;
-
-  nmetric = array_n(stats_metric);
-  ASSERT(nmetric == STATS_POOL_NFIELD || nmetric == STATS_SERVER_NFIELD);
-
-  for (i = 0; i < nmetric; i++) {
-    struct stats_metric *stm = array_get(stats_metric, i);
-
-    stats_metric_init(stm);
-  }
-}
-
 static rstatus_t stats_pool_metric_init(struct array *stats_metric) {
   uint32_t i, nfield = STATS_POOL_NFIELD;
 
@@ -220,13 +308,6 @@ static rstatus_t stats_pool_init(struct stats_pool *stp,
   return DN_OK;
 }
 
-static void stats_pool_reset(struct stats_pool *stp) {
-  stats_metric_reset(&stp->metric);
-
-  struct stats_server *sts = &stp->server;
-  stats_metric_reset(&sts->metric);
-}
-
 static void stats_pool_unmap(struct stats_pool *stp) {
   stats_metric_deinit(&stp->metric);
   stats_server_unmap(&stp->server);
@@ -385,6 +466,33 @@ static rstatus_t stats_create_bufs(struct stats *st) {
   return DN_OK;
 }
 
+static rstatus_t stats_top_keys_init(struct stats *st) {
+  struct stats_buffer *buf = &st->top_keys_buf;
+  size_t size;
+
+  if (st->top_keys == 0) {
+    return DN_OK;
+  }
+
+  st->hot_keys = topk_create(st->top_keys);
+  st->big_keys = topk_create(st->top_keys);
+  st->top_keys_list = dn_alloc(sizeof(*st->top_keys_list) * st->top_keys);
+  if (st->hot_keys == NULL || st->big_keys == NULL ||
+      st->top_keys_list == NULL) {
+    return DN_ENOMEM;
+  }
+
+  /* two lists of keys escaped for JSON, at most six bytes per key byte */
+  size = 2 * st->top_keys * (6 * TOPK_KEY_LEN + 128) + 256;
+  buf->data = dn_alloc(size);
+  if (buf->data == NULL) {
+    return DN_ENOMEM;
+  }
+  buf->size = size;
+
+  return DN_OK;
+}
+
 static void stats_destroy_buf(struct stats_buffer *buf) {
   if (buf->size != 0) {
     ASSERT(buf->data != NULL);
@@ -545,6 +653,23 @@ static rstatus_t stats_add_header(struct stats *st) {
   THROW_STATUS(
       stats_add_num_str(&st->buf, "99_server_queue_wait",
                         (int64_t)st->server_queue_wait_time_histo.val_99th));
+  THROW_STATUS(stats_add_num_str(&st->buf, "average_datastore_batch",
+                                 (int64_t)st->datastore_batch_histo.mean));
+  THROW_STATUS(
+      stats_add_num_str(&st->buf, "99_datastore_batch",
+                        (int64_t)st->datastore_batch_histo.val_99th));
+  THROW_STATUS(stats_add_num_str(&st->buf, "average_peer_batch",
+                                 (int64_t)st->peer_batch_histo.mean));
+  THROW_STATUS(stats_add_num_str(&st->buf, "99_peer_batch",
+                                 (int64_t)st->peer_batch_histo.val_99th));
+  THROW_STATUS(stats_add_num_str(&st->buf, "average_peer_batch_wait",
+                                 (int64_t)st->peer_batch_wait_histo.mean));
+  THROW_STATUS(
+      stats_add_num_str(&st->buf, "99_peer_batch_wait",
+                        (int64_t)st->peer_batch_wait_histo.val_99th));
+  THROW_STATUS(
+      stats_add_num_str(&st->buf, "average_peer_compress_ratio",
+                        (int64_t)st->peer_compress_ratio_histo.mean));
 
   THROW_STATUS(stats_add_num(&st->buf, &st->client_out_queue_99,
                              (int64_t)st->client_out_queue.val_99th));
@@ -667,57 +792,72 @@ static rstatus_t stats_copy_metric(struct stats *st, struct array *metric,
   return DN_OK;
 }
 
-static void stats_aggregate_metric(struct array *dst, struct array *src) {
-  uint32_t i;
+/*
+ * Sum a metric over the counters of every thread, or take the latest of a
+ * timestamp. Every thread keeps running totals, so the result is the value
+ * of the metric whenever the stats thread looks, however busy the event
+ * loops are.
+ */
+static void stats_aggregate_metric(struct stats *st, struct array *metric,
+                                   bool server) {
+  uint32_t i, t;
 
-  for (i = 0; i < array_n(src); i++) {
-    struct stats_metric *stm1, *stm2;
+  for (i = 0; i < array_n(metric); i++) {
+    struct stats_metric *stm = array_get(metric, i);
+    int64_t val = 0;
 
-    stm1 = array_get(src, i);
-    stm2 = array_get(dst, i);
+    for (t = 0; t < st->ncounters; t++) {
+      struct stats_counters *c = &st->counters[t];
+      int64_t v = __atomic_load_n(server ? &c->server[i] : &c->pool[i],
+                                  __ATOMIC_RELAXED);
 
-    ASSERT(stm1->type == stm2->type);
+      switch (stm->type) {
+        case STATS_COUNTER:
+        case STATS_GAUGE:
+          val += v;
+          break;
 
-    switch (stm1->type) {
-      case STATS_COUNTER:
-        stm2->value.counter += stm1->value.counter;
-        break;
+        case STATS_TIMESTAMP:
+          val = MAX(val, v);
+          break;
 
-      case STATS_GAUGE:
-        stm2->value.counter += stm1->value.counter;
-        break;
+        default:
+          NOT_REACHED();
+      }
+    }
+    stm->value.counter = val;
+  }
+}
 
-      case STATS_TIMESTAMP:
-        if (stm1->value.timestamp) {
-          stm2->value.timestamp = stm1->value.timestamp;
-        }
-        break;
+static void stats_aggregate_families(struct stats *st) {
+  uint32_t path, family, t;
 
-      default:
-        NOT_REACHED();
+  for (path = 0; path < STATS_NPATH; path++) {
+    for (family = 0; family < STATS_NFAMILY; family++) {
+      int64_t requests = 0, bytes = 0;
+      for (t = 0; t < st->ncounters; t++) {
+        struct stats_counters *c = &st->counters[t];
+        requests += __atomic_load_n(&c->family_requests[path][family],
+                                    __ATOMIC_RELAXED);
+        bytes +=
+            __atomic_load_n(&c->family_bytes[path][family], __ATOMIC_RELAXED);
+      }
+      st->family_requests[path][family] = requests;
+      st->family_bytes[path][family] = bytes;
     }
   }
 }
 
 static void stats_aggregate(struct stats *st) {
-  if (st->aggregate == 0) {
-    log_debug(LOG_PVERB,
-              "skip aggregate of shadow to sum as generator is slow");
-    return;
-  }
-
-  log_debug(LOG_PVERB, "aggregate stats shadow %p to sum %p", &st->shadow,
-            &st->sum);
-
-  struct stats_pool *stp1 = &st->shadow;
-  struct stats_pool *stp2 = &st->sum;
-  stats_aggregate_metric(&st->sum.metric, &st->shadow.metric);
+  struct rusage r_usage;
+  uint32_t i;
 
-  struct stats_server *sts1, *sts2;
+  log_debug(LOG_PVERB, "aggregate stats of %" PRIu32 " threads to sum %p",
+            st->ncounters, &st->sum);
 
-  sts1 = &stp1->server;
-  sts2 = &stp2->server;
-  stats_aggregate_metric(&sts2->metric, &sts1->metric);
+  stats_aggregate_metric(st, &st->sum.metric, false);
+  stats_aggregate_metric(st, &st->sum.server.metric, true);
+  stats_aggregate_families(st);
 
   static msec_t last_reset = 0;
   if (!last_reset) last_reset = dn_msec_now();
@@ -727,27 +867,34 @@ static void stats_aggregate(struct stats *st) {
   }
   if (st->reset_histogram) {
     st->reset_histogram = 0;
-    histo_reset(&st->latency_histo);
-    histo_reset(&st->payload_size_histo);
+    for (i = 0; i < NELEMS(stats_histos); i++) {
+      histo_reset(stats_histo(st, i));
+    }
+    for (i = 0; i < STATS_NPATH * STATS_NFAMILY; i++) {
+      histo_reset(stats_family_histo(st, i));
+    }
+  }
 
-    histo_reset(&st->server_latency_histo);
-    histo_reset(&st->cross_zone_latency_histo);
-    histo_reset(&st->cross_region_latency_histo);
+  for (i = 0; i < NELEMS(stats_histos); i++) {
+    histo_merge(stats_histo(st, i), &st->counters[0].histo[i], st->ncounters,
+                sizeof(*st->counters));
+    histo_compute(stats_histo(st, i));
+  }
+  for (i = 0; i < STATS_NPATH * STATS_NFAMILY; i++) {
+    histo_merge(stats_family_histo(st, i),
+                &st->counters[0].family_latency[i / STATS_NFAMILY]
+                                               [i % STATS_NFAMILY],
+                st->ncounters, sizeof(*st->counters));
+    histo_compute(stats_family_histo(st, i));
+  }
 
-    histo_reset(&st->server_queue_wait_time_histo);
-    histo_reset(&st->cross_zone_queue_wait_time_histo);
-    histo_reset(&st->cross_region_queue_wait_time_histo);
+  st->alloc_msgs = msg_alloc_msgs();
+  st->alloc_mbufs = mbuf_alloc_get_count();
+  getrusage(RUSAGE_SELF, &r_usage);
+  st->dyn_memory = (uint64_t)r_usage.ru_maxrss;
 
-    histo_reset(&st->server_in_queue);
-    histo_reset(&st->server_out_queue);
-    histo_reset(&st->client_out_queue);
-    histo_reset(&st->dnode_client_out_queue);
-    histo_reset(&st->peer_in_queue);
-    histo_reset(&st->peer_out_queue);
-    histo_reset(&st->remote_peer_in_queue);
-    histo_reset(&st->remote_peer_out_queue);
-  }
-  st->aggregate = 0;
+  /* free queues are per thread, the main thread samples its own */
+  st->sample_free_queues = 1;
 }
 
 static rstatus_t stats_make_info_rsp(struct stats *st) {
@@ -772,6 +919,598 @@ static rstatus_t stats_make_info_rsp(struct stats *st) {
   return DN_OK;
 }
 
+static rstatus_t stats_add_top_keys(struct stats *st, const char *name,
+                                     const char *count_name, struct topk *t,
+                                     bool with_error) {
+  struct stats_buffer *buf = &st->top_keys_buf;
+  uint32_t i, j, n = topk_list(t, st->top_keys_list);
+
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "\"%s\":[", name);
+  for (i = 0; i < n; i++) {
+    struct topk_item *item = &st->top_keys_list[i];
+
+    buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                     buf->size - buf->len, "%s{\"key\":\"",
+                                     i == 0 ? "" : ",");
+    for (j = 0; j < MIN(item->keylen, TOPK_KEY_LEN); j++) {
+      uint8_t c = item->key[j];
+      if (c == '"' || c == '\\') {
+        buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                         buf->size - buf->len, "\\%c", c);
+      } else if (c < 0x20 || c >= 0x7f) {
+        buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                         buf->size - buf->len, "\\u%04x", c);
+      } else if (buf->len < buf->size) {
+        buf->data[buf->len++] = c;
+      }
+    }
+    buf->len += (size_t)dn_scnprintf(
+        buf->data + buf->len, buf->size - buf->len,
+        "\",\"keylen\":%" PRIu32 ",\"%s\":%" PRIu64, item->keylen,
+        count_name, item->count);
+    if (with_error) {
+      buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                       buf->size - buf->len,
+                                       ",\"error\":%" PRIu64, item->error);
+    }
+    buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                     buf->size - buf->len, "}");
+  }
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "]");
+  return buf->len < buf->size ? DN_OK : DN_ENOMEM;
+}
+
+/*
+ * hotkeys response: the keys most often seen in the sampled requests, with
+ * their number of samples, and the keys with the largest sampled payloads,
+ * with their size in bytes.
+ */
+static rstatus_t stats_make_top_keys_rsp(struct stats *st) {
+  struct stats_buffer *buf = &st->top_keys_buf;
+  rstatus_t status;
+
+  buf->len = (size_t)dn_scnprintf(buf->data, buf->size,
+                                  "{\"sample_rate\":%" PRIu32 ",",
+                                  st->top_keys_sample_rate);
+  pthread_mutex_lock(&st->top_keys_lock);
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "\"samples\":%" PRIu64 ",",
+                                   st->top_keys_samples);
+  status = stats_add_top_keys(st, "hot_keys", "count", st->hot_keys, true);
+  if (status == DN_OK) {
+    buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                     buf->size - buf->len, ",");
+    status = stats_add_top_keys(st, "big_keys", "bytes", st->big_keys, false);
+  }
+  pthread_mutex_unlock(&st->top_keys_lock);
+  if (status != DN_OK) {
+    return status;
+  }
+
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "}\n");
+  return DN_OK;
+}
+
+static rstatus_t stats_reserve_histo_buf(struct stats *st, size_t size) {
+  struct stats_buffer *buf = &st->histo_buf;
+  uint8_t *data;
+
+  size = DN_ALIGN(size, DN_ALIGNMENT);
+  if (buf->size < size) {
+    data = dn_realloc(buf->data, size);
+    if (data == NULL) {
+      log_error("create histogram buffer of size %zu failed: %s", size,
+                strerror(errno));
+      return DN_ENOMEM;
+    }
+    buf->data = data;
+    buf->size = size;
+  }
+  buf->len = 0;
+  return DN_OK;
+}
+
+/*
+ * histograms response: for every histogram, the values in the window, a few
+ * percentiles, and each bucket that holds any value as [low, high, count].
+ */
+static rstatus_t stats_make_histograms_rsp(struct stats *st) {
+  struct stats_buffer *buf = &st->histo_buf;
+  size_t size = 256;
+  uint32_t i, j;
+
+  for (i = 0; i < NELEMS(stats_histos); i++) {
+    volatile struct histogram *histo = stats_histo(st, i);
+    for (j = 0; j < histo->nbuckets; j++) {
+      size += histo->window[j] != 0 ? 64 : 0;
+    }
+    size += 512;
+  }
+  THROW_STATUS(stats_reserve_histo_buf(st, size));
+
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "{\"precision\":%" PRIu32 ",",
+                                   stats_histo(st, 0)->precision);
+  for (i = 0; i < NELEMS(stats_histos); i++) {
+    volatile struct histogram *histo = stats_histo(st, i);
+    bool first = true;
+
+    buf->len += (size_t)dn_scnprintf(
+        buf->data + buf->len, buf->size - buf->len,
+        "%s\"%s\":{\"count\":%" PRIu64 ",\"mean\":%" PRIu64
+        ",\"max\":%" PRIu64,
+        i == 0 ? "" : ",", stats_histos[i].name, histo->count, histo->mean,
+        histo->val_max);
+    for (j = 0; j < NELEMS(stats_histo_percentiles); j++) {
+      buf->len += (size_t)dn_scnprintf(
+          buf->data + buf->len, buf->size - buf->len, ",\"%s\":%" PRIu64,
+          stats_histo_percentiles[j].name,
+          histo_percentile(histo, stats_histo_percentiles[j].percentile));
+    }
+    buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                     buf->size - buf->len, ",\"buckets\":[");
+    for (j = 0; j < histo->nbuckets; j++) {
+      if (histo->window[j] == 0) {
+        continue;
+      }
+      buf->len += (size_t)dn_scnprintf(
+          buf->data + buf->len, buf->size - buf->len,
+          "%s[%" PRIu64 ",%" PRIu64 ",%" PRIu64 "]", first ? "" : ",",
+          histo_bucket_low(histo->precision, j),
+          histo_bucket_high(histo->precision, j), histo->window[j]);
+      first = false;
+    }
+    buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                     buf->size - buf->len, "]}");
+  }
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "}\n");
+  return buf->len < buf->size - 1 ? DN_OK : DN_ENOMEM;
+}
+
+/* percentile response: the value of every histogram at the percentile */
+static rstatus_t stats_make_percentile_rsp(struct stats *st,
+                                           double percentile) {
+  struct stats_buffer *buf = &st->histo_buf;
+  uint32_t i;
+
+  THROW_STATUS(stats_reserve_histo_buf(st, 64 * NELEMS(stats_histos) + 64));
+
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "{\"percentile\":%g", percentile);
+  for (i = 0; i < NELEMS(stats_histos); i++) {
+    buf->len += (size_t)dn_scnprintf(
+        buf->data + buf->len, buf->size - buf->len, ",\"%s\":%" PRIu64,
+        stats_histos[i].name, histo_percentile(stats_histo(st, i), percentile));
+  }
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "}\n");
+  return buf->len < buf->size - 1 ? DN_OK : DN_ENOMEM;
+}
+
+/*
+ * Append to a metrics buffer, which grows as needed and is kept for the next
+ * scrape, so a scrape formats each value once and allocates nothing once the
+ * buffer has reached its size.
+ */
+static rstatus_t stats_metrics_printf(struct stats_buffer *buf,
+                                      const char *fmt, ...) {
+  va_list args;
+  size_t room;
+  uint8_t *data;
+  int n;
+
+  for (;;) {
+    room = buf->size - buf->len;
+    va_start(args, fmt);
+    n = vsnprintf((char *)buf->data + buf->len, room, fmt, args);
+    va_end(args);
+    if (n < 0) {
+      return DN_ERROR;
+    }
+    if ((size_t)n < room) {
+      buf->len += (size_t)n;
+      return DN_OK;
+    }
+
+    room = DN_ALIGN(MAX(2 * buf->size, buf->len + (size_t)n + 1),
+                    DN_ALIGNMENT);
+    data = dn_realloc(buf->data, room);
+    if (data == NULL) {
+      log_error("grow metrics buffer to %zu failed: %s", room,
+                strerror(errno));
+      return DN_ENOMEM;
+    }
+    buf->data = data;
+    buf->size = room;
+  }
+}
+
+/* Copy a label value into dst, escaped for the text exposition format */
+static void stats_metrics_escape(char *dst, size_t size,
+                                 const struct string *val) {
+  size_t i, len = 0;
+
+  for (i = 0; i < val->len && len + 2 < size; i++) {
+    uint8_t c = val->data[i];
+    if (c == '\\' || c == '"') {
+      dst[len++] = '\\';
+      dst[len++] = (char)c;
+    } else if (c == '\n') {
+      dst[len++] = '\\';
+      dst[len++] = 'n';
+    } else {
+      dst[len++] = (char)c;
+    }
+  }
+  dst[len] = '\0';
+}
+
+static rstatus_t stats_metrics_add_family(struct stats_buffer *buf,
+                                          const char *name, const char *type,
+                                          const char *help) {
+  /* stats descriptions start with "# " */
+  if (help[0] == '#' && help[1] == ' ') {
+    help += 2;
+  }
+  return stats_metrics_printf(buf, "# TYPE dynomite_%s %s\n"
+                              "# HELP dynomite_%s %s\n",
+                              name, type, name, help);
+}
+
+static rstatus_t stats_metrics_add_codec(struct stats_buffer *buf,
+                                         struct array *metric,
+                                         struct stats_desc *desc) {
+  uint32_t i;
+
+  for (i = 0; i < array_n(metric); i++) {
+    struct stats_metric *stm = array_get(metric, i);
+    bool counter = stm->type == STATS_COUNTER;
+
+    THROW_STATUS(stats_metrics_add_family(
+        buf, desc[i].name, counter ? "counter" : "gauge", desc[i].desc));
+    THROW_STATUS(stats_metrics_printf(buf, "dynomite_%s%s %" PRId64 "\n",
+                                      desc[i].name, counter ? "_total" : "",
+                                      stm->value.counter));
+  }
+  return DN_OK;
+}
+
+/*
+ * The buckets of a histogram as they were at the last aggregation, so they
+ * agree with each other and with the counters. They count every value since
+ * the start and so only grow, as the format wants.
+ */
+static rstatus_t stats_metrics_add_histo(struct stats_buffer *buf,
+                                         const char *name, const char *labels,
+                                         volatile struct histogram *histo) {
+  const char *sep = labels[0] != '\0' ? "," : "";
+  const char *open = labels[0] != '\0' ? "{" : "";
+  const char *close = labels[0] != '\0' ? "}" : "";
+  uint64_t *last = histo->last;
+  uint64_t count = 0;
+  uint32_t i;
+
+  for (i = 0; i < histo->nbuckets; i++) {
+    if (last[i] == 0) {
+      continue;
+    }
+    count += last[i];
+    THROW_STATUS(stats_metrics_printf(
+        buf, "dynomite_%s_bucket{%s%sle=\"%" PRIu64 "\"} %" PRIu64 "\n", name,
+        labels, sep, histo_bucket_high(histo->precision, i), count));
+  }
+  return stats_metrics_printf(
+      buf,
+      "dynomite_%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n"
+      "dynomite_%s_count%s%s%s %" PRIu64 "\n"
+      "dynomite_%s_sum%s%s%s %" PRIu64 "\n",
+      name, labels, sep, count, name, open, labels, close, count, name, open,
+      labels, close, histo->last_sum);
+}
+
+/* requests, bytes and latency of each command family that had requests */
+static rstatus_t stats_metrics_add_families(struct stats *st,
+                                            struct stats_buffer *buf) {
+  char labels[64];
+  uint32_t path, family;
+
+  THROW_STATUS(stats_metrics_add_family(
+      buf, "command_requests", "counter",
+      "requests answered, by path and command family"));
+  for (path = 0; path < STATS_NPATH; path++) {
+    for (family = 0; family < STATS_NFAMILY; family++) {
+      if (st->family_requests[path][family] == 0) {
+        continue;
+      }
+      THROW_STATUS(stats_metrics_printf(
+          buf,
+          "dynomite_command_requests_total{path=\"%s\",family=\"%s\"} "
+          "%" PRId64 "\n",
+          stats_path_names[path], stats_family_names[family],
+          st->family_requests[path][family]));
+    }
+  }
+
+  THROW_STATUS(stats_metrics_add_family(
+      buf, "command_bytes", "counter",
+      "bytes of requests and responses, by path and command family"));
+  for (path = 0; path < STATS_NPATH; path++) {
+    for (family = 0; family < STATS_NFAMILY; family++) {
+      if (st->family_requests[path][family] == 0) {
+        continue;
+      }
+      THROW_STATUS(stats_metrics_printf(
+          buf,
+          "dynomite_command_bytes_total{path=\"%s\",family=\"%s\"} "
+          "%" PRId64 "\n",
+          stats_path_names[path], stats_family_names[family],
+          st->family_bytes[path][family]));
+    }
+  }
+
+  THROW_STATUS(stats_metrics_add_family(
+      buf, "command_latency", "histogram",
+      "usec to answer requests, by path and command family"));
+  for (path = 0; path < STATS_NPATH; path++) {
+    for (family = 0; family < STATS_NFAMILY; family++) {
+      if (st->family_requests[path][family] == 0) {
+        continue;
+      }
+      dn_snprintf(labels, sizeof(labels), "path=\"%s\",family=\"%s\"",
+                  stats_path_names[path], stats_family_names[family]);
+      THROW_STATUS(stats_metrics_add_histo(buf, "command_latency", labels,
+                                           &st->family_latency[path][family]));
+    }
+  }
+  return DN_OK;
+}
+
+/*
+ * commands response: for each path and command family that had requests,
+ * the requests and bytes since the start and the latency in the window of
+ * the histograms.
+ */
+static rstatus_t stats_make_commands_rsp(struct stats *st) {
+  struct stats_buffer *buf = &st->histo_buf;
+  uint32_t path, family;
+
+  THROW_STATUS(
+      stats_reserve_histo_buf(st, STATS_NPATH * (STATS_NFAMILY * 256 + 64) + 64));
+
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "{");
+  for (path = 0; path < STATS_NPATH; path++) {
+    bool first = true;
+
+    buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                     buf->size - buf->len, "%s\"%s\":{",
+                                     path == 0 ? "" : ",",
+                                     stats_path_names[path]);
+    for (family = 0; family < STATS_NFAMILY; family++) {
+      volatile struct histogram *histo = &st->family_latency[path][family];
+      if (st->family_requests[path][family] == 0) {
+        continue;
+      }
+      buf->len += (size_t)dn_scnprintf(
+          buf->data + buf->len, buf->size - buf->len,
+          "%s\"%s\":{\"requests\":%" PRId64 ",\"bytes\":%" PRId64
+          ",\"mean\":%" PRIu64 ",\"p50\":%" PRIu64 ",\"p99\":%" PRIu64
+          ",\"p99.9\":%" PRIu64 ",\"max\":%" PRIu64 "}",
+          first ? "" : ",", stats_family_names[family],
+          st->family_requests[path][family], st->family_bytes[path][family],
+          histo->mean, histo_percentile(histo, 50.0), histo->val_99th,
+          histo->val_999th, histo->val_max);
+      first = false;
+    }
+    buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                     buf->size - buf->len, "}");
+  }
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "}\n");
+  return buf->len < buf->size - 1 ? DN_OK : DN_ENOMEM;
+}
+
+/*
+ * traces response: the spans in the trace ring, oldest first. Spans with the
+ * same id belong to the same request, here and on the other nodes it went to.
+ */
+static rstatus_t stats_make_traces_rsp(struct stats *st) {
+  struct stats_buffer *buf = &st->histo_buf;
+  struct server_pool *sp = &st->ctx->pool;
+  uint32_t i, hop, nspans;
+
+  if (st->trace_spans == NULL) {
+    st->trace_spans = dn_alloc(sizeof(*st->trace_spans) * TRACE_RING_SIZE);
+    if (st->trace_spans == NULL) {
+      return DN_ENOMEM;
+    }
+  }
+  nspans = trace_collect(st->trace_spans);
+
+  THROW_STATUS(stats_reserve_histo_buf(
+      st, nspans * (TRACE_NHOP * 40 + TRACE_TARGET_LEN + 128) + sp->dc.len +
+              sp->rack.len + 128));
+
+  buf->len += (size_t)dn_scnprintf(
+      buf->data + buf->len, buf->size - buf->len,
+      "{\"dc\":\"%.*s\",\"rack\":\"%.*s\",\"sample_rate\":%" PRIu32
+      ",\"spans\":[",
+      sp->dc.len, sp->dc.data, sp->rack.len, sp->rack.data,
+      sp->trace_sample_rate);
+  for (i = 0; i < nspans; i++) {
+    struct trace_span *span = &st->trace_spans[i];
+    struct string *type = msg_type_string((msg_type_t)span->type);
+    bool first = true;
+
+    buf->len += (size_t)dn_scnprintf(
+        buf->data + buf->len, buf->size - buf->len,
+        "%s{\"id\":\"%016" PRIx64 "\",\"kind\":\"%s\",\"type\":\"%.*s\","
+        "\"target\":\"%s\",\"hops\":{",
+        i == 0 ? "" : ",", span->id, trace_kind_name(span->kind), type->len,
+        type->data, span->target);
+    for (hop = 0; hop < TRACE_NHOP; hop++) {
+      if (span->hops[hop] == 0) {
+        continue;
+      }
+      buf->len += (size_t)dn_scnprintf(
+          buf->data + buf->len, buf->size - buf->len, "%s\"%s\":%" PRIu64,
+          first ? "" : ",", trace_hop_name(hop), span->hops[hop]);
+      first = false;
+    }
+    buf->len += (size_t)dn_scnprintf(buf->data + buf->len,
+                                     buf->size - buf->len, "}}");
+  }
+  buf->len += (size_t)dn_scnprintf(buf->data + buf->len, buf->size - buf->len,
+                                   "]}\n");
+  return buf->len < buf->size - 1 ? DN_OK : DN_ENOMEM;
+}
+
+/* one series per peer, labelled with its dc, rack and host:port */
+static rstatus_t stats_metrics_add_peers(struct stats *st,
+                                         struct stats_buffer *buf) {
+  struct server_pool *sp = &st->ctx->pool;
+  char dc[128], rack[128], name[256];
+  uint32_t i, npeers = array_n(&sp->peers);
+
+  THROW_STATUS(stats_metrics_add_family(
+      buf, "peer_up", "gauge", "whether a peer is in the normal state"));
+  for (i = 0; i < npeers; i++) {
+    struct node *peer = *(struct node **)array_get(&sp->peers, i);
+    if (peer->is_local) {
+      continue;
+    }
+    stats_metrics_escape(dc, sizeof(dc), &peer->dc);
+    stats_metrics_escape(rack, sizeof(rack), &peer->rack);
+    stats_metrics_escape(name, sizeof(name), &peer->name);
+    THROW_STATUS(stats_metrics_printf(
+        buf, "dynomite_peer_up{dc=\"%s\",rack=\"%s\",peer=\"%s:%" PRIu16
+              "\"} %d\n",
+        dc, rack, name, peer->endpoint.port, peer->state == NORMAL ? 1 : 0));
+  }
+
+  THROW_STATUS(stats_metrics_add_family(
+      buf, "peer_failures", "gauge", "consecutive failures to reach a peer"));
+  for (i = 0; i < npeers; i++) {
+    struct node *peer = *(struct node **)array_get(&sp->peers, i);
+    if (peer->is_local) {
+      continue;
+    }
+    stats_metrics_escape(dc, sizeof(dc), &peer->dc);
+    stats_metrics_escape(rack, sizeof(rack), &peer->rack);
+    stats_metrics_escape(name, sizeof(name), &peer->name);
+    THROW_STATUS(stats_metrics_printf(
+        buf,
+        "dynomite_peer_failures{dc=\"%s\",rack=\"%s\",peer=\"%s:%" PRIu16
+        "\"} %" PRIu32 "\n",
+        dc, rack, name, peer->endpoint.port, peer->failure_count));
+  }
+
+  THROW_STATUS(stats_metrics_add_family(
+      buf, "peer_concurrency_limit", "gauge",
+      "requests a peer may have in flight, 0 when they are not limited"));
+  for (i = 0; i < npeers; i++) {
+    struct node *peer = *(struct node **)array_get(&sp->peers, i);
+    if (peer->is_local) {
+      continue;
+    }
+    stats_metrics_escape(dc, sizeof(dc), &peer->dc);
+    stats_metrics_escape(rack, sizeof(rack), &peer->rack);
+    stats_metrics_escape(name, sizeof(name), &peer->name);
+    THROW_STATUS(stats_metrics_printf(
+        buf,
+        "dynomite_peer_concurrency_limit{dc=\"%s\",rack=\"%s\","
+        "peer=\"%s:%" PRIu16 "\"} %" PRIu32 "\n",
+        dc, rack, name, peer->endpoint.port,
+        sp->peer_concurrency_max == 0 || peer->is_same_dc
+            ? 0
+            : MIN(peer->limit.limit, sp->peer_concurrency_max)));
+  }
+
+  THROW_STATUS(stats_metrics_add_family(
+      buf, "peer_in_flight", "gauge", "requests in flight to a peer"));
+  for (i = 0; i < npeers; i++) {
+    struct node *peer = *(struct node **)array_get(&sp->peers, i);
+    if (peer->is_local) {
+      continue;
+    }
+    stats_metrics_escape(dc, sizeof(dc), &peer->dc);
+    stats_metrics_escape(rack, sizeof(rack), &peer->rack);
+    stats_metrics_escape(name, sizeof(name), &peer->name);
+    THROW_STATUS(stats_metrics_printf(
+        buf,
+        "dynomite_peer_in_flight{dc=\"%s\",rack=\"%s\",peer=\"%s:%" PRIu16
+        "\"} %" PRIu32 "\n",
+        dc, rack, name, peer->endpoint.port, peer->limit.inflight));
+  }
+  return DN_OK;
+}
+
+/*
+ * metrics response: the stats of the last aggregation in the OpenMetrics text
+ * format, which Prometheus scrapes.
+ */
+static rstatus_t stats_make_metrics_rsp(struct stats *st) {
+  struct stats_buffer *buf = &st->metrics_buf;
+  char dc[128], rack[128];
+  uint32_t i;
+
+  buf->len = 0;
+
+  stats_metrics_escape(dc, sizeof(dc), &st->dc);
+  stats_metrics_escape(rack, sizeof(rack), &st->rack);
+  THROW_STATUS(stats_metrics_add_family(buf, "build", "info",
+                                        "version and place of this node"));
+  THROW_STATUS(stats_metrics_printf(
+      buf, "dynomite_build_info{version=\"%.*s\",dc=\"%s\",rack=\"%s\"} 1\n",
+      st->version.len, st->version.data, dc, rack));
+  THROW_STATUS(stats_metrics_add_family(buf, "uptime_seconds", "gauge",
+                                        "seconds since the start"));
+  THROW_STATUS(stats_metrics_printf(buf, "dynomite_uptime_seconds %" PRId64
+                                    "\n", (int64_t)time(NULL) - st->start_ts));
+
+  THROW_STATUS(stats_metrics_add_codec(buf, &st->sum.metric, stats_pool_desc));
+  THROW_STATUS(
+      stats_metrics_add_codec(buf, &st->sum.server.metric, stats_server_desc));
+
+  THROW_STATUS(stats_metrics_add_family(buf, "alloc_msgs", "gauge",
+                                        "messages allocated"));
+  THROW_STATUS(stats_metrics_printf(buf, "dynomite_alloc_msgs %zu\n",
+                                    st->alloc_msgs));
+  THROW_STATUS(stats_metrics_add_family(buf, "free_msgs", "gauge",
+                                        "messages free for reuse"));
+  THROW_STATUS(stats_metrics_printf(buf, "dynomite_free_msgs %zu\n",
+                                    st->free_msgs));
+  THROW_STATUS(stats_metrics_add_family(buf, "alloc_mbufs", "gauge",
+                                        "mbufs allocated"));
+  THROW_STATUS(stats_metrics_printf(buf, "dynomite_alloc_mbufs %" PRIu64 "\n",
+                                    st->alloc_mbufs));
+  THROW_STATUS(stats_metrics_add_family(buf, "free_mbufs", "gauge",
+                                        "mbufs free for reuse"));
+  THROW_STATUS(stats_metrics_printf(buf, "dynomite_free_mbufs %" PRIu64 "\n",
+                                    st->free_mbufs));
+  THROW_STATUS(stats_metrics_add_family(buf, "max_rss_kilobytes", "gauge",
+                                        "largest resident set size"));
+  THROW_STATUS(stats_metrics_printf(
+      buf, "dynomite_max_rss_kilobytes %" PRIu64 "\n", st->dyn_memory));
+
+  for (i = 0; i < NELEMS(stats_histos); i++) {
+    THROW_STATUS(stats_metrics_add_family(buf, stats_histos[i].name,
+                                          "histogram", stats_histos[i].desc));
+    THROW_STATUS(
+        stats_metrics_add_histo(buf, stats_histos[i].name, "", stats_histo(st, i)));
+  }
+
+  THROW_STATUS(stats_metrics_add_families(st, buf));
+
+  THROW_STATUS(stats_metrics_add_peers(st, buf));
+
+  return stats_metrics_printf(buf, "# EOF\n");
+}
+
 static rstatus_t get_host_from_pname(struct string *host,
                                      struct string *pname) {
   uint8_t *found = dn_strchr(pname->data, &pname->data[pname->len], ':');
@@ -989,6 +1728,35 @@ static void parse_request(int sd, struct stats_cmd *st_cmd) {
         } else if (strcmp(reqline[1], "/historeset") == 0) {
           st_cmd->cmd = CMD_HISTO_RESET;
           return;
+        } else if (strcmp(reqline[1], "/commands") == 0) {
+          st_cmd->cmd = CMD_COMMANDS;
+          return;
+        } else if (strcmp(reqline[1], "/traces") == 0) {
+          st_cmd->cmd = CMD_TRACES;
+          return;
+        } else if (strcmp(reqline[1], "/metrics") == 0) {
+          st_cmd->cmd = CMD_METRICS;
+          return;
+        } else if (strcmp(reqline[1], "/histograms") == 0) {
+          st_cmd->cmd = CMD_HISTOGRAMS;
+          return;
+        } else if (strncmp(reqline[1], "/percentile/",
+                           dn_strlen("/percentile/")) == 0) {
+          char *val = reqline[1] + dn_strlen("/percentile/");
+          if (*val == '\0') {
+            st_cmd->cmd = CMD_UNKNOWN;
+            return;
+          }
+          st_cmd->cmd = CMD_PERCENTILE;
+          string_init(&st_cmd->req_data);
+          string_copy_c(&st_cmd->req_data, val);
+          return;
+        } else if (strcmp(reqline[1], "/hotkeys") == 0) {
+          st_cmd->cmd = CMD_HOT_KEYS;
+          return;
+        } else if (strcmp(reqline[1], "/hotkeys/reset") == 0) {
+          st_cmd->cmd = CMD_HOT_KEYS_RESET;
+          return;
         } else if (strcmp(reqline[1], "/cluster_describe") == 0) {
           st_cmd->cmd = CMD_CL_DESCRIBE;
           return;
@@ -1107,12 +1875,13 @@ static void parse_request(int sd, struct stats_cmd *st_cmd) {
   }
 }
 
-static rstatus_t stats_http_rsp(int sd, uint8_t *content, size_t len) {
+static rstatus_t stats_http_send(int sd, struct string *header,
+                                 uint8_t *content, size_t len) {
   ssize_t n;
   uint8_t http_header[MAX_HTTP_HEADER_SIZE];
   memset((void *)http_header, (int)'\0', MAX_HTTP_HEADER_SIZE);
   n = dn_snprintf(http_header, MAX_HTTP_HEADER_SIZE, "%.*s %lu \r\n\r\n",
-                  header_str.len, header_str.data, len);
+                  header->len, header->data, len);
 
   if (n < 0 || n >= MAX_HTTP_HEADER_SIZE) {
     return DN_ERROR;
@@ -1138,6 +1907,10 @@ static rstatus_t stats_http_rsp(int sd, uint8_t *content, size_t len) {
   return DN_OK;
 }
 
+static rstatus_t stats_http_rsp(int sd, uint8_t *content, size_t len) {
+  return stats_http_send(sd, &header_str, content, len);
+}
+
 static rstatus_t stats_send_rsp(struct stats *st) {
   int sd;
 
@@ -1166,9 +1939,11 @@ static rstatus_t stats_send_rsp(struct stats *st) {
     dn_sprintf(rsp,
                "/info\n/help\n/ping\n/cluster_describe\n"
                "/setloglevel/<0-11>\n/loglevelup\n/logleveldown\n/historeset\n"
+               "/histograms\n/percentile/<0-100>\n/commands\n/metrics\n/traces\n"
                "/get_consistency\n/set_consistency/<read|write>/"
                "<dc_one|dc_quorum|dc_safe_quorum>\n"
-               "/get_timeout_factor\n/set_timeout_factor/<1-10>\n/peer/"
+               "/get_timeout_factor\n/set_timeout_factor/<1-10>\n"
+               "/hotkeys\n/hotkeys/reset\n/peer/"
                "<up|down|reset>\n"
                "/state/<get_state|standby|writes_only|normal|%s>\n\n",
                "resuming");
@@ -1176,6 +1951,23 @@ static rstatus_t stats_send_rsp(struct stats *st) {
   } else if (cmd == CMD_NORMAL) {
     core_set_local_state(st->ctx, NORMAL);
     return stats_http_rsp(sd, ok.data, ok.len);
+  } else if (cmd == CMD_HOT_KEYS) {
+    if (st->hot_keys == NULL) {
+      char rsp[] = "hotkeys are off, set top_keys to turn them on\n";
+      return stats_http_rsp(sd, rsp, dn_strlen(rsp));
+    }
+    if (stats_make_top_keys_rsp(st) != DN_OK)
+      return stats_http_rsp(sd, err_resp.data, err_resp.len);
+    return stats_http_rsp(sd, st->top_keys_buf.data, st->top_keys_buf.len);
+  } else if (cmd == CMD_HOT_KEYS_RESET) {
+    if (st->hot_keys != NULL) {
+      pthread_mutex_lock(&st->top_keys_lock);
+      topk_reset(st->hot_keys);
+      topk_reset(st->big_keys);
+      st->top_keys_samples = 0;
+      pthread_mutex_unlock(&st->top_keys_lock);
+    }
+    return stats_http_rsp(sd, ok.data, ok.len);
   } else if (cmd == CMD_CL_DESCRIBE) {
     if (stats_make_cl_desc_rsp(st) != DN_OK)
       return stats_http_rsp(sd, err_resp.data, err_resp.len);
@@ -1209,8 +2001,34 @@ static rstatus_t stats_send_rsp(struct stats *st) {
     return stats_http_rsp(sd, ok.data, ok.len);
   } else if (cmd == CMD_HISTO_RESET) {
     st->reset_histogram = 1;
-    st->updated = 1;
     return stats_http_rsp(sd, ok.data, ok.len);
+  } else if (cmd == CMD_COMMANDS) {
+    if (stats_make_commands_rsp(st) != DN_OK)
+      return stats_http_rsp(sd, err_resp.data, err_resp.len);
+    return stats_http_rsp(sd, st->histo_buf.data, st->histo_buf.len);
+  } else if (cmd == CMD_TRACES) {
+    if (stats_make_traces_rsp(st) != DN_OK)
+      return stats_http_rsp(sd, err_resp.data, err_resp.len);
+    return stats_http_rsp(sd, st->histo_buf.data, st->histo_buf.len);
+  } else if (cmd == CMD_METRICS) {
+    if (stats_make_metrics_rsp(st) != DN_OK)
+      return stats_http_rsp(sd, err_resp.data, err_resp.len);
+    return stats_http_send(sd, &metrics_header_str, st->metrics_buf.data,
+                           st->metrics_buf.len);
+  } else if (cmd == CMD_HISTOGRAMS) {
+    if (stats_make_histograms_rsp(st) != DN_OK)
+      return stats_http_rsp(sd, err_resp.data, err_resp.len);
+    return stats_http_rsp(sd, st->histo_buf.data, st->histo_buf.len);
+  } else if (cmd == CMD_PERCENTILE) {
+    rstatus_t status = DN_ERROR;
+    char *end = NULL;
+    double percentile = strtod((char *)st_cmd.req_data.data, &end);
+    if (*end == '\0' && percentile >= 0.0 && percentile <= 100.0)
+      status = stats_make_percentile_rsp(st, percentile);
+    string_deinit(&st_cmd.req_data);
+    if (status != DN_OK)
+      return stats_http_rsp(sd, err_resp.data, err_resp.len);
+    return stats_http_rsp(sd, st->histo_buf.data, st->histo_buf.len);
   } else if (cmd == CMD_GET_CONSISTENCY) {
     char cons_rsp[1024];
     dn_sprintf(cons_rsp, "Read Consistency: %s\r\nWrite Consistency: %s\r\n",
@@ -1289,14 +2107,14 @@ static void stats_loop_callback(void *arg1, void *arg2) {
   struct stats *st = arg1;
   int n = *((int *)arg2);
 
-  /* aggregate stats from shadow (b) -> sum (c) */
+  /* aggregate the counters of every thread to sum */
   stats_aggregate(st);
 
   if (n == 0) {
     return;
   }
 
-  /* send aggregate stats sum (c) to collector */
+  /* send aggregate stats sum to collector */
   stats_send_rsp(st);
 }
 
@@ -1370,16 +2188,45 @@ static void stats_stop_aggregator(struct stats *st) {
   close(st->sd);
 }
 
+/* Set up the histogram recorders of one thread's counters */
+static rstatus_t stats_counters_init(struct stats_counters *counters,
+                                     uint32_t precision) {
+  uint32_t i;
+
+  for (i = 0; i < STATS_NHISTO; i++) {
+    THROW_STATUS(histo_recorder_init(&counters->histo[i], precision));
+  }
+  for (i = 0; i < STATS_NPATH * STATS_NFAMILY; i++) {
+    THROW_STATUS(histo_recorder_init(
+        &counters->family_latency[i / STATS_NFAMILY][i % STATS_NFAMILY],
+        precision));
+  }
+  return DN_OK;
+}
+
+static void stats_counters_deinit(struct stats_counters *counters) {
+  uint32_t i;
+
+  for (i = 0; i < STATS_NHISTO; i++) {
+    histo_recorder_deinit(&counters->histo[i]);
+  }
+  for (i = 0; i < STATS_NPATH * STATS_NFAMILY; i++) {
+    histo_recorder_deinit(
+        &counters->family_latency[i / STATS_NFAMILY][i % STATS_NFAMILY]);
+  }
+}
+
 struct stats *stats_create(uint16_t stats_port, struct string pname,
                            msec_t stats_interval, char *source,
                            struct server_pool *sp, struct context *ctx) {
   rstatus_t status;
   struct stats *st;
+  uint32_t i, t;
 
   struct string stats_ip;
   get_host_from_pname(&stats_ip, &pname);
 
-  st = dn_alloc(sizeof(*st));
+  st = dn_zalloc(sizeof(*st));
   if (st == NULL) {
     return NULL;
   }
@@ -1399,6 +2246,19 @@ struct stats *stats_create(uint16_t stats_port, struct string pname,
 
   st->tid = (pthread_t)-1;
   st->sd = -1;
+  st->counters = NULL;
+  st->ncounters = 0;
+
+  pthread_mutex_init(&st->top_keys_lock, NULL);
+  st->top_keys_buf.len = 0;
+  st->top_keys_buf.data = NULL;
+  st->top_keys_buf.size = 0;
+  st->hot_keys = NULL;
+  st->big_keys = NULL;
+  st->top_keys_list = NULL;
+  st->top_keys = sp->top_keys;
+  st->top_keys_sample_rate = sp->top_keys_sample_rate;
+  st->top_keys_samples = 0;
 
   string_set_text(&st->service_str, "service");
   string_set_text(&st->service, "dynomite");
@@ -1452,53 +2312,60 @@ struct stats *stats_create(uint16_t stats_port, struct string pname,
   string_set_text(&st->dc_str, "dc");
   string_copy(&st->dc, sp->dc.data, sp->dc.len);
 
-  st->updated = 0;
-  st->aggregate = 0;
-
-  histo_init(&st->latency_histo);
-  histo_init(&st->payload_size_histo);
-
-  histo_init(&st->server_latency_histo);
-  histo_init(&st->cross_zone_latency_histo);
-  histo_init(&st->cross_region_latency_histo);
+  st->sample_free_queues = 0;
 
-  histo_init(&st->server_queue_wait_time_histo);
-  histo_init(&st->cross_zone_queue_wait_time_histo);
-  histo_init(&st->cross_region_queue_wait_time_histo);
-
-  histo_init(&st->client_out_queue);
-  histo_init(&st->server_in_queue);
-  histo_init(&st->server_out_queue);
-  histo_init(&st->dnode_client_out_queue);
-  histo_init(&st->peer_in_queue);
-  histo_init(&st->peer_out_queue);
-  histo_init(&st->remote_peer_in_queue);
-  histo_init(&st->remote_peer_out_queue);
+  for (i = 0; i < NELEMS(stats_histos); i++) {
+    status = histo_init(stats_histo(st, i), sp->histogram_precision);
+    if (status != DN_OK) {
+      goto error;
+    }
+  }
+  for (i = 0; i < STATS_NPATH * STATS_NFAMILY; i++) {
+    status = histo_init(stats_family_histo(st, i), sp->histogram_precision);
+    if (status != DN_OK) {
+      goto error;
+    }
+  }
+  stats_families_init();
   st->reset_histogram = 0;
+  st->histo_buf.len = 0;
+  st->histo_buf.data = NULL;
+  st->histo_buf.size = 0;
+  st->metrics_buf.len = 0;
+  st->metrics_buf.data = NULL;
+  st->metrics_buf.size = 0;
   st->alloc_msgs = 0;
   st->free_msgs = 0;
   st->alloc_mbufs = 0;
   st->free_mbufs = 0;
   st->dyn_memory = 0;
 
-  /* map server pool to current (a), shadow (b) and sum (c) */
-
-  status = stats_pool_init(&st->current, sp);
-  if (status != DN_OK) {
+  /* one block of counters for each event loop thread, see worker_start() */
+  st->ncounters = (uint32_t)MAX(ctx->cf->pool.worker_threads, 1);
+  if (posix_memalign((void **)&st->counters, STATS_CACHE_LINE_SIZE,
+                     sizeof(*st->counters) * st->ncounters) != 0) {
+    st->counters = NULL;
     goto error;
   }
+  memset(st->counters, 0, sizeof(*st->counters) * st->ncounters);
+  for (t = 0; t < st->ncounters; t++) {
+    status = stats_counters_init(&st->counters[t], sp->histogram_precision);
+    if (status != DN_OK) {
+      goto error;
+    }
+  }
 
-  status = stats_pool_init(&st->shadow, sp);
+  status = stats_pool_init(&st->sum, sp);
   if (status != DN_OK) {
     goto error;
   }
 
-  status = stats_pool_init(&st->sum, sp);
+  status = stats_create_bufs(st);
   if (status != DN_OK) {
     goto error;
   }
 
-  status = stats_create_bufs(st);
+  status = stats_top_keys_init(st);
   if (status != DN_OK) {
     goto error;
   }
@@ -1517,268 +2384,310 @@ error:
 }
 
 void stats_destroy(struct stats *st) {
+  uint32_t i;
+
   stats_stop_aggregator(st);
   stats_pool_unmap(&st->sum);
-  stats_pool_unmap(&st->shadow);
-  stats_pool_unmap(&st->current);
+  if (st->counters != NULL) {
+    for (i = 0; i < st->ncounters; i++) {
+      stats_counters_deinit(&st->counters[i]);
+    }
+    dn_free(st->counters);
+  }
   stats_destroy_buf(&st->buf);
   stats_destroy_buf(&st->clus_desc_buf);
+  stats_destroy_buf(&st->top_keys_buf);
+  stats_destroy_buf(&st->histo_buf);
+  stats_destroy_buf(&st->metrics_buf);
+  if (st->trace_spans != NULL) {
+    dn_free(st->trace_spans);
+  }
+  for (i = 0; i < NELEMS(stats_histos); i++) {
+    histo_deinit(stats_histo(st, i));
+  }
+  for (i = 0; i < STATS_NPATH * STATS_NFAMILY; i++) {
+    histo_deinit(stats_family_histo(st, i));
+  }
+  topk_destroy(st->hot_keys);
+  topk_destroy(st->big_keys);
+  if (st->top_keys_list != NULL) {
+    dn_free(st->top_keys_list);
+  }
+  pthread_mutex_destroy(&st->top_keys_lock);
   dn_free(st);
 }
 
-void stats_swap(struct stats *st) {
-  struct rusage r_usage;
-  if (!stats_enabled) {
-    return;
-  }
-
-  if (st->aggregate == 1) {
-    log_debug(LOG_PVERB,
-              "skip swap of current %p shadow %p as aggregator "
-              "is busy",
-              &st->current, &st->shadow);
-    return;
-  }
+struct stats_counters *stats_thread_counters(struct stats *st,
+                                             uint32_t worker_id) {
+  ASSERT(worker_id < st->ncounters);
+  return &st->counters[worker_id];
+}
 
-  if (st->updated == 0) {
-    log_debug(LOG_PVERB,
-              "skip swap of current %p shadow %p as there is "
-              "nothing new",
-              &st->current, &st->shadow);
+/*
+ * Called by the main event loop. The free msg and mbuf queues belong to the
+ * thread that uses them, so the main thread samples its own whenever the
+ * stats thread has aggregated.
+ */
+void stats_sample_free_queues(struct stats *st) {
+  if (!stats_enabled || !st->sample_free_queues) {
     return;
   }
 
-  log_debug(LOG_PVERB, "swap stats current %p shadow %p", &st->current,
-            &st->shadow);
-
-  // set the latencies
-  histo_compute(&st->latency_histo);
-
-  histo_compute(&st->payload_size_histo);
-
-  histo_compute(&st->server_latency_histo);
-  histo_compute(&st->cross_zone_latency_histo);
-  histo_compute(&st->cross_region_latency_histo);
-
-  histo_compute(&st->server_queue_wait_time_histo);
-  histo_compute(&st->cross_zone_queue_wait_time_histo);
-  histo_compute(&st->cross_region_queue_wait_time_histo);
-
-  histo_compute(&st->client_out_queue);
-  histo_compute(&st->server_in_queue);
-  histo_compute(&st->server_out_queue);
-  histo_compute(&st->dnode_client_out_queue);
-  histo_compute(&st->peer_in_queue);
-  histo_compute(&st->peer_out_queue);
-  histo_compute(&st->remote_peer_in_queue);
-  histo_compute(&st->remote_peer_out_queue);
-
-  st->alloc_msgs = msg_alloc_msgs();
   st->free_msgs = msg_free_queue_size();
-  st->alloc_mbufs = mbuf_alloc_get_count();
   st->free_mbufs = mbuf_free_queue_size();
+  st->sample_free_queues = 0;
+}
 
-  getrusage(RUSAGE_SELF, &r_usage);
-  st->dyn_memory = r_usage.ru_maxrss;
-
-  // swap current and shadow
-  struct stats_pool temp = st->current;
-  st->current = st->shadow;
-  st->shadow = temp;
-
-  /*
-   * Reset current (a) stats before giving it back to generator to keep
-   * stats addition idempotent
-   */
-  stats_pool_reset(&st->current);
-  st->updated = 0;
+/* Only the owning thread writes a counter, so a plain add is enough */
+static inline void stats_counter_add(int64_t *counter, int64_t val) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + val,
+                   __ATOMIC_RELAXED);
+}
 
-  st->aggregate = 1;
+static inline void stats_counter_set(int64_t *counter, int64_t val) {
+  __atomic_store_n(counter, val, __ATOMIC_RELAXED);
 }
 
 uint64_t _stats_pool_get_ts(struct context *ctx, stats_pool_field_t fidx) {
-  struct stats *st = ctx->stats;
-  struct stats_pool *stp = &st->current;
-  struct stats_metric *stm = array_get(&stp->metric, fidx);
-  return stm->value.counter;
+  return (uint64_t)ctx->stats_counters->pool[fidx];
 }
 
 int64_t _stats_pool_get_val(struct context *ctx, stats_pool_field_t fidx) {
-  struct stats *st = ctx->stats;
-  struct stats_pool *stp = &st->current;
-  struct stats_metric *stm = array_get(&stp->metric, fidx);
-  return stm->value.counter;
+  return ctx->stats_counters->pool[fidx];
 }
 
-static struct stats_metric *stats_pool_to_metric(struct context *ctx,
-                                                 stats_pool_field_t fidx) {
-  struct stats *st = ctx->stats;
-  struct stats_pool *stp = &st->current;
-  struct stats_metric *stm = array_get(&stp->metric, fidx);
-  st->updated = 1;
-  return stm;
+static int64_t *stats_pool_to_counter(struct context *ctx,
+                                      stats_pool_field_t fidx) {
+  ASSERT(ctx->stats_counters != NULL);
+  return &ctx->stats_counters->pool[fidx];
 }
 
 void _stats_pool_incr(struct context *ctx, stats_pool_field_t fidx) {
-  struct stats_metric *stm = stats_pool_to_metric(ctx, fidx);
+  int64_t *counter = stats_pool_to_counter(ctx, fidx);
 
-  ASSERT(stm->type == STATS_COUNTER || stm->type == STATS_GAUGE);
-  stm->value.counter++;
+  ASSERT(stats_pool_codec[fidx].type == STATS_COUNTER ||
+         stats_pool_codec[fidx].type == STATS_GAUGE);
+  stats_counter_add(counter, 1);
 
-  log_debug(LOG_VVVERB, "incr field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.counter);
+  log_debug(LOG_VVVERB, "incr field '%.*s' to %" PRId64 "",
+            stats_pool_codec[fidx].name.len, stats_pool_codec[fidx].name.data,
+            *counter);
 }
 
 void _stats_pool_decr(struct context *ctx, stats_pool_field_t fidx) {
-  struct stats_metric *stm = stats_pool_to_metric(ctx, fidx);
+  int64_t *counter = stats_pool_to_counter(ctx, fidx);
 
-  ASSERT(stm->type == STATS_GAUGE);
-  stm->value.counter--;
+  ASSERT(stats_pool_codec[fidx].type == STATS_GAUGE);
+  stats_counter_add(counter, -1);
 
-  log_debug(LOG_VVVERB, "decr field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.counter);
+  log_debug(LOG_VVVERB, "decr field '%.*s' to %" PRId64 "",
+            stats_pool_codec[fidx].name.len, stats_pool_codec[fidx].name.data,
+            *counter);
 }
 
 void _stats_pool_incr_by(struct context *ctx, stats_pool_field_t fidx,
                          int64_t val) {
-  struct stats_metric *stm = stats_pool_to_metric(ctx, fidx);
+  int64_t *counter = stats_pool_to_counter(ctx, fidx);
 
-  ASSERT(stm->type == STATS_COUNTER || stm->type == STATS_GAUGE);
-  stm->value.counter += val;
+  ASSERT(stats_pool_codec[fidx].type == STATS_COUNTER ||
+         stats_pool_codec[fidx].type == STATS_GAUGE);
+  stats_counter_add(counter, val);
 
-  log_debug(LOG_VVVERB, "incr by field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.counter);
+  log_debug(LOG_VVVERB, "incr by field '%.*s' to %" PRId64 "",
+            stats_pool_codec[fidx].name.len, stats_pool_codec[fidx].name.data,
+            *counter);
 }
 
 void _stats_pool_decr_by(struct context *ctx, stats_pool_field_t fidx,
                          int64_t val) {
-  struct stats_metric *stm = stats_pool_to_metric(ctx, fidx);
+  int64_t *counter = stats_pool_to_counter(ctx, fidx);
 
-  ASSERT(stm->type == STATS_GAUGE);
-  stm->value.counter -= val;
+  ASSERT(stats_pool_codec[fidx].type == STATS_GAUGE);
+  stats_counter_add(counter, -val);
 
-  log_debug(LOG_VVVERB, "decr by field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.counter);
+  log_debug(LOG_VVVERB, "decr by field '%.*s' to %" PRId64 "",
+            stats_pool_codec[fidx].name.len, stats_pool_codec[fidx].name.data,
+            *counter);
 }
 
 void _stats_pool_set_ts(struct context *ctx, stats_pool_field_t fidx,
                         int64_t val) {
-  struct stats_metric *stm = stats_pool_to_metric(ctx, fidx);
+  int64_t *counter = stats_pool_to_counter(ctx, fidx);
 
-  ASSERT(stm->type == STATS_TIMESTAMP);
-  stm->value.timestamp = val;
+  ASSERT(stats_pool_codec[fidx].type == STATS_TIMESTAMP);
+  stats_counter_set(counter, val);
 
-  log_debug(LOG_VVVERB, "set ts field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.timestamp);
+  log_debug(LOG_VVVERB, "set ts field '%.*s' to %" PRId64 "",
+            stats_pool_codec[fidx].name.len, stats_pool_codec[fidx].name.data,
+            val);
 }
 
 uint64_t _stats_server_get_ts(struct context *ctx, stats_server_field_t fidx) {
-  struct stats *st = ctx->stats;
-  struct stats_pool *stp = &st->current;
-  struct stats_server *sts = &stp->server;
-  struct stats_metric *stm = array_get(&sts->metric, fidx);
-
-  return stm->value.timestamp;
+  return (uint64_t)ctx->stats_counters->server[fidx];
 }
 
 void _stats_pool_set_val(struct context *ctx, stats_pool_field_t fidx,
                          int64_t val) {
-  struct stats_metric *stm = stats_pool_to_metric(ctx, fidx);
+  int64_t *counter = stats_pool_to_counter(ctx, fidx);
 
-  stm->value.counter = val;
+  stats_counter_set(counter, val);
 
-  log_debug(LOG_VVVERB, "set val field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.counter);
+  log_debug(LOG_VVVERB, "set val field '%.*s' to %" PRId64 "",
+            stats_pool_codec[fidx].name.len, stats_pool_codec[fidx].name.data,
+            val);
 }
 
 int64_t _stats_server_get_val(struct context *ctx, stats_server_field_t fidx) {
-  struct stats *st = ctx->stats;
-  struct stats_pool *stp = &st->current;
-  struct stats_server *sts = &stp->server;
-  struct stats_metric *stm = array_get(&sts->metric, fidx);
-
-  return stm->value.counter;
+  return ctx->stats_counters->server[fidx];
 }
 
-static struct stats_metric *stats_server_to_metric(struct context *ctx,
-                                                   stats_server_field_t fidx) {
-  struct stats *st = ctx->stats;
-  ASSERT(st != NULL);
-
-  struct stats_pool *stp = &st->current;
-  struct stats_server *sts = &stp->server;
-  struct stats_metric *stm = array_get(&sts->metric, fidx);
-
-  st->updated = 1;
-
-  log_debug(LOG_VVVERB, "metric '%.*s' for server", stm->name.len,
-            stm->name.data);
-
-  return stm;
+static int64_t *stats_server_to_counter(struct context *ctx,
+                                        stats_server_field_t fidx) {
+  ASSERT(ctx->stats_counters != NULL);
+  return &ctx->stats_counters->server[fidx];
 }
 
 void _stats_server_incr(struct context *ctx, stats_server_field_t fidx) {
-  struct stats_metric *stm = stats_server_to_metric(ctx, fidx);
+  int64_t *counter = stats_server_to_counter(ctx, fidx);
 
-  ASSERT(stm->type == STATS_COUNTER || stm->type == STATS_GAUGE);
-  stm->value.counter++;
+  ASSERT(stats_server_codec[fidx].type == STATS_COUNTER ||
+         stats_server_codec[fidx].type == STATS_GAUGE);
+  stats_counter_add(counter, 1);
 
-  log_debug(LOG_VVVERB, "incr field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.counter);
+  log_debug(LOG_VVVERB, "incr field '%.*s' to %" PRId64 "",
+            stats_server_codec[fidx].name.len,
+            stats_server_codec[fidx].name.data, *counter);
 }
 
 void _stats_server_decr(struct context *ctx, stats_server_field_t fidx) {
-  struct stats_metric *stm = stats_server_to_metric(ctx, fidx);
+  int64_t *counter = stats_server_to_counter(ctx, fidx);
 
-  ASSERT(stm->type == STATS_GAUGE);
-  stm->value.counter--;
+  ASSERT(stats_server_codec[fidx].type == STATS_GAUGE);
+  stats_counter_add(counter, -1);
 
-  log_debug(LOG_VVVERB, "decr field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.counter);
+  log_debug(LOG_VVVERB, "decr field '%.*s' to %" PRId64 "",
+            stats_server_codec[fidx].name.len,
+            stats_server_codec[fidx].name.data, *counter);
 }
 
 void _stats_server_incr_by(struct context *ctx, stats_server_field_t fidx,
                            int64_t val) {
-  struct stats_metric *stm = stats_server_to_metric(ctx, fidx);
+  int64_t *counter = stats_server_to_counter(ctx, fidx);
 
-  ASSERT(stm->type == STATS_COUNTER || stm->type == STATS_GAUGE);
-  stm->value.counter += val;
+  ASSERT(stats_server_codec[fidx].type == STATS_COUNTER ||
+         stats_server_codec[fidx].type == STATS_GAUGE);
+  stats_counter_add(counter, val);
 
-  log_debug(LOG_VVVERB, "incr by field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.counter);
+  log_debug(LOG_VVVERB, "incr by field '%.*s' to %" PRId64 "",
+            stats_server_codec[fidx].name.len,
+            stats_server_codec[fidx].name.data, *counter);
 }
 
 void _stats_server_decr_by(struct context *ctx, stats_server_field_t fidx,
                            int64_t val) {
-  struct stats_metric *stm = stats_server_to_metric(ctx, fidx);
+  int64_t *counter = stats_server_to_counter(ctx, fidx);
 
-  ASSERT(stm->type == STATS_GAUGE);
-  stm->value.counter -= val;
+  ASSERT(stats_server_codec[fidx].type == STATS_GAUGE);
+  stats_counter_add(counter, -val);
 
-  log_debug(LOG_VVVERB, "decr by field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.counter);
+  log_debug(LOG_VVVERB, "decr by field '%.*s' to %" PRId64 "",
+            stats_server_codec[fidx].name.len,
+            stats_server_codec[fidx].name.data, *counter);
 }
 
 void _stats_server_set_ts(struct context *ctx, stats_server_field_t fidx,
                           uint64_t val) {
-  struct stats_metric *stm = stats_server_to_metric(ctx, fidx);
+  int64_t *counter = stats_server_to_counter(ctx, fidx);
+
+  ASSERT(stats_server_codec[fidx].type == STATS_TIMESTAMP);
+  stats_counter_set(counter, (int64_t)val);
+
+  log_debug(LOG_VVVERB, "set ts field '%.*s' to %" PRIu64 "",
+            stats_server_codec[fidx].name.len,
+            stats_server_codec[fidx].name.data, val);
+}
+
+void _stats_histo_add(struct context *ctx, stats_histo_field_t fidx,
+                      uint64_t val) {
+  ASSERT(ctx->stats_counters != NULL);
+  histo_add(&ctx->stats_counters->histo[fidx], val);
+}
 
-  ASSERT(stm->type == STATS_TIMESTAMP);
-  stm->value.timestamp = val;
+/*
+ * Count a request answered on the given path towards its command family,
+ * with the bytes of the request and response and the usec it took.
+ */
+void stats_family_add(struct context *ctx, stats_path_t path, struct msg *req,
+                      uint32_t rsp_bytes, uint64_t usec) {
+  stats_family_t family = (stats_family_t)stats_families[req->type];
 
-  log_debug(LOG_VVVERB, "set ts field '%.*s' to %" PRId64 "", stm->name.len,
-            stm->name.data, stm->value.timestamp);
+  ASSERT(ctx->stats_counters != NULL);
+  stats_counter_add(&ctx->stats_counters->family_requests[path][family], 1);
+  stats_counter_add(&ctx->stats_counters->family_bytes[path][family],
+                    (int64_t)req->mlen + rsp_bytes);
+  histo_add(&ctx->stats_counters->family_latency[path][family], usec);
 }
 
-// should use macro or something else to make this more elegant
-void stats_histo_add_latency(struct context *ctx, uint64_t val) {
+static __thread uint32_t top_keys_rand; /* xorshift state, 0 until seeded */
+
+/*
+ * Count the keys of one request in top_keys_sample_rate towards the hot keys
+ * and flag it, so that the size of its payload is looked at once the
+ * datastore answers.
+ */
+void stats_top_keys_sample(struct context *ctx, struct msg *req) {
   struct stats *st = ctx->stats;
-  histo_add(&st->latency_histo, val);
-  ctx->stats->updated = 1;
+  uint32_t i, nkeys;
+
+  if (st->hot_keys == NULL) {
+    return;
+  }
+
+  if (top_keys_rand == 0) {
+    top_keys_rand = (uint32_t)random() | 1;
+  }
+  top_keys_rand ^= top_keys_rand << 13;
+  top_keys_rand ^= top_keys_rand >> 17;
+  top_keys_rand ^= top_keys_rand << 5;
+  if (top_keys_rand % st->top_keys_sample_rate != 0) {
+    return;
+  }
+
+  nkeys = array_n(req->keys);
+  if (nkeys == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&st->top_keys_lock);
+  st->top_keys_samples++;
+  for (i = 0; i < nkeys; i++) {
+    struct keypos *kpos = array_get(req->keys, i);
+    topk_add(st->hot_keys, kpos->start, (uint32_t)(kpos->end - kpos->start), 1);
+  }
+  pthread_mutex_unlock(&st->top_keys_lock);
+  req->top_keys_sampled = 1;
 }
 
-void stats_histo_add_payloadsize(struct context *ctx, uint64_t val) {
+/*
+ * Count the payload of a sampled single-key request towards the big keys: the
+ * larger of the request, which carries the value of a write, and the
+ * response, which carries the value of a read. The mlen of a spliced
+ * response already counts the bytes that went through its pipe.
+ */
+void stats_top_keys_add_rsp(struct context *ctx, struct msg *req,
+                            struct msg *rsp) {
   struct stats *st = ctx->stats;
-  histo_add(&st->payload_size_histo, val);
-  ctx->stats->updated = 1;
+  struct keypos *kpos;
+  uint64_t payload;
+
+  if (!req->top_keys_sampled || array_n(req->keys) != 1) {
+    return;
+  }
+
+  kpos = array_get(req->keys, 0);
+  payload = MAX(req->mlen, rsp->mlen);
+  pthread_mutex_lock(&st->top_keys_lock);
+  topk_max(st->big_keys, kpos->start, (uint32_t)(kpos->end - kpos->start),
+           payload);
+  pthread_mutex_unlock(&st->top_keys_lock);
 }
@@ -27,9 +27,13 @@
 #include "dyn_histogram.h"
 #include "dyn_string.h"
 
+#define STATS_CACHE_LINE_SIZE 64
+
 // Forward declarations
 struct context;
+struct msg;
 struct server_pool;
+struct topk;
 
 #define STATS_POOL_CODEC(ACTION)                                               \
   /* client behavior */                                                        \
@@ -103,11 +107,46 @@ struct server_pool;
          "current peer request bytes in outgoing queue to remote DC")          \
   ACTION(peer_mismatch_requests, STATS_COUNTER,                                \
          "current dnode peer mismatched messages")                             \
+  ACTION(peer_compress_in_bytes, STATS_COUNTER,                                \
+         "payload bytes compressed for remote dc peers")                       \
+  ACTION(peer_compress_out_bytes, STATS_COUNTER,                               \
+         "compressed payload bytes sent to remote dc peers")                   \
+  ACTION(peer_compress_usec, STATS_COUNTER,                                    \
+         "usec spent compressing payloads")                                    \
+  ACTION(peer_decompress_usec, STATS_COUNTER,                                  \
+         "usec spent inflating payloads")                                      \
   /* forwarder behavior */                                                     \
   ACTION(forward_error, STATS_COUNTER,                                         \
          "# times we encountered a forwarding error")                          \
   ACTION(fragments, STATS_COUNTER,                                             \
          "# fragments created from a multi-vector request")                    \
+  /* read cache behavior */                                                    \
+  ACTION(read_cache_hits, STATS_COUNTER, "# reads answered by the read cache") \
+  ACTION(read_cache_misses, STATS_COUNTER,                                     \
+         "# cacheable reads sent to the datastore")                            \
+  ACTION(read_cache_fills, STATS_COUNTER,                                      \
+         "# hot key responses kept in the read cache")                         \
+  ACTION(read_cache_invalidations, STATS_COUNTER,                              \
+         "# read cache entries dropped by writes")                             \
+  /* replica selection behavior */                                             \
+  ACTION(replica_diverted_reads, STATS_COUNTER,                                \
+         "# DC_ONE reads sent to a replica on another local rack")             \
+  ACTION(replica_diverted_gain_usec, STATS_COUNTER,                            \
+         "usec diverted reads were expected to save")                          \
+  ACTION(hedged_reads, STATS_COUNTER,                                          \
+         "# DC_ONE reads also sent to a replica on another rack")              \
+  ACTION(hedged_read_wins, STATS_COUNTER,                                      \
+         "# hedged reads answered first by the other replica")                 \
+  ACTION(quorum_digest_reads, STATS_COUNTER,                                   \
+         "# DC_QUORUM reads that asked other racks for digests")                \
+  ACTION(quorum_digest_mismatches, STATS_COUNTER,                              \
+         "# digests that differed from the value returned")                    \
+  ACTION(quorum_digest_full_reads, STATS_COUNTER,                              \
+         "# digest reads that read a digest's value in full")                  \
+  ACTION(peer_shed_requests, STATS_COUNTER,                                    \
+         "# requests shed with a peer's queue at its concurrency limit")       \
+  ACTION(peer_limit_backoffs, STATS_COUNTER,                                   \
+         "# times a peer's concurrency limit was cut")                         \
   ACTION(stats_count, STATS_COUNTER, "# stats request")
 
 #define STATS_SERVER_CODEC(ACTION)                                            \
@@ -153,6 +192,89 @@ struct server_pool;
   ACTION(redis_req_sortedsets, STATS_COUNTER, "# Redis sortedsets")           \
   ACTION(redis_req_other, STATS_COUNTER, "# Redis other")
 
+/* Command families that requests are broken down by */
+#define STATS_FAMILY_CODEC(ACTION) \
+  ACTION(other)                    \
+  ACTION(keys)                     \
+  ACTION(string)                   \
+  ACTION(hash)                     \
+  ACTION(list)                     \
+  ACTION(set)                      \
+  ACTION(zset)                     \
+  ACTION(hyperloglog)              \
+  ACTION(geo)                      \
+  ACTION(json)                     \
+  ACTION(script)                   \
+  ACTION(server)                   \
+  ACTION(memcache)
+
+/* Where a request was answered: datastore, peer in this dc, or in another */
+#define STATS_PATH_CODEC(ACTION) \
+  ACTION(local)                  \
+  ACTION(cross_zone)             \
+  ACTION(cross_region)
+
+#define DEFINE_ACTION(_name) STATS_FAMILY_##_name,
+typedef enum stats_family {
+  STATS_FAMILY_CODEC(DEFINE_ACTION) STATS_NFAMILY
+} stats_family_t;
+#undef DEFINE_ACTION
+
+#define DEFINE_ACTION(_name) STATS_PATH_##_name,
+typedef enum stats_path {
+  STATS_PATH_CODEC(DEFINE_ACTION) STATS_NPATH
+} stats_path_t;
+#undef DEFINE_ACTION
+
+/*
+ * Histograms: name on the histograms and metrics endpoints, field of struct
+ * stats the threads' recorders are merged into, and description.
+ */
+#define STATS_HISTO_CODEC(ACTION)                                             \
+  ACTION(latency, latency_histo, "usec to answer client requests")            \
+  ACTION(payload_size, payload_size_histo, "bytes of client write requests")  \
+  ACTION(server_latency, server_latency_histo,                                \
+         "usec to get a response from the datastore")                         \
+  ACTION(cross_zone_latency, cross_zone_latency_histo,                        \
+         "usec to get a response from a peer in this dc")                     \
+  ACTION(cross_region_latency, cross_region_latency_histo,                    \
+         "usec to get a response from a peer in another dc")                  \
+  ACTION(server_queue_wait_time, server_queue_wait_time_histo,                \
+         "usec requests waited to be sent to the datastore")                  \
+  ACTION(cross_zone_queue_wait_time, cross_zone_queue_wait_time_histo,        \
+         "usec requests waited to be sent to a peer in this dc")              \
+  ACTION(cross_region_queue_wait_time, cross_region_queue_wait_time_histo,    \
+         "usec requests waited to be sent to a peer in another dc")           \
+  ACTION(client_out_queue, client_out_queue,                                  \
+         "responses queued on a client connection")                           \
+  ACTION(server_in_queue, server_in_queue,                                    \
+         "requests queued on a datastore connection")                         \
+  ACTION(server_out_queue, server_out_queue,                                  \
+         "requests awaiting a response on a datastore connection")            \
+  ACTION(dnode_client_out_queue, dnode_client_out_queue,                      \
+         "responses queued on a connection from a peer")                      \
+  ACTION(peer_in_queue, peer_in_queue,                                        \
+         "requests queued on a connection to a peer in this dc")              \
+  ACTION(peer_out_queue, peer_out_queue,                                      \
+         "requests awaiting a response from a peer in this dc")               \
+  ACTION(remote_peer_in_queue, remote_peer_in_queue,                          \
+         "requests queued on a connection to a peer in another dc")           \
+  ACTION(remote_peer_out_queue, remote_peer_out_queue,                        \
+         "requests awaiting a response from a peer in another dc")            \
+  ACTION(datastore_batch, datastore_batch_histo,                              \
+         "requests per write to the datastore")                               \
+  ACTION(peer_batch, peer_batch_histo, "messages per dnode frame")            \
+  ACTION(peer_batch_wait, peer_batch_wait_histo,                              \
+         "usec requests waited for their dnode frame")                        \
+  ACTION(peer_compress_ratio, peer_compress_ratio_histo,                      \
+         "compressed size of peer payloads in percent")
+
+#define DEFINE_ACTION(_name, _field, _desc) STATS_HISTO_##_name,
+typedef enum stats_histo_field {
+  STATS_HISTO_CODEC(DEFINE_ACTION) STATS_NHISTO
+} stats_histo_field_t;
+#undef DEFINE_ACTION
+
 typedef enum stats_type {
   STATS_INVALID,
   STATS_COUNTER,   /* monotonic accumulator */
@@ -188,6 +310,13 @@ typedef enum {
   CMD_SET_TIMEOUT_FACTOR,
   CMD_GET_STATE,
   CMD_TOGGLE_READ_REPAIRS,
+  CMD_HOT_KEYS,
+  CMD_HOT_KEYS_RESET,
+  CMD_HISTOGRAMS,
+  CMD_PERCENTILE,
+  CMD_METRICS,
+  CMD_COMMANDS,
+  CMD_TRACES,
 } stats_cmd_t;
 
 struct stats_metric {
@@ -234,10 +363,14 @@ struct stats {
   int64_t start_ts;                  /* start timestamp of dynomite */
   struct stats_buffer buf;           /* info buffer */
   struct stats_buffer clus_desc_buf; /* cluster_describe buffer */
+  struct stats_buffer top_keys_buf;  /* hotkeys buffer */
+  struct stats_buffer histo_buf;     /* histograms and percentile buffer */
+  struct stats_buffer metrics_buf;   /* metrics buffer, grows as needed */
+  struct trace_span *trace_spans;    /* trace ring copied for /traces */
 
-  struct stats_pool current; /* stats_pool[] (a) */
-  struct stats_pool shadow;  /* stats_pool[] (b) */
-  struct stats_pool sum;     /* stats_pool[] (c = a + b) */
+  struct stats_counters *counters; /* counters of each event loop thread */
+  uint32_t ncounters;              /* # event loop threads */
+  struct stats_pool sum;           /* stats_pool[] of all threads */
 
   pthread_t tid; /* stats aggregator thread */
   int sd;        /* stats descriptor */
@@ -286,8 +419,7 @@ struct stats {
   struct string dc_str;
   struct string dc;
 
-  volatile int aggregate; /* shadow (b) aggregate? */
-  volatile int updated;   /* current (a) updated? */
+  volatile int sample_free_queues; /* main thread to sample free queues? */
   volatile bool reset_histogram;
   volatile struct histogram latency_histo;
   volatile struct histogram payload_size_histo;
@@ -309,6 +441,25 @@ struct stats {
   volatile struct histogram remote_peer_in_queue;
   volatile struct histogram remote_peer_out_queue;
 
+  volatile struct histogram datastore_batch_histo;     /* requests per write */
+  volatile struct histogram peer_batch_histo;          /* messages per frame */
+  volatile struct histogram peer_batch_wait_histo;     /* usec before flush */
+  volatile struct histogram peer_compress_ratio_histo; /* percent */
+
+  /* usec for the datastore or a peer to answer, by path and command family */
+  volatile struct histogram family_latency[STATS_NPATH][STATS_NFAMILY];
+  int64_t family_requests[STATS_NPATH][STATS_NFAMILY]; /* sum of threads */
+  int64_t family_bytes[STATS_NPATH][STATS_NFAMILY];    /* sum of threads */
+
+  /* Hot and big keys of the sampled requests, shared by all threads */
+  pthread_mutex_t top_keys_lock;   /* guards the fields below */
+  struct topk *hot_keys;           /* sampled requests per key */
+  struct topk *big_keys;           /* largest sampled payload per key */
+  struct topk_item *top_keys_list; /* scratch for hotkeys responses */
+  uint32_t top_keys;               /* keys in each list, 0 is off */
+  uint32_t top_keys_sample_rate;   /* sample one request in this many */
+  uint64_t top_keys_samples;       /* requests sampled */
+
   size_t alloc_msgs;
   size_t free_msgs;
   uint64_t alloc_mbufs;
@@ -328,6 +479,22 @@ typedef enum stats_server_field {
 } stats_server_field_t;
 #undef DEFINE_ACTION
 
+/*
+ * Counters and histograms of one event loop thread, indexed by
+ * stats_pool_field_t, stats_server_field_t, stats_histo_field_t, and
+ * stats_path_t and stats_family_t. Only that thread writes them and the stats
+ * thread reads them, each counter with a single atomic load, so neither needs
+ * a lock. Aligned so that no two threads share a cache line.
+ */
+struct stats_counters {
+  int64_t pool[STATS_POOL_NFIELD];
+  int64_t server[STATS_SERVER_NFIELD];
+  int64_t family_requests[STATS_NPATH][STATS_NFAMILY];
+  int64_t family_bytes[STATS_NPATH][STATS_NFAMILY]; /* requests and responses */
+  struct histo_recorder histo[STATS_NHISTO];
+  struct histo_recorder family_latency[STATS_NPATH][STATS_NFAMILY];
+} __attribute__((aligned(STATS_CACHE_LINE_SIZE)));
+
 struct stats_cmd {
   stats_cmd_t cmd;
   struct string req_data;
@@ -441,6 +608,9 @@ struct stats_cmd {
 
 #define stats_enabled DN_STATS
 
+#define stats_histo_add(_ctx, _name, _val) \
+  _stats_histo_add(_ctx, STATS_HISTO_##_name, _val)
+
 void stats_describe(void);
 
 void _stats_pool_incr(struct context *ctx, stats_pool_field_t fidx);
@@ -474,9 +644,17 @@ struct stats *stats_create(uint16_t stats_port, struct string pname,
                            struct server_pool *sp, struct context *ctx);
 
 void stats_destroy(struct stats *stats);
-void stats_swap(struct stats *stats);
-
-void stats_histo_add_latency(struct context *ctx, uint64_t val);
-void stats_histo_add_payloadsize(struct context *ctx, uint64_t val);
+struct stats_counters *stats_thread_counters(struct stats *stats,
+                                             uint32_t worker_id);
+void stats_sample_free_queues(struct stats *stats);
+
+void _stats_histo_add(struct context *ctx, stats_histo_field_t fidx,
+                      uint64_t val);
+void stats_family_add(struct context *ctx, stats_path_t path, struct msg *req,
+                      uint32_t rsp_bytes, uint64_t usec);
+
+void stats_top_keys_sample(struct context *ctx, struct msg *req);
+void stats_top_keys_add_rsp(struct context *ctx, struct msg *req,
+                            struct msg *rsp);
 
 #endif
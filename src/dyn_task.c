@@ -20,23 +20,23 @@
  * schedule_task()
  * execute_expired_tasks()
  *
- * The time complexity for insert/delete in the red black tree is O(log N),
- * where N is the number of elements in the tree.
+ * Tasks are kept in a timing wheel (see dyn_timewheel.c), so scheduling and
+ * cancelling a task is O(1).
  *
  */
 
-struct rbtree task_rbt; /* rbtree which holds the tasks */
-struct rbnode task_rbs; /* rbtree sentinel */
+/* Each event loop thread has its own task wheel; see task_mgr_init(). */
+static __thread struct timewheel task_tw; /* wheel which holds the tasks */
 
 // Individual task
 struct task {
-  struct rbnode rbnode; /* always be the first field */
+  struct tw_node twnode; /* always be the first field */
   task_handler_1 handler;
   void *arg1;
 };
 
 rstatus_t task_mgr_init() {
-  rbtree_init(&task_rbt, &task_rbs);
+  timewheel_init(&task_tw, dn_msec_now());
   return DN_OK;
 }
 
@@ -55,55 +55,38 @@ struct task *schedule_task_1(task_handler_1 handler1, void *arg1,
 
   msec_t now_ms = dn_msec_now();
 
-  struct rbnode *rbnode = (struct rbnode *)task;
-  rbnode->timeout = timeout;
-  rbnode->key = now_ms + timeout;
-  rbnode->data = task;
-  rbtree_insert(&task_rbt, rbnode);
+  struct tw_node *twnode = (struct tw_node *)task;
+  timewheel_node_init(twnode);
+  twnode->rbnode.timeout = timeout;
+  twnode->rbnode.data = task;
+  timewheel_insert(&task_tw, twnode, now_ms + timeout);
   return task;
 }
 
 msec_t time_to_next_task(void) {
-  struct rbnode *rbnode = rbtree_min(&task_rbt);
-  if (!rbnode) return UINT64_MAX;
-  msec_t now_ms = dn_msec_now();
-  msec_t fire_at_ms = rbnode->key;
-  if (now_ms > fire_at_ms) return 0;
-  return fire_at_ms - now_ms;
-}
-
-static bool task_expired(struct task *task) {
-  msec_t now_ms = dn_msec_now();
-  msec_t fire_at_ms = task->rbnode.key;
-
-  if (now_ms > fire_at_ms) return true;
-  return false;
+  return timewheel_next(&task_tw, dn_msec_now());
 }
 
 void execute_expired_tasks(uint32_t limit) {
   uint32_t executed = 0;
+  msec_t now_ms = dn_msec_now();
   for (;;) {
-    struct rbnode *rbnode = rbtree_min(&task_rbt);
-    if (!rbnode) {
+    struct tw_node *twnode = timewheel_expire(&task_tw, now_ms);
+    if (!twnode) {
       return;
     }
 
-    struct task *task = rbnode->data;
+    struct task *task = twnode->rbnode.data;
 
-    if (task_expired(task)) {
-      rbtree_delete(&task_rbt, rbnode);
-      task->handler(task->arg1);
-      dn_free(task);
-      executed++;
-      if (!limit && executed == limit) return;
-      continue;
-    }
-    break;
+    task->handler(task->arg1);
+    dn_free(task);
+    executed++;
+    if (limit && executed == limit) return;
   }
 }
 
 void cancel_task(struct task *task) {
-  struct rbnode *rbnode = (struct rbnode *)task;
-  rbtree_delete(&task_rbt, rbnode);
+  struct tw_node *twnode = (struct tw_node *)task;
+  timewheel_delete(&task_tw, twnode);
   dn_free(task);
 }
@@ -1,7 +1,7 @@
 #ifndef _DYN_TASK_H_
 #define _DYN_TASK_H_
 
-#include "dyn_rbtree.h"
+#include "dyn_timewheel.h"
 #include "dyn_types.h"
 
 struct task;
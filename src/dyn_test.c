@@ -3,11 +3,14 @@
  * storages. Copyright (C) 2015 Netflix, Inc.
  */
 
+#include <ctype.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <unistd.h>
@@ -15,7 +18,17 @@
 #include "dyn_conf.h"
 #include "dyn_core.h"
 #include "dyn_dnode_peer.h"
+#include "dyn_server.h"
 #include "dyn_signal.h"
+#include "dyn_task.h"
+#include "dyn_timewheel.h"
+#include "dyn_topk.h"
+#include "dyn_vnode.h"
+#include "event/dyn_event.h"
+#include "proto/dyn_proto.h"
+#include "dyn_redis_cmd.h"
+#include "dyn_redis_scan.h"
+#include "hashkit/dyn_token_table.h"
 
 #define TEST_CONF_PATH "conf/dynomite.yml"
 
@@ -337,12 +350,12 @@ static rstatus_t test_msg_recv_chain(struct conn *conn, struct msg *msg) {
 static rstatus_t rsa_test(void) {
   static unsigned char encrypted_buf[256];
   static unsigned char decrypted_buf[AES_KEYLEN + 1];
-  static unsigned char *msg;
+  static unsigned char msg[AES_KEYLEN + 1];
 
   print_banner("RSA");
   int i = 0;
   for (; i < 3; i++) {
-    msg = generate_aes_key();
+    THROW_STATUS(generate_aes_key(msg));
 
     log_debug(LOG_VERB, "i = %d", i);
     SCOPED_CHARPTR(encoded_aes_key) = base64_encode(msg, AES_KEYLEN);
@@ -377,7 +390,8 @@ static void gen_random(unsigned char *s, const int len) {
 static rstatus_t aes_test(void) {
   unsigned char msg[MAX_MSG_LEN + 1];
   print_banner("AES");
-  unsigned char *aes_key = generate_aes_key();
+  unsigned char aes_key[AES_KEYLEN + 1];
+  THROW_STATUS(generate_aes_key(aes_key));
   SCOPED_CHARPTR(aes_key_print) = base64_encode(aes_key, AES_KEYLEN);
   loga("aesKey is '%s'", aes_key_print);
 
@@ -518,6 +532,48 @@ static rstatus_t test_tailq(void) {
   return DN_OK;
 }
 
+static rstatus_t test_mbuf_size_classes(void) {
+  print_banner("MBUF SIZE CLASSES");
+  struct mbuf *small = mbuf_get_sized(100);
+  struct mbuf *large = mbuf_get();
+  if (small == NULL || large == NULL) {
+    log_error("Failed to get mbufs");
+    return DN_ERROR;
+  }
+  if (mbuf_remaining_space(small) < 100 ||
+      mbuf_remaining_space(small) >= mbuf_remaining_space(large)) {
+    log_error("Wrong size class: small %u large %u",
+              mbuf_remaining_space(small), mbuf_remaining_space(large));
+    return DN_ERROR;
+  }
+  if (mbuf_remaining_space(large) != mbuf_data_size() - MBUF_ESIZE) {
+    log_error("Default class has %u bytes, expected %zu",
+              mbuf_remaining_space(large), mbuf_data_size() - MBUF_ESIZE);
+    return DN_ERROR;
+  }
+
+  // Returned mbufs go back to their own class and survive a trim.
+  uint64_t nfree = mbuf_free_queue_size();
+  mbuf_put(small);
+  mbuf_put(large);
+  if (mbuf_free_queue_size() != nfree + 2) {
+    log_error("Free queue size %lu, expected %lu", mbuf_free_queue_size(),
+              nfree + 2);
+    return DN_ERROR;
+  }
+  mbuf_trim();
+  large = mbuf_get();
+  memset(large->last, 'x', mbuf_remaining_space(large));
+  large->last = large->end;
+  if (!mbuf_full(large) || large->magic != MBUF_MAGIC) {
+    log_error("Trimmed mbuf is not usable");
+    return DN_ERROR;
+  }
+  mbuf_put(large);
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
 static void peer_ref(struct conn *conn, void *owner) {}
 
 struct conn_ops peer_ops = {
@@ -547,21 +603,339 @@ static rstatus_t aes_msg_test(struct node *server) {
   mbuf_write_string(mbuf2, &s2);
   STAILQ_INSERT_TAIL(&msg->mhdr, mbuf2, next);
 
-  /*
-  loga("dumping the content of the original msg: ");
-  msg_dump(msg);
+  // Sealed in place as one AES-GCM message, opened in one buffer.
+  uint8_t gcm_data[AES_GCM_DATA_LEN], buf[16];
+  size_t len;
+
+  if (dyn_aes_gcm_encrypt_msg(conn, msg, gcm_data, &len) != DN_OK ||
+      len != 9) {
+    log_error("AES-GCM encryption failed");
+    return DN_ERROR;
+  }
+  memcpy(buf, mbuf1->pos, 3);
+  memcpy(buf + 3, mbuf2->pos, 6);
+  if (dyn_aes_gcm_decrypt(conn, buf, len, gcm_data) != DN_OK ||
+      memcmp(buf, "abcabcabc", 9) != 0) {
+    log_error("AES-GCM decryption failed");
+    return DN_ERROR;
+  }
+
+  memcpy(buf, mbuf1->pos, 3);
+  memcpy(buf + 3, mbuf2->pos, 6);
+  buf[4] ^= 1;
+  if (dyn_aes_gcm_decrypt(conn, buf, len, gcm_data) != DN_ERROR) {
+    log_error("Tampered AES-GCM message decrypted");
+    return DN_ERROR;
+  }
+
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+// A read sent meanwhile, behind a dnode header, is copied as it came in.
+static rstatus_t test_msg_clone_sent(struct node *server) {
+  print_banner("MSG CLONE SENT");
+  struct conn *conn = conn_get(server, init_peer_conn);
+  struct msg *req = msg_get(conn, true, __FUNCTION__);
+  struct msg *copy = msg_get(conn, true, __FUNCTION__);
+  struct mbuf *first = mbuf_get(), *second = mbuf_get(), *header = mbuf_get();
+  struct string s1 = string("*2\r\n$3\r\nGET\r\n");
+  struct string s2 = string("$3\r\nfoo\r\n");
+  struct string h = string("header");
+  uint8_t *pos;
+
+  mbuf_write_string(first, &s1);
+  mbuf_write_string(second, &s2);
+  mbuf_write_string(header, &h);
+  STAILQ_INSERT_TAIL(&req->mhdr, first, next);
+  STAILQ_INSERT_TAIL(&req->mhdr, second, next);
+  pos = first->pos;
+
+  STAILQ_INSERT_HEAD(&req->mhdr, header, next);
+  header->pos = header->last;
+  first->pos = first->last;
+  second->pos = second->last;
+
+  if (msg_clone_sent(req, first, pos, copy) != DN_OK ||
+      msg_length(copy) != s1.len + s2.len ||
+      memcmp(STAILQ_FIRST(&copy->mhdr)->pos, s1.data, s1.len) != 0 ||
+      memcmp(STAILQ_LAST(&copy->mhdr, mbuf, next)->pos, s2.data, s2.len) !=
+          0) {
+    log_error("Copy of a sent read has %u bytes", msg_length(copy));
+    return DN_ERROR;
+  }
 
-  dyn_aes_encrypt_msg(msg, aes_key);
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
 
-  loga("dumping the content of encrypted msg");
-  msg_dump(msg);
+static rstatus_t test_compress(struct node *server) {
+  print_banner("COMPRESS");
+  struct conn *conn = conn_get(server, init_peer_conn);
+  struct msg *msg = msg_get(conn, true, __FUNCTION__);
+  struct string cmd = string("*3\r\n$3\r\nSET\r\n$4\r\nfoo1\r\n$300\r\n");
+  struct mbuf *mbuf1 = mbuf_get(), *mbuf2 = mbuf_get(), *out;
+  uint8_t raw[512];
+  uint32_t len;
+
+  mbuf_write_string(mbuf1, &cmd);
+  memset(mbuf2->last, 'v', 300);
+  mbuf2->last += 300;
+  mbuf_write_bytes(mbuf2, (unsigned char *)CRLF, CRLF_LEN);
+  STAILQ_INSERT_HEAD(&msg->mhdr, mbuf1, next);
+  STAILQ_INSERT_TAIL(&msg->mhdr, mbuf2, next);
+  len = mbuf_length(mbuf1) + mbuf_length(mbuf2);
+  memcpy(raw, mbuf1->pos, mbuf_length(mbuf1));
+  memcpy(raw + mbuf_length(mbuf1), mbuf2->pos, mbuf_length(mbuf2));
+
+  if (dyn_compress_msg(conn, msg) != DN_OK ||
+      STAILQ_FIRST(&msg->mhdr) != STAILQ_LAST(&msg->mhdr, mbuf, next) ||
+      mbuf_length(STAILQ_FIRST(&msg->mhdr)) >= len / 4) {
+    log_error("Message not compressed");
+    return DN_ERROR;
+  }
 
-  dyn_aes_decrypt_msg(msg, aes_key);
+  mbuf1 = STAILQ_FIRST(&msg->mhdr);
+  if (dyn_decompress(conn, mbuf1->pos, mbuf_length(mbuf1), 8, &out) != DN_OK ||
+      mbuf_length(out) != len || memcmp(out->pos, raw, len) != 0 ||
+      mbuf_remaining_space(out) < 8) {
+    log_error("Compressed message not inflated back");
+    return DN_ERROR;
+  }
+  mbuf_put(out);
 
-  loga("dumping the content of decrytped msg");
-  msg_dump(msg);
-  */
+  // a payload that does not inflate to the length it claims is refused
+  mbuf1->pos[DYN_COMPRESS_HDR_LEN - 1]++;
+  if (dyn_decompress(conn, mbuf1->pos, mbuf_length(mbuf1), 0, &out) == DN_OK) {
+    log_error("Compressed message of the wrong length inflated");
+    return DN_ERROR;
+  }
 
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+/* A request holding cmd, with its key at [off, off + len). */
+static struct msg *read_cache_req(struct conn *conn, msg_type_t type,
+                                  bool is_read, const char *cmd, uint32_t off,
+                                  uint32_t len) {
+  struct msg *req = msg_get(conn, true, __FUNCTION__);
+  struct mbuf *mbuf = mbuf_get();
+  struct keypos *kpos = array_push(req->keys);
+
+  mbuf_write_bytes(mbuf, (unsigned char *)cmd, (int)strlen(cmd));
+  STAILQ_INSERT_TAIL(&req->mhdr, mbuf, next);
+  req->type = type;
+  req->is_read = is_read ? 1 : 0;
+  kpos->start = mbuf->start + off;
+  kpos->end = kpos->start + len;
+  return req;
+}
+
+static rstatus_t test_read_cache(struct node *server) {
+  print_banner("READ CACHE");
+  struct conn *conn = conn_get(server, init_peer_conn);
+  struct read_cache *cache = read_cache_create(2, 1000, 3);
+  const char *get = "*2\r\n$3\r\nGET\r\n$3\r\nfoo\r\n";
+  const char *hget = "*3\r\n$4\r\nHGET\r\n$3\r\nfoo\r\n$1\r\nf\r\n";
+  const char *set = "*3\r\n$3\r\nSET\r\n$3\r\nfoo\r\n$3\r\nbaz\r\n";
+  const char *zunionstore =
+      "*4\r\n$11\r\nZUNIONSTORE\r\n$3\r\nfoo\r\n$1\r\n1\r\n$3\r\nbar\r\n";
+  struct string value = string("$3\r\nbar\r\n");
+  struct msg *req, *rsp = NULL;
+  usec_t now = 1000000;
+  uint32_t i;
+
+  // Hot on the third read, which fills the cache.
+  for (i = 0; i < 3; i++) {
+    req = read_cache_req(conn, MSG_REQ_REDIS_GET, true, get, 17, 3);
+    if (!read_cache_cacheable(req) ||
+        read_cache_get(cache, req, now, &rsp) != DN_NOOPS ||
+        req->read_cache_fill != (i == 2)) {
+      log_error("Read %u of a key not counted", i);
+      return DN_ERROR;
+    }
+  }
+  rsp = msg_get(conn, false, __FUNCTION__);
+  msg_append(rsp, value.data, value.len);
+  if (!read_cache_fill(cache, req, rsp, now)) {
+    log_error("Read cache not filled");
+    return DN_ERROR;
+  }
+
+  req = read_cache_req(conn, MSG_REQ_REDIS_GET, true, get, 17, 3);
+  if (read_cache_get(cache, req, now + 1000, &rsp) != DN_OK ||
+      msg_length(rsp) != value.len ||
+      memcmp(STAILQ_FIRST(&rsp->mhdr)->pos, value.data, value.len) != 0) {
+    log_error("Cached read not answered");
+    return DN_ERROR;
+  }
+  if (read_cache_get(cache, req, now + 1000001, &rsp) != DN_NOOPS ||
+      read_cache_entries(cache) != 1) {
+    log_error("Expired read answered");
+    return DN_ERROR;
+  }
+
+  // The field tells reads of a key apart, a write to the key drops both,
+  // whether they are filled or not.
+  req = read_cache_req(conn, MSG_REQ_REDIS_HGET, true, hget, 18, 3);
+  for (i = 0; i < 3; i++) {
+    read_cache_get(cache, req, now, &rsp);
+  }
+  if (read_cache_entries(cache) != 2) {
+    log_error("HGET and GET of a key share an entry");
+    return DN_ERROR;
+  }
+  req = read_cache_req(conn, MSG_REQ_REDIS_SET, false, set, 17, 3);
+  if (read_cache_cacheable(req) || read_cache_invalidate(cache, req) != 2 ||
+      read_cache_entries(cache) != 0) {
+    log_error("Write did not drop the entries of its key");
+    return DN_ERROR;
+  }
+
+  // A store command is flagged as a read but writes its destination.
+  for (i = 0; i < 3; i++) {
+    req = read_cache_req(conn, MSG_REQ_REDIS_GET, true, get, 17, 3);
+    read_cache_get(cache, req, now, &rsp);
+  }
+  req = read_cache_req(conn, MSG_REQ_REDIS_ZUNIONSTORE, true, zunionstore, 26,
+                       3);
+  if (read_cache_invalidate(cache, req) != 1 ||
+      read_cache_entries(cache) != 0) {
+    log_error("ZUNIONSTORE did not drop the entry of its destination");
+    return DN_ERROR;
+  }
+
+  read_cache_destroy(cache);
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+static rstatus_t test_dmsg_bin_header(struct node *server) {
+  print_banner("DMSG BINARY HEADER");
+  struct conn *conn = conn_get(server, init_peer_conn);
+  struct msg *msg = msg_get(conn, true, __FUNCTION__);
+  struct mbuf *mbuf = mbuf_get();
+  struct string payload = string("*1\r\n$4\r\nPING\r\n");
+  uint64_t id = (1ULL << 40) + 7;
+  uint8_t *last;
+
+  conn->dmsg_binary = 1;
+  dmsg_write(mbuf, id, DMSG_REQ, conn, payload.len);
+  if (*mbuf->pos != DMSG_BIN_MAGIC0 ||
+      mbuf_length(mbuf) != sizeof(struct dmsg_bin_header)) {
+    log_error("Binary header not written");
+    return DN_ERROR;
+  }
+  mbuf_write_string(mbuf, &payload);
+  STAILQ_INSERT_HEAD(&msg->mhdr, mbuf, next);
+  msg->pos = mbuf->pos;
+  msg->mlen = mbuf_length(mbuf);
+
+  // a header cut short waits for the rest
+  last = mbuf->last;
+  mbuf->last = mbuf->pos + 10;
+  msg->parser(msg, ctx);
+  if (msg->result != MSG_PARSE_AGAIN || msg->pos != mbuf->pos) {
+    log_error("Partial binary header parsed with result %d", msg->result);
+    return DN_ERROR;
+  }
+
+  mbuf->last = last;
+  msg->parser(msg, ctx);
+  if (msg->result != MSG_PARSE_OK || msg->dmsg->id != id ||
+      msg->dmsg->type != DMSG_REQ || msg->dmsg->version != VERSION_14 ||
+      msg->type != MSG_REQ_REDIS_PING || msg->pos != mbuf->last) {
+    log_error("Binary header parsed with result %d", msg->result);
+    return DN_ERROR;
+  }
+
+  // the trace id at the end of the data starts a span on the receiving side
+  uint64_t trace_id = 0x0123456789abcdefULL;
+  msg = msg_get(conn, true, __FUNCTION__);
+  mbuf = mbuf_get();
+  dmsg_write(mbuf, id, DMSG_REQ, conn, payload.len);
+  dmsg_set_trace(mbuf, trace_id);
+  mbuf_write_string(mbuf, &payload);
+  STAILQ_INSERT_HEAD(&msg->mhdr, mbuf, next);
+  msg->pos = mbuf->pos;
+  msg->mlen = mbuf_length(mbuf);
+  msg->parser(msg, ctx);
+  if (msg->result != MSG_PARSE_OK || msg->dmsg->trace_id != trace_id ||
+      msg->dmsg->mlen != 0 || msg->type != MSG_REQ_REDIS_PING ||
+      msg->trace == NULL || msg->trace->id != trace_id ||
+      msg->trace->kind != TRACE_PEER || msg->trace->hops[TRACE_peer_recv] == 0) {
+    log_error("Traced binary header parsed with result %d", msg->result);
+    return DN_ERROR;
+  }
+
+  // a digest at the end of the data of a response stands for its value
+  struct string digest_rsp = string("+DIGEST\r\n");
+  msg = msg_get(conn, false, __FUNCTION__);
+  mbuf = mbuf_get();
+  dmsg_write(mbuf, id, DMSG_RES, conn, digest_rsp.len);
+  dmsg_set_digest(mbuf, 0xdeadbeef);
+  mbuf_write_string(mbuf, &digest_rsp);
+  STAILQ_INSERT_HEAD(&msg->mhdr, mbuf, next);
+  msg->pos = mbuf->pos;
+  msg->mlen = mbuf_length(mbuf);
+  msg->parser(msg, ctx);
+  if (msg->result != MSG_PARSE_OK || msg->dmsg->digest != 0xdeadbeef ||
+      !(msg->dmsg->flags & DMSG_FLAG_DIGEST) || msg->dmsg->mlen != 0 ||
+      msg->pos != mbuf->last) {
+    log_error("Digest binary header parsed with result %d", msg->result);
+    return DN_ERROR;
+  }
+
+  // two requests packed into one frame come back out as two messages
+  struct msg *req[2];
+  struct mbuf *wire = mbuf_get();
+  uint32_t i;
+
+  conn->dmsg_frame = NULL;
+  for (i = 0; i < 2; i++) {
+    struct mbuf *hbuf = mbuf_get();
+    req[i] = msg_get(conn, true, __FUNCTION__);
+    dmsg_write(hbuf, id + i * 3, DMSG_REQ, conn, payload.len);
+    STAILQ_INSERT_HEAD(&req[i]->mhdr, hbuf, next);
+    dmsg_frame_add(conn, req[i], 64);
+  }
+  for (i = 0; i < 2; i++) {
+    struct mbuf *hbuf = STAILQ_FIRST(&req[i]->mhdr);
+    mbuf_copy(wire, hbuf->pos, mbuf_length(hbuf));
+    mbuf_write_string(wire, &payload);
+  }
+  if (wire->pos[4] != DMSG_FLAG_BATCH ||
+      mbuf_length(wire) != sizeof(struct dmsg_bin_header) +
+                               sizeof(struct dmsg_bin_sub_header) +
+                               2 * payload.len) {
+    log_error("Frame not written");
+    return DN_ERROR;
+  }
+
+  for (i = 0; i < 2; i++) {
+    struct mbuf *rbuf = mbuf_get();
+    mbuf_copy(rbuf, wire->pos, mbuf_length(wire));
+    msg = msg_get(conn, true, __FUNCTION__);
+    STAILQ_INSERT_HEAD(&msg->mhdr, rbuf, next);
+    msg->pos = rbuf->pos;
+    msg->mlen = mbuf_length(rbuf);
+    last = rbuf->start;
+    msg->parser(msg, ctx);
+    if (msg->result != MSG_PARSE_OK || msg->dmsg->id != id + i * 3 ||
+        msg->type != MSG_REQ_REDIS_PING) {
+      log_error("Message %u of the frame parsed with result %d", i,
+                msg->result);
+      return DN_ERROR;
+    }
+    wire->pos += msg->pos - last;
+  }
+  if (conn->dmsg_frame_left != 0 || wire->pos != wire->last) {
+    log_error("Frame not consumed");
+    return DN_ERROR;
+  }
+
+  loga(".....SUCCESS...");
   return DN_OK;
 }
 
@@ -611,6 +985,7 @@ static void test_core_ctx_create(struct instance *nci) {
   ctx->instance = nci;
   ctx->cf = NULL;
   ctx->stats = NULL;
+  ctx->stats_counters = NULL;
   ctx->evb = NULL;
   ctx->dyn_state = INIT;
 }
@@ -623,9 +998,14 @@ static void test_server_pool(struct instance *nci) {
   struct server_pool *sp = &ctx->pool;
   sp->mbuf_size = TEST_MBUF_SIZE;
   sp->alloc_msgs_max = TEST_ALLOC_MSGS_MAX;
+  sp->splice_threshold = 0;
+  sp->datastore_batch_size = 0;
+  sp->peer_batch_size = 1;
+  sp->remote_dc_compression = false;
   char *filename = "conf/dynomite.pem";
   string_copy(&sp->pem_key_file, filename, strlen(filename));
   sp->secure_server_option = SECURE_OPTION_DC;
+  sp->secure_cipher = SECURE_CIPHER_AES_CBC;
 
   mbuf_init(sp->mbuf_size);
   msg_init(sp->alloc_msgs_max);
@@ -654,6 +1034,969 @@ static void init_test(int argc, char **argv) {
   crypto_init(&(nci.ctx->pool));
 }
 
+static rstatus_t test_token_table(void) {
+  print_banner("TOKEN TABLE");
+  const uint32_t npoint = 10;
+  struct dyn_token tokens[10], key;
+  struct array continuums;
+  struct token_table *table;
+  uint32_t i;
+
+  THROW_STATUS(array_init(&continuums, npoint, sizeof(struct continuum)));
+  table = token_table_create(npoint);
+  if (table == NULL) {
+    return DN_ENOMEM;
+  }
+  for (i = 0; i < npoint; i++) {
+    struct continuum *c = array_push(&continuums);
+    set_int_dyn_token(&tokens[i], (i + 1) * 429496729U);
+    c->index = npoint - i;
+    c->value = 0;
+    c->token = &tokens[i];
+    table->entry[i].value = tokens[i].mag[0];
+    table->entry[i].owner = c->index;
+  }
+  token_table_index(table);
+
+  // Both ends of the ring, every token and its neighbours, then random keys.
+  for (i = 0; i < 3 * npoint + 1000; i++) {
+    uint32_t value;
+    if (i < 3 * npoint) {
+      value = tokens[i / 3].mag[0] + i % 3 - 1;
+    } else {
+      value = (uint32_t)random() ^ ((uint32_t)random() << 16);
+    }
+    set_int_dyn_token(&key, value);
+    uint32_t expected = vnode_dispatch(&continuums, npoint, &key);
+    uint32_t owner = token_table_dispatch(table, value);
+    if (owner != expected) {
+      log_error("Token %u routed to %u, expected %u", value, owner, expected);
+      return DN_ERROR;
+    }
+  }
+  set_int_dyn_token(&key, 0);
+  if (token_table_dispatch(table, 0) != vnode_dispatch(&continuums, npoint,
+                                                       &key)) {
+    log_error("Token 0 routed differently");
+    return DN_ERROR;
+  }
+
+  token_table_destroy(table);
+  array_deinit(&continuums);
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+static void test_task_run(void *arg) { (*(uint32_t *)arg)++; }
+
+static rstatus_t test_timewheel(void) {
+  print_banner("TIMING WHEEL");
+  const uint32_t nnode = 4096;
+  struct timewheel tw;
+  struct tw_node *nodes, *node;
+  msec_t now = 1000000007ULL;
+  uint32_t i, nexpired = 0, ndeleted = 0;
+
+  nodes = dn_alloc(nnode * sizeof(*nodes));
+  if (nodes == NULL) {
+    return DN_ENOMEM;
+  }
+  timewheel_init(&tw, now);
+
+  // Deadlines on every level and in the overflow tree.
+  for (i = 0; i < nnode; i++) {
+    msec_t delta = (msec_t)random() % (1ULL << (i % 28));
+    timewheel_node_init(&nodes[i]);
+    timewheel_insert(&tw, &nodes[i], now + delta);
+  }
+  for (i = 0; i < nnode; i += 7) {
+    timewheel_delete(&tw, &nodes[i]);
+    ndeleted++;
+  }
+
+  while (tw.count > 0) {
+    msec_t next = timewheel_next(&tw, now);
+    if (next == UINT64_MAX) {
+      log_error("Wheel with %u nodes reports no deadline", tw.count);
+      return DN_ERROR;
+    }
+    // Alternate between waking up when told to and sleeping past it.
+    now += next + ((random() & 1) ? (msec_t)random() % 5000 : 0);
+    while ((node = timewheel_expire(&tw, now)) != NULL) {
+      if (node->rbnode.key > now || (node - nodes) % 7 == 0) {
+        log_error("Node %ld expired at %lu, deadline %lu",
+                  (long)(node - nodes), now, node->rbnode.key);
+        return DN_ERROR;
+      }
+      nexpired++;
+    }
+    for (i = 0; i < nnode; i++) {
+      if (timewheel_queued(&nodes[i]) && nodes[i].rbnode.key <= now) {
+        log_error("Node %u still queued at %lu, deadline %lu", i, now,
+                  nodes[i].rbnode.key);
+        return DN_ERROR;
+      }
+    }
+  }
+
+  if (nexpired + ndeleted != nnode) {
+    log_error("Expired %u and deleted %u of %u nodes", nexpired, ndeleted,
+              nnode);
+    return DN_ERROR;
+  }
+
+  // Expired tasks run at most 'limit' a call, and all of them with 0.
+  uint32_t nrun = 0;
+  task_mgr_init();
+  for (i = 0; i < 5; i++) {
+    schedule_task_1(test_task_run, &nrun, 0);
+  }
+  execute_expired_tasks(2);
+  if (nrun != 2) {
+    log_error("Ran %u tasks with a limit of 2", nrun);
+    return DN_ERROR;
+  }
+  execute_expired_tasks(0);
+  if (nrun != 5) {
+    log_error("Ran %u of 5 tasks with no limit", nrun);
+    return DN_ERROR;
+  }
+
+  dn_free(nodes);
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+static rstatus_t test_topk(void) {
+  print_banner("TOP-K");
+  const uint32_t k = 16, nhot = 5, nhot_reads = 2000, ncold = 20000;
+  struct topk *t = topk_create(k);
+  struct topk_item items[16];
+  uint8_t key[TOPK_KEY_LEN + 16];
+  uint32_t i, n;
+
+  if (t == NULL) {
+    return DN_ENOMEM;
+  }
+
+  // Every key above a 1/k share of the stream is reported, with a count
+  // that bounds its real one from above and, less its error, from below.
+  for (i = 0; i < nhot * nhot_reads + ncold; i++) {
+    if (i % 3 == 0 && i / 3 < nhot * nhot_reads) {
+      n = (uint32_t)dn_snprintf(key, sizeof(key), "hot%u", (i / 3) % nhot);
+    } else {
+      n = (uint32_t)dn_snprintf(key, sizeof(key), "cold%u", i);
+    }
+    topk_add(t, key, n, 1);
+  }
+  n = topk_list(t, items);
+  if (n != k) {
+    log_error("Listed %u of %u keys", n, k);
+    return DN_ERROR;
+  }
+  for (i = 0; i < nhot; i++) {
+    if (dn_strncmp(items[i].key, "hot", 3) != 0 ||
+        items[i].count < nhot_reads ||
+        items[i].count - items[i].error > nhot_reads) {
+      log_error("Key %u is '%.*s' with count %lu error %lu", i,
+                items[i].keylen, items[i].key, items[i].count, items[i].error);
+      return DN_ERROR;
+    }
+  }
+
+  // Keys longer than what is kept of them still count apart.
+  topk_reset(t);
+  memset(key, 'x', sizeof(key));
+  for (i = 0; i < 4; i++) {
+    key[sizeof(key) - 1] = (uint8_t)('0' + i);
+    topk_add(t, key, sizeof(key), i + 1);
+  }
+  n = topk_list(t, items);
+  if (n != 4 || items[0].count != 4 || items[0].keylen != sizeof(key)) {
+    log_error("Long keys listed %u, largest count %lu", n, items[0].count);
+    return DN_ERROR;
+  }
+
+  // topk_max keeps the largest values, smaller ones leave them alone.
+  topk_reset(t);
+  for (i = 0; i < 1000; i++) {
+    n = (uint32_t)dn_snprintf(key, sizeof(key), "big%u", i % 100);
+    topk_max(t, key, n, (uint64_t)i);
+  }
+  n = topk_list(t, items);
+  if (n != k || items[0].count != 999 || items[k - 1].count != 999 - k + 1) {
+    log_error("Largest values %lu to %lu", items[0].count,
+              items[n - 1].count);
+    return DN_ERROR;
+  }
+
+  topk_destroy(t);
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+#define TEST_HISTO_THREADS 4
+#define TEST_HISTO_VALUES 200000
+
+struct test_histo_thread {
+  pthread_t tid;
+  struct histo_recorder rec;
+};
+
+static void *test_histo_record(void *arg) {
+  struct test_histo_thread *t = arg;
+  uint64_t val;
+
+  for (val = 1; val <= TEST_HISTO_VALUES; val++) {
+    histo_add(&t->rec, val);
+  }
+  return NULL;
+}
+
+static rstatus_t test_histogram(void) {
+  print_banner("HISTOGRAM");
+  struct histogram histo;
+  struct histo_recorder rec;
+  uint64_t val, p;
+  uint32_t precision, i, index, last = 0;
+
+  // Every value lies in the bounds of its bucket, buckets grow with the
+  // value, and a bucket is at most 1/2^precision of its values wide.
+  for (precision = 1; precision <= HISTO_MAX_PRECISION; precision++) {
+    for (i = 0; i < 64 * 64; i++) {
+      val = (i / 64 < 63) ? (1ULL << (i / 64)) + (uint64_t)(i % 64) * 7919
+                          : UINT64_MAX - (uint64_t)(i % 64);
+      index = histo_index(precision, val);
+      if (index >= ((65 - precision) << precision) ||
+          val < histo_bucket_low(precision, index) ||
+          val > histo_bucket_high(precision, index) ||
+          (histo_bucket_high(precision, index) -
+           histo_bucket_low(precision, index)) >
+              (val >> precision)) {
+        log_error("Precision %u value %lu in bucket %u [%lu, %lu]", precision,
+                  val, index, histo_bucket_low(precision, index),
+                  histo_bucket_high(precision, index));
+        return DN_ERROR;
+      }
+    }
+    for (val = 0; val < 100000; val++) {
+      index = histo_index(precision, val);
+      if (index < last || index > last + 1) {
+        log_error("Precision %u value %lu went from bucket %u to %u",
+                  precision, val, last, index);
+        return DN_ERROR;
+      }
+      last = index;
+    }
+    last = 0;
+  }
+
+  // Percentiles of 1..100000 are within the precision of the real ones.
+  if (histo_init(&histo, HISTO_DEFAULT_PRECISION) != DN_OK ||
+      histo_recorder_init(&rec, HISTO_DEFAULT_PRECISION) != DN_OK) {
+    return DN_ENOMEM;
+  }
+  for (val = 1; val <= 100000; val++) {
+    histo_add(&rec, val);
+  }
+  histo_merge(&histo, &rec, 1, sizeof(rec));
+  histo_compute(&histo);
+  for (i = 1; i <= 1000; i++) {
+    p = histo_percentile(&histo, (double)i / 10.0);
+    val = (uint64_t)i * 100;
+    if (p < val || p > val + (val >> HISTO_DEFAULT_PRECISION)) {
+      log_error("Percentile %.1f is %lu, not %lu", (double)i / 10.0, p, val);
+      return DN_ERROR;
+    }
+  }
+  if (histo.count != 100000 || histo.mean != 50001 || histo.val_max != 100000) {
+    log_error("Count %lu mean %lu max %lu", histo.count, histo.mean,
+              histo.val_max);
+    return DN_ERROR;
+  }
+
+  // A reset starts a new window, into which later intervals are merged.
+  histo_reset(&histo);
+  histo_add(&rec, 7);
+  histo_merge(&histo, &rec, 1, sizeof(rec));
+  histo_compute(&histo);
+  histo_add(&rec, 9);
+  histo_merge(&histo, &rec, 1, sizeof(rec));
+  histo_compute(&histo);
+  if (histo.count != 2 || histo.mean != 8 || histo.val_max != 9 ||
+      histo_percentile(&histo, 50.0) != 7) {
+    log_error("After reset count %lu mean %lu max %lu", histo.count,
+              histo.mean, histo.val_max);
+    return DN_ERROR;
+  }
+
+  // Threads record into their own recorders while the histogram is merged
+  // and reset, and nothing is lost once they are done.
+  struct test_histo_thread threads[TEST_HISTO_THREADS];
+  histo_reset(&histo);
+  for (i = 0; i < TEST_HISTO_THREADS; i++) {
+    if (histo_recorder_init(&threads[i].rec, HISTO_DEFAULT_PRECISION) !=
+        DN_OK) {
+      return DN_ENOMEM;
+    }
+  }
+  for (i = 0; i < TEST_HISTO_THREADS; i++) {
+    if (pthread_create(&threads[i].tid, NULL, test_histo_record,
+                       &threads[i]) != 0) {
+      log_error("Failed to start histogram thread %u", i);
+      return DN_ERROR;
+    }
+  }
+  for (i = 0; i < 100; i++) {
+    histo_merge(&histo, &threads[0].rec, TEST_HISTO_THREADS,
+                sizeof(threads[0]));
+    histo_compute(&histo);
+    if (i % 10 == 0) {
+      histo_reset(&histo);
+    }
+  }
+  for (i = 0; i < TEST_HISTO_THREADS; i++) {
+    pthread_join(threads[i].tid, NULL);
+  }
+  histo_add(&threads[0].rec, TEST_HISTO_VALUES + 1);
+  histo_merge(&histo, &threads[0].rec, TEST_HISTO_THREADS, sizeof(threads[0]));
+  histo_compute(&histo);
+  if (histo.sum != (uint64_t)TEST_HISTO_THREADS * TEST_HISTO_VALUES *
+                           (TEST_HISTO_VALUES + 1) / 2 +
+                       TEST_HISTO_VALUES + 1 ||
+      histo.val_max != TEST_HISTO_VALUES + 1) {
+    log_error("Threads summed to %lu with max %lu", histo.sum,
+              histo.val_max);
+    return DN_ERROR;
+  }
+  for (val = 0, index = 0; index < histo.nbuckets; index++) {
+    val += histo.buckets[index];
+  }
+  if (val != (uint64_t)TEST_HISTO_THREADS * TEST_HISTO_VALUES + 1) {
+    log_error("Threads recorded %lu values", val);
+    return DN_ERROR;
+  }
+  for (i = 0; i < TEST_HISTO_THREADS; i++) {
+    histo_recorder_deinit(&threads[i].rec);
+  }
+
+  histo_recorder_deinit(&rec);
+  histo_deinit(&histo);
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+static rstatus_t test_redis_scan(void) {
+  print_banner("REDIS SCAN");
+  uint8_t buf[128], *cr;
+  uint32_t i, ndigit, room, len;
+  rstatus_t status;
+
+  // Every number of digits, with and without room for a word read after it.
+  for (i = 0; i < 10000; i++) {
+    uint32_t expected = (uint32_t)random() % 1000000000U;
+
+    ndigit = (uint32_t)snprintf((char *)buf, sizeof(buf), "%0*u",
+                                (int)(1 + i % 9), expected);
+    room = i % 12;
+    memset(buf + ndigit, 'x', room + 1);
+    buf[ndigit] = (i % 17 == 0) ? ' ' : CR;
+
+    len = 0;
+    status = redis_scan_len(buf, buf + ndigit + room, &len, &cr);
+    if (room == 0) {
+      if (status != DN_EAGAIN) {
+        log_error("Truncated '%.*s' scanned with status %d", ndigit, buf,
+                  status);
+        return DN_ERROR;
+      }
+    } else if (buf[ndigit] != CR) {
+      if (status != DN_ERROR) {
+        log_error("'%.*s' ended by a space scanned with status %d", ndigit,
+                  buf, status);
+        return DN_ERROR;
+      }
+    } else if (status != DN_OK || len != expected || cr != buf + ndigit) {
+      log_error("'%.*s' scanned as %u with status %d", ndigit, buf, len,
+                status);
+      return DN_ERROR;
+    }
+  }
+
+  memcpy(buf, "\r\n0123456789", 12);
+  len = 0;
+  if (redis_scan_len(buf, buf + 12, &len, &cr) != DN_ERROR) {
+    log_error("Length without digits scanned");
+    return DN_ERROR;
+  }
+
+  // The CR in every position of every buffer length, or none at all.
+  for (i = 0; i < 100; i++) {
+    uint32_t pos;
+
+    for (pos = 0; pos <= i; pos++) {
+      memset(buf, 'a', sizeof(buf));
+      if (pos < i) {
+        buf[pos] = CR;
+      }
+      buf[i] = CR;  // past the end, must not be found
+      cr = redis_scan_cr(buf, buf + i);
+      if (cr != (pos < i ? buf + pos : NULL)) {
+        log_error("CR at %u of %u found at %ld", pos, i,
+                  cr == NULL ? -1L : (long)(cr - buf));
+        return DN_ERROR;
+      }
+    }
+  }
+
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+static rstatus_t test_redis_cmd(void) {
+  print_banner("REDIS COMMANDS");
+  const struct redis_cmd *cmd, *found;
+  uint8_t name[64];
+  uint32_t i, j;
+  bool script;
+
+  // Every command, in lower and upper case. A miss means dyn_redis_cmd_hash.h
+  // is out of date: run dyn_redis_cmd_gen.py.
+  for (i = 0; i < redis_ncmd; i++) {
+    cmd = &redis_cmds[i];
+    script = (cmd->flags & REDIS_CMD_SCRIPT) != 0;
+    for (j = 0; j < cmd->len; j++) {
+      name[j] = (uint8_t)toupper(cmd->name[j]);
+    }
+
+    found = redis_cmd_lookup((const uint8_t *)cmd->name, cmd->len, script);
+    if (found != cmd ||
+        redis_cmd_lookup(name, cmd->len, script) != cmd) {
+      log_error("Command '%s' not found, regenerate dyn_redis_cmd_hash.h",
+                cmd->name);
+      return DN_ERROR;
+    }
+    if (redis_cmd_arity[cmd->type] != cmd->arity) {
+      log_error("Command '%s' has arity %d", cmd->name,
+                redis_cmd_arity[cmd->type]);
+      return DN_ERROR;
+    }
+  }
+
+  if (redis_cmd_lookup((const uint8_t *)"gets", 4, false) != NULL ||
+      redis_cmd_lookup((const uint8_t *)"ge", 2, false) != NULL ||
+      redis_cmd_lookup((const uint8_t *)"load", 4, false) != NULL ||
+      redis_cmd_lookup((const uint8_t *)"get", 3, true) != NULL) {
+    log_error("Unknown command found");
+    return DN_ERROR;
+  }
+
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+static rstatus_t test_replica_load(void) {
+  print_banner("REPLICA LOAD");
+  struct replica_load load;
+  uint32_t i;
+
+  // The first response time is taken as it is, later ones move the average
+  // an eighth of the way towards them.
+  memset(&load, 0, sizeof(load));
+  replica_load_add(&load, 800);
+  if (load.latency_us != 800 || load.updated_us == 0) {
+    log_error("First response time gave %" PRIu64, load.latency_us);
+    return DN_ERROR;
+  }
+  replica_load_add(&load, 1600);
+  replica_load_add(&load, 0);
+  if (load.latency_us != 788) {
+    log_error("Response times averaged to %" PRIu64, load.latency_us);
+    return DN_ERROR;
+  }
+
+  // A replica that slows down is seen as slow within a few dozen responses,
+  // and as fast again once it recovers.
+  for (i = 0; i < 40; i++) {
+    replica_load_add(&load, 50000);
+  }
+  if (load.latency_us < 45000 || load.latency_us > 50000) {
+    log_error("Slow replica averaged to %" PRIu64, load.latency_us);
+    return DN_ERROR;
+  }
+  for (i = 0; i < 40; i++) {
+    replica_load_add(&load, 500);
+  }
+  if (load.latency_us < 500 || load.latency_us > 5000) {
+    log_error("Recovered replica averaged to %" PRIu64, load.latency_us);
+    return DN_ERROR;
+  }
+
+  // Percentiles are the largest value of their bucket, and need a few dozen
+  // response times to go by.
+  memset(&load, 0, sizeof(load));
+  for (i = 0; i < 20; i++) {
+    replica_load_add(&load, 1000);
+  }
+  if (replica_load_percentile(&load, 50) != 0) {
+    log_error("Percentile of %" PRIu32 " response times", load.count);
+    return DN_ERROR;
+  }
+  for (i = 0; i < 75; i++) {
+    replica_load_add(&load, 1000);
+  }
+  for (i = 0; i < 5; i++) {
+    replica_load_add(&load, 20000);
+  }
+  if (replica_load_percentile(&load, 90) != 1023 ||
+      replica_load_percentile(&load, 99) != 20479) {
+    log_error("Percentiles p90 %" PRIu64 " p99 %" PRIu64,
+              replica_load_percentile(&load, 90),
+              replica_load_percentile(&load, 99));
+    return DN_ERROR;
+  }
+
+  // Older response times are halved away as new ones come in.
+  for (i = 0; i < 1000; i++) {
+    replica_load_add(&load, 100000);
+  }
+  if (load.count > 512 || replica_load_percentile(&load, 50) != 114687) {
+    log_error("Decayed p50 %" PRIu64 " of %" PRIu32,
+              replica_load_percentile(&load, 50), load.count);
+    return DN_ERROR;
+  }
+
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+static rstatus_t test_peer_limit(void) {
+  print_banner("PEER CONCURRENCY LIMIT");
+  struct node peer;
+  usec_t sent_us;
+  uint32_t i, limit;
+
+  // Nothing is limited with no maximum. Otherwise a peer starts at 32.
+  memset(&peer, 0, sizeof(peer));
+  if (peer_limit_of(&peer, 0) != 0 || peer.limit.limit != 0 ||
+      peer_limit_of(&peer, 1024) != 32 || !peer.limit.slow_start) {
+    log_error("Started at %" PRIu32, peer.limit.limit);
+    return DN_ERROR;
+  }
+
+  // The limit only grows while the peer has enough requests in flight, by
+  // one a response in slow start.
+  replica_load_add(&peer.load, 1000);
+  peer_limit_sample(NULL, &peer, 1024, 1000, dn_usec_now());
+  peer.limit.inflight = 32;
+  for (i = 0; i < 10; i++) {
+    replica_load_add(&peer.load, 1000);
+    peer_limit_sample(NULL, &peer, 1024, 1000, dn_usec_now());
+  }
+  if (peer.limit.limit != 42 || peer.limit.rtt_us != 1000) {
+    log_error("Slow start grew to %" PRIu32, peer.limit.limit);
+    return DN_ERROR;
+  }
+
+  // Slower responses cut the limit by a tenth once their average is past
+  // twice the baseline, here at the third, and once for all the requests
+  // that were in flight when it was cut.
+  sent_us = dn_usec_now();
+  for (i = 0; i < 10; i++) {
+    replica_load_add(&peer.load, 5000);
+    peer_limit_sample(NULL, &peer, 1024, 5000, sent_us);
+  }
+  if (peer.limit.limit != 44 * 9 / 10 || peer.limit.slow_start) {
+    log_error("Backed off to %" PRIu32, peer.limit.limit);
+    return DN_ERROR;
+  }
+  for (i = 0; i < 50; i++) {
+    replica_load_add(&peer.load, 5000);
+    peer_limit_sample(NULL, &peer, 1024, 5000, peer.limit.cut_us + 1);
+  }
+  if (peer.limit.limit != 4) {
+    log_error("Backed off to %" PRIu32 " in the end", peer.limit.limit);
+    return DN_ERROR;
+  }
+
+  // Once the peer recovers the limit grows by one a limit's worth of
+  // responses, and never past the maximum.
+  peer.limit.inflight = 0;
+  for (i = 0; i < 40; i++) {
+    replica_load_add(&peer.load, 1000);
+    peer_limit_sample(NULL, &peer, 1024, 1000, dn_usec_now());
+  }
+  peer.limit.inflight = 4;
+  for (limit = 4; limit < 6; limit++) {
+    for (i = 0; i < limit; i++) {
+      replica_load_add(&peer.load, 1000);
+      peer_limit_sample(NULL, &peer, 1024, 1000, dn_usec_now());
+    }
+    if (peer.limit.limit != limit + 1) {
+      log_error("Grew to %" PRIu32 " from %" PRIu32, peer.limit.limit, limit);
+      return DN_ERROR;
+    }
+  }
+  if (peer_limit_of(&peer, 5) != 5) {
+    log_error("Limit of %" PRIu32 " over a maximum of 5", peer.limit.limit);
+    return DN_ERROR;
+  }
+
+  // Peers in the local datacenter are not limited.
+  peer.is_same_dc = true;
+  if (peer_limit_of(&peer, 1024) != 0) {
+    log_error("Local peer limited to %" PRIu32, peer.limit.limit);
+    return DN_ERROR;
+  }
+
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+static void batch_ref(struct conn *conn, void *owner) { conn->owner = owner; }
+
+static void batch_send_done(struct context *unused, struct conn *conn,
+                            struct msg *req) {
+  TAILQ_REMOVE(&conn->imsg_q, req, s_tqe);
+  TAILQ_INSERT_TAIL(&conn->omsg_q, req, s_tqe);
+}
+
+struct conn_ops batch_ops = {
+    NULL,      NULL, NULL, NULL, req_send_next, batch_send_done, NULL, NULL,
+    batch_ref, NULL, NULL, NULL, NULL,          NULL,            NULL,
+};
+
+static int batch_sd;
+
+static void init_batch_conn(struct conn *conn) {
+  conn->type = CONN_SERVER;
+  conn->sd = batch_sd;
+  conn->ops = &batch_ops;
+  conn->connected = 1;
+}
+
+// Queues a request of 'len' bytes on the datastore connection.
+static rstatus_t batch_req(struct conn *conn, size_t len) {
+  struct msg *req = msg_get(conn, true, __FUNCTION__);
+  uint8_t fill[4096];
+  size_t n;
+
+  if (req == NULL) {
+    return DN_ENOMEM;
+  }
+  memset(fill, 'x', sizeof(fill));
+  for (; len > 0; len -= n) {
+    n = MIN(len, sizeof(fill));
+    THROW_STATUS(msg_append(req, fill, n));
+  }
+  TAILQ_INSERT_TAIL(&conn->imsg_q, req, s_tqe);
+  return DN_OK;
+}
+
+static rstatus_t test_server_batch(void) {
+  print_banner("DATASTORE BATCH");
+  struct server_pool *sp = &ctx->pool;
+  struct stats_counters *counters;
+  struct histo_recorder *batches;
+  struct datastore datastore;
+  struct conn *conn;
+  uint8_t buf[1024];
+  uint64_t sum;
+  uint32_t i;
+  int sv[2];
+
+  counters = dn_zalloc(sizeof(*counters));
+  if (counters == NULL) {
+    return DN_ENOMEM;
+  }
+  batches = &counters->histo[STATS_HISTO_datastore_batch];
+  THROW_STATUS(histo_recorder_init(batches, HISTO_DEFAULT_PRECISION));
+  ctx->stats_counters = counters;
+  ctx->evb = event_base_create(16, NULL);
+  if (ctx->evb == NULL || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 ||
+      dn_set_nonblocking(sv[0]) < 0 || dn_set_nonblocking(sv[1]) < 0) {
+    log_error("Failed to set up a datastore connection: %s", strerror(errno));
+    return DN_ERROR;
+  }
+  sp->ctx = ctx;
+  TAILQ_INIT(&sp->batch_conn_q);
+  TAILQ_INIT(&sp->ready_conn_q);
+  memset(&datastore, 0, sizeof(datastore));
+  datastore.owner = sp;
+  batch_sd = sv[0];
+  conn = conn_get(&datastore, init_batch_conn);
+  if (event_add_conn(ctx->evb, conn) < 0 || event_del_out(ctx->evb, conn) < 0) {
+    return DN_ERROR;
+  }
+
+  // One request at a time waits for the connection to be writable, as before
+  // batching.
+  sp->datastore_batch_size = 1;
+  THROW_STATUS(batch_req(conn, 14));
+  THROW_STATUS(server_send_queued(ctx, conn));
+  if (conn->batched || !conn->send_active) {
+    log_error("Batch size 1 did not wait for the connection to be writable");
+    return DN_ERROR;
+  }
+  THROW_STATUS(event_del_out(ctx->evb, conn));
+
+  // A batch takes datastore_batch_size requests in one write, the rest wait
+  // for the connection to be writable.
+  sp->datastore_batch_size = 2;
+  for (i = 0; i < 4; i++) {
+    THROW_STATUS(batch_req(conn, 14));
+  }
+  THROW_STATUS(server_send_queued(ctx, conn));
+  if (!conn->batched || conn->send_active) {
+    log_error("Batch size 2 did not batch the connection");
+    return DN_ERROR;
+  }
+  core_batch_flush(ctx);
+  if (conn->batched || TAILQ_COUNT(&conn->omsg_q) != 2 ||
+      TAILQ_COUNT(&conn->imsg_q) != 3 || batches->sum != 2 ||
+      read(sv[1], buf, sizeof(buf)) != 2 * 14) {
+    log_error("Batch sent %u requests, left %u", TAILQ_COUNT(&conn->omsg_q),
+              TAILQ_COUNT(&conn->imsg_q));
+    return DN_ERROR;
+  }
+  if (!conn->send_active) {
+    log_error("Requests left out of the batch were not armed to be sent");
+    return DN_ERROR;
+  }
+
+  // It stops taking requests once it holds SERVER_BATCH_BYTES.
+  THROW_STATUS(msg_send(ctx, conn));
+  while (read(sv[1], buf, sizeof(buf)) > 0) {
+  }
+  sp->datastore_batch_size = 100;
+  for (i = 0; i < 4; i++) {
+    THROW_STATUS(batch_req(conn, SERVER_BATCH_BYTES * 5 / 8));
+  }
+  sum = batches->sum;
+  THROW_STATUS(server_send_queued(ctx, conn));
+  core_batch_flush(ctx);
+  if (batches->sum - sum != 2 || TAILQ_COUNT(&conn->imsg_q) < 2 ||
+      !conn->send_active) {
+    log_error("Batch of %lu requests, left %u", batches->sum - sum,
+              TAILQ_COUNT(&conn->imsg_q));
+    return DN_ERROR;
+  }
+
+  sp->datastore_batch_size = 0;
+  conn->sd = -1;
+  close(sv[0]);
+  close(sv[1]);
+  event_base_destroy(ctx->evb);
+  ctx->evb = NULL;
+  ctx->stats_counters = NULL;
+  histo_recorder_deinit(batches);
+  dn_free(counters);
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+static rstatus_t test_payload_crc(struct node *server) {
+  print_banner("PAYLOAD CRC32C");
+  struct conn *conn = conn_get(server, init_peer_conn);
+  const uint8_t *check = (const uint8_t *)"123456789";
+  static uint8_t buf[3000];
+  uint32_t crc, i;
+
+  // the check value of crc32c, on both paths, and checksums carried on
+  if (crc32c(check, 9, 0) != 0xe3069283 || crc32c_sw(check, 9, 0) != 0xe3069283) {
+    log_error("crc32c of the check string is %08x", crc32c(check, 9, 0));
+    return DN_ERROR;
+  }
+  for (i = 0; i < sizeof(buf); i++) {
+    buf[i] = (uint8_t)(i * 131 + (i >> 3));
+  }
+  crc = crc32c(buf, sizeof(buf), 0);
+  for (i = 0; i < 64; i++) {
+    if (crc32c(buf + i, sizeof(buf) - i, crc32c(buf, i, 0)) != crc ||
+        crc32c_sw(buf + i, sizeof(buf) - i, crc32c_sw(buf, i, 0)) != crc) {
+      log_error("crc32c split at %u differs", i);
+      return DN_ERROR;
+    }
+  }
+
+  // a bulk reply read a few bytes at a time is checksummed as it is parsed
+  struct msg *msg = msg_get(conn, false, __FUNCTION__);
+  struct mbuf *mbuf = mbuf_get();
+  struct string hdr = string("$2000\r\n");
+  uint8_t *end;
+
+  STAILQ_INSERT_HEAD(&msg->mhdr, mbuf, next);
+  mbuf_copy(mbuf, hdr.data, hdr.len);
+  mbuf_copy(mbuf, buf, 2000);
+  mbuf_copy(mbuf, (uint8_t *)CRLF, CRLF_LEN);
+  end = mbuf->last;
+  crc = crc32c(mbuf->pos, mbuf_length(mbuf), 0);
+  msg->pos = mbuf->pos;
+  for (mbuf->last = mbuf->pos + 7;; mbuf->last = MIN(mbuf->last + 7, end)) {
+    redis_parse_rsp(msg, ctx);
+    if (msg->result != MSG_PARSE_AGAIN || mbuf->last == end) {
+      break;
+    }
+  }
+  if (msg->result != MSG_PARSE_OK || !msg->crc_done || msg->crc != crc ||
+      msg_payload_crc32(msg) != crc) {
+    log_error("Bulk reply parsed with result %d crc %08x", msg->result,
+              msg->crc);
+    return DN_ERROR;
+  }
+  msg->crc_done = 0;
+  if (msg_payload_crc32(msg) != crc) {
+    log_error("Bulk reply walked to crc %08x", msg_payload_crc32(msg));
+    return DN_ERROR;
+  }
+
+  // a token cut off by the end of the mbuf is checksummed once, after repair
+  struct string reply = string("*2\r\n$3\r\nfoo\r\n$3\r\nbar\r\n");
+  struct mbuf *nbuf;
+
+  crc = crc32c(reply.data, reply.len, 0);
+  msg = msg_get(conn, false, __FUNCTION__);
+  mbuf = mbuf_get();
+  STAILQ_INSERT_HEAD(&msg->mhdr, mbuf, next);
+  mbuf->pos = mbuf->last = mbuf->end - 15;
+  mbuf_copy(mbuf, reply.data, 15);
+  msg->pos = mbuf->pos;
+  redis_parse_rsp(msg, ctx);
+  if (msg->result != MSG_PARSE_REPAIR) {
+    log_error("Cut reply parsed with result %d", msg->result);
+    return DN_ERROR;
+  }
+  nbuf = mbuf_split(&msg->mhdr, msg->pos, NULL, NULL);
+  mbuf_insert(&msg->mhdr, nbuf);
+  msg->pos = nbuf->pos;
+  mbuf_copy(nbuf, reply.data + 15, reply.len - 15);
+  redis_parse_rsp(msg, ctx);
+  if (msg->result != MSG_PARSE_OK || msg->crc != crc) {
+    log_error("Repaired reply parsed with result %d crc %08x", msg->result,
+              msg->crc);
+    return DN_ERROR;
+  }
+
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
+// A response to a digest read, a value unless 'digest' is set.
+static struct msg *digest_read_rsp(struct conn *conn, const char *value,
+                                   bool digest) {
+  struct msg *rsp = msg_get(conn, false, __FUNCTION__);
+  struct mbuf *mbuf = mbuf_get();
+
+  mbuf_copy(mbuf, (uint8_t *)value, dn_strlen(value));
+  STAILQ_INSERT_HEAD(&rsp->mhdr, mbuf, next);
+  if (digest) {
+    rsp->dmsg = dmsg_get();
+    rsp->dmsg->flags = DMSG_FLAG_DIGEST;
+    rsp->dmsg->digest = crc32c(mbuf->pos, mbuf_length(mbuf), 0);
+  }
+  return rsp;
+}
+
+// The responses of a digest read from 'server', over 'conn', in three cases.
+static rstatus_t digest_full_read_cases(struct node *server,
+                                        struct conn *conn) {
+  struct msg *req = msg_get(conn, true, __FUNCTION__);
+  struct response_mgr *rspmgr = &req->rspmgr;
+  struct msg *full;
+
+  req->digest_read = 1;
+  req->consistency = DC_QUORUM;
+
+  // the local rack failed and two digests agree: one of them is read in full
+  init_response_mgr(req, rspmgr, 3, conn);
+  rspmgr_submit_response(rspmgr,
+                         msg_get_error(conn, PEER_CONNECTION_REFUSE, 0));
+  rspmgr_submit_response(rspmgr, digest_read_rsp(conn, "+foo\r\n", true));
+  rspmgr_submit_response(rspmgr, digest_read_rsp(conn, "+foo\r\n", true));
+  if (!rspmgr_check_is_done(rspmgr) || rspmgr_full_read_index(rspmgr) != 0 ||
+      rspmgr->digest_peers[0] != server) {
+    log_error("Digests that agree read digest %d in full",
+              rspmgr_full_read_index(rspmgr));
+    return DN_ERROR;
+  }
+  rspmgr_await_full_read(rspmgr, 0);
+  if (rspmgr_check_is_done(rspmgr) || req->awaiting_rsps != 1 ||
+      rspmgr_full_read_index(rspmgr) != -1) {
+    log_error("Full read is not awaited, %u responses", req->awaiting_rsps);
+    return DN_ERROR;
+  }
+  full = digest_read_rsp(conn, "+foo\r\n", false);
+  rspmgr_submit_response(rspmgr, full);
+  if (!rspmgr_check_is_done(rspmgr) || req->awaiting_rsps != 0 ||
+      rspmgr_get_response(ctx, rspmgr) != full) {
+    log_error("Value read in full is not returned");
+    return DN_ERROR;
+  }
+  rspmgr_free_other_responses(rspmgr, NULL);
+
+  // the value disagrees with every digest, and the full read fails: the
+  // value is all there is to return
+  init_response_mgr(req, rspmgr, 3, conn);
+  full = digest_read_rsp(conn, "+foo\r\n", false);
+  rspmgr_submit_response(rspmgr, full);
+  rspmgr_submit_response(rspmgr, digest_read_rsp(conn, "+bar\r\n", true));
+  rspmgr_submit_response(rspmgr, digest_read_rsp(conn, "+baz\r\n", true));
+  if (!rspmgr_check_is_done(rspmgr) || rspmgr_full_read_index(rspmgr) != 1) {
+    log_error("Digests that disagree read digest %d in full",
+              rspmgr_full_read_index(rspmgr));
+    return DN_ERROR;
+  }
+  rspmgr_await_full_read(rspmgr, 1);
+  rspmgr_submit_response(rspmgr,
+                         msg_get_error(conn, PEER_CONNECTION_REFUSE, 0));
+  if (!rspmgr_check_is_done(rspmgr) || !rspmgr->digests[1] ||
+      rspmgr_get_response(ctx, rspmgr) != full) {
+    log_error("Failed full read does not fall back to the value");
+    return DN_ERROR;
+  }
+  rspmgr_free_other_responses(rspmgr, NULL);
+
+  // a value that already has a quorum is not read again
+  init_response_mgr(req, rspmgr, 3, conn);
+  rspmgr_submit_response(rspmgr, digest_read_rsp(conn, "+foo\r\n", false));
+  rspmgr_submit_response(rspmgr, digest_read_rsp(conn, "+foo\r\n", true));
+  if (!rspmgr_check_is_done(rspmgr) || rspmgr_full_read_index(rspmgr) != -1) {
+    log_error("Digest read with a quorum is read in full");
+    return DN_ERROR;
+  }
+  rspmgr_free_other_responses(rspmgr, NULL);
+  return DN_OK;
+}
+
+static rstatus_t test_digest_full_read(struct node *server) {
+  print_banner("DIGEST FULL READ");
+  struct conn *conn = conn_get(server, init_peer_conn);
+  struct stats_counters *counters;
+  rstatus_t status;
+
+  counters = dn_zalloc(sizeof(*counters));
+  if (counters == NULL) {
+    return DN_ENOMEM;
+  }
+  set_datastore_ops();
+  ctx->stats_counters = counters;
+  ctx->pool.ctx = ctx;
+  server->owner = &ctx->pool;
+  conn->type = CONN_DNODE_PEER_SERVER;
+  conn->owner = server;
+
+  status = digest_full_read_cases(server, conn);
+
+  server->owner = NULL;
+  ctx->stats_counters = NULL;
+  dn_free(counters);
+  if (status != DN_OK) {
+    return status;
+  }
+  loga(".....SUCCESS...");
+  return DN_OK;
+}
+
 int main(int argc, char **argv) {
   // rstatus_t status;
   init_test(argc, argv);
@@ -679,6 +2022,60 @@ int main(int argc, char **argv) {
     goto err_out;
   }
 
+  ret = test_mbuf_size_classes();
+  if (ret != DN_OK) {
+    loga("Error in testing mbuf size classes!!!");
+    goto err_out;
+  }
+
+  ret = test_token_table();
+  if (ret != DN_OK) {
+    loga("Error in testing token table!!!");
+    goto err_out;
+  }
+
+  ret = test_timewheel();
+  if (ret != DN_OK) {
+    loga("Error in testing timing wheel!!!");
+    goto err_out;
+  }
+
+  ret = test_topk();
+  if (ret != DN_OK) {
+    loga("Error in testing top-k keys!!!");
+    goto err_out;
+  }
+
+  ret = test_histogram();
+  if (ret != DN_OK) {
+    loga("Error in testing histograms!!!");
+    goto err_out;
+  }
+
+  ret = test_replica_load();
+  if (ret != DN_OK) {
+    loga("Error in testing replica load!!!");
+    goto err_out;
+  }
+
+  ret = test_peer_limit();
+  if (ret != DN_OK) {
+    loga("Error in testing peer concurrency limits!!!");
+    goto err_out;
+  }
+
+  ret = test_redis_scan();
+  if (ret != DN_OK) {
+    loga("Error in testing redis scan!!!");
+    goto err_out;
+  }
+
+  ret = test_redis_cmd();
+  if (ret != DN_OK) {
+    loga("Error in testing redis commands!!!");
+    goto err_out;
+  }
+
   // ret = rsa_test();
   if (ret != DN_OK) {
     loga("Error in testing RSA !!!");
@@ -697,6 +2094,48 @@ int main(int argc, char **argv) {
     goto err_out;
   }
 
+  ret = test_msg_clone_sent(peer);
+  if (ret != DN_OK) {
+    loga("Error in testing copies of sent reads !!!");
+    goto err_out;
+  }
+
+  ret = test_compress(peer);
+  if (ret != DN_OK) {
+    loga("Error in testing compression !!!");
+    goto err_out;
+  }
+
+  ret = test_read_cache(peer);
+  if (ret != DN_OK) {
+    loga("Error in testing the read cache !!!");
+    goto err_out;
+  }
+
+  ret = test_dmsg_bin_header(peer);
+  if (ret != DN_OK) {
+    loga("Error in testing binary dmsg header !!!");
+    goto err_out;
+  }
+
+  ret = test_server_batch();
+  if (ret != DN_OK) {
+    loga("Error in testing datastore batches !!!");
+    goto err_out;
+  }
+
+  ret = test_payload_crc(peer);
+  if (ret != DN_OK) {
+    loga("Error in testing payload checksums !!!");
+    goto err_out;
+  }
+
+  ret = test_digest_full_read(peer);
+  if (ret != DN_OK) {
+    loga("Error in testing full reads of digests !!!");
+    goto err_out;
+  }
+
   loga("Testing is done!!!");
 err_out:
   return ret;
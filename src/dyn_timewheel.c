@@ -0,0 +1,279 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#include "dyn_timewheel.h"
+#include "dyn_util.h"
+
+/*
+ * A node in slot s of level n > 0 has its deadline in the s-th block of
+ * TW_SLOTS^n ticks, counted modulo TW_SLOTS, and is always between 1 and
+ * TW_SLOTS blocks ahead of the current tick. When the wheel reaches the start
+ * of that block the slot is emptied and its nodes are queued again, now on a
+ * lower level. Level 0 slots are single ticks and are moved to the expired
+ * list once their tick has passed.
+ *
+ * The busy bitmaps let timewheel_expire() skip straight to the next tick that
+ * has work to do, so an idle wheel costs nothing to advance.
+ */
+
+static inline uint64_t tw_rotr(uint64_t x, uint32_t n) {
+  n &= 63;
+  return n == 0 ? x : (x >> n) | (x << (64 - n));
+}
+
+void timewheel_node_init(struct tw_node *node) {
+  rbtree_node_init(&node->rbnode);
+  node->next = NULL;
+  node->pprev = NULL;
+  node->where = TW_NONE;
+  node->level = 0;
+  node->slot = 0;
+}
+
+void timewheel_init(struct timewheel *tw, msec_t now) {
+  memset(tw->slot, 0, sizeof(tw->slot));
+  memset(tw->busy, 0, sizeof(tw->busy));
+  tw->now = now;
+  tw->count = 0;
+  tw->expired = NULL;
+  tw->expired_tail = &tw->expired;
+  rbtree_init(&tw->overflow, &tw->overflow_sentinel);
+}
+
+static void tw_append_expired(struct timewheel *tw, struct tw_node *node) {
+  node->next = NULL;
+  node->pprev = tw->expired_tail;
+  *tw->expired_tail = node;
+  tw->expired_tail = &node->next;
+  node->where = TW_EXPIRED;
+}
+
+/* Links a node into the place its deadline calls for, relative to tw->now. */
+static void tw_queue(struct timewheel *tw, struct tw_node *node) {
+  msec_t deadline = node->rbnode.key;
+  struct tw_node **head;
+  uint64_t delta;
+  uint32_t level, slot;
+
+  if (deadline < tw->now) {
+    tw_append_expired(tw, node);
+    return;
+  }
+
+  delta = deadline - tw->now;
+  if (delta >= TW_RANGE) {
+    node->next = NULL;
+    node->pprev = NULL;
+    node->where = TW_OVERFLOW;
+    rbtree_insert(&tw->overflow, &node->rbnode);
+    return;
+  }
+
+  level = 0;
+  while (delta >= (1ULL << (TW_BITS * (level + 1)))) {
+    level++;
+  }
+  slot = (uint32_t)(deadline >> (TW_BITS * level)) & TW_MASK;
+
+  head = &tw->slot[level][slot];
+  node->next = *head;
+  if (node->next != NULL) {
+    node->next->pprev = &node->next;
+  }
+  *head = node;
+  node->pprev = head;
+  node->where = TW_WHEEL;
+  node->level = (uint8_t)level;
+  node->slot = (uint8_t)slot;
+  tw->busy[level] |= 1ULL << slot;
+}
+
+void timewheel_insert(struct timewheel *tw, struct tw_node *node,
+                      msec_t deadline) {
+  ASSERT(node->where == TW_NONE);
+
+  node->rbnode.key = deadline;
+  tw_queue(tw, node);
+  tw->count++;
+}
+
+void timewheel_delete(struct timewheel *tw, struct tw_node *node) {
+  switch (node->where) {
+    case TW_NONE:
+      return;
+
+    case TW_OVERFLOW: {
+      /* rbtree_delete() clears the node, keep what the owner put there */
+      msec_t key = node->rbnode.key, timeout = node->rbnode.timeout;
+      void *data = node->rbnode.data;
+
+      rbtree_delete(&tw->overflow, &node->rbnode);
+      node->rbnode.key = key;
+      node->rbnode.timeout = timeout;
+      node->rbnode.data = data;
+      break;
+    }
+
+    case TW_EXPIRED:
+      if (tw->expired_tail == &node->next) {
+        tw->expired_tail = node->pprev;
+      }
+      /* fall through */
+
+    case TW_WHEEL:
+      *node->pprev = node->next;
+      if (node->next != NULL) {
+        node->next->pprev = node->pprev;
+      }
+      if (node->where == TW_WHEEL &&
+          tw->slot[node->level][node->slot] == NULL) {
+        tw->busy[node->level] &= ~(1ULL << node->slot);
+      }
+      break;
+
+    default:
+      NOT_REACHED();
+  }
+
+  node->next = NULL;
+  node->pprev = NULL;
+  node->where = TW_NONE;
+  ASSERT(tw->count > 0);
+  tw->count--;
+}
+
+/* Returns the first tick >= tw->now with a slot to move, or UINT64_MAX. */
+static msec_t tw_next_tick(struct timewheel *tw) {
+  msec_t next = UINT64_MAX, tick;
+  struct rbnode *min;
+  uint32_t level;
+
+  for (level = 0; level < TW_LEVELS; level++) {
+    uint32_t shift = TW_BITS * level;
+    uint32_t cur = (uint32_t)(tw->now >> shift) & TW_MASK;
+    uint64_t d;
+
+    if (tw->busy[level] == 0) {
+      continue;
+    }
+
+    if ((tw->now & ((1ULL << shift) - 1)) == 0) {
+      /* the current slot is moved at tw->now */
+      d = (uint64_t)__builtin_ctzll(tw_rotr(tw->busy[level], cur));
+    } else {
+      /* the current slot was moved, it now holds the block TW_SLOTS ahead */
+      d = (uint64_t)__builtin_ctzll(tw_rotr(tw->busy[level], cur + 1)) + 1;
+    }
+    tick = ((tw->now >> shift) + d) << shift;
+    next = MIN(next, tick);
+  }
+
+  min = rbtree_min(&tw->overflow);
+  if (min != NULL) {
+    tick = min->key - TW_RANGE + 1;
+    next = MIN(next, MAX(tick, tw->now));
+  }
+
+  return next;
+}
+
+/* Moves the slots due at tick tw->now and steps to the next tick. */
+static void tw_tick(struct timewheel *tw) {
+  msec_t tick = tw->now;
+  struct tw_node *node, *next;
+  struct rbnode *min;
+  uint32_t slot;
+
+  if ((tick & TW_MASK) == 0) {
+    uint32_t level, top = 1;
+
+    while (top < TW_LEVELS - 1 &&
+           ((tick >> (TW_BITS * top)) & TW_MASK) == 0) {
+      top++;
+    }
+
+    for (level = top; level > 0; level--) {
+      slot = (uint32_t)(tick >> (TW_BITS * level)) & TW_MASK;
+      node = tw->slot[level][slot];
+      tw->slot[level][slot] = NULL;
+      tw->busy[level] &= ~(1ULL << slot);
+      for (; node != NULL; node = next) {
+        next = node->next;
+        tw_queue(tw, node);
+      }
+    }
+  }
+
+  while ((min = rbtree_min(&tw->overflow)) != NULL &&
+         min->key < tick + TW_RANGE) {
+    node = (struct tw_node *)min;
+    msec_t key = min->key, timeout = min->timeout;
+    void *data = min->data;
+
+    rbtree_delete(&tw->overflow, min);
+    min->key = key;
+    min->timeout = timeout;
+    min->data = data;
+    tw_queue(tw, node);
+  }
+
+  slot = (uint32_t)tick & TW_MASK;
+  node = tw->slot[0][slot];
+  tw->slot[0][slot] = NULL;
+  tw->busy[0] &= ~(1ULL << slot);
+  for (; node != NULL; node = next) {
+    next = node->next;
+    tw_append_expired(tw, node);
+  }
+
+  tw->now = tick + 1;
+}
+
+/*
+ * Advances the wheel to 'now' and removes and returns one node whose deadline
+ * is at or before 'now', or NULL if there is none. Nodes may be deleted
+ * between calls, including nodes that already expired.
+ */
+struct tw_node *timewheel_expire(struct timewheel *tw, msec_t now) {
+  struct tw_node *node;
+
+  while (tw->expired == NULL && tw->now <= now) {
+    msec_t next = tw_next_tick(tw);
+
+    if (next > now) {
+      tw->now = now + 1;
+      break;
+    }
+    tw->now = next;
+    tw_tick(tw);
+  }
+
+  node = tw->expired;
+  if (node != NULL) {
+    timewheel_delete(tw, node);
+  }
+
+  return node;
+}
+
+/*
+ * Returns the msec from 'now' until timewheel_expire() may have a node to
+ * return, or UINT64_MAX if the wheel is empty. Nodes on the upper levels are
+ * only known to the block they fall in, so this can be early but never late.
+ */
+msec_t timewheel_next(struct timewheel *tw, msec_t now) {
+  msec_t next;
+
+  if (tw->expired != NULL) {
+    return 0;
+  }
+
+  next = tw_next_tick(tw);
+  if (next == UINT64_MAX) {
+    return UINT64_MAX;
+  }
+
+  return next > now ? next - now : 0;
+}
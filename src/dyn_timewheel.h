@@ -0,0 +1,69 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#ifndef _DYN_TIMEWHEEL_H_
+#define _DYN_TIMEWHEEL_H_
+
+#include <stdbool.h>
+
+#include "dyn_rbtree.h"
+#include "dyn_types.h"
+
+/*
+ * Hierarchical timing wheel with millisecond ticks.
+ *
+ * TW_LEVELS wheels of TW_SLOTS slots each; level n slots span TW_SLOTS^n
+ * ticks, so the wheel covers deadlines up to TW_RANGE msec (about 4.6 hours)
+ * ahead. Insert and delete are O(1): a node is linked into the slot its
+ * deadline falls in, and moved one level down each time the wheel reaches the
+ * slot it sits in. Deadlines beyond TW_RANGE go to an overflow rbtree and move
+ * into the wheel once they come within range.
+ */
+#define TW_BITS 6
+#define TW_SLOTS (1U << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4
+#define TW_RANGE (1ULL << (TW_BITS * TW_LEVELS))
+
+typedef enum tw_where {
+  TW_NONE,     /* not queued */
+  TW_WHEEL,    /* in a wheel slot */
+  TW_OVERFLOW, /* in the overflow rbtree */
+  TW_EXPIRED,  /* in the expired list */
+} tw_where_t;
+
+struct tw_node {
+  struct rbnode rbnode;   /* deadline (key), timeout and data */
+  struct tw_node *next;   /* next node in slot or expired list */
+  struct tw_node **pprev; /* link that points to this node */
+  uint8_t where;          /* tw_where_t */
+  uint8_t level;          /* wheel level, if TW_WHEEL */
+  uint8_t slot;           /* wheel slot, if TW_WHEEL */
+};
+
+struct timewheel {
+  msec_t now;                                 /* next tick to process */
+  uint32_t count;                             /* # queued nodes */
+  uint64_t busy[TW_LEVELS];                   /* bitmap of non-empty slots */
+  struct tw_node *slot[TW_LEVELS][TW_SLOTS];  /* wheel slots */
+  struct tw_node *expired;                    /* nodes past their deadline */
+  struct tw_node **expired_tail;              /* end of expired list */
+  struct rbtree overflow;                     /* deadlines beyond TW_RANGE */
+  struct rbnode overflow_sentinel;            /* overflow rbtree sentinel */
+};
+
+void timewheel_init(struct timewheel *tw, msec_t now);
+void timewheel_node_init(struct tw_node *node);
+void timewheel_insert(struct timewheel *tw, struct tw_node *node,
+                      msec_t deadline);
+void timewheel_delete(struct timewheel *tw, struct tw_node *node);
+struct tw_node *timewheel_expire(struct timewheel *tw, msec_t now);
+msec_t timewheel_next(struct timewheel *tw, msec_t now);
+
+static inline bool timewheel_queued(const struct tw_node *node) {
+  return node->where != TW_NONE;
+}
+
+#endif /* _DYN_TIMEWHEEL_H_ */
@@ -0,0 +1,262 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dyn_dict.h"
+#include "dyn_topk.h"
+#include "dyn_util.h"
+
+/*
+ * Top-K keys of a stream with the space-saving algorithm of Metwally et al.
+ *
+ * At most k keys are tracked. A key that is not tracked takes the place of
+ * the one with the smallest count and inherits that count as its error, so
+ * any key whose weight is above total / k is always in the list. topk_max()
+ * instead keeps the k keys with the largest value seen.
+ *
+ * The entries sit in a min-heap on their count, which finds the smallest
+ * one, and in a chained hash table, which finds a key. Nothing is allocated
+ * after topk_create(). Callers serialize access.
+ */
+
+#define TOPK_NIL UINT32_MAX
+
+struct topk_entry {
+  struct topk_item item;
+  uint32_t hash;  /* hash of the whole key */
+  uint32_t heap;  /* index in the heap */
+  uint32_t next;  /* next entry in the bucket */
+};
+
+struct topk {
+  uint32_t k;                 /* entries at most */
+  uint32_t nentries;          /* entries in use */
+  uint32_t mask;              /* buckets - 1 */
+  struct topk_entry *entries; /* k entries */
+  uint32_t *heap;             /* entry indices, smallest count first */
+  uint32_t *buckets;          /* first entry of each bucket */
+};
+
+struct topk *topk_create(uint32_t k) {
+  struct topk *t;
+  uint32_t nbuckets = 1;
+
+  ASSERT(k > 0);
+  while (nbuckets < 2 * k) {
+    nbuckets <<= 1;
+  }
+
+  t = dn_zalloc(sizeof(*t));
+  if (t == NULL) {
+    return NULL;
+  }
+  t->k = k;
+  t->mask = nbuckets - 1;
+  t->entries = dn_zalloc(sizeof(*t->entries) * k);
+  t->heap = dn_alloc(sizeof(*t->heap) * k);
+  t->buckets = dn_alloc(sizeof(*t->buckets) * nbuckets);
+  if (t->entries == NULL || t->heap == NULL || t->buckets == NULL) {
+    topk_destroy(t);
+    return NULL;
+  }
+  topk_reset(t);
+  return t;
+}
+
+void topk_destroy(struct topk *t) {
+  if (t == NULL) {
+    return;
+  }
+  if (t->entries != NULL) {
+    dn_free(t->entries);
+  }
+  if (t->heap != NULL) {
+    dn_free(t->heap);
+  }
+  if (t->buckets != NULL) {
+    dn_free(t->buckets);
+  }
+  dn_free(t);
+}
+
+void topk_reset(struct topk *t) {
+  uint32_t i;
+
+  t->nentries = 0;
+  for (i = 0; i <= t->mask; i++) {
+    t->buckets[i] = TOPK_NIL;
+  }
+}
+
+static bool topk_match(struct topk_entry *e, uint32_t hash, const uint8_t *key,
+                       uint32_t keylen) {
+  return e->hash == hash && e->item.keylen == keylen &&
+         memcmp(e->item.key, key, MIN(keylen, TOPK_KEY_LEN)) == 0;
+}
+
+static struct topk_entry *topk_find(struct topk *t, uint32_t hash,
+                                    const uint8_t *key, uint32_t keylen) {
+  uint32_t i;
+
+  for (i = t->buckets[hash & t->mask]; i != TOPK_NIL; i = t->entries[i].next) {
+    if (topk_match(&t->entries[i], hash, key, keylen)) {
+      return &t->entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void topk_unlink(struct topk *t, struct topk_entry *e) {
+  uint32_t idx = (uint32_t)(e - t->entries);
+  uint32_t *p = &t->buckets[e->hash & t->mask];
+
+  while (*p != idx) {
+    p = &t->entries[*p].next;
+  }
+  *p = e->next;
+}
+
+static void topk_link(struct topk *t, struct topk_entry *e, uint32_t hash,
+                      const uint8_t *key, uint32_t keylen) {
+  uint32_t bucket = hash & t->mask;
+
+  e->hash = hash;
+  e->item.keylen = keylen;
+  memcpy(e->item.key, key, MIN(keylen, TOPK_KEY_LEN));
+  e->next = t->buckets[bucket];
+  t->buckets[bucket] = (uint32_t)(e - t->entries);
+}
+
+static uint64_t topk_heap_count(struct topk *t, uint32_t pos) {
+  return t->entries[t->heap[pos]].item.count;
+}
+
+static void topk_heap_swap(struct topk *t, uint32_t a, uint32_t b) {
+  uint32_t tmp = t->heap[a];
+
+  t->heap[a] = t->heap[b];
+  t->heap[b] = tmp;
+  t->entries[t->heap[a]].heap = a;
+  t->entries[t->heap[b]].heap = b;
+}
+
+static void topk_sift_up(struct topk *t, uint32_t pos) {
+  while (pos > 0) {
+    uint32_t parent = (pos - 1) / 2;
+    if (topk_heap_count(t, parent) <= topk_heap_count(t, pos)) {
+      break;
+    }
+    topk_heap_swap(t, parent, pos);
+    pos = parent;
+  }
+}
+
+static void topk_sift_down(struct topk *t, uint32_t pos) {
+  for (;;) {
+    uint32_t child = 2 * pos + 1;
+    if (child >= t->nentries) {
+      break;
+    }
+    if (child + 1 < t->nentries &&
+        topk_heap_count(t, child + 1) < topk_heap_count(t, child)) {
+      child++;
+    }
+    if (topk_heap_count(t, pos) <= topk_heap_count(t, child)) {
+      break;
+    }
+    topk_heap_swap(t, pos, child);
+    pos = child;
+  }
+}
+
+static void topk_insert(struct topk *t, uint32_t hash, const uint8_t *key,
+                        uint32_t keylen, uint64_t count) {
+  uint32_t pos = t->nentries++;
+  struct topk_entry *e = &t->entries[pos];
+
+  topk_link(t, e, hash, key, keylen);
+  e->item.count = count;
+  e->item.error = 0;
+  e->heap = pos;
+  t->heap[pos] = pos;
+  topk_sift_up(t, pos);
+}
+
+/* Give the entry with the smallest count to another key */
+static struct topk_entry *topk_replace_min(struct topk *t, uint32_t hash,
+                                           const uint8_t *key,
+                                           uint32_t keylen) {
+  struct topk_entry *e = &t->entries[t->heap[0]];
+
+  topk_unlink(t, e);
+  topk_link(t, e, hash, key, keylen);
+  return e;
+}
+
+void topk_add(struct topk *t, const uint8_t *key, uint32_t keylen,
+              uint64_t weight) {
+  uint32_t hash = dictGenHashFunction(key, keylen);
+  struct topk_entry *e = topk_find(t, hash, key, keylen);
+
+  if (e == NULL && t->nentries < t->k) {
+    topk_insert(t, hash, key, keylen, weight);
+    return;
+  }
+
+  if (e == NULL) {
+    e = topk_replace_min(t, hash, key, keylen);
+    e->item.error = e->item.count;
+  }
+  e->item.count += weight;
+  topk_sift_down(t, e->heap);
+}
+
+void topk_max(struct topk *t, const uint8_t *key, uint32_t keylen,
+              uint64_t value) {
+  uint32_t hash = dictGenHashFunction(key, keylen);
+  struct topk_entry *e = topk_find(t, hash, key, keylen);
+
+  if (e == NULL && t->nentries < t->k) {
+    topk_insert(t, hash, key, keylen, value);
+    return;
+  }
+
+  if (e == NULL) {
+    if (value <= topk_heap_count(t, 0)) {
+      return;
+    }
+    e = topk_replace_min(t, hash, key, keylen);
+    e->item.error = 0;
+  } else if (value <= e->item.count) {
+    return;
+  }
+  e->item.count = value;
+  topk_sift_down(t, e->heap);
+}
+
+static int topk_item_cmp(const void *a, const void *b) {
+  const struct topk_item *x = a, *y = b;
+
+  if (x->count != y->count) {
+    return x->count > y->count ? -1 : 1;
+  }
+  return 0;
+}
+
+/*
+ * Copy the tracked keys to items, which has room for k of them, largest count
+ * first. Returns how many were copied.
+ */
+uint32_t topk_list(struct topk *t, struct topk_item *items) {
+  uint32_t i;
+
+  for (i = 0; i < t->nentries; i++) {
+    items[i] = t->entries[i].item;
+  }
+  qsort(items, t->nentries, sizeof(*items), topk_item_cmp);
+  return t->nentries;
+}
@@ -0,0 +1,32 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#ifndef DYN_TOPK_H_
+#define DYN_TOPK_H_
+
+#include "dyn_types.h"
+
+/* Bytes of a key kept for reporting; longer keys are told apart by hash */
+#define TOPK_KEY_LEN 128
+
+struct topk;
+
+struct topk_item {
+  uint64_t count;            /* estimated weight, never below the real one */
+  uint64_t error;            /* most the count can be over the real one */
+  uint32_t keylen;           /* length of the whole key */
+  uint8_t key[TOPK_KEY_LEN]; /* first bytes of the key */
+};
+
+struct topk *topk_create(uint32_t k);
+void topk_destroy(struct topk *t);
+void topk_reset(struct topk *t);
+void topk_add(struct topk *t, const uint8_t *key, uint32_t keylen,
+              uint64_t weight);
+void topk_max(struct topk *t, const uint8_t *key, uint32_t keylen,
+              uint64_t value);
+uint32_t topk_list(struct topk *t, struct topk_item *items);
+
+#endif /* DYN_TOPK_H_ */
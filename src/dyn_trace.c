@@ -0,0 +1,208 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dyn_core.h"
+#include "dyn_trace.h"
+
+/*
+ * Sampled request tracing.
+ *
+ * A traced message carries a span, allocated when it starts being traced and
+ * filled in with the time of each hop as the message goes through it. Copies
+ * and fragments of a traced request get spans of their own with the same id,
+ * and so do requests that peers receive with an id in their dnode header.
+ * Once the message is put, its span goes to a ring shared by all threads, in
+ * which the newest TRACE_RING_SIZE spans are kept for /traces.
+ *
+ * Each slot of the ring has a sequence number, odd while a writer copies a
+ * span in. Writers take the next slot with an atomic increment and give up on
+ * the span if another writer, a whole lap ahead, still holds the slot. Readers
+ * copy a span out and keep it only if the sequence number was even and did
+ * not change meanwhile, so neither side ever waits for the other.
+ */
+
+struct trace_slot {
+  uint64_t seq;             /* odd while a span is being written */
+  struct trace_span span;
+};
+
+static struct trace_slot *trace_ring; /* NULL until trace_init() */
+static uint64_t trace_next;           /* slots taken since init */
+
+static __thread uint64_t trace_rand;      /* xorshift state, 0 until seeded */
+static __thread uint32_t trace_countdown; /* requests until the next sample */
+
+#define DEFINE_ACTION(_name, _desc) #_name,
+static const char *trace_hop_names[] = {TRACE_HOP_CODEC(DEFINE_ACTION)};
+#undef DEFINE_ACTION
+
+static const char *trace_kind_names[] = {"request", "fragment", "leg", "peer"};
+
+rstatus_t trace_init(void) {
+  trace_ring = dn_zalloc(sizeof(*trace_ring) * TRACE_RING_SIZE);
+  if (trace_ring == NULL) {
+    return DN_ENOMEM;
+  }
+  trace_next = 0;
+  return DN_OK;
+}
+
+void trace_deinit(void) {
+  if (trace_ring != NULL) {
+    dn_free(trace_ring);
+    trace_ring = NULL;
+  }
+}
+
+const char *trace_hop_name(trace_hop_t hop) {
+  ASSERT(hop < TRACE_NHOP);
+  return trace_hop_names[hop];
+}
+
+const char *trace_kind_name(trace_kind_t kind) {
+  ASSERT(kind < TRACE_NKIND);
+  return trace_kind_names[kind];
+}
+
+/* A random id, which tells apart the traces started on all nodes. */
+static uint64_t trace_id(void) {
+  if (trace_rand == 0) {
+    trace_rand = ((uint64_t)random() << 32) ^ (uint64_t)random() ^
+                 dn_usec_now() ^ ((uint64_t)getpid() << 16);
+    trace_rand |= 1;
+  }
+  trace_rand ^= trace_rand << 13;
+  trace_rand ^= trace_rand >> 7;
+  trace_rand ^= trace_rand << 17;
+  return trace_rand;
+}
+
+/* Start tracing a request with the given id, if it is not traced already. */
+void trace_start(struct msg *req, uint64_t id, trace_kind_t kind) {
+  struct trace_span *span;
+
+  ASSERT(id != 0);
+  if (req->trace != NULL) {
+    return;
+  }
+
+  span = dn_zalloc(sizeof(*span));
+  if (span == NULL) {
+    return;
+  }
+  span->id = id;
+  span->kind = (uint8_t)kind;
+  req->trace = span;
+}
+
+/*
+ * Trace one client request in 'rate', 0 being none. The sample is taken when
+ * the request is allocated, which is also when it starts to be read.
+ */
+void trace_sample(struct msg *req, uint32_t rate) {
+  if (rate == 0) {
+    return;
+  }
+  if (trace_countdown > 1) {
+    trace_countdown--;
+    return;
+  }
+  trace_countdown = rate;
+
+  trace_start(req, trace_id(), TRACE_REQUEST);
+  trace_hop(req, TRACE_client_recv);
+}
+
+/* Trace a copy or a fragment of a traced request as part of the same trace. */
+void trace_fork(struct msg *req, struct msg *child, trace_kind_t kind) {
+  if (req->trace == NULL || child == req) {
+    return;
+  }
+  trace_start(child, req->trace->id, kind);
+}
+
+/* Hand the span of a request over to the request it is rewritten into. */
+void trace_move(struct msg *from, struct msg *to) {
+  if (from == to || from->trace == NULL || to->trace != NULL) {
+    return;
+  }
+  to->trace = from->trace;
+  from->trace = NULL;
+}
+
+/* Record the datastore or peer a traced request is queued to. */
+void trace_target(struct msg *req, const struct string *name, uint16_t port) {
+  if (req->trace == NULL) {
+    return;
+  }
+  dn_scnprintf(req->trace->target, sizeof(req->trace->target), "%.*s:%" PRIu16,
+               name->len, name->data, port);
+}
+
+/*
+ * Publish the span of a request that is being put, and free it. A span is
+ * dropped if it finds its slot still being written a lap earlier.
+ */
+void trace_finish(struct msg *req) {
+  struct trace_span *span = req->trace;
+  struct trace_slot *slot;
+  uint64_t seq;
+
+  if (span == NULL) {
+    return;
+  }
+  req->trace = NULL;
+
+  if (trace_ring != NULL) {
+    span->type = (uint32_t)req->type;
+    slot = &trace_ring[__atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED) &
+                       (TRACE_RING_SIZE - 1)];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) == 0 &&
+        __atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      memcpy(&slot->span, span, sizeof(*span));
+      __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    }
+  }
+
+  dn_free(span);
+}
+
+/*
+ * Copy the spans in the ring to 'spans', which has room for TRACE_RING_SIZE
+ * of them, oldest first. Returns how many were copied.
+ */
+uint32_t trace_collect(struct trace_span *spans) {
+  uint64_t next, seq;
+  uint32_t i, n = 0;
+
+  if (trace_ring == NULL) {
+    return 0;
+  }
+
+  next = __atomic_load_n(&trace_next, __ATOMIC_RELAXED);
+  for (i = 0; i < TRACE_RING_SIZE; i++) {
+    struct trace_slot *slot = &trace_ring[(next + i) & (TRACE_RING_SIZE - 1)];
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == 0 || (seq & 1) != 0) {
+      continue;
+    }
+    memcpy(&spans[n], &slot->span, sizeof(spans[n]));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+      continue;
+    }
+    n++;
+  }
+
+  return n;
+}
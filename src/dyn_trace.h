@@ -0,0 +1,85 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#ifndef DYN_TRACE_H_
+#define DYN_TRACE_H_
+
+#include "dyn_types.h"
+#include "dyn_util.h"
+
+/* Spans kept for /traces, a power of two */
+#define TRACE_RING_SIZE 1024
+
+/* Bytes of the name:port a span went to */
+#define TRACE_TARGET_LEN 64
+
+struct msg;
+struct string;
+
+/*
+ * ACTION(name, description)
+ *
+ * Hops a traced request goes through, in order. A span has those of the hops
+ * that happened on this node to its message.
+ */
+#define TRACE_HOP_CODEC(ACTION)                                               \
+  ACTION(client_recv, "first bytes of the request read from the client")      \
+  ACTION(peer_recv, "dnode header of the request read from the peer")         \
+  ACTION(parse_done, "request parsed")                                        \
+  ACTION(enqueue, "queued to the datastore or peer connection")               \
+  ACTION(send, "written to the datastore or peer")                            \
+  ACTION(reply, "response read from the datastore or peer")                  \
+  ACTION(quorum, "response chosen for the client, once enough are in")        \
+  ACTION(client_send, "response written to the client or peer that asked")
+
+#define DEFINE_ACTION(_name, _desc) TRACE_##_name,
+typedef enum trace_hop {
+  TRACE_HOP_CODEC(DEFINE_ACTION) TRACE_NHOP
+} trace_hop_t;
+#undef DEFINE_ACTION
+
+typedef enum trace_kind {
+  TRACE_REQUEST,  /* request of a client, on the node it connected to */
+  TRACE_FRAGMENT, /* one of the requests a multi-key request is split into */
+  TRACE_LEG,      /* copy of a request sent to another rack or datacenter */
+  TRACE_PEER,     /* request received from a peer */
+  TRACE_NKIND
+} trace_kind_t;
+
+/*
+ * What one message of a traced request went through on this node. The id is
+ * carried to peers in the dnode header, so the spans of one request on all
+ * the nodes it touched share it. Hop times are wall clock microseconds, 0 for
+ * the hops the message did not go through.
+ */
+struct trace_span {
+  uint64_t id;                  /* trace id, never 0 */
+  uint8_t kind;                 /* trace_kind_t */
+  uint32_t type;                /* msg_type_t of the request */
+  usec_t hops[TRACE_NHOP];      /* when each hop happened */
+  char target[TRACE_TARGET_LEN]; /* datastore or peer it went to, if any */
+};
+
+/* Record when a hop of a traced request happened. */
+#define trace_hop(_req, _hop)                                   \
+  do {                                                          \
+    if ((_req)->trace != NULL) {                                \
+      (_req)->trace->hops[_hop] = dn_usec_now();                \
+    }                                                           \
+  } while (0)
+
+rstatus_t trace_init(void);
+void trace_deinit(void);
+void trace_sample(struct msg *req, uint32_t rate);
+void trace_start(struct msg *req, uint64_t id, trace_kind_t kind);
+void trace_fork(struct msg *req, struct msg *child, trace_kind_t kind);
+void trace_move(struct msg *from, struct msg *to);
+void trace_target(struct msg *req, const struct string *name, uint16_t port);
+void trace_finish(struct msg *req);
+uint32_t trace_collect(struct trace_span *spans);
+const char *trace_hop_name(trace_hop_t hop);
+const char *trace_kind_name(trace_kind_t kind);
+
+#endif /* DYN_TRACE_H_ */
@@ -58,6 +58,10 @@
 #define DN_HAVE_BACKTRACE 1
 #endif
 
+#if defined(HAVE_SPLICE) && defined(HAVE_PIPE2)
+#define DN_HAVE_SPLICE 1
+#endif
+
 
 #define DN_NOOPS 1
 #define DN_OK 0
@@ -92,6 +96,11 @@ typedef enum {
   SECURE_OPTION_ALL,
 } secure_server_option_t;
 
+typedef enum {
+  SECURE_CIPHER_AES_CBC,
+  SECURE_CIPHER_AES_GCM,
+} secure_cipher_t;
+
 struct array;
 struct string;
 struct context;
@@ -74,6 +74,25 @@ int dn_set_reuseaddr(int sd) {
   return setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, len);
 }
 
+/*
+ * Allow several listening sockets to bind the same address so that the
+ * kernel load balances accepted connections between them.
+ */
+int dn_set_reuseport(int sd) {
+#ifdef SO_REUSEPORT
+  int reuse;
+  socklen_t len;
+
+  reuse = 1;
+  len = sizeof(reuse);
+
+  return setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &reuse, len);
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
 int dn_set_keepalive(int sd, int val) {
   return setsockopt(sd, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
 }
@@ -169,6 +188,46 @@ int dn_get_rcvbuf(int sd) {
   return size;
 }
 
+/*
+ * Returns the number of bytes that can be read from 'sd' without blocking.
+ */
+int dn_get_nread(int sd) {
+  int status, n;
+
+  n = 0;
+  status = ioctl(sd, FIONREAD, &n);
+  if (status < 0) {
+    return status;
+  }
+
+  return n;
+}
+
+/*
+ * Creates a non-blocking pipe and asks the kernel for a 'size' byte buffer.
+ * Getting a smaller buffer is not an error, callers must cope with the pipe
+ * filling up.
+ */
+int dn_pipe(int fd[2], int size) {
+#ifdef DN_HAVE_SPLICE
+  int status;
+
+  status = pipe2(fd, O_NONBLOCK | O_CLOEXEC);
+  if (status < 0) {
+    return status;
+  }
+
+#ifdef F_SETPIPE_SZ
+  (void)fcntl(fd[1], F_SETPIPE_SZ, size);
+#endif
+
+  return 0;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
 int _dn_atoi(uint8_t *line, size_t n) {
   int value;
 
@@ -93,6 +93,7 @@ struct argpos;
 int dn_set_blocking(int sd);
 int dn_set_nonblocking(int sd);
 int dn_set_reuseaddr(int sd);
+int dn_set_reuseport(int sd);
 int dn_set_keepalive(int sd, int val);
 int dn_set_tcpnodelay(int sd);
 int dn_set_linger(int sd, int timeout);
@@ -101,6 +102,8 @@ int dn_set_rcvbuf(int sd, int size);
 int dn_get_soerror(int sd);
 int dn_get_sndbuf(int sd);
 int dn_get_rcvbuf(int sd);
+int dn_get_nread(int sd);
+int dn_pipe(int fd[2], int size);
 
 int _dn_atoi(uint8_t *line, size_t n);
 uint32_t _dn_atoui(uint8_t *line, size_t n);
@@ -28,6 +28,7 @@
 #include <dyn_dnode_peer.h>
 #include <dyn_server.h>
 #include <dyn_vnode.h>
+#include <hashkit/dyn_token_table.h>
 
 
 // Similar to strcmp() but compares 2 'dyn_token' structs instead.
@@ -37,12 +38,48 @@ static int vnode_item_cmp(const void *t1, const void *t2) {
   return cmp_dyn_token(ct1->token, ct2->token);
 }
 
+// Rebuilds the rack's flat token table from its sorted continuum. Racks with
+// tokens wider than 32 bits get no table and fall back to vnode_dispatch().
+static rstatus_t vnode_rack_build_table(struct rack *rack) {
+  struct token_table *table;
+  uint32_t i;
+
+  vnode_rack_deinit(rack);
+
+  if (rack->ncontinuum == 0) {
+    return DN_OK;
+  }
+
+  table = token_table_create(rack->ncontinuum);
+  if (table == NULL) {
+    return DN_ENOMEM;
+  }
+
+  for (i = 0; i < rack->ncontinuum; i++) {
+    struct continuum *c = (struct continuum*) array_get(&rack->continuums, i);
+    if (!token_table_value(c->token, &table->entry[i].value)) {
+      log_debug(LOG_INFO, "rack '%.*s' has wide tokens, using binary search",
+                rack->name->len, rack->name->data);
+      token_table_destroy(table);
+      return DN_OK;
+    }
+    table->entry[i].owner = c->index;
+  }
+
+  token_table_index(table);
+  rack->table = table;
+
+  return DN_OK;
+}
+
 // Sorts the continuum for a rack based on their tokens.
 static rstatus_t vnode_rack_verify_continuum(void *elem) {
   struct rack *rack = elem;
   qsort(rack->continuums.elem, rack->ncontinuum, sizeof(struct continuum),
         vnode_item_cmp);
 
+  THROW_STATUS(vnode_rack_build_table(rack));
+
   log_debug(LOG_VERB, "**** printing continuums for rack '%.*s'",
             rack->name->len, rack->name->data);
   uint32_t i;
@@ -149,3 +186,20 @@ uint32_t vnode_dispatch(struct array *continuums, uint32_t ncontinuum,
 
   return right->index;
 }
+
+uint32_t vnode_dispatch_rack(struct rack *rack, struct dyn_token *token) {
+  uint32_t value;
+
+  if (rack->table != NULL && token_table_value(token, &value)) {
+    return token_table_dispatch(rack->table, value);
+  }
+
+  return vnode_dispatch(&rack->continuums, rack->ncontinuum, token);
+}
+
+void vnode_rack_deinit(struct rack *rack) {
+  if (rack->table != NULL) {
+    token_table_destroy(rack->table);
+    rack->table = NULL;
+  }
+}
@@ -14,3 +14,10 @@ rstatus_t vnode_update(struct server_pool *pool);
 // If 'token' falls into interval (a,b], we return b.
 uint32_t vnode_dispatch(struct array *continuums, uint32_t ncontinuum,
                         struct dyn_token *token);
+
+// Same as vnode_dispatch() over the rack's continuums, but answered from the
+// rack's flat token table when every token in the ring fits in 32 bits.
+uint32_t vnode_dispatch_rack(struct rack *rack, struct dyn_token *token);
+
+// Frees the rack's token table.
+void vnode_rack_deinit(struct rack *rack);
@@ -0,0 +1,175 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2019 Netflix, Inc.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "dyn_conf.h"
+#include "dyn_core.h"
+#include "dyn_dnode_msg.h"
+#include "dyn_dnode_peer.h"
+#include "dyn_proxy.h"
+#include "dyn_server.h"
+#include "dyn_task.h"
+#include "dyn_worker.h"
+#include "event/dyn_event.h"
+
+/**
+ * Worker threads let a single dynomite process use more than one core.
+ *
+ * With "worker_threads: N" the main context keeps doing everything it always
+ * did (dnode listener, gossip, stats, admin) and N - 1 worker contexts are
+ * added next to it. Every worker owns:
+ * - an event base,
+ * - a client listener bound to the same address with SO_REUSEPORT, so the
+ *   kernel spreads accepted client connections over all N listeners,
+ * - a server pool with its own datastore and peer connection pools,
+ * - thread local mbuf/msg/conn free lists, timeout rbtree and task manager.
+ *
+ * A client connection and everything it fans out to therefore stays on one
+ * thread for its whole life and the request path takes no locks. The
+ * configuration and the stats object are shared with the main context. The
+ * topology is static (gossip must be disabled) since workers build their peer
+ * list from the configured seeds.
+ */
+
+/*
+ * Stop taking client connections on a worker whose event loop is gone. Its
+ * listener would otherwise stay bound, and the kernel would keep handing it
+ * a share of the new connections that nobody accepts.
+ */
+static void worker_abandon(struct context *ctx) {
+  struct conn *p = ctx->pool.p_conn;
+
+  if (p != NULL && p->sd > 0) {
+    close(p->sd);
+    p->sd = -1;
+  }
+  log_error("worker %" PRIu32 " closed its client listener",
+            ctx->worker_id);
+}
+
+static void *worker_loop(void *arg) {
+  struct context *ctx = arg;
+  rstatus_t status;
+
+  status = worker_thread_init(ctx);
+  if (status != DN_OK) {
+    log_error("worker %" PRIu32 " failed to initialize", ctx->worker_id);
+    worker_abandon(ctx);
+    return NULL;
+  }
+
+  IGNORE_RET_VAL(server_pool_preconnect(ctx));
+  IGNORE_RET_VAL(dnode_peer_pool_preconnect(ctx));
+
+  log_notice("worker %" PRIu32 " running", ctx->worker_id);
+
+  for (;;) {
+    status = core_loop(ctx);
+    if (status != DN_OK) {
+      break;
+    }
+  }
+
+  log_error("worker %" PRIu32 " event loop exited", ctx->worker_id);
+  worker_abandon(ctx);
+  return NULL;
+}
+
+static rstatus_t worker_ctx_init(struct context *ctx,
+                                 struct context *main_ctx,
+                                 uint32_t worker_id) {
+  ctx->instance = main_ctx->instance;
+  ctx->cf = main_ctx->cf;
+  ctx->stats = main_ctx->stats;
+  ctx->stats_counters = stats_thread_counters(main_ctx->stats, worker_id);
+  ctx->entropy = NULL;
+  ctx->max_timeout = main_ctx->max_timeout;
+  ctx->timeout = ctx->max_timeout;
+  ctx->dyn_state = main_ctx->dyn_state;
+  ctx->admin_opt = main_ctx->admin_opt;
+  ctx->worker_id = worker_id;
+
+  THROW_STATUS(server_pool_init(&ctx->pool, &ctx->cf->pool, ctx));
+
+  ctx->evb = event_base_create(EVENT_SIZE, &core_core);
+  if (ctx->evb == NULL) {
+    log_error("worker %" PRIu32 " failed to create event base", worker_id);
+    return DN_ERROR;
+  }
+
+  THROW_STATUS(proxy_init(ctx));
+  THROW_STATUS(dnode_initialize_peers(ctx));
+  preselect_remote_rack_for_replication(ctx);
+  core_set_local_state(ctx, main_ctx->dyn_state);
+
+  return DN_OK;
+}
+
+rstatus_t worker_start(struct context *ctx) {
+  uint32_t nworker = (uint32_t)ctx->cf->pool.worker_threads;
+  struct context *workers;
+  uint32_t worker_id;
+
+  if (nworker <= 1) {
+    return DN_OK;
+  }
+
+  /* worker contexts live as long as the process */
+  workers = dn_zalloc(sizeof(struct context) * (nworker - 1));
+  if (workers == NULL) {
+    return DN_ENOMEM;
+  }
+
+  /* build every context before any thread runs, server_pool_init() sets
+   * process wide settings */
+  for (worker_id = 1; worker_id < nworker; worker_id++) {
+    rstatus_t status = worker_ctx_init(&workers[worker_id - 1], ctx, worker_id);
+    if (status != DN_OK) {
+      log_error("failed to create worker %" PRIu32, worker_id);
+      for (; worker_id > 0; worker_id--) {
+        worker_abandon(&workers[worker_id - 1]);
+      }
+      return status;
+    }
+  }
+
+  for (worker_id = 1; worker_id < nworker; worker_id++) {
+    struct context *wctx = &workers[worker_id - 1];
+    pthread_t tid;
+    int pthread_status = pthread_create(&tid, NULL, worker_loop, wctx);
+    if (pthread_status != 0) {
+      log_error("worker %" PRIu32 " create failed: %s", worker_id,
+                strerror(pthread_status));
+      for (; worker_id < nworker; worker_id++) {
+        worker_abandon(&workers[worker_id - 1]);
+      }
+      return DN_ERROR;
+    }
+    pthread_detach(tid);
+  }
+
+  loga("started %" PRIu32 " event loop threads", nworker);
+  return DN_OK;
+}
+
+rstatus_t worker_thread_init(struct context *ctx) {
+  conn_init();
+  task_mgr_init();
+  mbuf_thread_init();
+  msg_thread_init();
+  dmsg_init();
+  THROW_STATUS(crypto_thread_init(&ctx->pool));
+  return DN_OK;
+}
+
+void worker_sync_state(struct context *ctx) {
+  dyn_state_t state = ctx->instance->ctx->dyn_state;
+
+  if (ctx->dyn_state != state) {
+    core_set_local_state(ctx, state);
+  }
+}
@@ -0,0 +1,26 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2019 Netflix, Inc.
+ */
+
+#ifndef _DYN_WORKER_H_
+#define _DYN_WORKER_H_
+
+#include "dyn_types.h"
+
+struct context;
+
+/* Start the additional event loop threads requested through
+ * "worker_threads:". Does nothing when only one thread is configured.
+ */
+rstatus_t worker_start(struct context *ctx);
+
+/* Initialize the per-thread state (free lists, timeout rbtree, task manager
+ * and cipher contexts) of the calling event loop thread.
+ */
+rstatus_t worker_thread_init(struct context *ctx);
+
+/* Mirror the node state set on the main context into a worker context */
+void worker_sync_state(struct context *ctx);
+
+#endif /* _DYN_WORKER_H_ */
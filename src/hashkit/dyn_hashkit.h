@@ -23,6 +23,8 @@
 #ifndef _DYN_HASHKIT_H_
 #define _DYN_HASHKIT_H_
 
+#include <stdbool.h>
+
 #include "../dyn_types.h"
 
 // Forward declarations
@@ -36,6 +38,9 @@ void md5_signature(const unsigned char *key, unsigned int length,
                    unsigned char *result);
 
 uint32_t crc32_sz(const char *buf, size_t length, uint32_t in_crc32);
+uint32_t crc32c(const uint8_t *buf, size_t len, uint32_t in_crc);
+uint32_t crc32c_sw(const uint8_t *buf, size_t len, uint32_t in_crc);
+bool crc32c_hw_available(void);
 
 #define HASH_CODEC(ACTION)                  \
   ACTION(HASH_ONE_AT_A_TIME, one_at_a_time) \
@@ -0,0 +1,93 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#include "dyn_token_table.h"
+#include "../dyn_log.h"
+#include "../dyn_util.h"
+#include "dyn_token.h"
+
+/*
+ * Converts a token to the 32-bit integer it orders as. Hashed keys always fit
+ * (see set_int_dyn_token()); configured tokens wider than 32 bits do not, and
+ * rings containing them must use the binary search instead.
+ */
+bool token_table_value(const struct dyn_token *token, uint32_t *value) {
+  if (token->signum == 0) {
+    *value = 0;
+    return true;
+  }
+
+  if (token->signum == 1 && token->len == 1 && token->mag[0] != 0) {
+    *value = token->mag[0];
+    return true;
+  }
+
+  return false;
+}
+
+/*
+ * Allocates a table with room for 'nentry' entries. The caller fills entry[]
+ * in ascending order of value and then calls token_table_index().
+ */
+struct token_table *token_table_create(uint32_t nentry) {
+  struct token_table *table;
+  uint32_t bits, nbucket;
+  size_t size;
+
+  ASSERT(nentry != 0);
+
+  bits = TOKEN_TABLE_MIN_BITS;
+  while (bits < TOKEN_TABLE_MAX_BITS && (1U << bits) < 2 * nentry) {
+    bits++;
+  }
+  nbucket = 1U << bits;
+
+  // Entries first so they stay 8-byte aligned, then the bucket offsets.
+  size = sizeof(*table) + nentry * sizeof(struct token_entry) +
+         (nbucket + 1) * sizeof(uint32_t);
+  table = dn_alloc(size);
+  if (table == NULL) {
+    return NULL;
+  }
+
+  table->shift = 32 - bits;
+  table->nentry = nentry;
+  table->entry = (struct token_entry *)(table + 1);
+  table->bucket = (uint32_t *)(table->entry + nentry);
+
+  return table;
+}
+
+void token_table_index(struct token_table *table) {
+  uint32_t nbucket = 1U << (32 - table->shift);
+  uint32_t b, i;
+
+  for (b = 0, i = 0; b <= nbucket; b++) {
+    while (i < table->nentry && (table->entry[i].value >> table->shift) < b) {
+      ASSERT(i == 0 || table->entry[i - 1].value <= table->entry[i].value);
+      i++;
+    }
+    table->bucket[b] = i;
+  }
+}
+
+uint32_t token_table_dispatch(const struct token_table *table, uint32_t value) {
+  uint32_t b = value >> table->shift;
+  uint32_t i = table->bucket[b], end = table->bucket[b + 1];
+
+  while (i < end && table->entry[i].value < value) {
+    i++;
+  }
+
+  // Either an entry in this bucket, the first entry of a later bucket, or
+  // past the end of the ring.
+  if (i == table->nentry) {
+    i = 0;
+  }
+
+  return table->entry[i].owner;
+}
+
+void token_table_destroy(struct token_table *table) { dn_free(table); }
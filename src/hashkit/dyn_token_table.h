@@ -0,0 +1,51 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#ifndef _DYN_TOKEN_TABLE_H_
+#define _DYN_TOKEN_TABLE_H_
+
+#include <stdbool.h>
+#include "../dyn_types.h"
+
+// Forward declarations
+struct dyn_token;
+
+#define TOKEN_TABLE_MIN_BITS 4
+#define TOKEN_TABLE_MAX_BITS 16
+
+struct token_entry {
+  uint32_t value; /* token as a 32-bit integer */
+  uint32_t owner; /* dyn_peer index */
+};
+
+/*
+ * Flat lookup table for a token ring whose tokens all fit in 32 bits.
+ *
+ * The ring is kept as one sorted entry[] array plus a direct-index bucket[]
+ * array keyed by the top bits of the token: bucket[b] is the position of the
+ * first entry whose value has prefix >= b. The table is sized so that a bucket
+ * holds about half an entry on average, so routing a token reads bucket[b],
+ * bucket[b + 1] and usually a single entry, all from one allocation.
+ */
+struct token_table {
+  uint32_t shift;            /* 32 - log2(# buckets) */
+  uint32_t nentry;           /* # entries */
+  uint32_t *bucket;          /* # buckets + 1 offsets into entry[] */
+  struct token_entry *entry; /* entries sorted by value */
+};
+
+bool token_table_value(const struct dyn_token *token, uint32_t *value);
+struct token_table *token_table_create(uint32_t nentry);
+void token_table_index(struct token_table *table);
+void token_table_destroy(struct token_table *table);
+
+/*
+ * Returns the owner of the first entry whose value is >= 'value', wrapping to
+ * the first entry past the end of the ring. This is the same answer a binary
+ * search over the sorted continuum gives (see vnode_dispatch()).
+ */
+uint32_t token_table_dispatch(const struct token_table *table, uint32_t value);
+
+#endif
@@ -28,6 +28,8 @@
 #include "../dyn_util.h"
 #include "dyn_proto.h"
 #include "dyn_proto_repair.h"
+#include "dyn_redis_cmd.h"
+#include "dyn_redis_scan.h"
 
 #define RSP_STRING(ACTION) ACTION(ok, "+OK\r\n")
 
@@ -43,18 +45,7 @@ RSP_STRING(DEFINE_ACTION)
  * return false
  */
 static bool redis_argz(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_PING:
-    case MSG_REQ_REDIS_QUIT:
-    case MSG_REQ_REDIS_SCRIPT_FLUSH:
-    case MSG_REQ_REDIS_SCRIPT_KILL:
-      return true;
-
-    default:
-      break;
-  }
-
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARGZ;
 }
 
 /*
@@ -62,42 +53,7 @@ static bool redis_argz(struct msg *r) {
  * return false
  */
 static bool redis_arg0(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_PERSIST:
-    case MSG_REQ_REDIS_PTTL:
-    case MSG_REQ_REDIS_TTL:
-    case MSG_REQ_REDIS_TYPE:
-    case MSG_REQ_REDIS_DUMP:
-
-    case MSG_REQ_REDIS_DECR:
-    case MSG_REQ_REDIS_GET:
-    case MSG_REQ_REDIS_INCR:
-    case MSG_REQ_REDIS_STRLEN:
-
-    case MSG_REQ_REDIS_HGETALL:
-    case MSG_REQ_REDIS_HKEYS:
-    case MSG_REQ_REDIS_HLEN:
-    case MSG_REQ_REDIS_HVALS:
-
-    case MSG_REQ_REDIS_LLEN:
-    case MSG_REQ_REDIS_LPOP:
-    case MSG_REQ_REDIS_RPOP:
-
-    case MSG_REQ_REDIS_SCARD:
-    case MSG_REQ_REDIS_SMEMBERS:
-    case MSG_REQ_REDIS_SRANDMEMBER:
-
-    case MSG_REQ_REDIS_ZCARD:
-
-    case MSG_REQ_REDIS_KEYS:
-    case MSG_REQ_REDIS_PFCOUNT:
-      return true;
-
-    default:
-      break;
-  }
-
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARG0;
 }
 
 /*
@@ -105,96 +61,19 @@ static bool redis_arg0(struct msg *r) {
  * return false
  */
 static bool redis_arg1(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_EXPIRE:
-    case MSG_REQ_REDIS_EXPIREAT:
-    case MSG_REQ_REDIS_PEXPIRE:
-    case MSG_REQ_REDIS_PEXPIREAT:
-
-    case MSG_REQ_REDIS_APPEND:
-    case MSG_REQ_REDIS_DECRBY:
-    case MSG_REQ_REDIS_GETBIT:
-    case MSG_REQ_REDIS_GETSET:
-    case MSG_REQ_REDIS_INCRBY:
-    case MSG_REQ_REDIS_INCRBYFLOAT:
-    case MSG_REQ_REDIS_SETNX:
-
-    case MSG_REQ_REDIS_HEXISTS:
-    case MSG_REQ_REDIS_HGET:
-
-    case MSG_REQ_REDIS_LINDEX:
-    case MSG_REQ_REDIS_LPUSHX:
-    case MSG_REQ_REDIS_RPOPLPUSH:
-    case MSG_REQ_REDIS_RPUSHX:
-
-    case MSG_REQ_REDIS_SISMEMBER:
-
-    case MSG_REQ_REDIS_ZRANK:
-    case MSG_REQ_REDIS_ZREVRANK:
-    case MSG_REQ_REDIS_ZSCORE:
-    case MSG_REQ_REDIS_SLAVEOF:
-    case MSG_REQ_REDIS_CONFIG:
-    case MSG_REQ_REDIS_SCRIPT_LOAD:
-    case MSG_REQ_REDIS_SCRIPT_EXISTS:
-
-      return true;
-
-    default:
-      break;
-  }
-
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARG1;
 }
 
 static bool redis_arg_upto1(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_INFO:
-      return true;
-    default:
-      break;
-  }
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARG_UPTO1;
 }
+
 /*
  * Return true, if the redis command accepts exactly 2 arguments, otherwise
  * return false
  */
 static bool redis_arg2(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_GETRANGE:
-    case MSG_REQ_REDIS_PSETEX:
-    case MSG_REQ_REDIS_SETBIT:
-    case MSG_REQ_REDIS_SETEX:
-    case MSG_REQ_REDIS_SETRANGE:
-
-    case MSG_REQ_REDIS_HINCRBY:
-    case MSG_REQ_REDIS_HINCRBYFLOAT:
-    case MSG_REQ_REDIS_HSET:
-    case MSG_REQ_REDIS_HSETNX:
-
-    case MSG_REQ_REDIS_LRANGE:
-    case MSG_REQ_REDIS_LREM:
-    case MSG_REQ_REDIS_LSET:
-    case MSG_REQ_REDIS_LTRIM:
-
-    case MSG_REQ_REDIS_SMOVE:
-
-    case MSG_REQ_REDIS_ZCOUNT:
-    case MSG_REQ_REDIS_ZINCRBY:
-    case MSG_REQ_REDIS_ZLEXCOUNT:
-    case MSG_REQ_REDIS_ZREMRANGEBYLEX:
-    case MSG_REQ_REDIS_ZREMRANGEBYRANK:
-    case MSG_REQ_REDIS_ZREMRANGEBYSCORE:
-
-    case MSG_REQ_REDIS_RESTORE:
-
-      return true;
-
-    default:
-      break;
-  }
-
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARG2;
 }
 
 /*
@@ -202,15 +81,7 @@ static bool redis_arg2(struct msg *r) {
  * return false
  */
 static bool redis_arg3(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_LINSERT:
-      return true;
-
-    default:
-      break;
-  }
-
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARG3;
 }
 
 /*
@@ -218,68 +89,7 @@ static bool redis_arg3(struct msg *r) {
  * return false
  */
 static bool redis_argn(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_SORT:
-
-    case MSG_REQ_REDIS_BITCOUNT:
-
-    case MSG_REQ_REDIS_SET:
-    case MSG_REQ_REDIS_SCAN:
-    case MSG_REQ_REDIS_HDEL:
-    case MSG_REQ_REDIS_HMGET:
-    case MSG_REQ_REDIS_HMSET:
-    case MSG_REQ_REDIS_HSCAN:
-
-    case MSG_REQ_REDIS_LPUSH:
-    case MSG_REQ_REDIS_RPUSH:
-
-    case MSG_REQ_REDIS_SADD:
-    case MSG_REQ_REDIS_SDIFF:
-    case MSG_REQ_REDIS_SDIFFSTORE:
-    case MSG_REQ_REDIS_SINTER:
-    case MSG_REQ_REDIS_SINTERSTORE:
-    case MSG_REQ_REDIS_SREM:
-    case MSG_REQ_REDIS_SUNION:
-    case MSG_REQ_REDIS_SUNIONSTORE:
-    case MSG_REQ_REDIS_SSCAN:
-    case MSG_REQ_REDIS_SPOP:
-
-    case MSG_REQ_REDIS_ZADD:
-    case MSG_REQ_REDIS_ZINTERSTORE:
-    case MSG_REQ_REDIS_ZRANGE:
-    case MSG_REQ_REDIS_ZRANGEBYSCORE:
-    case MSG_REQ_REDIS_ZREM:
-    case MSG_REQ_REDIS_ZREVRANGE:
-    case MSG_REQ_REDIS_ZRANGEBYLEX:
-    case MSG_REQ_REDIS_ZREVRANGEBYLEX:
-    case MSG_REQ_REDIS_ZREVRANGEBYSCORE:
-    case MSG_REQ_REDIS_ZUNIONSTORE:
-    case MSG_REQ_REDIS_ZSCAN:
-    case MSG_REQ_REDIS_PFADD:
-    case MSG_REQ_REDIS_GEOADD:
-    case MSG_REQ_REDIS_GEORADIUS:
-    case MSG_REQ_REDIS_GEODIST:
-    case MSG_REQ_REDIS_GEOHASH:
-    case MSG_REQ_REDIS_GEOPOS:
-    case MSG_REQ_REDIS_GEORADIUSBYMEMBER:
-
-    case MSG_REQ_REDIS_JSONSET:
-    case MSG_REQ_REDIS_JSONGET:
-    case MSG_REQ_REDIS_JSONDEL:
-    case MSG_REQ_REDIS_JSONTYPE:
-    case MSG_REQ_REDIS_JSONMGET:
-    case MSG_REQ_REDIS_JSONARRAPPEND:
-    case MSG_REQ_REDIS_JSONARRINSERT:
-    case MSG_REQ_REDIS_JSONARRLEN:
-    case MSG_REQ_REDIS_JSONOBJKEYS:
-    case MSG_REQ_REDIS_JSONOBJLEN:
-      return true;
-
-    default:
-      break;
-  }
-
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARGN;
 }
 
 /*
@@ -287,17 +97,7 @@ static bool redis_argn(struct msg *r) {
  * more keys, otherwise return false
  */
 static bool redis_argx(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_MGET:
-    case MSG_REQ_REDIS_DEL:
-    case MSG_REQ_REDIS_EXISTS:
-      return true;
-
-    default:
-      break;
-  }
-
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARGX;
 }
 
 /*
@@ -305,15 +105,7 @@ static bool redis_argx(struct msg *r) {
  * more key-value pairs, otherwise return false
  */
 static bool redis_argkvx(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_MSET:
-      return true;
-
-    default:
-      break;
-  }
-
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARGKVX;
 }
 
 /*
@@ -323,16 +115,7 @@ static bool redis_argkvx(struct msg *r) {
  * that at least one argument is required, but that shouldn't be the case).
  */
 static bool redis_argeval(struct msg *r) {
-  switch (r->type) {
-    case MSG_REQ_REDIS_EVAL:
-    case MSG_REQ_REDIS_EVALSHA:
-      return true;
-
-    default:
-      break;
-  }
-
-  return false;
+  return redis_cmd_arity[r->type] == REDIS_ARGEVAL;
 }
 
 /*
@@ -467,1123 +250,269 @@ error:
   if (new_msg != NULL) msg_put(new_msg);
   return ret_status;
 
-done:
-  if (key != NULL) dn_free(key);
-  return DN_OK;
-}
-
-/*
- * Reference: http://redis.io/topics/protocol
- *
- * Redis >= 1.2 uses the unified protocol to send requests to the Redis
- * server. In the unified protocol all the arguments sent to the server
- * are binary safe and every request has the following general form:
- *
- *   *<number of arguments> CR LF
- *   $<number of bytes of argument 1> CR LF
- *   <argument data> CR LF
- *   ...
- *   $<number of bytes of argument N> CR LF
- *   <argument data> CR LF
- *
- * Before the unified request protocol, redis protocol for requests supported
- * the following commands
- * 1). Inline commands: simple commands where arguments are just space
- *     separated strings. No binary safeness is possible.
- * 2). Bulk commands: bulk commands are exactly like inline commands, but
- *     the last argument is handled in a special way in order to allow for
- *     a binary-safe last argument.
- * 3). Single command that contains a space. Eg: "SCRIPT LOAD"
- *
- * Dynomite supports the Redis unified protocol for requests and inline ping.
- * The inline ping is being utilized by redis-benchmark
- */
-void redis_parse_req(struct msg *r, struct context *ctx) {
-  struct mbuf *b;
-  uint8_t *p, *m = 0;
-  uint8_t ch;
-  enum {
-    SW_START,
-    SW_NARG,
-    SW_NARG_LF,
-    SW_REQ_TYPE_LEN,
-    SW_REQ_TYPE_LEN_LF,
-    SW_REQ_TYPE,
-    SW_REQ_TYPE_LF,
-    SW_KEY_LEN,
-    SW_KEY_LEN_LF,
-    SW_KEY,
-    SW_KEY_LF,
-    SW_ARG1_LEN,
-    SW_ARG1_LEN_LF,
-    SW_ARG1,
-    SW_ARG1_LF,
-    SW_ARG2_LEN,
-    SW_ARG2_LEN_LF,
-    SW_ARG2,
-    SW_ARG2_LF,
-    SW_ARG3_LEN,
-    SW_ARG3_LEN_LF,
-    SW_ARG3,
-    SW_ARG3_LF,
-    SW_ARGN_LEN,
-    SW_ARGN_LEN_LF,
-    SW_ARGN,
-    SW_ARGN_LF,
-    SW_FRAGMENT,
-    SW_INLINE_PING,
-    SW_SENTINEL
-  } state;
-
-  const struct string* hash_tag = &ctx->pool.hash_tag;
-
-  state = r->state;
-
-  // Get the state of read repairs in the beginning, so that we don't risk it
-  // getting changed in the middle of parsing.
-  bool read_repairs_enabled = is_read_repairs_enabled();
-
-  if (read_repairs_enabled) {
-    b = STAILQ_FIRST(&r->mhdr);
-    if (r->state > SW_START) {
-      // If this is not the first time we're parsing the same request (because we hadn't
-      // receive the entire payload yet), skip all the mbufs already parsed.
-      int mbuf_idx = -1;
-      while (r->latest_parsed_mbuf_idx > mbuf_idx) {
-        loga("Skipping previously parsed mbuf");
-        b = STAILQ_NEXT(b, next);
-        ++mbuf_idx;
-      }
-    }
-  } else {
-    b = STAILQ_LAST(&r->mhdr, mbuf, next);
-  }
-
-  ASSERT(r->is_request);
-  ASSERT(state >= SW_START && state < SW_SENTINEL);
-  ASSERT(b != NULL);
-  ASSERT(b->pos <= b->last);
-
-  /* validate the parsing maker */
-  ASSERT(r->pos != NULL);
-  // ASSERT(r->pos >= b->pos && r->pos <= b->last);
-
-  for (p = r->pos; p < b->last; p++) {
-    ch = *p;
-
-    switch (state) {
-      case SW_START:
-
-      case SW_NARG:
-        if (r->token == NULL) {
-          if (ch == 'p' || ch == 'P') { /* inline ping */
-            state = SW_INLINE_PING;
-            log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "INLINE PING");
-            break;
-          } else if (ch != '*') {
-            goto error;
-          }
-          r->token = p;
-          /* req_start <- p */
-          r->ntoken_start = p;
-          r->rntokens = 0;
-          state = SW_NARG;
-        } else if (isdigit(ch)) {
-          r->rntokens = r->rntokens * 10 + (uint32_t)(ch - '0');
-        } else if (ch == CR) {
-          if (r->rntokens == 0) {
-            goto error;
-          }
-          r->ntokens = r->rntokens;
-          r->ntoken_end = p;
-          r->token = NULL;
-          state = SW_NARG_LF;
-        } else {
-          goto error;
-        }
-
-        break;
-
-      case SW_INLINE_PING:
-        if (str3icmp(p, 'i', 'n', 'g') && p + 4 < b->last) {
-          p = p + 4;
-          log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "PING");
-          r->type = MSG_REQ_REDIS_PING;
-          r->is_read = 1;
-          state = SW_REQ_TYPE_LF;
-          goto done;
-        } else {
-          log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "PING ERROR %d, %s",
-                      p - m, p);
-          goto error;
-        }
-
-        break;
-
-      case SW_NARG_LF:
-        switch (ch) {
-          case LF:
-            state = SW_REQ_TYPE_LEN;
-            break;
-
-          default:
-            goto error;
-        }
-
-        break;
-
-      case SW_REQ_TYPE_LEN:
-        if (r->token == NULL) {
-          if (ch != '$') {
-            goto error;
-          }
-          r->token = p;
-          r->rlen = 0;
-        } else if (isdigit(ch)) {
-          r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
-        } else if (ch == CR) {
-          if (r->rlen == 0 || r->rntokens == 0) {
-            goto error;
-          }
-          r->rntokens--;
-          r->token = NULL;
-          state = SW_REQ_TYPE_LEN_LF;
-        } else {
-          goto error;
-        }
-
-        break;
-
-      case SW_REQ_TYPE_LEN_LF:
-        switch (ch) {
-          case LF:
-            state = SW_REQ_TYPE;
-            break;
-
-          default:
-            goto error;
-        }
-
-        break;
-
-      case SW_REQ_TYPE:
-        if (r->token == NULL) {
-          r->token = p;
-        }
-
-        // TODO: No multi-mbuf support for SW_REQ_TYPE (since very unlikely)
-        m = r->token + r->rlen;
-        if (m >= b->last) {
-          m = b->last - 1;
-          p = m;
-          break;
-        }
-
-        if (*m != CR) {
-          goto error;
-        }
-
-        p = m; /* move forward by rlen bytes */
-        r->rlen = 0;
-        m = r->token;
-        r->token = NULL;
-
-        // 'SCRIPT' commands are parsed in 2 steps due to the whitespace in between cmds,
-        // so don't set the type to MSG_UNKNOWN.
-        if (r->type != MSG_REQ_REDIS_SCRIPT) r->type = MSG_UNKNOWN;
-
-        switch (p - m) {
-          case 3:
-            if (str3icmp(m, 'g', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_GET;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str3icmp(m, 's', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_SET;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str3icmp(m, 't', 't', 'l')) {
-              r->type = MSG_REQ_REDIS_TTL;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str3icmp(m, 'd', 'e', 'l')) {
-              r->type = MSG_REQ_REDIS_DEL;
-              r->is_read = 0;
-              break;
-            }
-
-            break;
-
-          case 4:
-            if (str4icmp(m, 'p', 't', 't', 'l')) {
-              r->type = MSG_REQ_REDIS_PTTL;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'd', 'e', 'c', 'r')) {
-              r->type = MSG_REQ_REDIS_DECR;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'd', 'u', 'm', 'p')) {
-              r->type = MSG_REQ_REDIS_DUMP;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'h', 'd', 'e', 'l')) {
-              r->type = MSG_REQ_REDIS_HDEL;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'h', 'g', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_HGET;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'h', 'l', 'e', 'n')) {
-              r->type = MSG_REQ_REDIS_HLEN;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'h', 's', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_HSET;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'i', 'n', 'c', 'r')) {
-              r->type = MSG_REQ_REDIS_INCR;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'k', 'e', 'y', 's')) { /* Yannis: Need to identify
-                                                      how this is defined in
-                                                      Redis protocol */
-              r->type = MSG_REQ_REDIS_KEYS;
-              r->msg_routing = ROUTING_LOCAL_NODE_ONLY;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'i', 'n', 'f', 'o')) {
-              r->type = MSG_REQ_REDIS_INFO;
-              r->msg_routing = ROUTING_LOCAL_NODE_ONLY;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'l', 'l', 'e', 'n')) {
-              r->type = MSG_REQ_REDIS_LLEN;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'l', 'p', 'o', 'p')) {
-              r->type = MSG_REQ_REDIS_LPOP;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'l', 'r', 'e', 'm')) {
-              r->type = MSG_REQ_REDIS_LREM;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'l', 's', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_LSET;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'm', 'g', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_MGET;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'm', 's', 'e',
-                         't')) { /* Yannis: need to investigate the fan out of
-                                    data to multiple nodes */
-              r->type = MSG_REQ_REDIS_MSET;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'p', 'i', 'n', 'g')) {
-              r->type = MSG_REQ_REDIS_PING;
-              r->msg_routing = ROUTING_LOCAL_NODE_ONLY;
-              p = p + 1;
-              r->is_read = 1;
-              goto done;
-            }
-
-            if (str4icmp(m, 'r', 'p', 'o', 'p')) {
-              r->type = MSG_REQ_REDIS_RPOP;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 's', 'a', 'd', 'd')) {
-              r->type = MSG_REQ_REDIS_SADD;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 's', 'c', 'a', 'n')) {
-              r->type = MSG_REQ_REDIS_SCAN;
-              r->msg_routing = ROUTING_LOCAL_NODE_ONLY;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 's', 'p', 'o', 'p')) {
-              r->type = MSG_REQ_REDIS_SPOP;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 's', 'r', 'e', 'm')) {
-              r->type = MSG_REQ_REDIS_SREM;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 't', 'y', 'p', 'e')) {
-              r->type = MSG_REQ_REDIS_TYPE;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'z', 'a', 'd', 'd')) {
-              r->type = MSG_REQ_REDIS_ZADD;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'z', 'r', 'e', 'm')) {
-              r->type = MSG_REQ_REDIS_ZREM;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 'e', 'v', 'a', 'l')) {
-              r->type = MSG_REQ_REDIS_EVAL;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str4icmp(m, 's', 'o', 'r', 't')) {
-              r->type = MSG_REQ_REDIS_SORT;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str4icmp(m, 'q', 'u', 'i', 't')) {
-              r->type = MSG_REQ_REDIS_QUIT;
-              r->quit = 1;
-              break;
-            }
-            if (str4icmp(m, 'l', 'o', 'a', 'd')) {
-              // A command called 'LOAD' does not exist. This is the second half of the
-              // command 'SCRIPT LOAD'.
-              r->type = MSG_REQ_REDIS_SCRIPT_LOAD;
-              r->msg_routing = ROUTING_ALL_NODES_ALL_RACKS_ALL_DCS;
-              r->is_read = 0;
-              break;
-            }
-            if (str4icmp(m, 'k', 'i', 'l', 'l')) {
-              // A command called 'KILL' does not exist. This is the second half of the
-              // command 'SCRIPT KILL'.
-              r->type = MSG_REQ_REDIS_SCRIPT_KILL;
-              r->msg_routing = ROUTING_ALL_NODES_ALL_RACKS_ALL_DCS;
-              r->is_read = 0;
-              break;
-            }
-
-
-            break;
-
-          case 5:
-            if (str5icmp(m, 'h', 'k', 'e', 'y', 's')) {
-              r->type = MSG_REQ_REDIS_HKEYS;
-              r->msg_routing = ROUTING_TOKEN_OWNER_LOCAL_RACK_ONLY;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str5icmp(m, 'h', 'm', 'g', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_HMGET;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str5icmp(m, 'h', 'm', 's', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_HMSET;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str5icmp(m, 'h', 'v', 'a', 'l', 's')) {
-              r->type = MSG_REQ_REDIS_HVALS;
-              r->msg_routing = ROUTING_TOKEN_OWNER_LOCAL_RACK_ONLY;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str5icmp(m, 'h', 's', 'c', 'a', 'n')) {
-              r->type = MSG_REQ_REDIS_HSCAN;
-              r->msg_routing = ROUTING_TOKEN_OWNER_LOCAL_RACK_ONLY;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str5icmp(m, 'l', 'p', 'u', 's', 'h')) {
-              r->type = MSG_REQ_REDIS_LPUSH;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str5icmp(m, 'l', 't', 'r', 'i', 'm')) {
-              r->type = MSG_REQ_REDIS_LTRIM;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str5icmp(m, 'r', 'p', 'u', 's', 'h')) {
-              r->type = MSG_REQ_REDIS_RPUSH;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str5icmp(m, 's', 'c', 'a', 'r', 'd')) {
-              r->type = MSG_REQ_REDIS_SCARD;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str5icmp(m, 's', 'd', 'i', 'f', 'f')) {
-              r->type = MSG_REQ_REDIS_SDIFF;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str5icmp(m, 's', 'e', 't', 'e', 'x')) {
-              r->type = MSG_REQ_REDIS_SETEX;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str5icmp(m, 's', 'e', 't', 'n', 'x')) {
-              r->type = MSG_REQ_REDIS_SETNX;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str5icmp(m, 's', 'm', 'o', 'v', 'e')) {
-              r->type = MSG_REQ_REDIS_SMOVE;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str5icmp(m, 's', 's', 'c', 'a', 'n')) {
-              r->type = MSG_REQ_REDIS_SSCAN;
-              r->msg_routing = ROUTING_TOKEN_OWNER_LOCAL_RACK_ONLY;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str5icmp(m, 'z', 'c', 'a', 'r', 'd')) {
-              r->type = MSG_REQ_REDIS_ZCARD;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str5icmp(m, 'z', 'r', 'a', 'n', 'k')) {
-              r->type = MSG_REQ_REDIS_ZRANK;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str5icmp(m, 'z', 's', 'c', 'a', 'n')) {
-              r->type = MSG_REQ_REDIS_ZSCAN;
-              r->msg_routing = ROUTING_TOKEN_OWNER_LOCAL_RACK_ONLY;
-              r->is_read = 1;
-              break;
-            }
-            if (str5icmp(m, 'p', 'f', 'a', 'd', 'd')) {
-              r->type = MSG_REQ_REDIS_PFADD;
-              r->is_read = 0;
-              break;
-            }
-            if (str5icmp(m, 'f', 'l', 'u', 's', 'h')) {
-              // A command called 'FLUSH' does not exist. This is the second half of the
-              // command 'SCRIPT FLUSH'.
-              ASSERT(r->type == MSG_REQ_REDIS_SCRIPT);
-              r->type = MSG_REQ_REDIS_SCRIPT_FLUSH;
-              r->msg_routing = ROUTING_ALL_NODES_ALL_RACKS_ALL_DCS;
-              r->is_read = 0;
-              break;
-            }
-
-            break;
-
-          case 6:
-            if (str6icmp(m, 'a', 'p', 'p', 'e', 'n', 'd')) {
-              r->type = MSG_REQ_REDIS_APPEND;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 'd', 'e', 'c', 'r', 'b', 'y')) {
-              r->type = MSG_REQ_REDIS_DECRBY;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 'e', 'x', 'i', 's', 't', 's')
-                && r->type != MSG_REQ_REDIS_SCRIPT) {
-              r->type = MSG_REQ_REDIS_EXISTS;
-              r->is_read = 1;
-              break;
-            }
-            if (str6icmp(m, 'e', 'x', 'i', 's', 't', 's')
-                && r->type == MSG_REQ_REDIS_SCRIPT) {
-              // This is not to be confused with 'EXISTS'. This is the second half of the
-              // command 'SCRIPT EXISTS'.
-              r->type = MSG_REQ_REDIS_SCRIPT_EXISTS;
-              r->msg_routing = ROUTING_ALL_NODES_ALL_RACKS_ALL_DCS;
-              r->is_read = 1;
-              break;
-            }
-
-
-            if (str6icmp(m, 'e', 'x', 'p', 'i', 'r', 'e')) {
-              r->type = MSG_REQ_REDIS_EXPIRE;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 'g', 'e', 't', 'b', 'i', 't')) {
-              r->type = MSG_REQ_REDIS_GETBIT;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str6icmp(m, 'g', 'e', 't', 's', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_GETSET;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 'p', 's', 'e', 't', 'e', 'x')) {
-              r->type = MSG_REQ_REDIS_PSETEX;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 'h', 's', 'e', 't', 'n', 'x')) {
-              r->type = MSG_REQ_REDIS_HSETNX;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 'i', 'n', 'c', 'r', 'b', 'y')) {
-              r->type = MSG_REQ_REDIS_INCRBY;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 'l', 'i', 'n', 'd', 'e', 'x')) {
-              r->type = MSG_REQ_REDIS_LINDEX;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str6icmp(m, 'l', 'p', 'u', 's', 'h', 'x')) {
-              r->type = MSG_REQ_REDIS_LPUSHX;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 'l', 'r', 'a', 'n', 'g', 'e')) {
-              r->type = MSG_REQ_REDIS_LRANGE;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str6icmp(m, 'r', 'p', 'u', 's', 'h', 'x')) {
-              r->type = MSG_REQ_REDIS_RPUSHX;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 's', 'e', 't', 'b', 'i', 't')) {
-              r->type = MSG_REQ_REDIS_SETBIT;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str6icmp(m, 's', 'i', 'n', 't', 'e', 'r')) {
-              r->type = MSG_REQ_REDIS_SINTER;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str6icmp(m, 's', 't', 'r', 'l', 'e', 'n')) {
-              r->type = MSG_REQ_REDIS_STRLEN;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str6icmp(m, 's', 'u', 'n', 'i', 'o', 'n')) {
-              r->type = MSG_REQ_REDIS_SUNION;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str6icmp(m, 'z', 'c', 'o', 'u', 'n', 't')) {
-              r->type = MSG_REQ_REDIS_ZCOUNT;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str6icmp(m, 'z', 'r', 'a', 'n', 'g', 'e')) {
-              r->type = MSG_REQ_REDIS_ZRANGE;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str6icmp(m, 'z', 's', 'c', 'o', 'r', 'e')) {
-              r->type = MSG_REQ_REDIS_ZSCORE;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str6icmp(m, 'c', 'o', 'n', 'f', 'i', 'g')) {
-              r->type = MSG_REQ_REDIS_CONFIG;
-              r->msg_routing = ROUTING_LOCAL_NODE_ONLY;
-              r->is_read = 1;
-              break;
-            }
-            if (str6icmp(m, 'g', 'e', 'o', 'a', 'd', 'd')) {
-              r->type = MSG_REQ_REDIS_GEOADD;
-              r->is_read = 0;
-              break;
-            }
-            if (str6icmp(m, 'g', 'e', 'o', 'p', 'o', 's')) {
-              r->type = MSG_REQ_REDIS_GEOPOS;
-              r->is_read = 1;
-              break;
-            }
-            if (str6icmp(m, 'u', 'n', 'l', 'i', 'n', 'k')) {
-              r->type = MSG_REQ_REDIS_UNLINK;
-              r->is_read = 0;
-              break;
-            }
-            if (str6icmp(m, 's', 'c', 'r', 'i', 'p', 't')) {
-              r->type = MSG_REQ_REDIS_SCRIPT;
-              r->is_read = 0;
-              break;
-            }
-            break;
-
-          case 7:
-            if (str7icmp(m, 'p', 'e', 'r', 's', 'i', 's', 't')) {
-              r->type = MSG_REQ_REDIS_PERSIST;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str7icmp(m, 'p', 'e', 'x', 'p', 'i', 'r', 'e')) {
-              r->type = MSG_REQ_REDIS_PEXPIRE;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str7icmp(m, 'h', 'e', 'x', 'i', 's', 't', 's')) {
-              r->type = MSG_REQ_REDIS_HEXISTS;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str7icmp(m, 'h', 'g', 'e', 't', 'a', 'l', 'l')) {
-              r->type = MSG_REQ_REDIS_HGETALL;
-              r->msg_routing = ROUTING_TOKEN_OWNER_LOCAL_RACK_ONLY;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str7icmp(m, 'h', 'i', 'n', 'c', 'r', 'b', 'y')) {
-              r->type = MSG_REQ_REDIS_HINCRBY;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str7icmp(m, 'l', 'i', 'n', 's', 'e', 'r', 't')) {
-              r->type = MSG_REQ_REDIS_LINSERT;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str7icmp(m, 'z', 'i', 'n', 'c', 'r', 'b', 'y')) {
-              r->type = MSG_REQ_REDIS_ZINCRBY;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str7icmp(m, 'e', 'v', 'a', 'l', 's', 'h', 'a')) {
-              r->type = MSG_REQ_REDIS_EVALSHA;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str7icmp(m, 'r', 'e', 's', 't', 'o', 'r', 'e')) {
-              r->type = MSG_REQ_REDIS_RESTORE;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str7icmp(m, 's', 'l', 'a', 'v', 'e', 'o', 'f')) {
-              r->type = MSG_REQ_REDIS_SLAVEOF;
-              r->msg_routing = ROUTING_LOCAL_NODE_ONLY;
-              r->is_read = 0;
-              break;
-            }
-            if (str7icmp(m, 'p', 'f', 'c', 'o', 'u', 'n', 't')) {
-              r->type = MSG_REQ_REDIS_PFCOUNT;
-              r->is_read = 0;
-              break;
-            }
-            if (str7icmp(m, 'g', 'e', 'o', 'h', 'a', 's', 'h')) {
-              r->type = MSG_REQ_REDIS_GEOHASH;
-              r->is_read = 1;
-              break;
-            }
-            if (str7icmp(m, 'g', 'e', 'o', 'd', 'i', 's', 't')) {
-              r->type = MSG_REQ_REDIS_GEODIST;
-              r->is_read = 1;
-              break;
-            }
-            if (str7icmp(m, 'h', 's', 't', 'r', 'l', 'e', 'n')) {
-              r->type = MSG_REQ_REDIS_HSTRLEN;
-              r->is_read = 1;
-              break;
-            }
-
-            break;
-
-          case 8:
-            if (str8icmp(m, 'e', 'x', 'p', 'i', 'r', 'e', 'a', 't')) {
-              r->type = MSG_REQ_REDIS_EXPIREAT;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str8icmp(m, 'b', 'i', 't', 'c', 'o', 'u', 'n', 't')) {
-              r->type = MSG_REQ_REDIS_BITCOUNT;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str8icmp(m, 'g', 'e', 't', 'r', 'a', 'n', 'g', 'e')) {
-              r->type = MSG_REQ_REDIS_GETRANGE;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str8icmp(m, 's', 'e', 't', 'r', 'a', 'n', 'g', 'e')) {
-              r->type = MSG_REQ_REDIS_SETRANGE;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str8icmp(m, 's', 'm', 'e', 'm', 'b', 'e', 'r', 's')) {
-              r->type = MSG_REQ_REDIS_SMEMBERS;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str8icmp(m, 'z', 'r', 'e', 'v', 'r', 'a', 'n', 'k')) {
-              r->type = MSG_REQ_REDIS_ZREVRANK;
-              r->is_read = 1;
-              break;
-            }
-            if (str8icmp(m, 'j', 's', 'o', 'n', '.', 's', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_JSONSET;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str8icmp(m, 'j', 's', 'o', 'n', '.', 'g', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_JSONGET;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str8icmp(m, 'j', 's', 'o', 'n', '.', 'd', 'e', 'l')) {
-              r->type = MSG_REQ_REDIS_JSONDEL;
-              r->is_read = 0;
-              break;
-            }
-
-            break;
-
-          case 9:
-            if (str9icmp(m, 'p', 'e', 'x', 'p', 'i', 'r', 'e', 'a', 't')) {
-              r->type = MSG_REQ_REDIS_PEXPIREAT;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str9icmp(m, 'r', 'p', 'o', 'p', 'l', 'p', 'u', 's', 'h')) {
-              r->type = MSG_REQ_REDIS_RPOPLPUSH;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str9icmp(m, 's', 'i', 's', 'm', 'e', 'm', 'b', 'e', 'r')) {
-              r->type = MSG_REQ_REDIS_SISMEMBER;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str9icmp(m, 'z', 'l', 'e', 'x', 'c', 'o', 'u', 'n', 't')) {
-              r->type = MSG_REQ_REDIS_ZLEXCOUNT;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str9icmp(m, 'z', 'r', 'e', 'v', 'r', 'a', 'n', 'g', 'e')) {
-              r->type = MSG_REQ_REDIS_ZREVRANGE;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str9icmp(m, 'g', 'e', 'o', 'r', 'a', 'd', 'i', 'u', 's')) {
-              r->type = MSG_REQ_REDIS_GEORADIUS;
-              r->is_read = 1;
-              break;
-            }
-            if (str9icmp(m, 'j', 's', 'o', 'n', '.', 't', 'y', 'p', 'e')) {
-              r->type = MSG_REQ_REDIS_JSONTYPE;
-              r->is_read = 1;
-              break;
-            }
-
-            if (str9icmp(m, 'j', 's', 'o', 'n', '.', 'm', 'g', 'e', 't')) {
-              r->type = MSG_REQ_REDIS_JSONMGET;
-              r->is_read = 1;
-              break;
-            }
-
-            break;
-
-          case 10:
-            if (str10icmp(m, 's', 'd', 'i', 'f', 'f', 's', 't', 'o', 'r',
-                          'e')) {
-              r->type = MSG_REQ_REDIS_SDIFFSTORE;
-              r->is_read = 0;
-              break;
-            }
-
-            break;
-
-          case 11:
-            if (str11icmp(m, 'i', 'n', 'c', 'r', 'b', 'y', 'f', 'l', 'o', 'a',
-                          't')) {
-              r->type = MSG_REQ_REDIS_INCRBYFLOAT;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str11icmp(m, 's', 'i', 'n', 't', 'e', 'r', 's', 't', 'o', 'r',
-                          'e')) {
-              r->type = MSG_REQ_REDIS_SINTERSTORE;
-              r->is_read = 0;
-              break;
-            }
-
-            if (str11icmp(m, 's', 'r', 'a', 'n', 'd', 'm', 'e', 'm', 'b', 'e',
-                          'r')) {
-              r->type = MSG_REQ_REDIS_SRANDMEMBER;
-              r->is_read = 1;
-              break;
-            }
+done:
+  if (key != NULL) dn_free(key);
+  return DN_OK;
+}
 
-            if (str11icmp(m, 's', 'u', 'n', 'i', 'o', 'n', 's', 't', 'o', 'r',
-                          'e')) {
-              r->type = MSG_REQ_REDIS_SUNIONSTORE;
-              r->is_read = 1;
-              break;
-            }
+/*
+ * Called with 'p' on the '*', '$' or ':' that starts a number. If the number
+ * and the CR that ends it are in [p, last), parses it into 'val' and returns
+ * the byte before the CR, so that the parser loop goes on from the CR.
+ * Otherwise returns 'p' and the digits are parsed a byte at a time.
+ */
+static inline uint8_t *redis_parse_num(uint8_t *p, uint8_t *last,
+                                       uint32_t *val) {
+  uint8_t *cr;
+  uint32_t n;
 
-            if (str11icmp(m, 'z', 'i', 'n', 't', 'e', 'r', 's', 't', 'o', 'r',
-                          'e')) {
-              r->type = MSG_REQ_REDIS_ZINTERSTORE;
-              r->is_read = 1;
-              break;
-            }
+  if (redis_scan_len(p + 1, last, &n, &cr) != DN_OK) {
+    return p;
+  }
 
-            if (str11icmp(m, 'z', 'r', 'a', 'n', 'g', 'e', 'b', 'y', 'l', 'e',
-                          'x')) {
-              r->type = MSG_REQ_REDIS_ZRANGEBYLEX;
-              r->is_read = 1;
-              break;
-            }
+  *val = n;
+  return cr - 1;
+}
 
-            if (str11icmp(m, 'z', 'u', 'n', 'i', 'o', 'n', 's', 't', 'o', 'r',
-                          'e')) {
-              r->type = MSG_REQ_REDIS_ZUNIONSTORE;
-              r->is_read = 1;
-              break;
-            }
+/*
+ * Reference: http://redis.io/topics/protocol
+ *
+ * Redis >= 1.2 uses the unified protocol to send requests to the Redis
+ * server. In the unified protocol all the arguments sent to the server
+ * are binary safe and every request has the following general form:
+ *
+ *   *<number of arguments> CR LF
+ *   $<number of bytes of argument 1> CR LF
+ *   <argument data> CR LF
+ *   ...
+ *   $<number of bytes of argument N> CR LF
+ *   <argument data> CR LF
+ *
+ * Before the unified request protocol, redis protocol for requests supported
+ * the following commands
+ * 1). Inline commands: simple commands where arguments are just space
+ *     separated strings. No binary safeness is possible.
+ * 2). Bulk commands: bulk commands are exactly like inline commands, but
+ *     the last argument is handled in a special way in order to allow for
+ *     a binary-safe last argument.
+ * 3). Single command that contains a space. Eg: "SCRIPT LOAD"
+ *
+ * Dynomite supports the Redis unified protocol for requests and inline ping.
+ * The inline ping is being utilized by redis-benchmark
+ */
+void redis_parse_req(struct msg *r, struct context *ctx) {
+  struct mbuf *b;
+  const struct redis_cmd *cmd;
+  uint8_t *p, *m = 0;
+  uint8_t ch;
+  enum {
+    SW_START,
+    SW_NARG,
+    SW_NARG_LF,
+    SW_REQ_TYPE_LEN,
+    SW_REQ_TYPE_LEN_LF,
+    SW_REQ_TYPE,
+    SW_REQ_TYPE_LF,
+    SW_KEY_LEN,
+    SW_KEY_LEN_LF,
+    SW_KEY,
+    SW_KEY_LF,
+    SW_ARG1_LEN,
+    SW_ARG1_LEN_LF,
+    SW_ARG1,
+    SW_ARG1_LF,
+    SW_ARG2_LEN,
+    SW_ARG2_LEN_LF,
+    SW_ARG2,
+    SW_ARG2_LF,
+    SW_ARG3_LEN,
+    SW_ARG3_LEN_LF,
+    SW_ARG3,
+    SW_ARG3_LF,
+    SW_ARGN_LEN,
+    SW_ARGN_LEN_LF,
+    SW_ARGN,
+    SW_ARGN_LF,
+    SW_FRAGMENT,
+    SW_INLINE_PING,
+    SW_SENTINEL
+  } state;
 
-            if (str11icmp(m, 'j', 's', 'o', 'n', '.', 'a', 'r', 'r', 'l', 'e',
-                          'n')) {
-              r->type = MSG_REQ_REDIS_JSONARRLEN;
-              r->is_read = 1;
-              break;
-            }
+  const struct string* hash_tag = &ctx->pool.hash_tag;
 
-            if (str11icmp(m, 'j', 's', 'o', 'n', '.', 'o', 'b', 'j', 'l', 'e',
-                          'n')) {
-              r->type = MSG_REQ_REDIS_JSONOBJLEN;
-              r->is_read = 1;
-              break;
-            }
+  state = r->state;
 
-            break;
+  // Get the state of read repairs in the beginning, so that we don't risk it
+  // getting changed in the middle of parsing.
+  bool read_repairs_enabled = is_read_repairs_enabled();
 
-          case 12:
-            if (str12icmp(m, 'h', 'i', 'n', 'c', 'r', 'b', 'y', 'f', 'l', 'o',
-                          'a', 't')) {
-              r->type = MSG_REQ_REDIS_HINCRBYFLOAT;
-              r->is_read = 0;
-              break;
-            }
+  if (read_repairs_enabled) {
+    b = STAILQ_FIRST(&r->mhdr);
+    if (r->state > SW_START) {
+      // If this is not the first time we're parsing the same request (because we hadn't
+      // receive the entire payload yet), skip all the mbufs already parsed.
+      int mbuf_idx = -1;
+      while (r->latest_parsed_mbuf_idx > mbuf_idx) {
+        loga("Skipping previously parsed mbuf");
+        b = STAILQ_NEXT(b, next);
+        ++mbuf_idx;
+      }
+    }
+  } else {
+    b = STAILQ_LAST(&r->mhdr, mbuf, next);
+  }
 
-            if (str12icmp(m, 'j', 's', 'o', 'n', '.', 'o', 'b', 'j', 'k', 'e',
-                          'y', 's')) {
-              r->type = MSG_REQ_REDIS_JSONOBJKEYS;
-              r->is_read = 1;
-              break;
-            }
+  ASSERT(r->is_request);
+  ASSERT(state >= SW_START && state < SW_SENTINEL);
+  ASSERT(b != NULL);
+  ASSERT(b->pos <= b->last);
 
-            break;
+  /* validate the parsing maker */
+  ASSERT(r->pos != NULL);
+  // ASSERT(r->pos >= b->pos && r->pos <= b->last);
 
-          case 13:
-            if (str13icmp(m, 'z', 'r', 'a', 'n', 'g', 'e', 'b', 'y', 's', 'c',
-                          'o', 'r', 'e')) {
-              r->type = MSG_REQ_REDIS_ZRANGEBYSCORE;
-              r->is_read = 1;
-              break;
-            }
+  for (p = r->pos; p < b->last; p++) {
+    ch = *p;
 
-            break;
+    switch (state) {
+      case SW_START:
 
-          case 14:
-            if (str14icmp(m, 'z', 'r', 'e', 'm', 'r', 'a', 'n', 'g', 'e', 'b',
-                          'y', 'l', 'e', 'x')) {
-              r->type = MSG_REQ_REDIS_ZREMRANGEBYLEX;
-              r->is_read = 0;
-              break;
-            }
+      case SW_NARG:
+        if (r->token == NULL) {
+          if (ch == 'p' || ch == 'P') { /* inline ping */
+            state = SW_INLINE_PING;
+            log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "INLINE PING");
+            break;
+          } else if (ch != '*') {
+            goto error;
+          }
+          r->token = p;
+          /* req_start <- p */
+          r->ntoken_start = p;
+          r->rntokens = 0;
+          p = redis_parse_num(p, b->last, &r->rntokens);
+          state = SW_NARG;
+        } else if (isdigit(ch)) {
+          r->rntokens = r->rntokens * 10 + (uint32_t)(ch - '0');
+        } else if (ch == CR) {
+          if (r->rntokens == 0) {
+            goto error;
+          }
+          r->ntokens = r->rntokens;
+          r->ntoken_end = p;
+          r->token = NULL;
+          state = SW_NARG_LF;
+        } else {
+          goto error;
+        }
 
-            if (str14icmp(m, 'z', 'r', 'e', 'v', 'r', 'a', 'n', 'g', 'e', 'b',
-                          'y', 'l', 'e', 'x')) {
-              r->type = MSG_REQ_REDIS_ZREVRANGEBYLEX;
-              r->is_read = 1;
-              break;
-            }
+        break;
 
-            if (str14icmp(m, 'j', 's', 'o', 'n', '.', 'a', 'r', 'r', 'a', 'p',
-                          'p', 'e', 'n', 'd')) {
-              r->type = MSG_REQ_REDIS_JSONARRAPPEND;
-              r->is_read = 0;
-              break;
-            }
+      case SW_INLINE_PING:
+        if (str3icmp(p, 'i', 'n', 'g') && p + 4 < b->last) {
+          p = p + 4;
+          log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "PING");
+          r->type = MSG_REQ_REDIS_PING;
+          r->is_read = 1;
+          state = SW_REQ_TYPE_LF;
+          goto done;
+        } else {
+          log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "PING ERROR %d, %s",
+                      p - m, p);
+          goto error;
+        }
 
-            if (str14icmp(m, 'j', 's', 'o', 'n', '.', 'a', 'r', 'r', 'i', 'n',
-                          's', 'e', 'r', 't')) {
-              r->type = MSG_REQ_REDIS_JSONARRINSERT;
-              r->is_read = 0;
-              break;
-            }
+        break;
 
+      case SW_NARG_LF:
+        switch (ch) {
+          case LF:
+            state = SW_REQ_TYPE_LEN;
             break;
 
-          case 15:
-            if (str15icmp(m, 'z', 'r', 'e', 'm', 'r', 'a', 'n', 'g', 'e', 'b',
-                          'y', 'r', 'a', 'n', 'k')) {
-              r->type = MSG_REQ_REDIS_ZREMRANGEBYRANK;
-              r->is_read = 0;
-              break;
-            }
+          default:
+            goto error;
+        }
 
-            break;
+        break;
 
-          case 16:
-            if (str16icmp(m, 'z', 'r', 'e', 'm', 'r', 'a', 'n', 'g', 'e', 'b',
-                          'y', 's', 'c', 'o', 'r', 'e')) {
-              r->type = MSG_REQ_REDIS_ZREMRANGEBYSCORE;
-              r->is_read = 0;
-              break;
-            }
+      case SW_REQ_TYPE_LEN:
+        if (r->token == NULL) {
+          if (ch != '$') {
+            goto error;
+          }
+          r->token = p;
+          r->rlen = 0;
+          p = redis_parse_num(p, b->last, &r->rlen);
+        } else if (isdigit(ch)) {
+          r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
+        } else if (ch == CR) {
+          if (r->rlen == 0 || r->rntokens == 0) {
+            goto error;
+          }
+          r->rntokens--;
+          r->token = NULL;
+          state = SW_REQ_TYPE_LEN_LF;
+        } else {
+          goto error;
+        }
 
-            if (str16icmp(m, 'z', 'r', 'e', 'v', 'r', 'a', 'n', 'g', 'e', 'b',
-                          'y', 's', 'c', 'o', 'r', 'e')) {
-              r->type = MSG_REQ_REDIS_ZREVRANGEBYSCORE;
-              r->is_read = 1;
-              break;
-            }
+        break;
 
+      case SW_REQ_TYPE_LEN_LF:
+        switch (ch) {
+          case LF:
+            state = SW_REQ_TYPE;
             break;
 
-          case 17:
-            if (str17icmp(m, 'g', 'e', 'o', 'r', 'a', 'd', 'i', 'u', 's', 'b',
-                          'y', 'm', 'e', 'm', 'b', 'e', 'r')) {
-              r->type = MSG_REQ_REDIS_GEORADIUSBYMEMBER;
-              r->is_read = 1;
-              break;
-            }
+          default:
+            goto error;
+        }
 
-            break;
+        break;
 
-          case 28:
-            // Note: This is not a Redis command, but a dynomite configuration
-            // command.
-            if (dn_strcasecmp(m, "dyno_config:conn_consistency") == 0) {
-              r->type = MSG_HACK_SETTING_CONN_CONSISTENCY;
-              r->is_read = 0;
-              break;
-            }
+      case SW_REQ_TYPE:
+        if (r->token == NULL) {
+          r->token = p;
+        }
 
-            break;
+        // TODO: No multi-mbuf support for SW_REQ_TYPE (since very unlikely)
+        m = r->token + r->rlen;
+        if (m >= b->last) {
+          m = b->last - 1;
+          p = m;
+          break;
+        }
 
-          default:
-            r->is_read = 1;
-            break;
+        if (*m != CR) {
+          goto error;
         }
 
-        if (r->type == MSG_UNKNOWN) {
+        p = m; /* move forward by rlen bytes */
+        r->rlen = 0;
+        m = r->token;
+        r->token = NULL;
+
+        // The second word of 'SCRIPT <LOAD/KILL/FLUSH/EXISTS>' is looked up
+        // among the SCRIPT subcommands.
+        cmd = redis_cmd_lookup(m, (uint32_t)(p - m),
+                               r->type == MSG_REQ_REDIS_SCRIPT);
+        if (cmd == NULL) {
           log_error("parsed unsupported command '%.*s'", p - m, m);
           goto error;
         }
 
+        r->type = cmd->type;
+        r->is_read = (cmd->flags & REDIS_CMD_READ) ? 1 : 0;
+        r->msg_routing = cmd->routing;
+        if (cmd->flags & REDIS_CMD_QUIT) {
+          r->quit = 1;
+        }
+        if (cmd->flags & REDIS_CMD_NOARGS) {
+          p = p + 1;
+          goto done;
+        }
+
         log_debug(LOG_VERB, "parsed command '%.*s'", p - m, m);
 
         state = SW_REQ_TYPE_LF;
@@ -1640,6 +569,7 @@ void redis_parse_req(struct msg *r, struct context *ctx) {
           }
           r->token = p;
           r->rlen = 0;
+          p = redis_parse_num(p, b->last, &r->rlen);
         } else if (isdigit(ch)) {
           r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
         } else if (ch == CR) {
@@ -1797,6 +727,7 @@ void redis_parse_req(struct msg *r, struct context *ctx) {
           }
           r->rlen = 0;
           r->token = p;
+          p = redis_parse_num(p, b->last, &r->rlen);
         } else if (isdigit(ch)) {
           r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
         } else if (ch == CR) {
@@ -1949,6 +880,7 @@ void redis_parse_req(struct msg *r, struct context *ctx) {
           }
           r->rlen = 0;
           r->token = p;
+          p = redis_parse_num(p, b->last, &r->rlen);
         } else if (isdigit(ch)) {
           r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
         } else if (ch == CR) {
@@ -2112,6 +1044,7 @@ void redis_parse_req(struct msg *r, struct context *ctx) {
           }
           r->rlen = 0;
           r->token = p;
+          p = redis_parse_num(p, b->last, &r->rlen);
         } else if (isdigit(ch)) {
           r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
         } else if (ch == CR) {
@@ -2221,6 +1154,7 @@ void redis_parse_req(struct msg *r, struct context *ctx) {
           }
           r->rlen = 0;
           r->token = p;
+          p = redis_parse_num(p, b->last, &r->rlen);
         } else if (isdigit(ch)) {
           r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
         } else if (ch == CR) {
@@ -2415,6 +1349,17 @@ error:
  *     strings (bulks) with the initial line indicating how many bulks that
  *     will follow. The first byte of a multi bulk reply is always *.
  */
+/*
+ * Extend the checksum of a reply over the bytes parsed up to 'end', in the
+ * last mbuf, so that quorum reads find it ready. See msg_payload_crc32().
+ */
+static inline void redis_rsp_crc(struct msg *r, uint8_t *end) {
+  if (end > r->crc_pos) {
+    r->crc = crc32c(r->crc_pos, (size_t)(end - r->crc_pos), r->crc);
+    r->crc_pos = end;
+  }
+}
+
 void redis_parse_rsp(struct msg *r, struct context *ctx) {
   struct mbuf *b;
   uint8_t *p, *m;
@@ -2444,6 +1389,7 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
 
   state = r->state;
   b = STAILQ_LAST(&r->mhdr, mbuf, next);
+  r->bulk_rlen = 0;
 
   ASSERT(!r->is_request);
   ASSERT(state >= SW_START && state < SW_SENTINEL);
@@ -2454,6 +1400,11 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
   ASSERT(r->pos != NULL);
   ASSERT(r->pos >= b->pos && r->pos <= b->last);
 
+  /* a reply that goes on in a new mbuf is checksummed from its start */
+  if (r->crc_pos == NULL || r->crc_pos < b->pos || r->crc_pos > r->pos) {
+    r->crc_pos = r->pos;
+  }
+
   for (p = r->pos; p < b->last; p++) {
     ch = *p;
 
@@ -2637,6 +1588,7 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
         /* rsp_start <- p */
         state = SW_INTEGER_START;
         r->integer = 0;
+        p = redis_parse_num(p, b->last, &r->integer);
         break;
 
       case SW_SIMPLE:
@@ -2661,6 +1613,9 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
 
           state = SW_MULTIBULK_ARGN_LF;
           r->rntokens--;
+        } else {
+          m = redis_scan_cr(p, b->last);
+          p = (m != NULL ? m : b->last) - 1;
         }
         break;
 
@@ -2683,6 +1638,9 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
             break;
 
           default:
+            /* skip to the CR, or to the end of the mbuf */
+            m = redis_scan_cr(p, b->last);
+            p = (m != NULL ? m : b->last) - 1;
             break;
         }
 
@@ -2708,6 +1666,7 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
           /* rsp_start <- p */
           r->token = p;
           r->rlen = 0;
+          p = redis_parse_num(p, b->last, &r->rlen);
         } else if (ch == '-') {
           /* handles null bulk reply = '$-1' */
           state = SW_RUNTO_CRLF;
@@ -2741,6 +1700,8 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
         m = p + r->rlen;
         if (m >= b->last) {
           r->rlen -= (uint32_t)(b->last - p);
+          /* the rest of the value may be spliced, see msg_splice_start() */
+          r->bulk_rlen = r->rlen;
           m = b->last - 1;
           p = m;
           break;
@@ -2777,6 +1738,7 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
           /* rsp_start <- p */
           r->ntoken_start = p;
           r->rntokens = 0;
+          p = redis_parse_num(p, b->last, &r->rntokens);
         } else if (ch == '-') {
           state = SW_RUNTO_CRLF;
         } else if (isdigit(ch)) {
@@ -2858,6 +1820,7 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
 
           r->token = p;
           r->rlen = 0;
+          p = redis_parse_num(p, b->last, &r->rlen);
         } else if (isdigit(ch)) {
           r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
         } else if (ch == '-') {
@@ -2951,6 +1914,9 @@ void redis_parse_rsp(struct msg *r, struct context *ctx) {
   r->state = state;
   r->is_error = redis_error(r);
 
+  /* the bytes from the token on are parsed again, and checksummed then */
+  redis_rsp_crc(r, r->token != NULL ? r->token : p);
+
   if (b->last == b->end && r->token != NULL) {
     r->pos = r->token;
     r->token = NULL;
@@ -2971,6 +1937,8 @@ done:
   ASSERT(r->type > MSG_UNKNOWN && r->type < MSG_SENTINEL);
   r->pos = p + 1;
   ASSERT(r->pos <= b->last);
+  redis_rsp_crc(r, r->pos);
+  r->crc_done = 1;
   r->state = SW_START;
   r->token = NULL;
   r->result = MSG_PARSE_OK;
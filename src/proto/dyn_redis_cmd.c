@@ -0,0 +1,55 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+#include <strings.h>
+
+#include "dyn_redis_cmd.h"
+#include "dyn_redis_cmd_hash.h"
+
+#define DEFINE_ACTION(_name, _type, _arity, _routing, _flags)         \
+  {_name,          sizeof(_name) - 1, MSG_##_type, REDIS_##_arity, \
+   ROUTING_##_routing, _flags},
+const struct redis_cmd redis_cmds[] = {REDIS_CMD_CODEC(DEFINE_ACTION)};
+#undef DEFINE_ACTION
+
+const uint32_t redis_ncmd = sizeof(redis_cmds) / sizeof(redis_cmds[0]);
+
+#define DEFINE_ACTION(_name, _type, _arity, _routing, _flags) \
+  [MSG_##_type] = REDIS_##_arity,
+const uint8_t redis_cmd_arity[MSG_SENTINEL] = {REDIS_CMD_CODEC(DEFINE_ACTION)};
+#undef DEFINE_ACTION
+
+/*
+ * Returns the command called 'name', in any case, or NULL if there is none.
+ * With 'script' set, looks for a SCRIPT subcommand instead.
+ */
+const struct redis_cmd *redis_cmd_lookup(const uint8_t *name, uint32_t len,
+                                         bool script) {
+  const struct redis_cmd *cmd;
+  uint64_t h;
+  uint32_t i, slot;
+
+  h = REDIS_CMD_HASH_BASIS ^ (script ? REDIS_CMD_HASH_SCRIPT : 0);
+  for (i = 0; i < len; i++) {
+    h ^= name[i] | 0x20;
+    h *= REDIS_CMD_HASH_PRIME;
+  }
+
+  slot = (uint32_t)((h >> 32) +
+                    redis_cmd_disp[h & (REDIS_CMD_HASH_NBUCKET - 1)] *
+                        ((h >> 16) | 1)) &
+         (REDIS_CMD_HASH_NSLOT - 1);
+  if (redis_cmd_slot[slot] == 0) {
+    return NULL;
+  }
+
+  cmd = &redis_cmds[redis_cmd_slot[slot] - 1];
+  if (cmd->len != len || ((cmd->flags & REDIS_CMD_SCRIPT) != 0) != script ||
+      strncasecmp(cmd->name, (const char *)name, len) != 0) {
+    return NULL;
+  }
+
+  return cmd;
+}
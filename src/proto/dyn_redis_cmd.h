@@ -0,0 +1,208 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+/*
+ * The redis commands dynomite accepts. Each is looked up by name with one
+ * hash and one compare, through a perfect hash generated from the table below
+ * by dyn_redis_cmd_gen.py; after adding a command, run the script to update
+ * dyn_redis_cmd_hash.h. The unit tests fail if it is out of date.
+ */
+
+#ifndef _DYN_REDIS_CMD_H_
+#define _DYN_REDIS_CMD_H_
+
+#include "../dyn_message.h"
+
+/* What follows the command name in a request. */
+typedef enum redis_arity {
+  REDIS_ARG_NONE,  /* not accepted past the first key */
+  REDIS_ARGZ,      /* no key */
+  REDIS_ARG0,      /* a key */
+  REDIS_ARG1,      /* a key and 1 argument */
+  REDIS_ARG_UPTO1, /* no key and up to 1 argument */
+  REDIS_ARG2,      /* a key and 2 arguments */
+  REDIS_ARG3,      /* a key and 3 arguments */
+  REDIS_ARGN,      /* a key and 0 or more arguments */
+  REDIS_ARGX,      /* 1 or more keys */
+  REDIS_ARGKVX,    /* 1 or more key value pairs */
+  REDIS_ARGEVAL    /* script, # keys, 1 or more keys and 0 or more arguments */
+} redis_arity_t;
+
+#define REDIS_CMD_READ 0x01   /* does not modify the data set */
+#define REDIS_CMD_QUIT 0x02   /* closes the connection once answered */
+#define REDIS_CMD_NOARGS 0x04 /* the request ends with the name */
+#define REDIS_CMD_SCRIPT 0x08 /* second word of SCRIPT <name> */
+
+/*
+ * name, msg type, arity, routing, flags
+ */
+#define REDIS_CMD_CODEC(ACTION)                                                \
+  ACTION("del", REQ_REDIS_DEL, ARGX, NORMAL, 0)                                \
+  ACTION("exists", REQ_REDIS_EXISTS, ARGX, NORMAL, REDIS_CMD_READ)             \
+  ACTION("expire", REQ_REDIS_EXPIRE, ARG1, NORMAL, 0)                          \
+  ACTION("expireat", REQ_REDIS_EXPIREAT, ARG1, NORMAL, 0)                      \
+  ACTION("pexpire", REQ_REDIS_PEXPIRE, ARG1, NORMAL, 0)                        \
+  ACTION("pexpireat", REQ_REDIS_PEXPIREAT, ARG1, NORMAL, 0)                    \
+  ACTION("persist", REQ_REDIS_PERSIST, ARG0, NORMAL, 0)                        \
+  ACTION("pttl", REQ_REDIS_PTTL, ARG0, NORMAL, REDIS_CMD_READ)                 \
+  ACTION("scan", REQ_REDIS_SCAN, ARGN, LOCAL_NODE_ONLY, REDIS_CMD_READ)        \
+  ACTION("sort", REQ_REDIS_SORT, ARGN, NORMAL, REDIS_CMD_READ)                 \
+  ACTION("ttl", REQ_REDIS_TTL, ARG0, NORMAL, 0)                                \
+  ACTION("type", REQ_REDIS_TYPE, ARG0, NORMAL, REDIS_CMD_READ)                 \
+  ACTION("append", REQ_REDIS_APPEND, ARG1, NORMAL, 0)                          \
+  ACTION("bitcount", REQ_REDIS_BITCOUNT, ARGN, NORMAL, REDIS_CMD_READ)         \
+  ACTION("decr", REQ_REDIS_DECR, ARG0, NORMAL, 0)                              \
+  ACTION("decrby", REQ_REDIS_DECRBY, ARG1, NORMAL, 0)                          \
+  ACTION("dump", REQ_REDIS_DUMP, ARG0, NORMAL, REDIS_CMD_READ)                 \
+  ACTION("get", REQ_REDIS_GET, ARG0, NORMAL, REDIS_CMD_READ)                   \
+  ACTION("getbit", REQ_REDIS_GETBIT, ARG1, NORMAL, REDIS_CMD_READ)             \
+  ACTION("getrange", REQ_REDIS_GETRANGE, ARG2, NORMAL, REDIS_CMD_READ)         \
+  ACTION("getset", REQ_REDIS_GETSET, ARG1, NORMAL, 0)                          \
+  ACTION("incr", REQ_REDIS_INCR, ARG0, NORMAL, 0)                              \
+  ACTION("incrby", REQ_REDIS_INCRBY, ARG1, NORMAL, 0)                          \
+  ACTION("incrbyfloat", REQ_REDIS_INCRBYFLOAT, ARG1, NORMAL, 0)                \
+  ACTION("mset", REQ_REDIS_MSET, ARGKVX, NORMAL, 0)                            \
+  ACTION("mget", REQ_REDIS_MGET, ARGX, NORMAL, REDIS_CMD_READ)                 \
+  ACTION("psetex", REQ_REDIS_PSETEX, ARG2, NORMAL, 0)                          \
+  ACTION("restore", REQ_REDIS_RESTORE, ARG2, NORMAL, 0)                        \
+  ACTION("set", REQ_REDIS_SET, ARGN, NORMAL, 0)                                \
+  ACTION("setbit", REQ_REDIS_SETBIT, ARG2, NORMAL, 0)                          \
+  ACTION("setex", REQ_REDIS_SETEX, ARG2, NORMAL, 0)                            \
+  ACTION("setnx", REQ_REDIS_SETNX, ARG1, NORMAL, 0)                            \
+  ACTION("setrange", REQ_REDIS_SETRANGE, ARG2, NORMAL, 0)                      \
+  ACTION("strlen", REQ_REDIS_STRLEN, ARG0, NORMAL, REDIS_CMD_READ)             \
+  ACTION("hdel", REQ_REDIS_HDEL, ARGN, NORMAL, 0)                              \
+  ACTION("hexists", REQ_REDIS_HEXISTS, ARG1, NORMAL, REDIS_CMD_READ)           \
+  ACTION("hget", REQ_REDIS_HGET, ARG1, NORMAL, REDIS_CMD_READ)                 \
+  ACTION("hgetall", REQ_REDIS_HGETALL, ARG0, TOKEN_OWNER_LOCAL_RACK_ONLY,      \
+         REDIS_CMD_READ)                                                       \
+  ACTION("hincrby", REQ_REDIS_HINCRBY, ARG2, NORMAL, 0)                        \
+  ACTION("hincrbyfloat", REQ_REDIS_HINCRBYFLOAT, ARG2, NORMAL, 0)              \
+  ACTION("hkeys", REQ_REDIS_HKEYS, ARG0, TOKEN_OWNER_LOCAL_RACK_ONLY,          \
+         REDIS_CMD_READ)                                                       \
+  ACTION("hlen", REQ_REDIS_HLEN, ARG0, NORMAL, REDIS_CMD_READ)                 \
+  ACTION("hmget", REQ_REDIS_HMGET, ARGN, NORMAL, REDIS_CMD_READ)               \
+  ACTION("hmset", REQ_REDIS_HMSET, ARGN, NORMAL, 0)                            \
+  ACTION("hset", REQ_REDIS_HSET, ARG2, NORMAL, 0)                              \
+  ACTION("hsetnx", REQ_REDIS_HSETNX, ARG2, NORMAL, 0)                          \
+  ACTION("hscan", REQ_REDIS_HSCAN, ARGN, TOKEN_OWNER_LOCAL_RACK_ONLY,          \
+         REDIS_CMD_READ)                                                       \
+  ACTION("hvals", REQ_REDIS_HVALS, ARG0, TOKEN_OWNER_LOCAL_RACK_ONLY,          \
+         REDIS_CMD_READ)                                                       \
+  ACTION("hstrlen", REQ_REDIS_HSTRLEN, ARG_NONE, NORMAL, REDIS_CMD_READ)       \
+  ACTION("keys", REQ_REDIS_KEYS, ARG0, LOCAL_NODE_ONLY, REDIS_CMD_READ)        \
+  ACTION("info", REQ_REDIS_INFO, ARG_UPTO1, LOCAL_NODE_ONLY, REDIS_CMD_READ)   \
+  ACTION("lindex", REQ_REDIS_LINDEX, ARG1, NORMAL, REDIS_CMD_READ)             \
+  ACTION("linsert", REQ_REDIS_LINSERT, ARG3, NORMAL, 0)                        \
+  ACTION("llen", REQ_REDIS_LLEN, ARG0, NORMAL, REDIS_CMD_READ)                 \
+  ACTION("lpop", REQ_REDIS_LPOP, ARG0, NORMAL, 0)                              \
+  ACTION("lpush", REQ_REDIS_LPUSH, ARGN, NORMAL, 0)                            \
+  ACTION("lpushx", REQ_REDIS_LPUSHX, ARG1, NORMAL, 0)                          \
+  ACTION("lrange", REQ_REDIS_LRANGE, ARG2, NORMAL, REDIS_CMD_READ)             \
+  ACTION("lrem", REQ_REDIS_LREM, ARG2, NORMAL, 0)                              \
+  ACTION("lset", REQ_REDIS_LSET, ARG2, NORMAL, 0)                              \
+  ACTION("ltrim", REQ_REDIS_LTRIM, ARG2, NORMAL, 0)                            \
+  ACTION("ping", REQ_REDIS_PING, ARGZ, LOCAL_NODE_ONLY,                        \
+         REDIS_CMD_READ | REDIS_CMD_NOARGS)                                    \
+  ACTION("quit", REQ_REDIS_QUIT, ARGZ, NORMAL,                                 \
+         REDIS_CMD_READ | REDIS_CMD_QUIT)                                      \
+  ACTION("rpop", REQ_REDIS_RPOP, ARG0, NORMAL, 0)                              \
+  ACTION("rpoplpush", REQ_REDIS_RPOPLPUSH, ARG1, NORMAL, 0)                    \
+  ACTION("rpush", REQ_REDIS_RPUSH, ARGN, NORMAL, 0)                            \
+  ACTION("rpushx", REQ_REDIS_RPUSHX, ARG1, NORMAL, 0)                          \
+  ACTION("sadd", REQ_REDIS_SADD, ARGN, NORMAL, 0)                              \
+  ACTION("scard", REQ_REDIS_SCARD, ARG0, NORMAL, REDIS_CMD_READ)               \
+  ACTION("sdiff", REQ_REDIS_SDIFF, ARGN, NORMAL, REDIS_CMD_READ)               \
+  ACTION("sdiffstore", REQ_REDIS_SDIFFSTORE, ARGN, NORMAL, 0)                  \
+  ACTION("sinter", REQ_REDIS_SINTER, ARGN, NORMAL, REDIS_CMD_READ)             \
+  ACTION("sinterstore", REQ_REDIS_SINTERSTORE, ARGN, NORMAL, 0)                \
+  ACTION("sismember", REQ_REDIS_SISMEMBER, ARG1, NORMAL, REDIS_CMD_READ)       \
+  ACTION("slaveof", REQ_REDIS_SLAVEOF, ARG1, LOCAL_NODE_ONLY, 0)               \
+  ACTION("smembers", REQ_REDIS_SMEMBERS, ARG0, NORMAL, REDIS_CMD_READ)         \
+  ACTION("smove", REQ_REDIS_SMOVE, ARG2, NORMAL, 0)                            \
+  ACTION("spop", REQ_REDIS_SPOP, ARGN, NORMAL, 0)                              \
+  ACTION("srandmember", REQ_REDIS_SRANDMEMBER, ARG0, NORMAL, REDIS_CMD_READ)   \
+  ACTION("srem", REQ_REDIS_SREM, ARGN, NORMAL, 0)                              \
+  ACTION("sunion", REQ_REDIS_SUNION, ARGN, NORMAL, REDIS_CMD_READ)             \
+  ACTION("sunionstore", REQ_REDIS_SUNIONSTORE, ARGN, NORMAL, REDIS_CMD_READ)   \
+  ACTION("sscan", REQ_REDIS_SSCAN, ARGN, TOKEN_OWNER_LOCAL_RACK_ONLY,          \
+         REDIS_CMD_READ)                                                       \
+  ACTION("zadd", REQ_REDIS_ZADD, ARGN, NORMAL, 0)                              \
+  ACTION("zcard", REQ_REDIS_ZCARD, ARG0, NORMAL, REDIS_CMD_READ)               \
+  ACTION("zcount", REQ_REDIS_ZCOUNT, ARG2, NORMAL, REDIS_CMD_READ)             \
+  ACTION("zincrby", REQ_REDIS_ZINCRBY, ARG2, NORMAL, 0)                        \
+  ACTION("zinterstore", REQ_REDIS_ZINTERSTORE, ARGN, NORMAL, REDIS_CMD_READ)   \
+  ACTION("zlexcount", REQ_REDIS_ZLEXCOUNT, ARG2, NORMAL, REDIS_CMD_READ)       \
+  ACTION("zrange", REQ_REDIS_ZRANGE, ARGN, NORMAL, REDIS_CMD_READ)             \
+  ACTION("zrangebylex", REQ_REDIS_ZRANGEBYLEX, ARGN, NORMAL, REDIS_CMD_READ)   \
+  ACTION("zrangebyscore", REQ_REDIS_ZRANGEBYSCORE, ARGN, NORMAL,               \
+         REDIS_CMD_READ)                                                       \
+  ACTION("zrank", REQ_REDIS_ZRANK, ARG1, NORMAL, REDIS_CMD_READ)               \
+  ACTION("zrem", REQ_REDIS_ZREM, ARGN, NORMAL, 0)                              \
+  ACTION("zremrangebyrank", REQ_REDIS_ZREMRANGEBYRANK, ARG2, NORMAL, 0)        \
+  ACTION("zremrangebylex", REQ_REDIS_ZREMRANGEBYLEX, ARG2, NORMAL, 0)          \
+  ACTION("zremrangebyscore", REQ_REDIS_ZREMRANGEBYSCORE, ARG2, NORMAL, 0)      \
+  ACTION("zrevrange", REQ_REDIS_ZREVRANGE, ARGN, NORMAL, REDIS_CMD_READ)       \
+  ACTION("zrevrangebylex", REQ_REDIS_ZREVRANGEBYLEX, ARGN, NORMAL,             \
+         REDIS_CMD_READ)                                                       \
+  ACTION("zrevrangebyscore", REQ_REDIS_ZREVRANGEBYSCORE, ARGN, NORMAL,         \
+         REDIS_CMD_READ)                                                       \
+  ACTION("zrevrank", REQ_REDIS_ZREVRANK, ARG1, NORMAL, REDIS_CMD_READ)         \
+  ACTION("zscore", REQ_REDIS_ZSCORE, ARG1, NORMAL, REDIS_CMD_READ)             \
+  ACTION("zunionstore", REQ_REDIS_ZUNIONSTORE, ARGN, NORMAL, REDIS_CMD_READ)   \
+  ACTION("zscan", REQ_REDIS_ZSCAN, ARGN, TOKEN_OWNER_LOCAL_RACK_ONLY,          \
+         REDIS_CMD_READ)                                                       \
+  ACTION("eval", REQ_REDIS_EVAL, ARGEVAL, NORMAL, 0)                           \
+  ACTION("evalsha", REQ_REDIS_EVALSHA, ARGEVAL, NORMAL, 0)                     \
+  ACTION("geoadd", REQ_REDIS_GEOADD, ARGN, NORMAL, 0)                          \
+  ACTION("georadius", REQ_REDIS_GEORADIUS, ARGN, NORMAL, REDIS_CMD_READ)       \
+  ACTION("geodist", REQ_REDIS_GEODIST, ARGN, NORMAL, REDIS_CMD_READ)           \
+  ACTION("geohash", REQ_REDIS_GEOHASH, ARGN, NORMAL, REDIS_CMD_READ)           \
+  ACTION("geopos", REQ_REDIS_GEOPOS, ARGN, NORMAL, REDIS_CMD_READ)             \
+  ACTION("georadiusbymember", REQ_REDIS_GEORADIUSBYMEMBER, ARGN, NORMAL,       \
+         REDIS_CMD_READ)                                                       \
+  ACTION("unlink", REQ_REDIS_UNLINK, ARG_NONE, NORMAL, 0)                      \
+  ACTION("json.set", REQ_REDIS_JSONSET, ARGN, NORMAL, 0)                       \
+  ACTION("json.get", REQ_REDIS_JSONGET, ARGN, NORMAL, REDIS_CMD_READ)          \
+  ACTION("json.del", REQ_REDIS_JSONDEL, ARGN, NORMAL, 0)                       \
+  ACTION("json.type", REQ_REDIS_JSONTYPE, ARGN, NORMAL, REDIS_CMD_READ)        \
+  ACTION("json.mget", REQ_REDIS_JSONMGET, ARGN, NORMAL, REDIS_CMD_READ)        \
+  ACTION("json.arrappend", REQ_REDIS_JSONARRAPPEND, ARGN, NORMAL, 0)           \
+  ACTION("json.arrinsert", REQ_REDIS_JSONARRINSERT, ARGN, NORMAL, 0)           \
+  ACTION("json.arrlen", REQ_REDIS_JSONARRLEN, ARGN, NORMAL, REDIS_CMD_READ)    \
+  ACTION("json.objkeys", REQ_REDIS_JSONOBJKEYS, ARGN, NORMAL, REDIS_CMD_READ)  \
+  ACTION("json.objlen", REQ_REDIS_JSONOBJLEN, ARGN, NORMAL, REDIS_CMD_READ)    \
+  ACTION("pfadd", REQ_REDIS_PFADD, ARGN, NORMAL, 0)                            \
+  ACTION("pfcount", REQ_REDIS_PFCOUNT, ARG0, NORMAL, 0)                        \
+  ACTION("config", REQ_REDIS_CONFIG, ARG1, LOCAL_NODE_ONLY, REDIS_CMD_READ)    \
+  ACTION("script", REQ_REDIS_SCRIPT, ARG_NONE, NORMAL, 0)                      \
+  ACTION("load", REQ_REDIS_SCRIPT_LOAD, ARG1, ALL_NODES_ALL_RACKS_ALL_DCS,     \
+         REDIS_CMD_SCRIPT)                                                     \
+  ACTION("exists", REQ_REDIS_SCRIPT_EXISTS, ARG1,                              \
+         ALL_NODES_ALL_RACKS_ALL_DCS, REDIS_CMD_READ | REDIS_CMD_SCRIPT)       \
+  ACTION("flush", REQ_REDIS_SCRIPT_FLUSH, ARGZ, ALL_NODES_ALL_RACKS_ALL_DCS,   \
+         REDIS_CMD_SCRIPT)                                                     \
+  ACTION("kill", REQ_REDIS_SCRIPT_KILL, ARGZ, ALL_NODES_ALL_RACKS_ALL_DCS,     \
+         REDIS_CMD_SCRIPT)                                                     \
+  ACTION("dyno_config:conn_consistency", HACK_SETTING_CONN_CONSISTENCY,        \
+         ARG_NONE, NORMAL, 0)
+
+struct redis_cmd {
+  const char *name;
+  uint32_t len;
+  msg_type_t type;
+  redis_arity_t arity;
+  msg_routing_t routing;
+  uint32_t flags;
+};
+
+extern const struct redis_cmd redis_cmds[];
+extern const uint32_t redis_ncmd;
+extern const uint8_t redis_cmd_arity[MSG_SENTINEL];
+
+const struct redis_cmd *redis_cmd_lookup(const uint8_t *name, uint32_t len,
+                                         bool script);
+
+#endif
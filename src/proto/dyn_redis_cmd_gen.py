@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+#
+# Generates dyn_redis_cmd_hash.h, the perfect hash over the command names in
+# REDIS_CMD_CODEC of dyn_redis_cmd.h. Run it from this directory after
+# changing the command table:
+#
+#   $ ./dyn_redis_cmd_gen.py > dyn_redis_cmd_hash.h
+#
+# Names are hashed case insensitively with 64 bit FNV-1a. The low bits of the
+# hash pick a bucket and every bucket has a displacement, found here, that
+# moves all names in it to free slots (hash and displace).
+
+import re
+import sys
+
+FNV_BASIS = 0xcbf29ce484222325
+FNV_PRIME = 0x100000001b3
+SCRIPT_SALT = 0x5c5c5c5c5c5c5c5c
+MASK64 = (1 << 64) - 1
+
+NBUCKET = 64
+NSLOT = 256
+
+
+def read_commands(path):
+    with open(path) as f:
+        text = f.read().replace('\\\n', ' ')
+    codec = re.search(r'#define REDIS_CMD_CODEC\(ACTION\)(.*)', text).group(1)
+    cmds = []
+    for m in re.finditer(r'ACTION\("([^"]+)",[^)]*?,\s*([^,)]+)\)', codec):
+        cmds.append((m.group(1), 'REDIS_CMD_SCRIPT' in m.group(2)))
+    return cmds
+
+
+def cmd_hash(basis, name, script):
+    h = basis ^ (SCRIPT_SALT if script else 0)
+    for c in name.encode():
+        h ^= c | 0x20
+        h = (h * FNV_PRIME) & MASK64
+    return h
+
+
+def cmd_slot(h, disp):
+    return ((h >> 32) + disp * ((h >> 16) | 1)) & (NSLOT - 1)
+
+
+def build(cmds, basis):
+    buckets = [[] for _ in range(NBUCKET)]
+    for i, (name, script) in enumerate(cmds):
+        buckets[cmd_hash(basis, name, script) & (NBUCKET - 1)].append(i)
+
+    disp = [0] * NBUCKET
+    slot = [0] * NSLOT
+    for b in sorted(range(NBUCKET), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            break
+        for d in range(256):
+            slots = [cmd_slot(cmd_hash(basis, *cmds[i]), d) for i in buckets[b]]
+            if len(set(slots)) == len(slots) and all(slot[s] == 0
+                                                     for s in slots):
+                break
+        else:
+            return None
+        disp[b] = d
+        for i, s in zip(buckets[b], slots):
+            slot[s] = i + 1
+    return disp, slot
+
+
+def table(values):
+    lines = []
+    for i in range(0, len(values), 12):
+        lines.append('    ' + ', '.join('%3d' % v for v in values[i:i + 12]) +
+                     ',')
+    return '\n'.join(lines)
+
+
+def main():
+    cmds = read_commands('dyn_redis_cmd.h')
+    if len(cmds) >= NSLOT:
+        sys.exit('too many commands for %d slots' % NSLOT)
+
+    for seed in range(1 << 16):
+        basis = FNV_BASIS ^ seed
+        result = build(cmds, basis)
+        if result is not None:
+            break
+    else:
+        sys.exit('no perfect hash found')
+    disp, slot = result
+
+    print('''/*
+ * Generated by dyn_redis_cmd_gen.py from the %d commands in dyn_redis_cmd.h.
+ * Do not edit.
+ */
+
+#ifndef _DYN_REDIS_CMD_HASH_H_
+#define _DYN_REDIS_CMD_HASH_H_
+
+#define REDIS_CMD_HASH_BASIS 0x%016xULL
+#define REDIS_CMD_HASH_PRIME 0x%xULL
+#define REDIS_CMD_HASH_SCRIPT 0x%016xULL
+#define REDIS_CMD_HASH_NBUCKET %d
+#define REDIS_CMD_HASH_NSLOT %d
+
+static const uint8_t redis_cmd_disp[REDIS_CMD_HASH_NBUCKET] = {
+%s
+};
+
+/* index in redis_cmds[] plus one, 0 for an empty slot */
+static const uint8_t redis_cmd_slot[REDIS_CMD_HASH_NSLOT] = {
+%s
+};
+
+#endif''' % (len(cmds), basis, FNV_PRIME, SCRIPT_SALT, NBUCKET, NSLOT,
+             table(disp), table(slot)))
+
+
+if __name__ == '__main__':
+    main()
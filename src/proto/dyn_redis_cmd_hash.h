@@ -0,0 +1,50 @@
+/*
+ * Generated by dyn_redis_cmd_gen.py from the 132 commands in dyn_redis_cmd.h.
+ * Do not edit.
+ */
+
+#ifndef _DYN_REDIS_CMD_HASH_H_
+#define _DYN_REDIS_CMD_HASH_H_
+
+#define REDIS_CMD_HASH_BASIS 0xcbf29ce484222325ULL
+#define REDIS_CMD_HASH_PRIME 0x100000001b3ULL
+#define REDIS_CMD_HASH_SCRIPT 0x5c5c5c5c5c5c5c5cULL
+#define REDIS_CMD_HASH_NBUCKET 64
+#define REDIS_CMD_HASH_NSLOT 256
+
+static const uint8_t redis_cmd_disp[REDIS_CMD_HASH_NBUCKET] = {
+      1,   1,   1,   0,   0,   0,   0,   0,   1,   0,   0,   0,
+      0,   3,   0,   2,   1,   2,   5,   0,   0,   3,   4,   0,
+      0,   1,   0,   1,   0,   0,   0,   0,   2,   1,   0,   0,
+      0,   0,   1,   0,   1,   0,   0,   0,   1,   0,   3,   3,
+      4,   2,  14,   7,   0,   4,   0,   1,   1,   6,   2,   0,
+      0,   5,   2,   0,
+};
+
+/* index in redis_cmds[] plus one, 0 for an empty slot */
+static const uint8_t redis_cmd_slot[REDIS_CMD_HASH_NSLOT] = {
+      0, 101,   0,   0,  19, 118,  88,  63, 129,   0,   0,  38,
+     20,  62,   0,  23,   0,   0,   0,   0,   0,   0,  10,   0,
+      1,  29,   0,   0,  97,   0,  21,  25,   0,   0,   0,   0,
+      0,  86,   0, 103,   0, 127,  98,   0,  52,   0,   0,   9,
+     32,   0, 131,   0,   0,   0,  70,   0,   0,   0,   0,  16,
+    102,   0,   0,   0,   0, 106,   0,   0,   0,   0, 113,   0,
+      0,   0,   0,   0,   0,  42,  57,   0,   0,  44,   0,  22,
+     84,  99,   0,   0,   0,  59, 112,  60,   0,   0,   0,  91,
+     85,  13,   0, 117,   3,  92,  17, 123,   0, 109,  95, 111,
+      0,   0,   0, 121,  24,   0,  77,   0,  34, 126,  61,  90,
+      0,  58, 104,  87,  56, 124,  75,   0,   7,  67,   0,  83,
+      0,   0,   4,  46, 107,   0,   0,   0,  43, 105,   0,  65,
+     15,   0,   0,  94,  66,   0,   0,  39,   0,  41,   0,  96,
+      0, 116,  11,  78,   0,   0,  26, 115, 108,  74, 100,  14,
+     40,  64,   0, 130,   0,  54,  30,   0,   0, 119,   0,   0,
+     33,   0,   0,  53,  89,  82,   0,   0,  48, 128,   0,  45,
+      0,   0, 125,  18,   0,  51,   0,  68,   0,  27,  36,  37,
+     35,  81,   0,   0,   0,   0,  71,   2,  47,   0,   0,  50,
+      0,  80,   0,   0,   0,  72,  49,   0,   5,   0,  93, 132,
+      0,  79,   0,  28,  76,   0,   0,   0,   0, 110,   0,  12,
+    114,   6,  55,   0,   0,   8,   0, 120, 122,   0,   0,  69,
+     73,   0,  31,   0,
+};
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+/*
+ * Word-at-a-time helpers for the RESP parsers. The parsers walk a request or
+ * reply one byte per loop iteration; these let them cover a length prefix or
+ * a line in one step when it lies entirely in the mbuf being parsed. Anything
+ * they cannot handle is left to the byte-at-a-time state machine.
+ */
+
+#ifndef _DYN_REDIS_SCAN_H_
+#define _DYN_REDIS_SCAN_H_
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../dyn_types.h"
+#include "../dyn_util.h"
+
+#define REDIS_SCAN_ONES 0x0101010101010101ULL
+#define REDIS_SCAN_HIGH 0x8080808080808080ULL
+#define REDIS_SCAN_MAX_DIGITS 9 /* larger numbers are left to the parser */
+
+/* Returns the first CR in [p, last), or NULL if there is none. */
+static inline uint8_t *redis_scan_cr(uint8_t *p, uint8_t *last) {
+#if defined(__AVX2__)
+  const __m256i cr32 = _mm256_set1_epi8((char)CR);
+
+  while (last - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr32));
+
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i cr16 = _mm_set1_epi8((char)CR);
+
+  while (last - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr16));
+
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#endif
+
+  return memchr(p, CR, (size_t)(last - p));
+}
+
+/*
+ * Parses the decimal number that starts at 'p' and is ended by a CR. Returns
+ * DN_OK with the number in 'len' and the CR in 'cr', DN_EAGAIN if [p, last)
+ * ends within the digits, or DN_ERROR if there are no digits, more than
+ * REDIS_SCAN_MAX_DIGITS of them, or they are ended by anything but a CR.
+ */
+static inline rstatus_t redis_scan_len(uint8_t *p, uint8_t *last,
+                                       uint32_t *len, uint8_t **cr) {
+  uint32_t n = 0;
+  uint8_t *q;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (last - p >= 8) {
+    uint64_t x, nondigit;
+    uint32_t ndigit;
+
+    memcpy(&x, p, sizeof(x));
+
+    /* the high bit of every byte that is not '0' - '9' */
+    nondigit = (x | ((x & ~REDIS_SCAN_HIGH) + 0x46 * REDIS_SCAN_ONES) |
+                ~((x | REDIS_SCAN_HIGH) - 0x30 * REDIS_SCAN_ONES)) &
+               REDIS_SCAN_HIGH;
+
+    if (nondigit != 0) {
+      ndigit = (uint32_t)__builtin_ctzll(nondigit) / 8;
+      if (ndigit == 0 || p[ndigit] != CR) {
+        return DN_ERROR;
+      }
+
+      /*
+       * Move the digits to the top bytes so the ones past them drop out and
+       * the bottom ones read as leading zeros, then add up neighbouring
+       * digits, pairs and quads.
+       */
+      x = (x - 0x30 * REDIS_SCAN_ONES) << (64 - 8 * ndigit);
+      x = (x * 10 + (x >> 8)) & 0x00ff00ff00ff00ffULL;
+      x = ((x * (1 + (100ULL << 16))) >> 16) & 0x0000ffff0000ffffULL;
+      x = (x * (1 + (10000ULL << 32))) >> 32;
+
+      *len = (uint32_t)x;
+      *cr = p + ndigit;
+      return DN_OK;
+    }
+  }
+#endif
+
+  for (q = p; q < last; q++) {
+    if (*q < '0' || *q > '9') {
+      if (q == p || *q != CR || q - p > REDIS_SCAN_MAX_DIGITS) {
+        return DN_ERROR;
+      }
+      *len = n;
+      *cr = q;
+      return DN_OK;
+    }
+    n = n * 10 + (uint32_t)(*q - '0');
+  }
+
+  return DN_EAGAIN;
+}
+
+#endif
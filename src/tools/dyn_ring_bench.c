@@ -0,0 +1,196 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+/*
+ * Compares routing a token through the flat token table against the binary
+ * search over the sorted continuum that vnode_dispatch() does, for rings of
+ * 10, 100 and 1000 nodes.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dyn_log.h"
+#include "../dyn_types.h"
+#include "../dyn_util.h"
+#include "../hashkit/dyn_token.h"
+#include "../hashkit/dyn_token_table.h"
+
+#define RING_BENCH_LOOKUPS 10000000U
+#define RING_BENCH_NKEYS (1U << 16)
+
+struct ring_point {
+  uint32_t index;
+  struct dyn_token token;
+};
+
+static struct option long_options[] = {{"help", no_argument, NULL, 'h'},
+                                       {"lookups", required_argument, NULL, 'n'},
+                                       {NULL, 0, NULL, 0}};
+
+static char short_options[] = "hn:";
+
+static void print_usage(void) {
+  printf("Usage: dynomite-ring-bench [-h] [-n lookups]\n");
+  printf(
+      "Time token to node lookups with the binary search and the flat token\n");
+  printf("table on 10, 100 and 1000 node rings.\n\n");
+  printf("Options:\n");
+  printf("  -h, --help             : this help\n");
+  printf("  -n, --lookups=N        : lookups per ring (default: %u)\n\n",
+         RING_BENCH_LOOKUPS);
+}
+
+static int ring_point_cmp(const void *t1, const void *t2) {
+  const struct ring_point *p1 = t1, *p2 = t2;
+
+  return cmp_dyn_token(&p1->token, &p2->token);
+}
+
+// The search vnode_dispatch() does, over a plain array.
+static uint32_t ring_search(struct ring_point *ring, uint32_t npoint,
+                            struct dyn_token *token) {
+  struct ring_point *left = ring, *right = ring + npoint - 1, *middle;
+
+  if (cmp_dyn_token(&right->token, token) < 0 ||
+      cmp_dyn_token(&left->token, token) >= 0)
+    return left->index;
+
+  while (left < right) {
+    middle = left + (right - left) / 2;
+    int32_t cmp = cmp_dyn_token(&middle->token, token);
+    if (cmp == 0) {
+      return middle->index;
+    } else if (cmp < 0) {
+      left = middle + 1;
+    } else {
+      right = middle;
+    }
+  }
+
+  return right->index;
+}
+
+static uint64_t ring_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int ring_bench(uint32_t nnode, uint32_t nlookup) {
+  struct ring_point *ring;
+  struct dyn_token *keys;
+  struct token_table *table;
+  uint64_t start, search_ns, table_ns;
+  uint32_t i, sum_search = 0, sum_table = 0;
+
+  ring = dn_alloc(nnode * sizeof(*ring));
+  keys = dn_alloc(RING_BENCH_NKEYS * sizeof(*keys));
+  table = token_table_create(nnode);
+  if (ring == NULL || keys == NULL || table == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+
+  // Evenly spaced tokens with some jitter, like a hand-assigned ring.
+  for (i = 0; i < nnode; i++) {
+    uint32_t step = (uint32_t)(0xffffffffU / nnode);
+    ring[i].index = i;
+    set_int_dyn_token(&ring[i].token,
+                      step * i + (uint32_t)random() % (step / 2 + 1) + 1);
+  }
+  qsort(ring, nnode, sizeof(*ring), ring_point_cmp);
+
+  for (i = 0; i < nnode; i++) {
+    token_table_value(&ring[i].token, &table->entry[i].value);
+    table->entry[i].owner = ring[i].index;
+  }
+  token_table_index(table);
+
+  for (i = 0; i < RING_BENCH_NKEYS; i++) {
+    set_int_dyn_token(&keys[i],
+                      (uint32_t)random() ^ ((uint32_t)random() << 16));
+  }
+
+  for (i = 0; i < RING_BENCH_NKEYS; i++) {
+    uint32_t value;
+    token_table_value(&keys[i], &value);
+    if (ring_search(ring, nnode, &keys[i]) !=
+        token_table_dispatch(table, value)) {
+      fprintf(stderr, "mismatch on %u node ring for token %u\n", nnode,
+              keys[i].mag[0]);
+      return -1;
+    }
+  }
+
+  start = ring_now_ns();
+  for (i = 0; i < nlookup; i++) {
+    sum_search += ring_search(ring, nnode, &keys[i & (RING_BENCH_NKEYS - 1)]);
+  }
+  search_ns = ring_now_ns() - start;
+
+  start = ring_now_ns();
+  for (i = 0; i < nlookup; i++) {
+    struct dyn_token *key = &keys[i & (RING_BENCH_NKEYS - 1)];
+    uint32_t value;
+    if (token_table_value(key, &value)) {
+      sum_table += token_table_dispatch(table, value);
+    }
+  }
+  table_ns = ring_now_ns() - start;
+
+  printf("%6u nodes: binary search %6.2f ns/lookup, table %6.2f ns/lookup "
+         "(%u buckets)%s\n",
+         nnode, (double)search_ns / nlookup, (double)table_ns / nlookup,
+         1U << (32 - table->shift), sum_search == sum_table ? "" : " MISMATCH");
+
+  token_table_destroy(table);
+  dn_free(keys);
+  dn_free(ring);
+
+  return sum_search == sum_table ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+  static const uint32_t nodes[] = {10, 100, 1000};
+  uint32_t nlookup = RING_BENCH_LOOKUPS;
+  uint32_t i;
+  int c;
+
+  for (;;) {
+    c = getopt_long(argc, argv, short_options, long_options, NULL);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+      case 'n':
+        nlookup = (uint32_t)atoi(optarg);
+        if (nlookup == 0) {
+          print_usage();
+          return 1;
+        }
+        break;
+
+      case 'h':
+      default:
+        print_usage();
+        return c == 'h' ? 0 : 1;
+    }
+  }
+
+  srandom(1);
+  for (i = 0; i < sizeof(nodes) / sizeof(nodes[0]); i++) {
+    if (ring_bench(nodes[i], nlookup) != 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Dynomite - A thin, distributed replication layer for multi non-distributed
+ * storages. Copyright (C) 2014 Netflix, Inc.
+ */
+
+/*
+ * Measures the timeout bookkeeping each request costs: one insert when it is
+ * sent and one delete when its response arrives, with the given number of
+ * requests in flight. Compares the rbtree the timeouts used to live in against
+ * the timing wheel.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dyn_log.h"
+#include "../dyn_rbtree.h"
+#include "../dyn_timewheel.h"
+#include "../dyn_types.h"
+#include "../dyn_util.h"
+
+#define TIMER_BENCH_REQUESTS 10000000U
+#define TIMER_BENCH_TIMEOUT 5000U /* msec, like server timeout */
+#define TIMER_BENCH_RATE 200      /* requests per msec of simulated time */
+
+static struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"requests", required_argument, NULL, 'n'},
+    {NULL, 0, NULL, 0}};
+
+static char short_options[] = "hn:";
+
+static void print_usage(void) {
+  printf("Usage: dynomite-timer-bench [-h] [-n requests]\n");
+  printf("Time the request timeout insert and delete with the rbtree and the\n");
+  printf("timing wheel for 1000, 10000 and 100000 requests in flight.\n\n");
+  printf("Options:\n");
+  printf("  -h, --help             : this help\n");
+  printf("  -n, --requests=N       : requests per run (default: %u)\n\n",
+         TIMER_BENCH_REQUESTS);
+}
+
+static uint64_t timer_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Requests complete in random order; each completion deletes its timeout and
+ * the slot is reused for a new request whose timeout is inserted. Simulated
+ * time advances TIMER_BENCH_RATE requests per msec, and requests that go
+ * unpicked for TIMER_BENCH_TIMEOUT time out and are sent again.
+ */
+static double timer_bench_rbtree(uint32_t ninflight, uint32_t nrequest,
+                                 uint32_t *pick) {
+  struct rbtree tree;
+  struct rbnode sentinel, *nodes;
+  msec_t now = 1;
+  uint64_t start;
+  uint32_t i;
+
+  nodes = dn_alloc(ninflight * sizeof(*nodes));
+  if (nodes == NULL) {
+    return -1;
+  }
+  rbtree_init(&tree, &sentinel);
+  for (i = 0; i < ninflight; i++) {
+    rbtree_node_init(&nodes[i]);
+    nodes[i].key = now + TIMER_BENCH_TIMEOUT + i % 64;
+    rbtree_insert(&tree, &nodes[i]);
+  }
+
+  start = timer_now_ns();
+  for (i = 0; i < nrequest; i++) {
+    struct rbnode *node = &nodes[pick[i]];
+
+    rbtree_delete(&tree, node);
+    node->key = now + TIMER_BENCH_TIMEOUT;
+    rbtree_insert(&tree, node);
+    if (i % TIMER_BENCH_RATE == 0) {
+      now++;
+      // what core_timeout() does every loop; time out stragglers
+      while ((node = rbtree_min(&tree))->key <= now) {
+        rbtree_delete(&tree, node);
+        node->key = now + TIMER_BENCH_TIMEOUT;
+        rbtree_insert(&tree, node);
+      }
+    }
+  }
+
+  dn_free(nodes);
+  return (double)(timer_now_ns() - start) / nrequest;
+}
+
+static double timer_bench_wheel(uint32_t ninflight, uint32_t nrequest,
+                                uint32_t *pick) {
+  struct timewheel *tw;
+  struct tw_node *nodes;
+  msec_t now = 1;
+  uint64_t start;
+  uint32_t i;
+
+  tw = dn_alloc(sizeof(*tw));
+  nodes = dn_alloc(ninflight * sizeof(*nodes));
+  if (tw == NULL || nodes == NULL) {
+    return -1;
+  }
+  timewheel_init(tw, now);
+  for (i = 0; i < ninflight; i++) {
+    timewheel_node_init(&nodes[i]);
+    timewheel_insert(tw, &nodes[i], now + TIMER_BENCH_TIMEOUT + i % 64);
+  }
+
+  start = timer_now_ns();
+  for (i = 0; i < nrequest; i++) {
+    struct tw_node *node = &nodes[pick[i]];
+
+    timewheel_delete(tw, node);
+    timewheel_insert(tw, node, now + TIMER_BENCH_TIMEOUT);
+    if (i % TIMER_BENCH_RATE == 0) {
+      now++;
+      // what core_timeout() does every loop; time out stragglers
+      while ((node = timewheel_expire(tw, now)) != NULL) {
+        timewheel_insert(tw, node, now + TIMER_BENCH_TIMEOUT);
+      }
+    }
+  }
+
+  dn_free(nodes);
+  dn_free(tw);
+  return (double)(timer_now_ns() - start) / nrequest;
+}
+
+int main(int argc, char **argv) {
+  static const uint32_t inflight[] = {1000, 10000, 100000};
+  uint32_t nrequest = TIMER_BENCH_REQUESTS;
+  uint32_t *pick;
+  uint32_t i, j;
+  int c;
+
+  for (;;) {
+    c = getopt_long(argc, argv, short_options, long_options, NULL);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+      case 'n':
+        nrequest = (uint32_t)atoi(optarg);
+        if (nrequest == 0) {
+          print_usage();
+          return 1;
+        }
+        break;
+
+      case 'h':
+      default:
+        print_usage();
+        return c == 'h' ? 0 : 1;
+    }
+  }
+
+  pick = dn_alloc(nrequest * sizeof(*pick));
+  if (pick == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  srandom(1);
+  for (i = 0; i < sizeof(inflight) / sizeof(inflight[0]); i++) {
+    double tree_ns, wheel_ns;
+
+    for (j = 0; j < nrequest; j++) {
+      pick[j] = (uint32_t)random() % inflight[i];
+    }
+
+    tree_ns = timer_bench_rbtree(inflight[i], nrequest, pick);
+    wheel_ns = timer_bench_wheel(inflight[i], nrequest, pick);
+    if (tree_ns < 0 || wheel_ns < 0) {
+      fprintf(stderr, "run with %u requests in flight failed\n", inflight[i]);
+      return 1;
+    }
+
+    printf("%7u in flight: rbtree %6.2f ns/request, wheel %6.2f ns/request\n",
+           inflight[i], tree_ns, wheel_ns);
+  }
+
+  dn_free(pick);
+  return 0;
+}